@@ -11,10 +11,7 @@
 #include <sys/param.h>
 #include "DESSupport.h"
 
-#ifndef USE_CRYPT
-#define DES_CBLOCK_SIZE		8
-
-static unsigned char odd_parity[256] = {
+static const unsigned char odd_parity[256] = {
     1,  1,  2,  2,  4,  4,  7,  7,  8,  8, 11, 11, 13, 13, 14, 14,
     16, 16, 19, 19, 21, 21, 22, 22, 25, 25, 26, 26, 28, 28, 31, 31,
     32, 32, 35, 35, 37, 37, 38, 38, 41, 41, 42, 42, 44, 44, 47, 47,
@@ -32,47 +29,44 @@ static unsigned char odd_parity[256] = {
     224, 224, 227, 227, 229, 229, 230, 230, 233, 233, 234, 234, 236, 236, 239, 239,
     241, 241, 242, 242, 244, 244, 247, 247, 248, 248, 251, 251, 253, 253, 254, 254};
 
-static void 
-set_odd_parity(unsigned char *key)
-{
-    int idx;
-    for (idx = 0; idx < DES_CBLOCK_SIZE; idx++)
-	key[idx] = odd_parity[key[idx]];
-}
-
+#ifndef USE_CRYPT
 #include <CommonCrypto/CommonCryptor.h>
 #endif
 
-static u_char Get7Bits(const unsigned char *input, int startBit)
-{
-    register unsigned int       word;
-
-    word  = (unsigned)input[startBit / 8] << 8;
-    word |= (unsigned)input[startBit / 8 + 1];
-
-    word >>= 15 - (startBit % 8 + 7);
-
-    return word & 0xFE;
-}
-
-
-static void MakeKey(const unsigned char *key, unsigned char *des_key)
+/*
+ * Function: DesMakeKeys
+ * Purpose:
+ *   Expand consecutive 7-byte (56-bit) strings from "key" into
+ *   8-byte DES keys with odd parity.  Key material beyond "key_len"
+ *   is treated as zero, so the three MS-CHAP sub-keys can be taken
+ *   directly from the 16-byte password hash without zero-padding it
+ *   to 21 bytes first.
+ */
+__private_extern__ void
+DesMakeKeys(const unsigned char * key, int key_len,
+	    unsigned char des_keys[][DES_KEY_SIZE], int des_keys_count)
 {
-    des_key[0] = Get7Bits(key,  0);
-    des_key[1] = Get7Bits(key,  7);
-    des_key[2] = Get7Bits(key, 14);
-    des_key[3] = Get7Bits(key, 21);
-    des_key[4] = Get7Bits(key, 28);
-    des_key[5] = Get7Bits(key, 35);
-    des_key[6] = Get7Bits(key, 42);
-    des_key[7] = Get7Bits(key, 49);
-
-#ifndef USE_CRYPT
-    set_odd_parity(des_key);
-#endif
+    int		i;
+
+    for (i = 0; i < des_keys_count; i++) {
+	uint64_t	bits = 0;
+	int		j;
+	int		offset = i * DES_KEY_MATERIAL_SIZE;
+
+	for (j = 0; j < DES_KEY_MATERIAL_SIZE; j++, offset++) {
+	    bits <<= 8;
+	    if (offset < key_len) {
+		bits |= key[offset];
+	    }
+	}
+	for (j = 0; j < DES_KEY_SIZE; j++) {
+	    des_keys[i][j]
+		= odd_parity[((bits >> (49 - 7 * j)) & 0x7f) << 1];
+	}
+    }
+    return;
 }
 
-
 #ifdef USE_CRYPT
 /* in == 8-byte string (expanded version of the 56-bit key)
  * out == 64-byte string where each byte is either 1 or 0
@@ -107,45 +101,60 @@ static void Collapse(unsigned char *in, unsigned char *out)
 	}
 }
 
+/*
+ * Function: DesEncryptBlocks
+ * Purpose:
+ *   Encrypt "count" consecutive 8-byte blocks with an expanded DES key
+ *   (ECB), so that the key schedule is set up once for all of them.
+ */
 __private_extern__ void
-DesEncrypt(const unsigned char *clear, const unsigned char *key, 
-	   unsigned char *cipher)
+DesEncryptBlocks(const unsigned char des_key[DES_KEY_SIZE],
+		 const unsigned char * clear, int count,
+		 unsigned char * cipher)
 {
-    u_char des_key[8];
     u_char crypt_key[66];
     u_char des_input[66];
-
-    MakeKey(key, des_key);
-
-    Expand(des_key, crypt_key);
-    setkey(crypt_key);
-
-    Expand(clear, des_input);
-    encrypt(des_input, 0);
-    Collapse(des_input, cipher);
+    int	   i;
+
+    Expand((unsigned char *)des_key, crypt_key);
+    setkey((char *)crypt_key);
+    for (i = 0; i < count; i++) {
+	Expand((unsigned char *)clear + i * DES_BLOCK_SIZE, des_input);
+	encrypt((char *)des_input, 0);
+	Collapse(des_input, cipher + i * DES_BLOCK_SIZE);
+    }
+    return;
 }
 #else /* don't USE_CRYPT */
 __private_extern__ void
-DesEncrypt(const unsigned char * clear, const unsigned char * key,
-	   unsigned char * cipher)
+DesEncryptBlocks(const unsigned char des_key[DES_KEY_SIZE],
+		 const unsigned char * clear, int count,
+		 unsigned char * cipher)
 {
     CCCryptorStatus	c_status;
-    u_char		des_key[DES_CBLOCK_SIZE];
     size_t		output_bytes;
 
-    MakeKey(key, des_key);
-    c_status = CCCrypt(kCCEncrypt, kCCAlgorithmDES, 0,
-		       des_key, sizeof(des_key),
+    c_status = CCCrypt(kCCEncrypt, kCCAlgorithmDES, kCCOptionECBMode,
+		       des_key, DES_KEY_SIZE,
 		       NULL,
-		       clear, DES_CBLOCK_SIZE,
-		       cipher, DES_CBLOCK_SIZE, &output_bytes);
+		       clear, count * DES_BLOCK_SIZE,
+		       cipher, count * DES_BLOCK_SIZE, &output_bytes);
     if (c_status != kCCSuccess) {
 	fprintf(stderr,
-		"DESEncrypt: CCCrypt failed with %d\n",
+		"DesEncryptBlocks: CCCrypt failed with %d\n",
 		c_status);
     }
     return;
 }
 #endif /* USE_CRYPT */
 
+__private_extern__ void
+DesEncrypt(const unsigned char * clear, const unsigned char * key,
+	   unsigned char * cipher)
+{
+    u_char	des_key[1][DES_KEY_SIZE];
 
+    DesMakeKeys(key, DES_KEY_MATERIAL_SIZE, des_key, 1);
+    DesEncryptBlocks(des_key[0], clear, 1, cipher);
+    return;
+}
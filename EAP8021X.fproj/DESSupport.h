@@ -24,6 +24,19 @@
 #ifndef _EAP8021X_DESSUPPORT_H
 #define _EAP8021X_DESSUPPORT_H
 
+#include <stdint.h>
+
+#define DES_BLOCK_SIZE		8
+#define DES_KEY_SIZE		8
+#define DES_KEY_MATERIAL_SIZE	7	/* 56 bits, without parity */
+
+void DesMakeKeys(const unsigned char * key, int key_len,
+		 unsigned char des_keys[][DES_KEY_SIZE], int des_keys_count);
+
+void DesEncryptBlocks(const unsigned char des_key[DES_KEY_SIZE],
+		      const unsigned char * clear, int count,
+		      unsigned char * cipher);
+
 void DesEncrypt(const unsigned char * clear, const unsigned char * key, 
 		unsigned char * cipher);
 
@@ -36,6 +36,13 @@
  * October 11, 2002	Dieter Siegmund (dieter@apple)
  * - created
  */
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <arpa/inet.h>
+
 typedef struct {
     u_int32_t	AVP_code;
     u_int32_t	AVP_flags_length;
@@ -61,7 +68,7 @@ DiameterAVPMakeFlagsLength(u_int8_t flags, u_int32_t length)
 {
     u_int32_t flags_length;
 
-    flags_length = (length & DIAMETER_LENGTH_MASK) | (flags << 24);
+    flags_length = (length & DIAMETER_LENGTH_MASK) | ((u_int32_t)flags << 24);
     return (flags_length);
 }
 
@@ -77,4 +84,304 @@ DiameterAVPFlagsFromFlagsLength(u_int32_t flags_length)
     return (flags_length >> 24);
 }
 
+/*
+ * Compile-time AVP sizes, including the padding to a 4-byte boundary;
+ * use these to size the buffer for a fixed set of AVPs.
+ */
+#define DIAMETER_AVP_PAD(length)	(((length) + 3) & ~3)
+#define DIAMETER_AVP_SIZE(data_length)				\
+    DIAMETER_AVP_PAD(sizeof(DiameterAVP) + (data_length))
+#define DIAMETER_VENDOR_AVP_SIZE(data_length)			\
+    DIAMETER_AVP_PAD(sizeof(DiameterVendorAVP) + (data_length))
+
+/**
+ ** DiameterAVPEncoder
+ ** - lays out a sequence of AVPs in one contiguous buffer so that the
+ **   whole message can be handed to a single write
+ **/
+typedef struct {
+    u_int8_t *	buf;
+    u_int32_t	size;
+    u_int32_t	length;
+    bool	buf_allocated;
+} DiameterAVPEncoder;
+
+/*
+ * Function: DiameterAVPEncoderInit
+ * Purpose:
+ *   Initialize the encoder to hold "size" bytes of AVPs.  The caller's
+ *   buffer is used if it is large enough, otherwise one is allocated.
+ * Returns:
+ *   false if the buffer could not be allocated, true otherwise.
+ */
+static __inline__ bool
+DiameterAVPEncoderInit(DiameterAVPEncoder * enc, void * buf,
+		       u_int32_t buf_size, u_int32_t size)
+{
+    enc->length = 0;
+    enc->size = size;
+    if (size <= buf_size) {
+	enc->buf = (u_int8_t *)buf;
+	enc->buf_allocated = false;
+    }
+    else {
+	enc->buf = (u_int8_t *)malloc(size);
+	enc->buf_allocated = true;
+    }
+    return (enc->buf != NULL);
+}
+
+static __inline__ void
+DiameterAVPEncoderFree(DiameterAVPEncoder * enc)
+{
+    if (enc->buf_allocated && enc->buf != NULL) {
+	free(enc->buf);
+    }
+    enc->buf = NULL;
+    return;
+}
+
+static __inline__ const void *
+DiameterAVPEncoderGetBytes(DiameterAVPEncoder * enc)
+{
+    return (enc->buf);
+}
+
+static __inline__ u_int32_t
+DiameterAVPEncoderGetLength(DiameterAVPEncoder * enc)
+{
+    return (enc->length);
+}
+
+/*
+ * Function: DiameterAVPEncoderAppend
+ * Purpose:
+ *   Append the header of an AVP with "data_length" bytes of data.
+ *   A non-zero "vendor" adds the Vendor-Id and sets the 'V' flag.
+ *   The padding is zeroed, the caller fills in the data.
+ * Returns:
+ *   A pointer to the AVP data, or NULL if there is no room.
+ */
+static __inline__ u_int8_t *
+DiameterAVPEncoderAppend(DiameterAVPEncoder * enc, u_int32_t code,
+			 u_int32_t vendor, u_int32_t data_length)
+{
+    u_int32_t		avp_length;
+    u_int8_t *		data;
+    u_int32_t		header_length;
+
+    header_length = (vendor != 0)
+	? sizeof(DiameterVendorAVP) : sizeof(DiameterAVP);
+    avp_length = header_length + data_length;
+    if (data_length > DIAMETER_LENGTH_MASK
+	|| DIAMETER_AVP_PAD(avp_length) > (enc->size - enc->length)) {
+	return (NULL);
+    }
+    if (vendor != 0) {
+	DiameterVendorAVP *	avpv;
+
+	avpv = (DiameterVendorAVP *)(enc->buf + enc->length);
+	avpv->AVPV_code = htonl(code);
+	avpv->AVPV_flags_length
+	    = htonl(DiameterAVPMakeFlagsLength(kDiameterFlagsVendorSpecific,
+					       avp_length));
+	avpv->AVPV_vendor = htonl(vendor);
+    }
+    else {
+	DiameterAVP *		avp;
+
+	avp = (DiameterAVP *)(enc->buf + enc->length);
+	avp->AVP_code = htonl(code);
+	avp->AVP_flags_length
+	    = htonl(DiameterAVPMakeFlagsLength(0, avp_length));
+    }
+    data = enc->buf + enc->length + header_length;
+    if (DIAMETER_AVP_PAD(avp_length) > avp_length) {
+	bzero(data + data_length, DIAMETER_AVP_PAD(avp_length) - avp_length);
+    }
+    enc->length += DIAMETER_AVP_PAD(avp_length);
+    return (data);
+}
+
+static __inline__ bool
+DiameterAVPEncoderAppendData(DiameterAVPEncoder * enc, u_int32_t code,
+			     u_int32_t vendor, const void * data,
+			     u_int32_t data_length)
+{
+    u_int8_t *		avp_data;
+
+    avp_data = DiameterAVPEncoderAppend(enc, code, vendor, data_length);
+    if (avp_data == NULL) {
+	return (false);
+    }
+    bcopy(data, avp_data, data_length);
+    return (true);
+}
+
+/**
+ ** DiameterAVPDecoder
+ ** - incremental AVP parser: the caller asks for the next buffer to
+ **   fill, reads as many bytes as are available into it, and reports
+ **   the count back.  AVPs may be split at any byte, e.g. across TLS
+ **   records, and AVP data is read directly into the caller's buffer
+ **   (or discarded) without buffering the whole message.
+ **/
+typedef enum {
+    kDiameterAVPDecoderStatusNeedMore = 0,
+    kDiameterAVPDecoderStatusHeader,	/* code/vendor/data_length valid */
+    kDiameterAVPDecoderStatusComplete,	/* AVP data and padding consumed */
+    kDiameterAVPDecoderStatusInvalid,
+} DiameterAVPDecoderStatus;
+
+typedef enum {
+    kDiameterAVPDecoderStateHeader = 0,
+    kDiameterAVPDecoderStateData,
+    kDiameterAVPDecoderStatePad,
+} DiameterAVPDecoderState;
+
+typedef struct {
+    DiameterAVPDecoderState	state;
+    u_int32_t			offset;	/* bytes consumed in this state */
+    u_int32_t			header_length;
+    u_int8_t			header[sizeof(DiameterVendorAVP)];
+    u_int8_t			scratch[64];
+    u_int8_t *			data;
+    u_int32_t			data_size;
+
+    /* valid after kDiameterAVPDecoderStatusHeader */
+    u_int32_t			code;
+    u_int8_t			flags;
+    u_int32_t			vendor;
+    u_int32_t			data_length;
+    u_int32_t			pad_length;
+} DiameterAVPDecoder;
+
+static __inline__ void
+DiameterAVPDecoderInit(DiameterAVPDecoder * dec)
+{
+    bzero(dec, sizeof(*dec));
+    dec->state = kDiameterAVPDecoderStateHeader;
+    dec->header_length = sizeof(DiameterAVP);
+    return;
+}
+
+/*
+ * Function: DiameterAVPDecoderSetData
+ * Purpose:
+ *   Called after kDiameterAVPDecoderStatusHeader to have the data of
+ *   the current AVP read into "buf".  At most "size" bytes are kept,
+ *   the remainder is discarded.  Without a buffer, the data is
+ *   discarded.
+ */
+static __inline__ void
+DiameterAVPDecoderSetData(DiameterAVPDecoder * dec, void * buf,
+			  u_int32_t size)
+{
+    dec->data = (u_int8_t *)buf;
+    dec->data_size = size;
+    return;
+}
+
+/*
+ * Function: DiameterAVPDecoderGetBuffer
+ * Purpose:
+ *   Return where the next bytes of input should be placed, and in
+ *   "want" how many bytes the decoder can accept there.  "want" may be
+ *   zero, in which case the caller calls DiameterAVPDecoderAdvance()
+ *   with a count of zero to move on.
+ */
+static __inline__ void *
+DiameterAVPDecoderGetBuffer(DiameterAVPDecoder * dec, u_int32_t * want)
+{
+    u_int32_t		remaining;
+
+    switch (dec->state) {
+    case kDiameterAVPDecoderStateHeader:
+	*want = dec->header_length - dec->offset;
+	return (dec->header + dec->offset);
+    case kDiameterAVPDecoderStateData:
+	remaining = dec->data_length - dec->offset;
+	if (dec->data != NULL && dec->offset < dec->data_size) {
+	    u_int32_t	room = dec->data_size - dec->offset;
+
+	    *want = (remaining < room) ? remaining : room;
+	    return (dec->data + dec->offset);
+	}
+	break;
+    case kDiameterAVPDecoderStatePad:
+	remaining = dec->pad_length - dec->offset;
+	break;
+    default:
+	*want = 0;
+	return (NULL);
+    }
+    *want = (remaining < sizeof(dec->scratch))
+	? remaining : sizeof(dec->scratch);
+    return (dec->scratch);
+}
+
+/*
+ * Function: DiameterAVPDecoderAdvance
+ * Purpose:
+ *   Consume "count" bytes placed in the buffer returned by
+ *   DiameterAVPDecoderGetBuffer().
+ */
+static __inline__ DiameterAVPDecoderStatus
+DiameterAVPDecoderAdvance(DiameterAVPDecoder * dec, u_int32_t count)
+{
+    u_int32_t		flags_length;
+    u_int32_t		length;
+
+    dec->offset += count;
+    switch (dec->state) {
+    case kDiameterAVPDecoderStateHeader:
+	if (dec->offset < dec->header_length) {
+	    return (kDiameterAVPDecoderStatusNeedMore);
+	}
+	flags_length
+	    = ntohl(((DiameterAVP *)(void *)dec->header)->AVP_flags_length);
+	if ((DiameterAVPFlagsFromFlagsLength(flags_length)
+	     & kDiameterFlagsVendorSpecific) != 0
+	    && dec->header_length == sizeof(DiameterAVP)) {
+	    /* need the Vendor-Id as well */
+	    dec->header_length = sizeof(DiameterVendorAVP);
+	    return (kDiameterAVPDecoderStatusNeedMore);
+	}
+	length = DiameterAVPLengthFromFlagsLength(flags_length);
+	if (length < dec->header_length) {
+	    return (kDiameterAVPDecoderStatusInvalid);
+	}
+	dec->code = ntohl(((DiameterAVP *)(void *)dec->header)->AVP_code);
+	dec->flags = DiameterAVPFlagsFromFlagsLength(flags_length);
+	dec->vendor = (dec->header_length == sizeof(DiameterVendorAVP))
+	    ? ntohl(((DiameterVendorAVP *)(void *)dec->header)->AVPV_vendor)
+	    : 0;
+	dec->data_length = length - dec->header_length;
+	dec->pad_length = DIAMETER_AVP_PAD(length) - length;
+	dec->data = NULL;
+	dec->data_size = 0;
+	dec->state = kDiameterAVPDecoderStateData;
+	dec->offset = 0;
+	return (kDiameterAVPDecoderStatusHeader);
+    case kDiameterAVPDecoderStateData:
+	if (dec->offset < dec->data_length) {
+	    return (kDiameterAVPDecoderStatusNeedMore);
+	}
+	dec->state = kDiameterAVPDecoderStatePad;
+	dec->offset = 0;
+	/* FALLTHROUGH */
+    case kDiameterAVPDecoderStatePad:
+	if (dec->offset < dec->pad_length) {
+	    return (kDiameterAVPDecoderStatusNeedMore);
+	}
+	dec->state = kDiameterAVPDecoderStateHeader;
+	dec->header_length = sizeof(DiameterAVP);
+	dec->offset = 0;
+	return (kDiameterAVPDecoderStatusComplete);
+    default:
+	break;
+    }
+    return (kDiameterAVPDecoderStatusInvalid);
+}
+
 #endif /* _EAP8021X_DIAMETERAVP_H */
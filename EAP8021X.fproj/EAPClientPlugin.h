@@ -76,6 +76,8 @@ typedef const char * EAPClientPluginFuncName;
  *     Value is the MTU of the underlying hardware minus
  *     the framing overhead.  The size of frames generated by the client 
  *     "process" function (see below)  must not exceed this value.
+ *     The value may change between calls to "process" as the caller
+ *     discovers the largest frame the authenticator accepts.
  *  unique_id, unique_id_length
  *     A sequence of bytes that uniquely identifies this instance,
  *     used for TLS session resumption.
@@ -206,6 +206,7 @@
 #define kEAPTLSVersion1_0			CFSTR("1.0")
 #define kEAPTLSVersion1_1			CFSTR("1.1")
 #define kEAPTLSVersion1_2			CFSTR("1.2")
+#define kEAPTLSVersion1_3			CFSTR("1.3") /* maximum only: treated as 1.2 */
 
 /* for EAP-FAST */
 #define kEAPClientPropEAPFASTUsePAC		CFSTR("EAPFASTUsePAC") /* boolean (false) */
@@ -236,6 +237,18 @@
 
 #define kEAPClientPropEAPFASTPACWasProvisioned	CFSTR("EAPFASTPACWasProvisioned") /* boolean */
 
+/*
+ * EAP-SIM and EAP-AKA authentication counts, kept separately for each
+ * EAP type for the life of the supplicant process.  WasFastReauthentication
+ * is false after an authentication that ended in EAP-Failure.
+ */
+#define kEAPClientPropEAPSIMAKAFullAuthenticationCount \
+	CFSTR("EAPSIMAKAFullAuthenticationCount") /* integer */
+#define kEAPClientPropEAPSIMAKAFastReauthenticationCount \
+	CFSTR("EAPSIMAKAFastReauthenticationCount") /* integer */
+#define kEAPClientPropEAPSIMAKAWasFastReauthentication \
+	CFSTR("EAPSIMAKAWasFastReauthentication") /* boolean */
+
 /* 
  * Deprecated/unused properties
  */
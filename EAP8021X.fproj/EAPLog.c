@@ -33,6 +33,8 @@
  */
 
 #include <dispatch/dispatch.h>
+#include <pthread.h>
+#include <CoreFoundation/CFRuntime.h>
 #include <SystemConfiguration/SCPrivate.h>
 #include "EAPClientPlugin.h"
 #include "symbol_scope.h"
@@ -73,3 +75,102 @@ EAPLogInit(EAPLogCategory log_category)
 	S_eap_logger = os_log_create(EAPOL_OS_LOG_SUBSYSTEM,
 								 S_eap_os_log_categories[log_category]);
 }
+
+/**
+ ** EAPLogDeferredDescription
+ ** - a stand-in for an expensive "%@" argument, formatted on demand
+ **/
+typedef struct __EAPLogDeferredDescription {
+    CFRuntimeBase		cf_base;
+    EAPLogDescriptionFunc *	func;
+    const void *		bytes;
+    int				length;
+    const void *		info;
+    CFStringRef			description;
+} EAPLogDeferredDescription, * EAPLogDeferredDescriptionRef;
+
+STATIC CFStringRef	__EAPLogDeferredDescriptionCopyFormattingDesc(CFTypeRef cf,
+								      CFDictionaryRef options);
+STATIC CFStringRef	__EAPLogDeferredDescriptionCopyDebugDesc(CFTypeRef cf);
+STATIC void		__EAPLogDeferredDescriptionDeallocate(CFTypeRef cf);
+
+STATIC CFTypeID __kEAPLogDeferredDescriptionTypeID = _kCFRuntimeNotATypeID;
+
+STATIC const CFRuntimeClass __EAPLogDeferredDescriptionClass = {
+    0,						/* version */
+    "EAPLogDeferredDescription",		/* className */
+    NULL,					/* init */
+    NULL,					/* copy */
+    __EAPLogDeferredDescriptionDeallocate,	/* deallocate */
+    NULL,					/* equal */
+    NULL,					/* hash */
+    __EAPLogDeferredDescriptionCopyFormattingDesc, /* copyFormattingDesc */
+    __EAPLogDeferredDescriptionCopyDebugDesc	/* copyDebugDesc */
+};
+
+STATIC CFStringRef
+__EAPLogDeferredDescriptionCopyDebugDesc(CFTypeRef cf)
+{
+    EAPLogDeferredDescriptionRef	descr = (EAPLogDeferredDescriptionRef)cf;
+
+    if (descr->description == NULL) {
+	CFMutableStringRef	str;
+
+	/* first time anyone asked: format it now, and only once */
+	str = CFStringCreateMutable(CFGetAllocator(cf), 0);
+	(*descr->func)(str, descr->bytes, descr->length, descr->info);
+	descr->description = str;
+    }
+    return (CFRetain(descr->description));
+}
+
+STATIC CFStringRef
+__EAPLogDeferredDescriptionCopyFormattingDesc(CFTypeRef cf,
+					      CFDictionaryRef options)
+{
+    return (__EAPLogDeferredDescriptionCopyDebugDesc(cf));
+}
+
+STATIC void
+__EAPLogDeferredDescriptionDeallocate(CFTypeRef cf)
+{
+    EAPLogDeferredDescriptionRef	descr = (EAPLogDeferredDescriptionRef)cf;
+
+    if (descr->description != NULL) {
+	CFRelease(descr->description);
+    }
+    return;
+}
+
+STATIC void
+__EAPLogDeferredDescriptionInitialize(void)
+{
+    __kEAPLogDeferredDescriptionTypeID
+	= _CFRuntimeRegisterClass(&__EAPLogDeferredDescriptionClass);
+    return;
+}
+
+CFTypeRef
+EAPLogDeferredDescriptionCreate(EAPLogDescriptionFunc * func,
+				const void * bytes, int length,
+				const void * info)
+{
+    EAPLogDeferredDescriptionRef	descr;
+    STATIC pthread_once_t		initialized = PTHREAD_ONCE_INIT;
+
+    pthread_once(&initialized, __EAPLogDeferredDescriptionInitialize);
+    descr = (EAPLogDeferredDescriptionRef)
+	_CFRuntimeCreateInstance(NULL,
+				 __kEAPLogDeferredDescriptionTypeID,
+				 sizeof(*descr) - sizeof(CFRuntimeBase),
+				 NULL);
+    if (descr == NULL) {
+	return (NULL);
+    }
+    descr->func = func;
+    descr->bytes = bytes;
+    descr->length = length;
+    descr->info = info;
+    descr->description = NULL;
+    return (descr);
+}
@@ -76,4 +76,29 @@ EAPLogFileName(const char * file)
 
 #define EAPLOG_FL EAPLOG
 
+/*
+ * Type: EAPLogDescriptionFunc
+ * Purpose:
+ *   Append a description of the 'length' bytes at 'bytes' to 'str'.
+ */
+typedef void (EAPLogDescriptionFunc)(CFMutableStringRef str,
+				      const void * bytes, int length,
+				      const void * info);
+
+/*
+ * Function: EAPLogDeferredDescriptionCreate
+ * Purpose:
+ *   Create an object to pass to EAPLOG() for a "%@" whose text is expensive
+ *   to produce, e.g. a packet description.  'func' is only called when the
+ *   logging system asks for the object's description, that is, when the
+ *   record is actually emitted; the result is cached.
+ *
+ *   'bytes' and 'info' are referenced, not copied.  The log call formats
+ *   its arguments before returning, so release the object right after it.
+ */
+CFTypeRef
+EAPLogDeferredDescriptionCreate(EAPLogDescriptionFunc * func,
+				const void * bytes, int length,
+				const void * info);
+
 #endif /* _EAP8021X_EAPLOG_H */
@@ -44,4 +44,29 @@
  */
 #define kEAPOLControlClientItemID	CFSTR("ClientItemID")
 
+/*
+ * Properties: kEAPOLControlMTU, kEAPOLControlFragmentCount,
+ *             kEAPOLControlRoundTripCount
+ * Purpose:
+ *   Status properties describing the current authentication exchange:
+ *   the EAPOL MTU in use with the authenticator, the number of responses
+ *   that carried a TLS fragment, and the number of request/response
+ *   round trips.
+ */
+#define kEAPOLControlMTU		CFSTR("MTU")		/* CFNumber */
+#define kEAPOLControlFragmentCount	CFSTR("FragmentCount")	/* CFNumber */
+#define kEAPOLControlRoundTripCount	CFSTR("RoundTripCount")	/* CFNumber */
+
+/*
+ * Properties: kEAPOLControlIdentityPrewarmTime,
+ *             kEAPOLControlIdentityChainCopyTime
+ * Purpose:
+ *   Status properties comparing the time (in microseconds) spent
+ *   resolving the client identity and building its trust chain before
+ *   the link came up with the time the EAP method spent retrieving the
+ *   trust chain during the authentication exchange.
+ */
+#define kEAPOLControlIdentityPrewarmTime	CFSTR("IdentityPrewarmTime")	/* CFNumber */
+#define kEAPOLControlIdentityChainCopyTime	CFSTR("IdentityChainCopyTime")	/* CFNumber */
+
 #endif /* _EAP8021X_EAPOLCONTROLTYPESPRIVATE_H */
@@ -36,7 +36,6 @@
 #include "EAPUtil.h"
 #include "EAPOLUtil.h"
 #include "printdata.h"
-#include "nbo.h"
 #include "myCFUtil.h"
 #include <SystemConfiguration/SCPrivate.h>
 
@@ -69,11 +68,9 @@ EAPOLPacketTypeStr(EAPOLPacketType type)
 
 static void
 RC4KeyDescriptorAppendDescription(EAPOLRC4KeyDescriptorRef descr_p,
-				  unsigned int body_length,
+				  EAPOLKeyViewRef key,
 				  CFMutableStringRef str)
 {
-    int				key_data_length;
-    u_int16_t			key_length;
     const char *		which;
     
     if (descr_p->key_index & kEAPOLKeyDescriptorIndexUnicastFlag) {
@@ -82,12 +79,10 @@ RC4KeyDescriptorAppendDescription(EAPOLRC4KeyDescriptorRef descr_p,
     else {
 	which = "Broadcast";
     }
-    key_length = EAPOLKeyDescriptorGetLength(descr_p);
-    key_data_length = body_length - sizeof(*descr_p);
     STRING_APPEND(str,
 		  "EAPOL Key Descriptor: type RC4 (%d) length %d %s index %d\n",
-		  descr_p->descriptor_type, 
-		  key_length, 
+		  key->descriptor_type, 
+		  key->key_length, 
 		  which,
 		  descr_p->key_index & kEAPOLKeyDescriptorIndexMask);
     STRING_APPEND(str, "%-16s", "replay_counter:");
@@ -101,9 +96,9 @@ RC4KeyDescriptorAppendDescription(EAPOLRC4KeyDescriptorRef descr_p,
     print_bytes_cfstr(str, descr_p->key_signature,
 		      sizeof(descr_p->key_signature));
     STRING_APPEND(str, "\n");
-    if (key_data_length > 0) {
+    if (key->key_data_length > 0) {
 	STRING_APPEND(str, "%-16s", "key:");
-	print_bytes_cfstr(str, descr_p->key, key_data_length);
+	print_bytes_cfstr(str, key->key_data, key->key_data_length);
 	STRING_APPEND(str, "\n");
     }
     return;
@@ -111,20 +106,14 @@ RC4KeyDescriptorAppendDescription(EAPOLRC4KeyDescriptorRef descr_p,
 
 static void
 IEEE80211KeyDescriptorAppendDescription(EAPOLIEEE80211KeyDescriptorRef descr_p,
-					unsigned int body_length,
+					EAPOLKeyViewRef key,
 					CFMutableStringRef str)
 {
-    uint16_t		key_data_length;
-    uint16_t		key_information;
-    uint16_t		key_length;
-
-    key_length = EAPOLIEEE80211KeyDescriptorGetLength(descr_p);
-    key_information =  EAPOLIEEE80211KeyDescriptorGetInformation(descr_p);
-    key_data_length =  EAPOLIEEE80211KeyDescriptorGetKeyDataLength(descr_p);
     STRING_APPEND(str, "EAPOL Key Descriptor: type IEEE 802.11 (%d)\n",
-		  descr_p->descriptor_type);
-    STRING_APPEND(str, "%-18s0x%04x\n", "key_information:", key_information);
-    STRING_APPEND(str, "%-18s%d\n", "key_length:", key_length);
+		  key->descriptor_type);
+    STRING_APPEND(str, "%-18s0x%04x\n", "key_information:",
+		  key->key_information);
+    STRING_APPEND(str, "%-18s%d\n", "key_length:", key->key_length);
     STRING_APPEND(str, "%-18s", "replay_counter:");
     print_bytes_cfstr(str, descr_p->replay_counter,
 		      sizeof(descr_p->replay_counter));
@@ -146,21 +135,21 @@ IEEE80211KeyDescriptorAppendDescription(EAPOLIEEE80211KeyDescriptorRef descr_p,
     STRING_APPEND(str, "%-18s", "key_MIC:");
     print_bytes_cfstr(str, descr_p->key_MIC, sizeof(descr_p->key_MIC));
     STRING_APPEND(str, "\n");
-    STRING_APPEND(str, "%-18s%d\n", "key_data_length:", key_data_length);
-    if (key_data_length > 0) {
+    STRING_APPEND(str, "%-18s%d\n", "key_data_length:", key->key_data_length);
+    if (key->key_data_length > 0) {
 	STRING_APPEND(str, "%-18s", "key_data:");
-	print_bytes_cfstr(str, descr_p->key_data, key_data_length);
+	print_bytes_cfstr(str, key->key_data, key->key_data_length);
 	STRING_APPEND(str, "\n");
     }
     return;
 }
 
 static bool
-eapol_key_descriptor_valid(void * body, unsigned int body_length,
+eapol_key_descriptor_valid(EAPOLKeyViewRef key,
+			   void * body, unsigned int body_length,
 			   CFMutableStringRef str)
 {
     EAPOLIEEE80211KeyDescriptorRef	ieee80211_descr_p = body;
-    int					key_data_length;
     EAPOLRC4KeyDescriptorRef		rc4_descr_p = body;
 
     if (body_length < 1) {
@@ -169,8 +158,9 @@ eapol_key_descriptor_valid(void * body, unsigned int body_length,
 	}
 	return (false);
     }
+    key->descriptor_type = rc4_descr_p->descriptor_type;
 #define KEY_DESCRIPTOR_LABEL	"EAPOLKeyDescriptor"
-    switch (rc4_descr_p->descriptor_type) {
+    switch (key->descriptor_type) {
     case kEAPOLKeyDescriptorTypeRC4:
 	if (body_length < sizeof(*rc4_descr_p)) {
 	    if (str != NULL) {
@@ -180,8 +170,12 @@ eapol_key_descriptor_valid(void * body, unsigned int body_length,
 	    }
 	    return (false);
 	}
+	key->key_information = 0;
+	key->key_length = EAPOLHeaderGetUInt16(rc4_descr_p->key_length);
+	key->key_data = rc4_descr_p->key;
+	key->key_data_length = body_length - (int)sizeof(*rc4_descr_p);
 	if (str != NULL) {
-	    RC4KeyDescriptorAppendDescription(rc4_descr_p, body_length, str);
+	    RC4KeyDescriptorAppendDescription(rc4_descr_p, key, str);
 	}
 	break;
     case kEAPOLKeyDescriptorTypeIEEE80211:
@@ -194,28 +188,32 @@ eapol_key_descriptor_valid(void * body, unsigned int body_length,
 	    }
 	    return (false);
 	}
-	key_data_length 
-	    = EAPOLIEEE80211KeyDescriptorGetKeyDataLength(ieee80211_descr_p);
-	if ((body_length - sizeof(*ieee80211_descr_p)) < key_data_length) {
+	key->key_information
+	    = EAPOLHeaderGetUInt16(ieee80211_descr_p->key_information);
+	key->key_length = EAPOLHeaderGetUInt16(ieee80211_descr_p->key_length);
+	key->key_data = ieee80211_descr_p->key_data;
+	key->key_data_length
+	    = EAPOLHeaderGetUInt16(ieee80211_descr_p->key_data_length);
+	if ((body_length - sizeof(*ieee80211_descr_p)) < key->key_data_length) {
 	    if (str != NULL) {
 		STRING_APPEND(str,
 			      "%s(IEEE80211) Key Data truncated %d < %d\n",
 			      KEY_DESCRIPTOR_LABEL,
 			      body_length - (int)sizeof(*ieee80211_descr_p),
-			      key_data_length);
+			      key->key_data_length);
 	    }
 	    return (false);
 	}
 	if (str != NULL) {
 	    IEEE80211KeyDescriptorAppendDescription(ieee80211_descr_p,
-						    body_length, str);
+						    key, str);
 	}
 	break;
     default:
 	if (str != NULL) {
 	    STRING_APPEND(str, "%s Type %d unrecognized\n",
 			  KEY_DESCRIPTOR_LABEL,
-			  rc4_descr_p->descriptor_type);
+			  key->descriptor_type);
 	}
 	return (false);
     }
@@ -223,28 +221,29 @@ eapol_key_descriptor_valid(void * body, unsigned int body_length,
 }
 
 static bool
-eapol_body_valid(EAPOLPacketRef eapol_p, unsigned int length, 
+eapol_body_valid(EAPOLPacketViewRef view, unsigned int length, 
 		 CFMutableStringRef str)
 {
-    unsigned int 	body_length;
+    EAPOLPacketRef	eapol_p = view->pkt;
     bool 		ret = true;
 
-    body_length = EAPOLPacketGetLength(eapol_p);
     length -= sizeof(*eapol_p);
-    if (length < body_length) {
+    if (length < view->body_length) {
 	if (str != NULL) {
 	    STRING_APPEND(str,
 			  "EAPOLPacket truncated %d < %d\n",
-			  length, body_length);
+			  length, view->body_length);
 	}
 	return (false);
     }
-    switch (eapol_p->packet_type) {
+    switch (view->packet_type) {
     case kEAPOLPacketTypeEAPPacket:
-	ret = EAPPacketIsValid((EAPPacketRef)eapol_p->body, body_length, str);
+	ret = EAPPacketViewInit(&view->body.eap, (EAPPacketRef)eapol_p->body,
+				view->body_length, str);
 	break;
     case kEAPOLPacketTypeKey:
-	ret = eapol_key_descriptor_valid(eapol_p->body, body_length, str);
+	ret = eapol_key_descriptor_valid(&view->body.key, eapol_p->body,
+					 view->body_length, str);
 	break;
     case kEAPOLPacketTypeStart:
     case kEAPOLPacketTypeLogoff:
@@ -254,25 +253,23 @@ eapol_body_valid(EAPOLPacketRef eapol_p, unsigned int length,
 	if (str != NULL) {
 	    STRING_APPEND(str,
 			  "EAPOLPacket type %d unrecognized\n",
-			  eapol_p->packet_type);
-	    print_data_cfstr(str, 
-			     ((void *)eapol_p) + sizeof(*eapol_p), body_length);
+			  view->packet_type);
+	    print_data_cfstr(str, eapol_p->body, view->body_length);
 	}
 	break;
     }
-    if (str != NULL && body_length < length) {
+    if (str != NULL && view->body_length < length) {
 	STRING_APPEND(str, "EAPOL: %d bytes follow body:\n", 
-		      length - body_length);
-	print_data_cfstr(str,
-			 ((void *)eapol_p) + sizeof(*eapol_p) + body_length, 
-			length - body_length);
+		      length - view->body_length);
+	print_data_cfstr(str, eapol_p->body + view->body_length,
+			 length - view->body_length);
     }
     return (ret);
 }
 
 static bool
-eapol_header_valid(EAPOLPacketRef eapol_p, unsigned int length,
-		   CFMutableStringRef str)
+eapol_header_valid(EAPOLPacketViewRef view, EAPOLPacketRef eapol_p,
+		   unsigned int length, CFMutableStringRef str)
 {
     if (length < sizeof(*eapol_p)) {
 	if (str != NULL) {
@@ -281,24 +278,36 @@ eapol_header_valid(EAPOLPacketRef eapol_p, unsigned int length,
 	}
 	return (false);
     }
+    view->pkt = eapol_p;
+    view->packet_type = eapol_p->packet_type;
+    view->body_length = EAPOLPacketHeaderGetLength(eapol_p);
     if (str != NULL) {
 	STRING_APPEND(str, 
 		      "EAPOL: proto version 0x%x type %s (%d) length %d\n",
 		      eapol_p->protocol_version, 
-		      EAPOLPacketTypeStr(eapol_p->packet_type),
-		      eapol_p->packet_type, EAPOLPacketGetLength(eapol_p));
+		      EAPOLPacketTypeStr(view->packet_type),
+		      view->packet_type, view->body_length);
     }
     return (true);
 }
 
 bool
-EAPOLPacketIsValid(EAPOLPacketRef eapol_p, unsigned int length,
-		   CFMutableStringRef str)
+EAPOLPacketViewInit(EAPOLPacketViewRef view, EAPOLPacketRef eapol_p,
+		    unsigned int length, CFMutableStringRef str)
 {
-    if (eapol_header_valid(eapol_p, length, str) == false) {
+    if (eapol_header_valid(view, eapol_p, length, str) == false) {
 	return (false);
     }
-    return (eapol_body_valid(eapol_p, length, str));
+    return (eapol_body_valid(view, length, str));
+}
+
+bool
+EAPOLPacketIsValid(EAPOLPacketRef eapol_p, unsigned int length,
+		   CFMutableStringRef str)
+{
+    EAPOLPacketView	view;
+
+    return (EAPOLPacketViewInit(&view, eapol_p, length, str));
 }
 
 bool
@@ -321,20 +330,20 @@ EAPOLPacketValid(EAPOLPacketRef eapol_p, unsigned int length, FILE * f)
 void
 EAPOLPacketSetLength(EAPOLPacketRef pkt, uint16_t length)
 {
-    net_uint16_set(pkt->body_length, length);
+    EAPOLHeaderSetUInt16(pkt->body_length, length);
     return;
 }
 
 uint16_t
 EAPOLPacketGetLength(const EAPOLPacketRef pkt)
 {
-    return (net_uint16_get(pkt->body_length));
+    return (EAPOLPacketHeaderGetLength(pkt));
 }
 
 void
 EAPOLRC4KeyDescriptorSetLength(EAPOLRC4KeyDescriptorRef pkt, uint16_t length)
 {
-    net_uint16_set(pkt->key_length, length);
+    EAPOLHeaderSetUInt16(pkt->key_length, length);
     return;
 }
 
@@ -348,7 +357,7 @@ EAPOLKeyDescriptorSetLength(EAPOLKeyDescriptorRef pkt, uint16_t length)
 uint16_t
 EAPOLRC4KeyDescriptorGetLength(const EAPOLRC4KeyDescriptorRef pkt)
 {
-    return (net_uint16_get(pkt->key_length));
+    return (EAPOLHeaderGetUInt16(pkt->key_length));
 }
 
 uint16_t
@@ -360,17 +369,17 @@ EAPOLKeyDescriptorGetLength(const EAPOLKeyDescriptorRef pkt)
 uint16_t
 EAPOLIEEE80211KeyDescriptorGetLength(const EAPOLIEEE80211KeyDescriptorRef pkt)
 {
-    return (net_uint16_get(pkt->key_length));
+    return (EAPOLHeaderGetUInt16(pkt->key_length));
 }
 
 uint16_t
 EAPOLIEEE80211KeyDescriptorGetInformation(const EAPOLIEEE80211KeyDescriptorRef pkt)
 {
-    return (net_uint16_get(pkt->key_information));
+    return (EAPOLHeaderGetUInt16(pkt->key_information));
 }
 
 uint16_t
 EAPOLIEEE80211KeyDescriptorGetKeyDataLength(const EAPOLIEEE80211KeyDescriptorRef pkt)
 {
-    return (net_uint16_get(pkt->key_data_length));
+    return (EAPOLHeaderGetUInt16(pkt->key_data_length));
 }
@@ -38,9 +38,82 @@
  */
 
 #include <EAP8021X/EAPOL.h>
+#include <EAP8021X/EAPUtil.h>
 #include <stdio.h>
 #include <CoreFoundation/CFString.h>
 
+/*
+ * Inline header accessors
+ * - like EAPPacketHeaderGetLength(), these read the byte array fields
+ *   directly and are safe for any alignment
+ * - the exported EAPOL*Get*() functions are implemented with these
+ */
+static __inline__ uint16_t
+EAPOLHeaderGetUInt16(const uint8_t field[2])
+{
+    return ((uint16_t)((field[0] << 8) | field[1]));
+}
+
+static __inline__ void
+EAPOLHeaderSetUInt16(uint8_t field[2], uint16_t value)
+{
+    field[0] = (uint8_t)(value >> 8);
+    field[1] = (uint8_t)value;
+    return;
+}
+
+static __inline__ uint16_t
+EAPOLPacketHeaderGetLength(const EAPOLPacket * pkt)
+{
+    return (EAPOLHeaderGetUInt16(pkt->body_length));
+}
+
+/*
+ * Type: EAPOLKeyView
+ * Purpose:
+ *   The decoded fields of a validated EAPOL Key Descriptor.
+ *   'key_information' is only set for IEEE 802.11/WPA descriptors.
+ *   'key_data' points at the RC4 key or the IEEE 802.11 Key Data.
+ */
+typedef struct {
+    EAPOLKeyDescriptorType	descriptor_type;
+    uint16_t			key_information;
+    uint16_t			key_length;
+    const uint8_t *		key_data;
+    int				key_data_length;
+} EAPOLKeyView, * EAPOLKeyViewRef;
+
+/*
+ * Type: EAPOLPacketView
+ * Purpose:
+ *   The decoded headers of an EAPOL packet that has passed validation,
+ *   including the EAP packet or Key Descriptor it carries.  Filled in by
+ *   EAPOLPacketViewInit(), which reads each header exactly once.
+ */
+typedef struct {
+    EAPOLPacketRef		pkt;
+    EAPOLPacketType		packet_type;
+    uint16_t			body_length;
+    union {
+	EAPPacketView		eap;	/* kEAPOLPacketTypeEAPPacket */
+	EAPOLKeyView		key;	/* kEAPOLPacketTypeKey */
+    } body;
+} EAPOLPacketView, * EAPOLPacketViewRef;
+
+/*
+ * Function: EAPOLPacketViewInit
+ * Purpose:
+ *   Validate the EAPOL packet 'eapol_p' of 'length' bytes and fill in
+ *   'view'.  If 'str' is not NULL, a description of the packet is
+ *   appended to it.
+ * Returns:
+ *   true if the packet is valid, false otherwise, in which case
+ *   'view' is not usable.
+ */
+bool
+EAPOLPacketViewInit(EAPOLPacketViewRef view, EAPOLPacketRef eapol_p,
+		    unsigned int length, CFMutableStringRef str);
+
 bool
 EAPOLPacketValid(EAPOLPacketRef eapol_p, unsigned int length, FILE * f);
 
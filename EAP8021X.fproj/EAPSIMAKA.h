@@ -39,6 +39,8 @@
 #include <stdbool.h>
 #include <sys/param.h>
 #include <CommonCrypto/CommonDigest.h>
+#include <CommonCrypto/CommonHMAC.h>
+#include <CommonCrypto/CommonCryptor.h>
 #include <CoreFoundation/CFString.h>
 #include "EAP.h"
 
@@ -252,6 +254,8 @@ typedef struct AT_ENCR_DATA_s {
 
 #define AT_ENCR_DATA_ALIGNMENT	16
 #define AT_ENCR_DATA_ROUNDUP(size)	roundup((size), AT_ENCR_DATA_ALIGNMENT)
+#define AT_ENCR_DATA_MAX_SIZE		(TLV_MAX_LENGTH \
+					 - offsetof(AT_ENCR_DATA, ed_encrypted_data))
 
 
 typedef struct AT_PADDING_s {
@@ -389,14 +393,31 @@ typedef union AttrUnion_u {
 #define EAPSIMAKA_KEY_SIZE	(EAPSIMAKA_K_ENCR_SIZE + EAPSIMAKA_K_AUT_SIZE \
 				 + EAPSIMAKA_MSK_SIZE + EAPSIMAKA_EMSK_SIZE)
 
-typedef union {
-    struct {
-	uint8_t	k_encr[EAPSIMAKA_K_ENCR_SIZE];
-	uint8_t	k_aut[EAPSIMAKA_K_AUT_SIZE];
-	uint8_t	msk[EAPSIMAKA_MSK_SIZE];
-	uint8_t	emsk[EAPSIMAKA_EMSK_SIZE];
-    } s;
-    uint8_t	key[EAPSIMAKA_KEY_SIZE];
+/*
+ * Type: EAPSIMAKAKeyInfo
+ * Purpose:
+ *   The keying material produced by the PRF, along with the HMAC-SHA1
+ *   context keyed with k_aut; EAPSIMAKAKeyInfoComputeKeys() fills in both,
+ *   and each AT_MAC computation starts from a copy of the context instead
+ *   of repeating the key setup.
+ *
+ *   The AES-CBC cryptors keyed with k_encr are created on first use and
+ *   reset with a new IV for each AT_ENCR_DATA.  The structure must start
+ *   out zeroed, and EAPSIMAKAKeyInfoRelease() releases the cryptors.
+ */
+typedef struct {
+    union {
+	struct {
+	    uint8_t	k_encr[EAPSIMAKA_K_ENCR_SIZE];
+	    uint8_t	k_aut[EAPSIMAKA_K_AUT_SIZE];
+	    uint8_t	msk[EAPSIMAKA_MSK_SIZE];
+	    uint8_t	emsk[EAPSIMAKA_EMSK_SIZE];
+	} s;
+	uint8_t	key[EAPSIMAKA_KEY_SIZE];
+    };
+    CCHmacContext	k_aut_hmac;
+    CCCryptorRef	k_encr_encrypt;
+    CCCryptorRef	k_encr_decrypt;
 } EAPSIMAKAKeyInfo, * EAPSIMAKAKeyInfoRef;
 
 typedef struct {
@@ -35,8 +35,18 @@
  * - created
  */
 
+/*
+ * The stored state for each protocol is kept in memory after it is first
+ * read.  EAPSIMAKAPersistentStateSave() only updates the in-memory copy;
+ * the keychain and preferences are written behind on a serial queue, so
+ * that authentication never waits for them.
+ */
+
 #include <CoreFoundation/CFPreferences.h>
+#include <dispatch/dispatch.h>
 #include <notify.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <SystemConfiguration/SCValidation.h>
 
 #include "symbol_scope.h"
@@ -59,6 +69,10 @@ STATIC void
 IMSIListRemoveMatches(EAPType type, IMSIMatchFuncRef iter,
 		      const void * context);
 
+STATIC Boolean
+IMSIDoesNotMatch(CFStringRef imsi, CFDictionaryRef info,
+		 const void * context);
+
 STATIC void
 EAPSIMAKAPersistentStatePurgePrefs(void);
 
@@ -187,29 +201,81 @@ MasterKeyRemoveFromKeychain(CFStringRef proto, CFStringRef imsi)
     return;
 }
 
+/*
+ * StateCache
+ * - the stored state for one protocol, keyed by IMSI; Save() removes the
+ *   entries for every other IMSI, so one entry per protocol is enough
+ *   	imsi:		NULL if the entry is empty
+ *   	info:		the preferences value for imsi
+ *   	master_key:	the keychain item for imsi, once master_key_loaded
+ *   	generation_id:	EAPOLSIMGenerationGet() when the entry was filled
+ *   	dirty:		changed since it was last written
+ *   	flushing:	being written, the stored state may lag behind
+ * - protected by S_state_cache_lock, along with the notification state
+ */
+typedef struct {
+    CFStringRef			imsi;
+    CFPropertyListRef		info;
+    CFDataRef			master_key;
+    uint32_t			generation_id;
+    Boolean			master_key_loaded;
+    Boolean			master_key_dirty;
+    Boolean			others_removed;
+    Boolean			dirty;
+    Boolean			flushing;
+    Boolean			flush_scheduled;
+} StateCache, * StateCacheRef;
+
+STATIC pthread_mutex_t		S_state_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+STATIC void
+StateCacheClear(StateCacheRef cache)
+{
+    my_CFRelease(&cache->imsi);
+    my_CFRelease(&cache->info);
+    my_CFRelease(&cache->master_key);
+    cache->generation_id = 0;
+    cache->master_key_loaded = FALSE;
+    cache->master_key_dirty = FALSE;
+    cache->others_removed = FALSE;
+    cache->dirty = FALSE;
+    return;
+}
+
+INLINE Boolean
+StateCacheIsClean(StateCacheRef cache)
+{
+    /* don't replace state that hasn't made it to storage yet */
+    return (!cache->dirty && !cache->flushing);
+}
+
 /*
  * ProtoInfo
  * - constant information specific to particular protocol (EAP-SIM, EAP-AKA)
+ *   	type:		EAP type
  *   	appID:		locates preferences
  *   	proto:		locates keychain items
  *   	generation:	multiplexes single notification to detect changes
+ *   	cache:		in-memory copy of the stored state
  */
 
 #define kEAPSIMAppIDStr	"com.apple.network.eapclient.eapsim"
 #define kEAPAKAAppIDStr "com.apple.network.eapclient.eapaka"
 
 typedef struct {
+    const EAPType		type;
     const CFStringRef		appID;
     const CFStringRef		proto;
     uint32_t			generation;
+    StateCache			cache;
 } ProtoInfo, * ProtoInfoRef;
 
 STATIC ProtoInfo	S_eapsim_info = {
-    CFSTR(kEAPSIMAppIDStr), CFSTR("eapsim"), 0,
+    kEAPTypeEAPSIM, CFSTR(kEAPSIMAppIDStr), CFSTR("eapsim"), 0,
 };
 
 STATIC ProtoInfo	S_eapaka_info = {
-    CFSTR(kEAPAKAAppIDStr), CFSTR("eapaka"), 0,
+    kEAPTypeEAPAKA, CFSTR(kEAPAKAAppIDStr), CFSTR("eapaka"), 0,
 };
 
 STATIC ProtoInfoRef
@@ -235,7 +301,16 @@ ProtoInfoForType(EAPType type)
 STATIC void
 ProtoInfoChangedCheck(ProtoInfoRef proto_info)
 {
-    if (prefs_did_change(&proto_info->generation)) {
+    Boolean	changed;
+
+    pthread_mutex_lock(&S_state_cache_lock);
+    changed = prefs_did_change(&proto_info->generation);
+    if (changed && StateCacheIsClean(&proto_info->cache)) {
+	/* another process may have changed the stored state */
+	StateCacheClear(&proto_info->cache);
+    }
+    pthread_mutex_unlock(&S_state_cache_lock);
+    if (changed) {
 	CFPreferencesSynchronize(proto_info->appID,
 				 kCFPreferencesCurrentUser,
 				 kCFPreferencesAnyHost);
@@ -250,6 +325,20 @@ ProtoInfoNotifyChange(ProtoInfoRef proto_info)
     return;
 }
 
+STATIC void
+ProtoInfoSetValue(ProtoInfoRef proto_info, CFStringRef imsi,
+		  CFPropertyListRef info)
+{
+    CFPreferencesSetValue(imsi, info,
+			  proto_info->appID,
+			  kCFPreferencesCurrentUser,
+			  kCFPreferencesAnyHost);
+    CFPreferencesSynchronize(proto_info->appID,
+			     kCFPreferencesCurrentUser,
+			     kCFPreferencesAnyHost);
+    return;
+}
+
 /**
  ** EAPSIMAKAPersistentState
  **/
@@ -261,6 +350,229 @@ STATIC CFStringRef kPrefsReauthID = CFSTR("ReauthID"); 	/* string */
 STATIC CFStringRef kPrefsSSID = CFSTR("SSID"); 		/* string */
 STATIC CFStringRef kPrefsGenID = CFSTR("GenerationID"); 		/* number */
 
+STATIC dispatch_queue_t
+StateCacheGetQueue(void)
+{
+    STATIC dispatch_once_t	once;
+    STATIC dispatch_queue_t	S_queue;
+
+    dispatch_once(&once, ^{
+	    S_queue
+		= dispatch_queue_create("com.apple.eapclient.eapsimaka.state",
+					NULL);
+	    /* don't lose state that hasn't been written yet */
+	    atexit(EAPSIMAKAPersistentStateSynchronize);
+	});
+    return (S_queue);
+}
+
+/*
+ * Function: StateCacheFlush
+ * Purpose:
+ *   Write the cached state for proto_info to the keychain and preferences.
+ *   A changed master key is written before the reauth ID that refers to it,
+ *   and the old reauth ID is removed before either, so that a crash at any
+ *   point never leaves a reauth ID paired with the wrong master key.
+ */
+STATIC void
+StateCacheFlush(ProtoInfoRef proto_info)
+{
+    /* only called on StateCacheGetQueue() */
+    StateCacheRef	cache = &proto_info->cache;
+    CFPropertyListRef	info = NULL;
+    CFStringRef		imsi = NULL;
+    CFDataRef		master_key = NULL;
+    Boolean		remove_others = FALSE;
+
+    pthread_mutex_lock(&S_state_cache_lock);
+    cache->flush_scheduled = FALSE;
+    if (cache->dirty && cache->imsi != NULL) {
+	imsi = CFRetain(cache->imsi);
+	if (cache->info != NULL) {
+	    info = CFRetain(cache->info);
+	}
+	if (cache->master_key_dirty && cache->master_key != NULL) {
+	    master_key = CFRetain(cache->master_key);
+	}
+	remove_others = !cache->others_removed;
+	cache->others_removed = TRUE;
+	cache->master_key_dirty = FALSE;
+	cache->dirty = FALSE;
+	cache->flushing = TRUE;
+    }
+    pthread_mutex_unlock(&S_state_cache_lock);
+    if (imsi == NULL) {
+	/* coalesced into an earlier flush, or purged */
+	return;
+    }
+    if (remove_others) {
+	/* remove any entry that does not match this IMSI */
+	IMSIListRemoveMatches(proto_info->type, IMSIDoesNotMatch, imsi);
+    }
+    else {
+	ProtoInfoChangedCheck(proto_info);
+    }
+    if (master_key != NULL) {
+	if (isA_CFDictionary(info) != NULL) {
+	    CFMutableDictionaryRef	no_reauth;
+
+	    no_reauth = CFDictionaryCreateMutableCopy(NULL, 0, info);
+	    CFDictionaryRemoveValue(no_reauth, kPrefsReauthID);
+	    CFDictionaryRemoveValue(no_reauth, kPrefsReauthCounter);
+	    ProtoInfoSetValue(proto_info, imsi, no_reauth);
+	    CFRelease(no_reauth);
+	}
+	MasterKeySaveToKeychain(proto_info->proto, imsi, master_key);
+	CFRelease(master_key);
+    }
+    ProtoInfoSetValue(proto_info, imsi, info);
+    ProtoInfoNotifyChange(proto_info);
+    pthread_mutex_lock(&S_state_cache_lock);
+    cache->flushing = FALSE;
+    /* don't let our own notification invalidate the cache */
+    (void)prefs_did_change(&proto_info->generation);
+    pthread_mutex_unlock(&S_state_cache_lock);
+    my_CFRelease(&info);
+    CFRelease(imsi);
+    return;
+}
+
+/*
+ * Function: StateCacheUpdate
+ * Purpose:
+ *   Replace the cached state for proto_info and schedule it to be written.
+ *   Updates that arrive before the write starts are coalesced into it.
+ *   If master_key is NULL, the keychain item is left alone.
+ */
+STATIC void
+StateCacheUpdate(ProtoInfoRef proto_info, CFStringRef imsi,
+		 uint32_t generation_id, CFPropertyListRef info,
+		 CFDataRef master_key)
+{
+    StateCacheRef	cache = &proto_info->cache;
+    Boolean		schedule = FALSE;
+
+    pthread_mutex_lock(&S_state_cache_lock);
+    if (!my_CFEqual(cache->imsi, imsi)) {
+	my_FieldSetRetainedCFType(&cache->imsi, imsi);
+	my_CFRelease(&cache->master_key);
+	cache->master_key_loaded = FALSE;
+	cache->others_removed = FALSE;
+    }
+    my_FieldSetRetainedCFType(&cache->info, info);
+    cache->generation_id = generation_id;
+    if (master_key != NULL
+	&& (!cache->master_key_loaded
+	    || !my_CFEqual(cache->master_key, master_key))) {
+	my_FieldSetRetainedCFType(&cache->master_key, master_key);
+	cache->master_key_loaded = TRUE;
+	cache->master_key_dirty = TRUE;
+    }
+    cache->dirty = TRUE;
+    if (!cache->flush_scheduled) {
+	cache->flush_scheduled = TRUE;
+	schedule = TRUE;
+    }
+    pthread_mutex_unlock(&S_state_cache_lock);
+    if (schedule) {
+	dispatch_async(StateCacheGetQueue(), ^{
+		StateCacheFlush(proto_info);
+	    });
+    }
+    return;
+}
+
+/*
+ * Function: StateCacheCopy
+ * Purpose:
+ *   Return the stored state for imsi, reading the preferences and the
+ *   keychain only if it isn't already cached.  The master key is only
+ *   retrieved if need_master_key is TRUE and there's a reauth ID to go
+ *   with it.
+ */
+STATIC void
+StateCacheCopy(ProtoInfoRef proto_info, CFStringRef imsi,
+	       uint32_t generation_id, Boolean need_master_key,
+	       CFPropertyListRef * ret_info, CFDataRef * ret_master_key)
+{
+    StateCacheRef	cache = &proto_info->cache;
+    Boolean		have_info = FALSE;
+    Boolean		have_master_key = FALSE;
+    CFPropertyListRef	info = NULL;
+    CFDataRef		master_key = NULL;
+
+    ProtoInfoChangedCheck(proto_info);
+    pthread_mutex_lock(&S_state_cache_lock);
+    if (my_CFEqual(cache->imsi, imsi)
+	&& cache->generation_id == generation_id) {
+	have_info = TRUE;
+	if (cache->info != NULL) {
+	    info = CFRetain(cache->info);
+	}
+	if (cache->master_key_loaded) {
+	    have_master_key = TRUE;
+	    if (cache->master_key != NULL) {
+		master_key = CFRetain(cache->master_key);
+	    }
+	}
+    }
+    pthread_mutex_unlock(&S_state_cache_lock);
+    if (!have_info) {
+	info = CFPreferencesCopyValue(imsi,
+				      proto_info->appID,
+				      kCFPreferencesCurrentUser,
+				      kCFPreferencesAnyHost);
+    }
+    if (need_master_key && !have_master_key
+	&& isA_CFDictionary(info) != NULL
+	&& CFDictionaryContainsKey(info, kPrefsReauthID)) {
+	master_key = MasterKeyCopyFromKeychain(proto_info->proto, imsi);
+	have_master_key = TRUE;
+    }
+    if (!have_info || have_master_key) {
+	pthread_mutex_lock(&S_state_cache_lock);
+	if (cache->imsi == NULL
+	    || (my_CFEqual(cache->imsi, imsi)
+		&& StateCacheIsClean(cache))) {
+	    my_FieldSetRetainedCFType(&cache->imsi, imsi);
+	    my_FieldSetRetainedCFType(&cache->info, info);
+	    cache->generation_id = generation_id;
+	    if (have_master_key) {
+		my_FieldSetRetainedCFType(&cache->master_key, master_key);
+		cache->master_key_loaded = TRUE;
+	    }
+	}
+	pthread_mutex_unlock(&S_state_cache_lock);
+    }
+    *ret_info = info;
+    *ret_master_key = master_key;
+    return;
+}
+
+/*
+ * Function: StateCacheRemove
+ * Purpose:
+ *   Empty the cache for proto_info if it matches, and discard any changes
+ *   that haven't been written yet.
+ */
+STATIC void
+StateCacheRemove(ProtoInfoRef proto_info, IMSIMatchFuncRef iter,
+		 const void * context)
+{
+    StateCacheRef	cache = &proto_info->cache;
+
+    pthread_mutex_lock(&S_state_cache_lock);
+    if (cache->imsi != NULL) {
+	CFDictionaryRef		info = isA_CFDictionary(cache->info);
+
+	if (info == NULL || (*iter)(cache->imsi, info, context)) {
+	    StateCacheClear(cache);
+	}
+    }
+    pthread_mutex_unlock(&S_state_cache_lock);
+    return;
+}
+
 struct EAPSIMAKAPersistentState {
     EAPType			type;
     EAPSIMAKAAttributeType 	identity_type;
@@ -361,6 +673,20 @@ EAPSIMAKAPersistentStateSetReauthID(EAPSIMAKAPersistentStateRef persist,
     return;
 }
 
+/*
+ * Function: EAPSIMAKAPersistentStateFastReauthAvailable
+ * Purpose:
+ *   Returns TRUE if fast re-authentication can be attempted i.e. there's a
+ *   reauth ID and it comes with a master key and counter.  A reauth ID is
+ *   only ever restored or set together with those, so its presence is
+ *   sufficient.
+ */
+PRIVATE_EXTERN Boolean
+EAPSIMAKAPersistentStateFastReauthAvailable(EAPSIMAKAPersistentStateRef persist)
+{
+    return (persist->reauth_id != NULL);
+}
+
 PRIVATE_EXTERN uint16_t
 EAPSIMAKAPersistentStateGetCounter(EAPSIMAKAPersistentStateRef persist)
 {
@@ -405,16 +731,15 @@ EAPSIMAKAPersistentStateCreate(EAPType type, int master_key_size,
     /* retrieve stored information if it's required */
     if (identity_type != kAT_PERMANENT_ID_REQ) {
 	CFPropertyListRef	info;
+	CFDataRef		master_key;
 	CFStringRef		pseudonym = NULL;
 	CFDateRef		pseudonym_start_time = NULL;
 	uint32_t		mobile_gen_id;
 	CFNumberRef		num_gen_id = NULL;
 
-	ProtoInfoChangedCheck(proto_info);
-	info = CFPreferencesCopyValue(imsi,
-				      proto_info->appID,
-				      kCFPreferencesCurrentUser,
-				      kCFPreferencesAnyHost);
+	StateCacheCopy(proto_info, imsi, persist->generation_id,
+		       (identity_type == kAT_ANY_ID_REQ),
+		       &info, &master_key);
 	if (isA_CFDictionary(info) != NULL) {
 	    CFDictionaryRef	dict = (CFDictionaryRef)info;
 
@@ -438,6 +763,7 @@ EAPSIMAKAPersistentStateCreate(EAPType type, int master_key_size,
 	    if (persist->generation_id != mobile_gen_id) {
 		/* wipe out the stored info */
 		my_CFRelease(&info);
+		my_CFRelease(&master_key);
 		EAPSIMAKAPersistentStatePurgePrefs();
 		goto done;
 	    }
@@ -456,7 +782,6 @@ EAPSIMAKAPersistentStateCreate(EAPType type, int master_key_size,
 	    }
 	    if (identity_type == kAT_ANY_ID_REQ) {
 		CFNumberRef		counter;
-		CFDataRef		master_key;
 		CFStringRef		reauth_id;
 
 		/* grab the reauth ID information */
@@ -465,8 +790,6 @@ EAPSIMAKAPersistentStateCreate(EAPType type, int master_key_size,
 							kPrefsReauthCounter));
 		reauth_id =
 		    isA_CFString(CFDictionaryGetValue(dict, kPrefsReauthID));
-		master_key 
-		    = MasterKeyCopyFromKeychain(proto_info->proto, imsi);
 		if (counter != NULL 
 		    && reauth_id != NULL
 		    && master_key != NULL 
@@ -481,7 +804,6 @@ EAPSIMAKAPersistentStateCreate(EAPType type, int master_key_size,
 		    EAPSIMAKAPersistentStateSetCounter(persist, val);
 		    EAPSIMAKAPersistentStateSetReauthID(persist, reauth_id);
 		}
-		my_CFRelease(&master_key);
 	    }
 	}
 	else if (isA_CFString(info) != NULL) {
@@ -491,6 +813,7 @@ EAPSIMAKAPersistentStateCreate(EAPType type, int master_key_size,
 	    EAPSIMAKAPersistentStateSetPseudonymAndTime(persist, pseudonym, pseudonym_start_time);
 	}
 	my_CFRelease(&info);
+	my_CFRelease(&master_key);
     }
  done:
     return (persist);
@@ -513,6 +836,7 @@ EAPSIMAKAPersistentStateSave(EAPSIMAKAPersistentStateRef persist,
 			     CFStringRef ssid)
 {
     CFMutableDictionaryRef	info = NULL;
+    CFDataRef			master_key = NULL;
     CFDateRef			pseudonym_start_time = NULL;
 
     if (persist->identity_type == kAT_PERMANENT_ID_REQ) {
@@ -520,9 +844,6 @@ EAPSIMAKAPersistentStateSave(EAPSIMAKAPersistentStateRef persist,
 	return;
     }
 
-    /* remove any entry that does not match this IMSI */
-    IMSIListRemoveMatches(persist->type, IMSIDoesNotMatch, persist->imsi);
-
     /* Pseudonym */
     if (EAPSIMAKAPersistentStateGetPseudonym(persist, &pseudonym_start_time) != NULL) {
 
@@ -541,7 +862,6 @@ EAPSIMAKAPersistentStateSave(EAPSIMAKAPersistentStateRef persist,
     if (EAPSIMAKAPersistentStateGetReauthID(persist) != NULL
 	&& master_key_valid) {
 	CFNumberRef	counter;
-	CFDataRef	master_key;
 	
 	if (info == NULL) {
 	    info = CFDictionaryCreateMutable(NULL, 0,
@@ -563,9 +883,6 @@ EAPSIMAKAPersistentStateSave(EAPSIMAKAPersistentStateRef persist,
 	    = CFDataCreate(NULL,
 			   EAPSIMAKAPersistentStateGetMasterKey(persist),
 			   EAPSIMAKAPersistentStateGetMasterKeySize(persist));
-	MasterKeySaveToKeychain(persist->proto_info->proto, persist->imsi,
-				master_key);
-	CFRelease(master_key);
     }
 
     /* SSID */
@@ -578,16 +895,10 @@ EAPSIMAKAPersistentStateSave(EAPSIMAKAPersistentStateRef persist,
 	CFDictionarySetValue(info, kPrefsGenID, generation_id);
 	CFRelease(generation_id);
     }
-    ProtoInfoChangedCheck(persist->proto_info);
-    CFPreferencesSetValue(persist->imsi, info,
-			  persist->proto_info->appID,
-			  kCFPreferencesCurrentUser,
-			  kCFPreferencesAnyHost);
-    my_CFRelease(&info);    
-    CFPreferencesSynchronize(persist->proto_info->appID,
-			     kCFPreferencesCurrentUser,
-			     kCFPreferencesAnyHost);
-    ProtoInfoNotifyChange(persist->proto_info);
+    StateCacheUpdate(persist->proto_info, persist->imsi,
+		     persist->generation_id, info, master_key);
+    my_CFRelease(&info);
+    my_CFRelease(&master_key);
     return;
 
 }
@@ -676,6 +987,9 @@ IMSIMatchesSSID(CFStringRef imsi, CFDictionaryRef info,
 PRIVATE_EXTERN void
 EAPSIMAKAPersistentStateForgetSSID(CFStringRef ssid)
 {
+    StateCacheRemove(&S_eapsim_info, IMSIMatchesSSID, ssid);
+    StateCacheRemove(&S_eapaka_info, IMSIMatchesSSID, ssid);
+    EAPSIMAKAPersistentStateSynchronize();
     IMSIListRemoveMatches(kEAPTypeEAPSIM, IMSIMatchesSSID, ssid);
     IMSIListRemoveMatches(kEAPTypeEAPAKA, IMSIMatchesSSID, ssid);
     return;
@@ -691,16 +1005,33 @@ IMSIMatchesEverything(CFStringRef imsi, CFDictionaryRef info,
 STATIC void
 EAPSIMAKAPersistentStatePurgePrefs(void)
 {
+    StateCacheRemove(&S_eapsim_info, IMSIMatchesEverything, NULL);
+    StateCacheRemove(&S_eapaka_info, IMSIMatchesEverything, NULL);
+    EAPSIMAKAPersistentStateSynchronize();
     IMSIListRemoveMatches(kEAPTypeEAPSIM, IMSIMatchesEverything, NULL);
     IMSIListRemoveMatches(kEAPTypeEAPAKA, IMSIMatchesEverything, NULL);
     return;
 }
 
+/*
+ * Function: EAPSIMAKAPersistentStateSynchronize
+ * Purpose:
+ *   Wait for the state saved by EAPSIMAKAPersistentStateSave() to be
+ *   written to the keychain and preferences.
+ */
+PRIVATE_EXTERN void
+EAPSIMAKAPersistentStateSynchronize(void)
+{
+    dispatch_sync(StateCacheGetQueue(), ^{});
+    return;
+}
+
 #ifdef TEST_EAPSIMAKA_PERSISTENT_STATE
 #define USE_SYSTEMCONFIGURATION_PRIVATE_HEADERS 1
 #include <SystemConfiguration/SCPrivate.h>
 #include <string.h>
 #include <sysexits.h>
+#include <mach/mach_time.h>
 #include <CommonCrypto/CommonDigest.h>
 #include "printdata.h"
 
@@ -708,7 +1039,8 @@ STATIC void
 usage(const char * progname)
 {
     printf("usage: %s \"sim\" | \"aka\" <command> <parameters>\n"
-	   "    <command> is one of \"get\", \"set\", or \"remove\"\n",
+	   "    <command> is one of \"get\", \"set\", \"remove\", "
+	   "or \"bench\"\n",
 	   progname);
     exit(EX_USAGE);
 }
@@ -849,6 +1181,74 @@ handle_set(const char * progname, EAPType type, int argc, char * argv[])
     }
     EAPSIMAKAPersistentStateSave(persist, (reauth_id != NULL), ssid);
     EAPSIMAKAPersistentStateRelease(persist);
+    EAPSIMAKAPersistentStateSynchronize();
+    return;
+}
+
+STATIC double
+nsecs_since(uint64_t start)
+{
+    mach_timebase_info_data_t	timebase;
+
+    mach_timebase_info(&timebase);
+    return ((double)(mach_absolute_time() - start)
+	    * timebase.numer / timebase.denom);
+}
+
+/*
+ * Function: handle_bench
+ * Purpose:
+ *   Time what an authentication sees: retrieve the state, bump the reauth
+ *   counter, and save it.  The time to write it all out is shown
+ *   separately.
+ */
+STATIC void
+handle_bench(const char * progname, EAPType type, int argc, char * argv[])
+{
+    int				count = 1000;
+    int				i;
+    CFStringRef			imsi;
+    uint64_t			start;
+    double			elapsed;
+
+    if (argc < 1) {
+	fprintf(stderr, "%s %s bench <IMSI> [ <count> ]\n",
+		progname, (type == kEAPTypeEAPSIM) ? "sim" : "aka");
+	exit(EX_USAGE);
+    }
+    imsi = CFStringCreateWithCString(NULL, argv[0], kCFStringEncodingUTF8);
+    if (argc > 1) {
+	count = (int)strtoul(argv[1], NULL, 0);
+	if (count <= 0) {
+	    count = 1;
+	}
+    }
+    start = mach_absolute_time();
+    for (i = 0; i < count; i++) {
+	EAPSIMAKAPersistentStateRef	persist;
+	CFStringRef			reauth_id;
+
+	persist = EAPSIMAKAPersistentStateCreate(type,
+						 CC_SHA1_DIGEST_LENGTH,
+						 imsi,
+						 kAT_ANY_ID_REQ);
+	reauth_id = CFStringCreateWithFormat(NULL, NULL,
+					     CFSTR("reauth-%d"), i);
+	EAPSIMAKAPersistentStateSetReauthID(persist, reauth_id);
+	CFRelease(reauth_id);
+	EAPSIMAKAPersistentStateSetCounter(persist, (uint16_t)i);
+	memset(EAPSIMAKAPersistentStateGetMasterKey(persist), i,
+	       EAPSIMAKAPersistentStateGetMasterKeySize(persist));
+	EAPSIMAKAPersistentStateSave(persist, TRUE, CFSTR("bench"));
+	EAPSIMAKAPersistentStateRelease(persist);
+    }
+    elapsed = nsecs_since(start);
+    printf("create + save: %d iterations, %.1f usecs each\n",
+	   count, elapsed / count / 1000);
+    start = mach_absolute_time();
+    EAPSIMAKAPersistentStateSynchronize();
+    printf("write behind: %.1f msecs\n", nsecs_since(start) / 1000000);
+    CFRelease(imsi);
     return;
 }
 
@@ -905,6 +1305,9 @@ main(int argc, char * argv[])
     else if (strcmp(command, "remove") == 0) {
 	handle_remove(progname, eap_type, argc, argv);
     }
+    else if (strcmp(command, "bench") == 0) {
+	handle_bench(progname, eap_type, argc, argv);
+    }
     else {
 	usage(progname);
     }
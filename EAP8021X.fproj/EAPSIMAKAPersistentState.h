@@ -64,6 +64,9 @@ void
 EAPSIMAKAPersistentStateSetReauthID(EAPSIMAKAPersistentStateRef persist,
 				    CFStringRef reauth_id);
 
+Boolean
+EAPSIMAKAPersistentStateFastReauthAvailable(EAPSIMAKAPersistentStateRef persist);
+
 uint16_t
 EAPSIMAKAPersistentStateGetCounter(EAPSIMAKAPersistentStateRef persist);
 
@@ -84,4 +87,7 @@ EAPSIMAKAPersistentStateRelease(EAPSIMAKAPersistentStateRef persist);
 void
 EAPSIMAKAPersistentStateForgetSSID(CFStringRef ssid);
 
+void
+EAPSIMAKAPersistentStateSynchronize(void);
+
 #endif /* __EAP8021X_EAPSIMAKAPERSISTENTSTATE_H__ */
@@ -276,6 +276,79 @@ EAPSIMAKAStatusForATNotificationCode(uint16_t notification_code)
     return (status);
 }
 
+STATIC void
+my_CCCryptorRelease(CCCryptorRef * cryptor_p)
+{
+    CCCryptorStatus 	status;
+
+    if (*cryptor_p != NULL) {
+	status = CCCryptorRelease(*cryptor_p);
+	if (status != kCCSuccess) {
+	    EAPLOG_FL(LOG_NOTICE, "CCCryptoRelease failed with %d", status);
+	}
+	*cryptor_p = NULL;
+    }
+    return;
+}
+
+PRIVATE_EXTERN void
+EAPSIMAKAKeyInfoRelease(EAPSIMAKAKeyInfoRef key_info_p)
+{
+    my_CCCryptorRelease(&key_info_p->k_encr_encrypt);
+    my_CCCryptorRelease(&key_info_p->k_encr_decrypt);
+    return;
+}
+
+/*
+ * Function: EAPSIMAKAKeyInfoGetCryptor
+ * Purpose:
+ *   Return the AES-CBC cryptor for 'op' keyed with k_encr, creating it
+ *   the first time, and reset it to start a new message with 'iv'.
+ */
+STATIC CCCryptorRef
+EAPSIMAKAKeyInfoGetCryptor(EAPSIMAKAKeyInfoRef key_info_p, CCOperation op,
+			   const uint8_t * iv)
+{
+    CCCryptorRef *	cryptor_p;
+    CCCryptorStatus 	status;
+
+    cryptor_p = (op == kCCEncrypt)
+	? &key_info_p->k_encr_encrypt : &key_info_p->k_encr_decrypt;
+    if (*cryptor_p == NULL) {
+	status = CCCryptorCreate(op,
+				 kCCAlgorithmAES128,
+				 0,
+				 key_info_p->s.k_encr,
+				 sizeof(key_info_p->s.k_encr),
+				 iv,
+				 cryptor_p);
+	if (status != kCCSuccess) {
+	    EAPLOG_FL(LOG_NOTICE, "CCCryptoCreate failed with %d", status);
+	    *cryptor_p = NULL;
+	}
+    }
+    else {
+	status = CCCryptorReset(*cryptor_p, iv);
+	if (status != kCCSuccess) {
+	    EAPLOG_FL(LOG_NOTICE, "CCCryptorReset failed with %d", status);
+	    my_CCCryptorRelease(cryptor_p);
+	}
+    }
+    return (*cryptor_p);
+}
+
+PRIVATE_EXTERN void
+EAPSIMAKAKeyInfoComputeKeys(EAPSIMAKAKeyInfoRef key_info_p,
+			    uint8_t mk[CC_SHA1_DIGEST_LENGTH])
+{
+    /* the cryptors are keyed with the old k_encr */
+    EAPSIMAKAKeyInfoRelease(key_info_p);
+    fips186_2prf(mk, key_info_p->key);
+    CCHmacInit(&key_info_p->k_aut_hmac, kCCHmacAlgSHA1, key_info_p->s.k_aut,
+	       sizeof(key_info_p->s.k_aut));
+    return;
+}
+
 /*
  * Function: EAPSIMAKAKeyInfoComputeMAC
  * Purpose:
@@ -307,9 +380,8 @@ EAPSIMAKAKeyInfoComputeMAC(EAPSIMAKAKeyInfoRef key_info_p,
     before_mac_size = (int)(mac_p - (const uint8_t *)pkt);
     after_mac_size = pkt_len - (before_mac_size + sizeof(zero_mac));
 
-    /* compute the hash */
-    CCHmacInit(&ctx, kCCHmacAlgSHA1, key_info_p->s.k_aut,
-	       sizeof(key_info_p->s.k_aut));
+    /* compute the hash, starting from the precomputed k_aut state */
+    ctx = key_info_p->k_aut_hmac;
     CCHmacUpdate(&ctx, pkt, before_mac_size);
     CCHmacUpdate(&ctx, zero_mac, sizeof(zero_mac));
     CCHmacUpdate(&ctx, mac_p + sizeof(zero_mac), after_mac_size);
@@ -317,6 +389,7 @@ EAPSIMAKAKeyInfoComputeMAC(EAPSIMAKAKeyInfoRef key_info_p,
 	CCHmacUpdate(&ctx, extra, extra_length);
     }
     CCHmacFinal(&ctx, hash);
+    cc_clear(sizeof(ctx), &ctx);
     return;
 }
 
@@ -348,37 +421,37 @@ EAPSIMAKAKeyInfoSetMAC(EAPSIMAKAKeyInfoRef key_info,
 #include <CommonCrypto/CommonDigest.h>
 #include <CommonCrypto/CommonCryptor.h>
 
-PRIVATE_EXTERN uint8_t *
+PRIVATE_EXTERN bool
 EAPSIMAKAKeyInfoDecryptTLVList(EAPSIMAKAKeyInfoRef key_info_p,
 			       AT_ENCR_DATA * encr_data_p, AT_IV * iv_p,
+			       uint8_t * buf, int buf_size,
 			       TLVListRef decrypted_tlvs_p)
 {
-    CCCryptorRef	cryptor = NULL;
     size_t		buf_used;
-    uint8_t *		decrypted_buffer = NULL;
+    CCCryptorRef	cryptor;
     int			encr_data_len;
     CCCryptorStatus 	status;
     bool		success = FALSE;
 
     encr_data_len = encr_data_p->ed_length * TLV_ALIGNMENT
 	- offsetof(AT_ENCR_DATA, ed_encrypted_data);
-    decrypted_buffer = (uint8_t *)malloc(encr_data_len);
-    status = CCCryptorCreate(kCCDecrypt,
-			     kCCAlgorithmAES128,
-			     0,
-			     key_info_p->s.k_encr,
-			     sizeof(key_info_p->s.k_encr),
-			     iv_p->iv_initialization_vector,
-			     &cryptor);
-    if (status != kCCSuccess) {
-	EAPLOG_FL(LOG_NOTICE, "CCCryptoCreate failed with %d", status);
+    if (encr_data_len <= 0
+	|| (encr_data_len % AT_ENCR_DATA_ALIGNMENT) != 0
+	|| encr_data_len > buf_size) {
+	EAPLOG_FL(LOG_NOTICE, "AT_ENCR_DATA length %d is invalid",
+		  encr_data_len);
+	goto done;
+    }
+    cryptor = EAPSIMAKAKeyInfoGetCryptor(key_info_p, kCCDecrypt,
+					 iv_p->iv_initialization_vector);
+    if (cryptor == NULL) {
 	goto done;
     }
     status = CCCryptorUpdate(cryptor,
 			     encr_data_p->ed_encrypted_data,
 			     encr_data_len,
-			     decrypted_buffer,
-			     encr_data_len,
+			     buf,
+			     buf_size,
 			     &buf_used);
     if (status != kCCSuccess) {
 	EAPLOG_FL(LOG_NOTICE, "CCCryptoUpdate failed with %d", status);
@@ -390,8 +463,7 @@ EAPSIMAKAKeyInfoDecryptTLVList(EAPSIMAKAKeyInfoRef key_info_p,
 		  (int)buf_used, encr_data_len);
 	goto done;
     }
-    if (TLVListParse(decrypted_tlvs_p, decrypted_buffer, encr_data_len)
-	== FALSE) {
+    if (TLVListParse(decrypted_tlvs_p, buf, encr_data_len) == FALSE) {
 	EAPLOG_FL(LOG_NOTICE,
 		  "TLVListParse failed on AT_ENCR_DATA, %s",
 		  TLVListErrorString(decrypted_tlvs_p));
@@ -400,17 +472,7 @@ EAPSIMAKAKeyInfoDecryptTLVList(EAPSIMAKAKeyInfoRef key_info_p,
     success = TRUE;
 
  done:
-    if (cryptor != NULL) {
-	status = CCCryptorRelease(cryptor);
-	if (status != kCCSuccess) {
-	    EAPLOG_FL(LOG_NOTICE, "CCCryptoRelease failed with %d", status);
-	}
-    }
-    if (success == FALSE && decrypted_buffer != NULL) {
-	free(decrypted_buffer);
-	decrypted_buffer = NULL;
-    }
-    return (decrypted_buffer);
+    return (success);
 }
 
 STATIC bool
@@ -422,15 +484,8 @@ EAPSIMAKAKeyInfoEncrypt(EAPSIMAKAKeyInfoRef key_info_p, const uint8_t * iv_p,
     bool		ret = FALSE;
     CCCryptorStatus 	status;
 
-    status = CCCryptorCreate(kCCEncrypt,
-			     kCCAlgorithmAES128,
-			     0,
-			     key_info_p->s.k_encr,
-			     sizeof(key_info_p->s.k_encr),
-			     iv_p,
-			     &cryptor);
-    if (status != kCCSuccess) {
-	EAPLOG_FL(LOG_NOTICE, "encrypt CCCryptoCreate failed with %d", status);
+    cryptor = EAPSIMAKAKeyInfoGetCryptor(key_info_p, kCCEncrypt, iv_p);
+    if (cryptor == NULL) {
 	goto done;
     }
     status = CCCryptorUpdate(cryptor, clear, size, encrypted, size, &buf_used);
@@ -447,10 +502,6 @@ EAPSIMAKAKeyInfoEncrypt(EAPSIMAKAKeyInfoRef key_info_p, const uint8_t * iv_p,
     ret = TRUE;
 
  done:
-    status = CCCryptorRelease(cryptor);
-    if (status != kCCSuccess) {
-	EAPLOG_FL(LOG_NOTICE, "CCCryptoRelease failed with %d", status);
-    }
     return (ret);
 }
 
@@ -606,6 +657,87 @@ EAPSIMAKAIdentityTypeGetAttributeType(CFStringRef string)
     return (type);
 }
 
+STATIC void
+dict_set_int(CFMutableDictionaryRef dict, CFStringRef key, int val)
+{
+    CFNumberRef		num;
+
+    num = CFNumberCreate(NULL, kCFNumberIntType, &val);
+    CFDictionarySetValue(dict, key, num);
+    CFRelease(num);
+    return;
+}
+
+/*
+ * The counts are kept for the life of the process rather than in the
+ * plugin context, which is freed on every disconnect.  EAP-SIM and
+ * EAP-AKA each have their own.
+ */
+typedef struct {
+    int			full_auth_count;
+    int			fast_reauth_count;
+    bool		last_was_fast_reauth;
+} EAPSIMAKAAuthenticationCounts;
+
+static EAPSIMAKAAuthenticationCounts	S_sim_counts;
+static EAPSIMAKAAuthenticationCounts	S_aka_counts;
+
+STATIC EAPSIMAKAAuthenticationCounts *
+authentication_counts_for_type(EAPType type)
+{
+    return ((type == kEAPTypeEAPSIM) ? &S_sim_counts : &S_aka_counts);
+}
+
+PRIVATE_EXTERN void
+EAPSIMAKAAuthenticationCountsUpdate(EAPType type, bool fast_reauth)
+{
+    EAPSIMAKAAuthenticationCounts *	counts;
+
+    counts = authentication_counts_for_type(type);
+    if (fast_reauth) {
+	counts->fast_reauth_count++;
+    }
+    else {
+	counts->full_auth_count++;
+    }
+    counts->last_was_fast_reauth = fast_reauth;
+    return;
+}
+
+PRIVATE_EXTERN void
+EAPSIMAKAAuthenticationCountsFailed(EAPType type)
+{
+    EAPSIMAKAAuthenticationCounts *	counts;
+
+    counts = authentication_counts_for_type(type);
+    counts->last_was_fast_reauth = FALSE;
+    return;
+}
+
+PRIVATE_EXTERN CFDictionaryRef
+EAPSIMAKACreatePublishedProperties(EAPType type)
+{
+    EAPSIMAKAAuthenticationCounts *	counts;
+    CFMutableDictionaryRef		dict;
+
+    counts = authentication_counts_for_type(type);
+    if (counts->full_auth_count == 0 && counts->fast_reauth_count == 0) {
+	return (NULL);
+    }
+    dict = CFDictionaryCreateMutable(NULL, 0,
+				     &kCFTypeDictionaryKeyCallBacks,
+				     &kCFTypeDictionaryValueCallBacks);
+    dict_set_int(dict, kEAPClientPropEAPSIMAKAFullAuthenticationCount,
+		 counts->full_auth_count);
+    dict_set_int(dict, kEAPClientPropEAPSIMAKAFastReauthenticationCount,
+		 counts->fast_reauth_count);
+    CFDictionarySetValue(dict, kEAPClientPropEAPSIMAKAWasFastReauthentication,
+			 counts->last_was_fast_reauth
+			 ? kCFBooleanTrue
+			 : kCFBooleanFalse);
+    return (dict);
+}
+
 PRIVATE_EXTERN EAPSIMAKAEncryptedIdentityInfoRef
 EAPSIMAKAInitEncryptedIdentityInfo(EAPType type, CFDictionaryRef properties, bool static_config)
 {
@@ -886,12 +1018,14 @@ TLVBufferAddPadding(TLVBufferRef tb_p, int padding_length)
 /**
  ** TLVList routines
  **/
-#define N_ATTRS_STATIC			10
+#define N_ATTRS_STATIC			16
+#define N_ATTR_TYPES			256
 struct TLVList {
     const void * *	attrs;		/* pointers to attributes */
     const void *	attrs_static[N_ATTRS_STATIC];
     int			count;
     int			size;
+    uint16_t		by_type[N_ATTR_TYPES]; /* first of type: index + 1 */
     char		err_str[160];
 };
 
@@ -921,6 +1055,7 @@ TLVListInit(TLVListRef tlvs_p)
 {
     tlvs_p->attrs = NULL;
     tlvs_p->count = tlvs_p->size = 0;
+    bzero(tlvs_p->by_type, sizeof(tlvs_p->by_type));
     return;
 }
 
@@ -958,10 +1093,55 @@ TLVListAddAttribute(TLVListRef tlvs_p, const uint8_t * attr)
 			 sizeof(*tlvs_p->attrs) * tlvs_p->size);
 	}
     }
+    if (tlvs_p->by_type[((TLVRef)attr)->tlv_type] == 0
+	&& tlvs_p->count < UINT16_MAX) {
+	tlvs_p->by_type[((TLVRef)attr)->tlv_type] = tlvs_p->count + 1;
+    }
     tlvs_p->attrs[tlvs_p->count++] = attr;
     return;
 }
 
+/*
+ * Function: TLVTypeMustBeUnique
+ * Purpose:
+ *   Returns whether an attribute of the given type may appear at most once
+ *   in a message (RFC 4186, RFC 4187).
+ */
+INLINE bool
+TLVTypeMustBeUnique(EAPSIMAKAAttributeType type)
+{
+    switch (type) {
+    case kAT_RAND:
+    case kAT_AUTN:
+    case kAT_RES:
+    case kAT_AUTS:
+    case kAT_PADDING:
+    case kAT_NONCE_MT:
+    case kAT_PERMANENT_ID_REQ:
+    case kAT_MAC:
+    case kAT_NOTIFICATION:
+    case kAT_ANY_ID_REQ:
+    case kAT_IDENTITY:
+    case kAT_VERSION_LIST:
+    case kAT_SELECTED_VERSION:
+    case kAT_FULLAUTH_ID_REQ:
+    case kAT_COUNTER:
+    case kAT_COUNTER_TOO_SMALL:
+    case kAT_NONCE_S:
+    case kAT_CLIENT_ERROR_CODE:
+    case kAT_IV:
+    case kAT_ENCR_DATA:
+    case kAT_NEXT_PSEUDONYM:
+    case kAT_NEXT_REAUTH_ID:
+    case kAT_CHECKCODE:
+    case kAT_RESULT_IND:
+	return (TRUE);
+    default:
+	break;
+    }
+    return (FALSE);
+}
+
 enum {
     kTLVGood = 0,
     kTLVBad = 1,
@@ -1203,6 +1383,15 @@ TLVListParse(TLVListRef tlvs_p, const uint8_t * attrs, int attrs_length)
 	}
 	tlv_validity = TLVCheckValidity(tlvs_p, this_tlv);
 	if (tlv_validity == kTLVGood) {
+	    if (tlvs_p->by_type[this_tlv->tlv_type] != 0
+		&& TLVTypeMustBeUnique(this_tlv->tlv_type)) {
+		snprintf(tlvs_p->err_str, sizeof(tlvs_p->err_str),
+			 "duplicate %s at offset %d",
+			 EAPSIMAKAAttributeTypeGetString(this_tlv->tlv_type),
+			 offset);
+		success = FALSE;
+		break;
+	    }
 	    TLVListAddAttribute(tlvs_p, scan);
 	}
 	else if (tlv_validity == kTLVBad
@@ -1377,17 +1566,13 @@ TLVListCopyDescription(TLVListRef tlvs_p)
 PRIVATE_EXTERN TLVRef
 TLVListLookupAttribute(TLVListRef tlvs_p, EAPSIMAKAAttributeType type)
 {
-    int			i;
-    const void * *	scan;
+    int		where;
 
-    for (i = 0, scan = tlvs_p->attrs; i < tlvs_p->count; i++, scan++) {
-	TLVRef	tlv_p = (TLVRef)(*scan);
-
-	if (tlv_p->tlv_type == type) {
-	    return (tlv_p);
-	}
+    where = tlvs_p->by_type[type];
+    if (where == 0) {
+	return (NULL);
     }
-    return (NULL);
+    return ((TLVRef)tlvs_p->attrs[where - 1]);
 }
 
 PRIVATE_EXTERN CFStringRef
@@ -1806,6 +1991,31 @@ const uint8_t	bad_at_encr_attr[] = {
     0x00, 0x00,
 };
 
+const uint8_t	duplicate_mac[] = {
+    0x01,
+    0x02,
+    0x00, 0x30,
+    0x12,
+    0x0b,
+    0x00, 0x00,
+    /* MAC */
+    0x0b,
+    0x05,
+    0x00, 0x00,
+    0xfe, 0xf3, 0x24, 0xac,
+    0x39, 0x62, 0xb5, 0x9f,
+    0x3b, 0xd7, 0x82, 0x53,
+    0xae, 0x4d, 0xcb, 0x6a,
+    /* MAC again */
+    0x0b,
+    0x05,
+    0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00
+};
+
 struct {
     const uint8_t *	packet;
     int			size;
@@ -1821,9 +2031,71 @@ struct {
     { bad_padding2, sizeof(bad_padding2), FALSE, "bad_padding2" },
     { bad_padding3, sizeof(bad_padding3), FALSE, "bad_padding3" },
     { bad_at_encr_attr, sizeof(bad_at_encr_attr), FALSE, "bad_at_encr_attr" },
+    { duplicate_mac, sizeof(duplicate_mac), FALSE, "duplicate_mac" },
     { NULL, 0 }
 };
 
+#include <CoreFoundation/CFDate.h>
+
+#define N_PARSE_ITERATIONS	1000000
+
+/*
+ * Parse each of the good packets above, then look up the attributes a
+ * challenge handler typically asks for.
+ */
+static void
+parse_benchmark(void)
+{
+    STATIC const EAPSIMAKAAttributeType types[] = {
+	kAT_MAC, kAT_RAND, kAT_IV, kAT_ENCR_DATA, kAT_COUNTER, kAT_RESULT_IND,
+	kAT_NONCE_S, kAT_NEXT_PSEUDONYM
+    };
+    int			bytes = 0;
+    int			found = 0;
+    int			good[sizeof(packets) / sizeof(packets[0])];
+    int			i;
+    int			j;
+    int			n_good = 0;
+    int			n_packets = 0;
+    CFAbsoluteTime	start;
+    CFAbsoluteTime	t;
+    TLVListDeclare(	tlvs_p);
+
+    for (i = 0; packets[i].packet != NULL; i++) {
+	if (packets[i].good) {
+	    good[n_good++] = i;
+	}
+    }
+    start = CFAbsoluteTimeGetCurrent();
+    for (i = 0; i < N_PARSE_ITERATIONS; i++) {
+	EAPSIMPacketRef	pkt;
+	int		which = good[i % n_good];
+
+	pkt = (EAPSIMPacketRef)packets[which].packet;
+	TLVListInit(tlvs_p);
+	if (TLVListParse(tlvs_p, pkt->attrs,
+			 packets[which].size
+			 - offsetof(EAPSIMPacket, attrs)) == FALSE) {
+	    fprintf(stderr, "%s: parse failed, %s\n",
+		    packets[which].name, TLVListErrorString(tlvs_p));
+	    exit(2);
+	}
+	for (j = 0; j < sizeof(types) / sizeof(types[0]); j++) {
+	    if (TLVListLookupAttribute(tlvs_p, types[j]) != NULL) {
+		found++;
+	    }
+	}
+	(void)TLVListLookupIdentityAttribute(tlvs_p);
+	TLVListFree(tlvs_p);
+	bytes += packets[which].size;
+	n_packets++;
+    }
+    t = CFAbsoluteTimeGetCurrent() - start;
+    printf("parse + lookup: %g nsecs/packet, %g MB/s (%d found)\n",
+	   t * 1e9 / n_packets, bytes / t / 1e6, found);
+    return;
+}
+
 int
 main(int argc, char * argv[])
 {
@@ -1844,6 +2116,7 @@ main(int argc, char * argv[])
 	       !good ? " " : " no ");
 	printf("\n");
     }
+    parse_benchmark();
     pkt = (EAPSIMPacketRef)buf;
     TLVBufferInit(tlv_buf_p, pkt->attrs,
 		  sizeof(buf) - offsetof(EAPSIMPacket, attrs));
@@ -1879,6 +2152,7 @@ main(int argc, char * argv[])
 #include <CommonCrypto/CommonCryptor.h>
 #include <CommonCrypto/CommonHMAC.h>
 #include <CoreFoundation/CFPropertyList.h>
+#include <CoreFoundation/CFDate.h>
 #include "fips186prf.h"
 
 typedef struct {
@@ -2254,6 +2528,230 @@ test_decrypt_data(void)
     return;
 }
 
+/*
+ * uncached_compute_mac, uncached_crypt
+ * - AT_MAC and AT_ENCR_DATA processing as it was before the k_aut state
+ *   and the k_encr cryptors were cached, for comparison
+ */
+static void
+uncached_compute_mac(EAPSIMAKAKeyInfoRef key_info_p, EAPPacketRef pkt,
+		     const uint8_t * mac_p,
+		     const uint8_t * extra, int extra_length,
+		     uint8_t hash[CC_SHA1_DIGEST_LENGTH])
+{
+    int			after_mac_size;
+    int			before_mac_size;
+    CCHmacContext	ctx;
+    uint8_t		zero_mac[MAC_SIZE];
+
+    bzero(&zero_mac, sizeof(zero_mac));
+    before_mac_size = (int)(mac_p - (const uint8_t *)pkt);
+    after_mac_size = EAPPacketGetLength(pkt)
+	- (before_mac_size + sizeof(zero_mac));
+    CCHmacInit(&ctx, kCCHmacAlgSHA1, key_info_p->s.k_aut,
+	       sizeof(key_info_p->s.k_aut));
+    CCHmacUpdate(&ctx, pkt, before_mac_size);
+    CCHmacUpdate(&ctx, zero_mac, sizeof(zero_mac));
+    CCHmacUpdate(&ctx, mac_p + sizeof(zero_mac), after_mac_size);
+    if (extra != NULL) {
+	CCHmacUpdate(&ctx, extra, extra_length);
+    }
+    CCHmacFinal(&ctx, hash);
+    return;
+}
+
+static uint8_t *
+uncached_crypt(EAPSIMAKAKeyInfoRef key_info_p, CCOperation op,
+	       const uint8_t * iv, const uint8_t * in, int in_length)
+{
+    size_t		buf_used;
+    CCCryptorRef	cryptor;
+    uint8_t *		out;
+
+    out = (uint8_t *)malloc(in_length);
+    CCCryptorCreate(op, kCCAlgorithmAES128, 0,
+		    key_info_p->s.k_encr, sizeof(key_info_p->s.k_encr),
+		    iv, &cryptor);
+    CCCryptorUpdate(cryptor, in, in_length, out, in_length, &buf_used);
+    CCCryptorRelease(cryptor);
+    return (out);
+}
+
+#define N_EXCHANGES	20000
+
+/*
+ * exchange_benchmark
+ * - time the AT_MAC and AT_ENCR_DATA work done over a full authentication
+ *   (derive keys, verify the Challenge, decrypt its AT_ENCR_DATA, MAC the
+ *   response) followed by a fast re-authentication (verify the request,
+ *   decrypt its AT_ENCR_DATA, derive the new MSK the way
+ *   eapsim_compute_reauth_key() and eapaka_compute_reauth_key() do,
+ *   encrypt and MAC the response), with and without the cached state
+ */
+static void
+exchange_benchmark(const uint8_t * mk, const uint8_t * mac_p)
+{
+    AT_COUNTER			counter;
+    uint8_t			decrypted[AT_ENCR_DATA_MAX_SIZE];
+    TLVListDeclare(		decrypted_tlvs_p);
+    uint8_t			encr_buf[offsetof(AT_ENCR_DATA, ed_encrypted_data)
+					 + sizeof(attrs_encrypted)];
+    AT_ENCR_DATA *		encr_data_p = (AT_ENCR_DATA *)encr_buf;
+    uint8_t			hash[CC_SHA1_DIGEST_LENGTH];
+    int				i;
+    AT_IV			iv;
+    EAPSIMAKAKeyInfo		key_info;
+    AT_NONCE_S			nonce_s;
+    uint8_t *			out;
+    EAPSIMAKAPersistentStateRef	persist;
+    uint8_t			reauth_clear[AT_ENCR_DATA_ALIGNMENT];
+    uint8_t			reauth_encrypted[AT_ENCR_DATA_ALIGNMENT];
+    uint8_t			response[sizeof(test_packet)];
+    uint8_t *			response_mac_p;
+    CFAbsoluteTime		start;
+    double			t_cached;
+    double			t_uncached;
+
+    persist = EAPSIMAKAPersistentStateCreate(kEAPTypeEAPSIM,
+					     CC_SHA1_DIGEST_LENGTH,
+					     CFSTR("1244070100000001"),
+					     kAT_PERMANENT_ID_REQ);
+    if (persist == NULL) {
+	fprintf(stderr, "EAPSIMAKAPersistentStateCreate failed\n");
+	exit(1);
+    }
+    bcopy(mk, EAPSIMAKAPersistentStateGetMasterKey(persist),
+	  CC_SHA1_DIGEST_LENGTH);
+    bzero(&counter, sizeof(counter));
+    counter.co_counter[1] = 1;
+    bzero(&nonce_s, sizeof(nonce_s));
+    bzero(reauth_clear, sizeof(reauth_clear));
+    bcopy(test_packet, response, sizeof(response));
+    response_mac_p = response + (mac_p - test_packet);
+    bzero(&iv, sizeof(iv));
+    iv.iv_type = kAT_IV;
+    iv.iv_length = sizeof(iv) / TLV_ALIGNMENT;
+    bcopy(test_iv, iv.iv_initialization_vector, sizeof(test_iv));
+    bzero(encr_buf, offsetof(AT_ENCR_DATA, ed_encrypted_data));
+    encr_data_p->ed_type = kAT_ENCR_DATA;
+    encr_data_p->ed_length = sizeof(encr_buf) / TLV_ALIGNMENT;
+    bcopy(attrs_encrypted, encr_data_p->ed_encrypted_data,
+	  sizeof(attrs_encrypted));
+
+    /* the cached and uncached paths must agree */
+    bzero(&key_info, sizeof(key_info));
+    EAPSIMAKAKeyInfoComputeKeys(&key_info,
+				EAPSIMAKAPersistentStateGetMasterKey(persist));
+    uncached_compute_mac(&key_info, (EAPPacketRef)test_packet, mac_p,
+			 test_nonce_mt, sizeof(test_nonce_mt), hash);
+    if (!EAPSIMAKAKeyInfoVerifyMAC(&key_info, (EAPPacketRef)test_packet,
+				   mac_p, test_nonce_mt, sizeof(test_nonce_mt))
+	|| cc_cmp_safe(MAC_SIZE, hash, mac_p) != 0) {
+	fprintf(stderr, "cached AT_MAC mismatch\n");
+	exit(1);
+    }
+    for (i = 0; i < 2; i++) {
+	/* the second pass exercises the reset cryptor */
+	TLVListInit(decrypted_tlvs_p);
+	if (!EAPSIMAKAKeyInfoDecryptTLVList(&key_info, encr_data_p, &iv,
+					    decrypted, sizeof(decrypted),
+					    decrypted_tlvs_p)
+	    || bcmp(decrypted, attrs_plaintext, sizeof(attrs_plaintext)) != 0
+	    || TLVListLookupAttribute(decrypted_tlvs_p,
+				      kAT_NEXT_REAUTH_ID) == NULL) {
+	    fprintf(stderr, "cached AT_ENCR_DATA decryption mismatch\n");
+	    exit(1);
+	}
+	TLVListFree(decrypted_tlvs_p);
+	if (!EAPSIMAKAKeyInfoEncrypt(&key_info, test_iv, attrs_plaintext,
+				     sizeof(attrs_plaintext), decrypted)
+	    || bcmp(decrypted, attrs_encrypted, sizeof(attrs_encrypted)) != 0) {
+	    fprintf(stderr, "cached AT_ENCR_DATA encryption mismatch\n");
+	    exit(1);
+	}
+    }
+
+    start = CFAbsoluteTimeGetCurrent();
+    for (i = 0; i < N_EXCHANGES; i++) {
+	/* full authentication */
+	EAPSIMAKAKeyInfoComputeKeys(&key_info,
+				    EAPSIMAKAPersistentStateGetMasterKey(persist));
+	EAPSIMAKAKeyInfoVerifyMAC(&key_info, (EAPPacketRef)test_packet, mac_p,
+				  test_nonce_mt, sizeof(test_nonce_mt));
+	TLVListInit(decrypted_tlvs_p);
+	EAPSIMAKAKeyInfoDecryptTLVList(&key_info, encr_data_p, &iv,
+				       decrypted, sizeof(decrypted),
+				       decrypted_tlvs_p);
+	TLVListFree(decrypted_tlvs_p);
+	EAPSIMAKAKeyInfoSetMAC(&key_info, (EAPPacketRef)response,
+			       response_mac_p,
+			       (const uint8_t *)test_kc, sizeof(test_kc));
+
+	/* fast re-authentication */
+	EAPSIMAKAKeyInfoVerifyMAC(&key_info, (EAPPacketRef)test_packet, mac_p,
+				  NULL, 0);
+	TLVListInit(decrypted_tlvs_p);
+	EAPSIMAKAKeyInfoDecryptTLVList(&key_info, encr_data_p, &iv,
+				       decrypted, sizeof(decrypted),
+				       decrypted_tlvs_p);
+	TLVListFree(decrypted_tlvs_p);
+	EAPSIMAKAKeyInfoComputeReauthKey(&key_info, persist,
+					 test_identity,
+					 sizeof(test_identity) - 1,
+					 &counter, &nonce_s);
+	EAPSIMAKAKeyInfoEncrypt(&key_info, test_iv, reauth_clear,
+				sizeof(reauth_clear), reauth_encrypted);
+	EAPSIMAKAKeyInfoSetMAC(&key_info, (EAPPacketRef)response,
+			       response_mac_p,
+			       nonce_s.nc_nonce_s, sizeof(nonce_s.nc_nonce_s));
+    }
+    t_cached = (CFAbsoluteTimeGetCurrent() - start) / N_EXCHANGES;
+
+    start = CFAbsoluteTimeGetCurrent();
+    for (i = 0; i < N_EXCHANGES; i++) {
+	/* full authentication */
+	fips186_2prf(EAPSIMAKAPersistentStateGetMasterKey(persist),
+		     key_info.key);
+	uncached_compute_mac(&key_info, (EAPPacketRef)test_packet, mac_p,
+			     test_nonce_mt, sizeof(test_nonce_mt), hash);
+	out = uncached_crypt(&key_info, kCCDecrypt, test_iv,
+			     attrs_encrypted, sizeof(attrs_encrypted));
+	TLVListInit(decrypted_tlvs_p);
+	TLVListParse(decrypted_tlvs_p, out, sizeof(attrs_encrypted));
+	TLVListFree(decrypted_tlvs_p);
+	free(out);
+	uncached_compute_mac(&key_info, (EAPPacketRef)response, response_mac_p,
+			     (const uint8_t *)test_kc, sizeof(test_kc), hash);
+
+	/* fast re-authentication */
+	uncached_compute_mac(&key_info, (EAPPacketRef)test_packet, mac_p,
+			     NULL, 0, hash);
+	out = uncached_crypt(&key_info, kCCDecrypt, test_iv,
+			     attrs_encrypted, sizeof(attrs_encrypted));
+	TLVListInit(decrypted_tlvs_p);
+	TLVListParse(decrypted_tlvs_p, out, sizeof(attrs_encrypted));
+	TLVListFree(decrypted_tlvs_p);
+	free(out);
+	EAPSIMAKAKeyInfoComputeReauthKey(&key_info, persist,
+					 test_identity,
+					 sizeof(test_identity) - 1,
+					 &counter, &nonce_s);
+	out = uncached_crypt(&key_info, kCCEncrypt, test_iv,
+			     reauth_clear, sizeof(reauth_clear));
+	free(out);
+	uncached_compute_mac(&key_info, (EAPPacketRef)response, response_mac_p,
+			     nonce_s.nc_nonce_s, sizeof(nonce_s.nc_nonce_s),
+			     hash);
+    }
+    t_uncached = (CFAbsoluteTimeGetCurrent() - start) / N_EXCHANGES;
+    printf("full + fast re-auth MAC and AT_ENCR_DATA work: "
+	   "cached %.0f ns, uncached %.0f ns\n",
+	   t_cached * 1e9, t_uncached * 1e9);
+    EAPSIMAKAKeyInfoRelease(&key_info);
+    EAPSIMAKAPersistentStateRelease(persist);
+    return;
+}
+
 int
 main(int argc, char * argv[])
 {
@@ -2292,7 +2790,8 @@ main(int argc, char * argv[])
     }
 
     /* now run PRF to generate keying material */
-    fips186_2prf(mk, key_info.key);
+    bzero(&key_info, sizeof(key_info));
+    EAPSIMAKAKeyInfoComputeKeys(&key_info, mk);
 
     /* make sure the key blocks are the same */
     if (bcmp(key_info.key, key_block, sizeof(key_info.key))) {
@@ -2338,6 +2837,7 @@ main(int argc, char * argv[])
     dump_triplets();
     test_encr_data();
     test_decrypt_data();
+    exchange_benchmark(mk, mac_p->ma_mac);
     exit(0);
     return (0);
 }
@@ -168,15 +168,37 @@ enum {
 };
 typedef uint32_t EAPSIMAKAStatus;
 
+/*
+ * Function: EAPSIMAKAKeyInfoComputeKeys
+ * Purpose:
+ *   Run the PRF over the master key to generate the keying material,
+ *   and precompute the HMAC-SHA1 state keyed with the new k_aut.
+ */
+void
+EAPSIMAKAKeyInfoComputeKeys(EAPSIMAKAKeyInfoRef key_info_p,
+			    uint8_t mk[CC_SHA1_DIGEST_LENGTH]);
+
+void
+EAPSIMAKAKeyInfoRelease(EAPSIMAKAKeyInfoRef key_info_p);
+
 void
 EAPSIMAKAKeyInfoComputeMAC(EAPSIMAKAKeyInfoRef key_info_p,
 			   EAPPacketRef pkt,
 			   const uint8_t * mac_p, 
 			   const uint8_t * extra, int extra_length,
 			   uint8_t hash[CC_SHA1_DIGEST_LENGTH]);
-uint8_t *
+/*
+ * Function: EAPSIMAKAKeyInfoDecryptTLVList
+ * Purpose:
+ *   Decrypt the AT_ENCR_DATA value into 'buf' and parse the result into
+ *   'decrypted_tlvs_p'.  The parsed attributes point into 'buf', so it
+ *   must remain valid as long as they are used; a buffer of
+ *   AT_ENCR_DATA_MAX_SIZE bytes is always large enough.
+ */
+bool
 EAPSIMAKAKeyInfoDecryptTLVList(EAPSIMAKAKeyInfoRef key_info_p,
 			       AT_ENCR_DATA * encr_data_p, AT_IV * iv_p,
+			       uint8_t * buf, int buf_size,
 			       TLVListRef decrypted_tlvs_p);
 
 bool
@@ -366,4 +388,60 @@ CFSTR("EAPSIMAKAConservativePeer")          /* boolean (false) */
 #define kEAPClientPropEAPSIMAKAPseudonymIdentityLifetimeHours \
 CFSTR("EAPSIMAKAPseudonymIdentityLifetimeHours") /* integer (24) */
 
+/*
+ * Property: kEAPClientPropEAPSIMAKAProactiveFastReauthentication
+ * Purpose:
+ *   When set to true, the EAP-SIM or EAP-AKA client prefers fast
+ *   re-authentication whenever the persistent state holds a reauth ID
+ *   together with its master key and counter:
+ *   - K_aut and K_encr are derived from the cached master key as soon as
+ *     the link comes up, rather than when the server's Reauthentication
+ *     request arrives
+ *   - the reauth ID is offered in response to AT_ANY_ID_REQ ahead of
+ *     any encrypted permanent identity
+ *   - if the server's Reauthentication request can't be verified, or the
+ *     exchange ends in EAP-Failure, the reauth ID is dropped so that the
+ *     next attempt falls back to full authentication
+ *
+ *   This property has no effect unless kEAPClientPropEAPSIMAKAIdentityType
+ *   allows reauth IDs.
+ *
+ *   On macOS, the client never answers AT_ANY_ID_REQ with a reauth ID,
+ *   so there the property only derives K_aut and K_encr early and does
+ *   not make fast re-authentication any more likely.
+ */
+#define kEAPClientPropEAPSIMAKAProactiveFastReauthentication \
+CFSTR("EAPSIMAKAProactiveFastReauthentication") /* boolean (false) */
+
+/*
+ * Function: EAPSIMAKAAuthenticationCountsUpdate
+ * Purpose:
+ *   Count a successful authentication of the given EAP type, either a
+ *   full authentication or a fast re-authentication.
+ */
+void
+EAPSIMAKAAuthenticationCountsUpdate(EAPType type, bool fast_reauth);
+
+/*
+ * Function: EAPSIMAKAAuthenticationCountsFailed
+ * Purpose:
+ *   Record that an authentication of the given EAP type ended in
+ *   EAP-Failure, so that it is no longer reported as a fast
+ *   re-authentication.
+ */
+void
+EAPSIMAKAAuthenticationCountsFailed(EAPType type);
+
+/*
+ * Function: EAPSIMAKACreatePublishedProperties
+ * Purpose:
+ *   Return the published properties describing how many authentications
+ *   of the given EAP type in this process completed with a full
+ *   authentication vs. a fast re-authentication, and whether the most
+ *   recent one was a fast re-authentication.  Returns NULL if no
+ *   authentication of that type has completed yet.
+ */
+CFDictionaryRef
+EAPSIMAKACreatePublishedProperties(EAPType type);
+
 #endif /* _EAP8021X_EAPSIMAKAUTIL_H */
@@ -58,6 +58,7 @@
 #include <Security/SecTrustPriv.h>
 #include <SystemConfiguration/SCValidation.h>
 #include <Security/SecPolicy.h>
+#include <CommonCrypto/CommonDigest.h>
 #include "EAPUtil.h"
 #include "EAPClientProperties.h"
 #include "EAPCertificateUtil.h"
@@ -421,13 +422,13 @@ EAPSSLContextCreate(SSLProtocol protocol_min, SSLProtocol protocol_max, bool is_
     return (NULL);
 }
 
-static void
+static bool
 get_preferred_tls_versions(CFDictionaryRef properties, SSLProtocol *min, SSLProtocol *max)
 {
     if (properties == NULL) {
 	*min = kTLSProtocol1;
 	*max = kTLSProtocol12;
-	return;
+	return (true);
     }
     CFStringRef tls_min_ver = CFDictionaryGetValue(properties, kEAPClientPropTLSMinimumVersion);
     CFStringRef tls_max_ver = CFDictionaryGetValue(properties, kEAPClientPropTLSMaximumVersion);
@@ -439,6 +440,11 @@ get_preferred_tls_versions(CFDictionaryRef properties, SSLProtocol *min, SSLProt
 	    *min = kTLSProtocol11;
 	} else if (CFEqual(tls_min_ver, kEAPTLSVersion1_2)) {
 	    *min = kTLSProtocol12;
+	} else if (CFEqual(tls_min_ver, kEAPTLSVersion1_3)) {
+	    /* can't be met, and silently using 1.2 would weaken the policy */
+	    EAPLOG_FL(LOG_ERR,
+		      "minimum TLS version 1.3 is not supported, refusing");
+	    return (false);
 	} else {
 	    *min = kTLSProtocol1;
 	    EAPLOG_FL(LOG_ERR, "invalid minimum TLS version");
@@ -454,6 +460,13 @@ get_preferred_tls_versions(CFDictionaryRef properties, SSLProtocol *min, SSLProt
 	    *max = kTLSProtocol11;
 	}  else if (CFEqual(tls_max_ver, kEAPTLSVersion1_2)) {
 	    *max = kTLSProtocol12;
+	} else if (CFEqual(tls_max_ver, kEAPTLSVersion1_3)) {
+	    /*
+	     * EAP-TLS 1.3 (RFC 9190) derives keys with the TLS 1.3
+	     * exporter, which SecureTransport doesn't provide.
+	     */
+	    *max = kTLSProtocol12;
+	    EAPLOG_FL(LOG_NOTICE, "TLS 1.3 not supported, using TLS 1.2");
 	} else {
 	    *max = kTLSProtocol12;
 	    EAPLOG_FL(LOG_ERR, "invalid maximum TLS version");
@@ -465,7 +478,7 @@ get_preferred_tls_versions(CFDictionaryRef properties, SSLProtocol *min, SSLProt
 	EAPLOG_FL(LOG_ERR, "minimum TLS version cannot be higher than maximum TLS version");
 	*min = *max;
     }
-    return;
+    return (true);
 }
 
 SSLContextRef
@@ -473,12 +486,24 @@ EAPTLSMemIOContextCreate(CFDictionaryRef properties, bool is_server, memoryIORef
 			 char * peername, OSStatus * ret_status)
 {
     SSLProtocol min_tls_ver, max_tls_ver;
-    get_preferred_tls_versions(properties, &min_tls_ver, &max_tls_ver);
+    if (get_preferred_tls_versions(properties, &min_tls_ver,
+				   &max_tls_ver) == false) {
+	*ret_status = errSSLIllegalParam;
+	return (NULL);
+    }
     return(EAPSSLContextCreate(min_tls_ver, max_tls_ver, is_server,
 			       EAPSSLMemoryIORead, EAPSSLMemoryIOWrite, 
 			       mem_io, peername, ret_status));
 }
 
+static void
+data_describe(CFMutableStringRef str, const void * bytes, int length,
+	      const void * info)
+{
+    print_data_cfstr(str, bytes, length);
+    return;
+}
+
 OSStatus 
 EAPSSLMemoryIORead(SSLConnectionRef connection, void * data_buf, 
 		   size_t * data_length)
@@ -515,13 +540,13 @@ EAPSSLMemoryIORead(SSLConnectionRef connection, void * data_buf,
     }
     *data_length = length;
     if (mem_io->debug) {
-	CFMutableStringRef	str;
+	CFTypeRef	log_descr;
 
-	str = CFStringCreateMutable(NULL, 0);
-	print_data_cfstr(str, data_buf, (int)length);
+	log_descr = EAPLogDeferredDescriptionCreate(data_describe, data_buf,
+						    (int)length, NULL);
 	EAPLOG_FL(-LOG_DEBUG, "Read %d bytes:\n%@", (int)length,
-		  str);
-	CFRelease(str);
+		  log_descr);
+	my_CFRelease(&log_descr);
     }
     return (noErr);
 }
@@ -555,14 +580,14 @@ EAPSSLMemoryIOWrite(SSLConnectionRef connection, const void * data_buf,
 	mem_buf->length += length;
     }
     if (mem_io->debug) {
-	CFMutableStringRef	str;
+	CFTypeRef	log_descr;
 
-	str = CFStringCreateMutable(NULL, 0);
-	print_data_cfstr(str, data_buf, (int)length);
+	log_descr = EAPLogDeferredDescriptionCreate(data_describe, data_buf,
+						    (int)length, NULL);
 	EAPLOG_FL(-LOG_DEBUG, "Wrote %s%d bytes:\n%@",
 		  additional ? "additional " : "",
-		  (int)length, str);
-	CFRelease(str);
+		  (int)length, log_descr);
+	my_CFRelease(&log_descr);
     }
     return (noErr);
 }
@@ -962,8 +987,202 @@ get_trusted_server_names(CFDictionaryRef properties)
     return (list);
 }
 
+/**
+ ** Server certificate chain verification cache
+ **/
+
+/*
+ * The result of a successful server certificate chain evaluation is
+ * remembered, keyed by the SHA-256 of the chain and the configuration
+ * that affects the evaluation (anchors, trusted server names, trust
+ * exceptions domain/ID and generation).  An entry expires after
+ * kVerifyCacheLifetimeSeconds, or when the first certificate in the chain
+ * expires, whichever is earlier.  Trust exception changes flush the cache.
+ *
+ * On macOS the result also depends on the keychain trust settings, which
+ * can change without a notification that we watch.  Entries there only
+ * live long enough to cover a burst of re-authentications e.g. while
+ * roaming.
+ */
+#define kVerifyCacheSize			8
+#if TARGET_OS_EMBEDDED
+#define kVerifyCacheLifetimeSeconds		(60 * 60)
+#else /* TARGET_OS_EMBEDDED */
+#define kVerifyCacheLifetimeSeconds		60
+#endif /* TARGET_OS_EMBEDDED */
+
+typedef struct {
+    uint8_t		key[CC_SHA256_DIGEST_LENGTH];
+    CFAbsoluteTime	expiration;
+} VerifyCacheEntry, * VerifyCacheEntryRef;
+
+static VerifyCacheEntry	S_verify_cache[kVerifyCacheSize];
+static int		S_verify_cache_next;
+static uint32_t		S_verify_cache_generation;
+
+#if TARGET_OS_EMBEDDED
+static void
+verify_cache_flush(void)
+{
+    bzero(S_verify_cache, sizeof(S_verify_cache));
+    S_verify_cache_next = 0;
+    S_verify_cache_generation++;
+    return;
+}
+#endif /* TARGET_OS_EMBEDDED */
+
+static void
+digest_add_bytes(CC_SHA256_CTX * ctx, const void * bytes, CC_LONG length)
+{
+    /* length prefix keeps adjacent values from running together */
+    CC_SHA256_Update(ctx, &length, sizeof(length));
+    CC_SHA256_Update(ctx, bytes, length);
+    return;
+}
+
+static void
+digest_add_data(CC_SHA256_CTX * ctx, CFDataRef data)
+{
+    if (isA_CFData(data) == NULL) {
+	digest_add_bytes(ctx, NULL, 0);
+	return;
+    }
+    digest_add_bytes(ctx, CFDataGetBytePtr(data),
+		     (CC_LONG)CFDataGetLength(data));
+    return;
+}
+
+static void
+digest_add_string(CC_SHA256_CTX * ctx, CFStringRef str)
+{
+    CFDataRef	data = NULL;
+
+    if (isA_CFString(str) != NULL) {
+	data = CFStringCreateExternalRepresentation(NULL, str,
+						    kCFStringEncodingUTF8, 0);
+    }
+    digest_add_data(ctx, data);
+    my_CFRelease(&data);
+    return;
+}
+
+static void
+digest_add_array(CC_SHA256_CTX * ctx, CFArrayRef list)
+{
+    CFIndex	count = 0;
+    int		i;
+
+    if (isA_CFArray(list) != NULL) {
+	count = CFArrayGetCount(list);
+    }
+    CC_SHA256_Update(ctx, &count, sizeof(count));
+    for (i = 0; i < count; i++) {
+	CFTypeRef	val = CFArrayGetValueAtIndex(list, i);
+
+	if (isA_CFData(val) != NULL) {
+	    digest_add_data(ctx, val);
+	}
+	else {
+	    digest_add_string(ctx, val);
+	}
+    }
+    return;
+}
+
+static bool
+verify_cache_compute_key(CFDictionaryRef properties, CFArrayRef server_certs,
+			 uint8_t key[CC_SHA256_DIGEST_LENGTH],
+			 CFAbsoluteTime * ret_not_after)
+{
+    CC_SHA256_CTX	ctx;
+    CFIndex		count;
+    int			i;
+    CFAbsoluteTime	not_after = 0;
+
+    if (properties == NULL || server_certs == NULL) {
+	return (FALSE);
+    }
+    count = CFArrayGetCount(server_certs);
+    if (count == 0) {
+	return (FALSE);
+    }
+    CC_SHA256_Init(&ctx);
+    CC_SHA256_Update(&ctx, &count, sizeof(count));
+    for (i = 0; i < count; i++) {
+	SecCertificateRef	cert;
+	CFDataRef		data;
+	CFAbsoluteTime		t;
+
+	cert = (SecCertificateRef)CFArrayGetValueAtIndex(server_certs, i);
+	data = SecCertificateCopyData(cert);
+	if (data == NULL) {
+	    return (FALSE);
+	}
+	digest_add_data(&ctx, data);
+	CFRelease(data);
+	t = SecCertificateNotValidAfter(cert);
+	if (i == 0 || t < not_after) {
+	    not_after = t;
+	}
+    }
+    digest_add_array(&ctx,
+		     CFDictionaryGetValue(properties,
+					  kEAPClientPropTLSTrustedCertificates));
+    digest_add_array(&ctx, get_trusted_server_names(properties));
+    digest_add_string(&ctx,
+		      CFDictionaryGetValue(properties,
+					   kEAPClientPropTLSTrustExceptionsDomain));
+    digest_add_string(&ctx,
+		      CFDictionaryGetValue(properties,
+					   kEAPClientPropTLSTrustExceptionsID));
+    digest_add_string(&ctx,
+		      CFDictionaryGetValue(properties,
+					   kEAPClientPropProfileID));
+    CC_SHA256_Update(&ctx, &S_verify_cache_generation,
+		     sizeof(S_verify_cache_generation));
+    CC_SHA256_Final(key, &ctx);
+    *ret_not_after = not_after;
+    return (TRUE);
+}
+
+static bool
+verify_cache_lookup(const uint8_t key[CC_SHA256_DIGEST_LENGTH])
+{
+    int			i;
+    CFAbsoluteTime	now = CFAbsoluteTimeGetCurrent();
+
+    for (i = 0; i < kVerifyCacheSize; i++) {
+	VerifyCacheEntryRef	entry = S_verify_cache + i;
+
+	if (entry->expiration > now
+	    && bcmp(entry->key, key, CC_SHA256_DIGEST_LENGTH) == 0) {
+	    return (TRUE);
+	}
+    }
+    return (FALSE);
+}
+
+static void
+verify_cache_add(const uint8_t key[CC_SHA256_DIGEST_LENGTH],
+		 CFAbsoluteTime not_after)
+{
+    VerifyCacheEntryRef	entry;
+    CFAbsoluteTime	expiration;
+
+    expiration = CFAbsoluteTimeGetCurrent() + kVerifyCacheLifetimeSeconds;
+    if (not_after < expiration) {
+	expiration = not_after;
+    }
+    entry = S_verify_cache + S_verify_cache_next;
+    bcopy(key, entry->key, CC_SHA256_DIGEST_LENGTH);
+    entry->expiration = expiration;
+    S_verify_cache_next = (S_verify_cache_next + 1) % kVerifyCacheSize;
+    return;
+}
+
 #if TARGET_OS_EMBEDDED
 #include <CoreFoundation/CFPreferences.h>
+#include <dispatch/dispatch.h>
 #include <notify.h>
 
 #define kEAPTLSTrustExceptionsID 		"com.apple.network.eapclient.tls.TrustExceptions"
@@ -972,6 +1191,44 @@ get_trusted_server_names(CFDictionaryRef properties)
 static int	token;
 static bool	token_valid;
 
+/*
+ * Trust exceptions store
+ *
+ * The trust exceptions preferences are read once per domain and kept in
+ * S_exceptions_store (domain -> identifier -> server hash -> exceptions),
+ * so that lookups during authentication don't touch the preferences.
+ * Changes are applied to the store and to the in-memory preferences
+ * immediately.  Writing new exceptions to disk and posting the change
+ * notification is coalesced onto S_exceptions_queue, and flushed at exit.
+ * Removals are written and posted right away, so that other processes
+ * stop trusting the server.  A change notification from another process
+ * causes the store to be re-read.
+ */
+#define kExceptionsFlushDelaySeconds	1
+
+static CFMutableDictionaryRef	S_exceptions_store;
+static dispatch_queue_t		S_exceptions_queue;
+static bool			S_exceptions_flush_scheduled;
+
+static void
+exceptions_store_flush(void)
+{
+    /* only called from S_exceptions_queue */
+    uint32_t	status;
+
+    S_exceptions_flush_scheduled = FALSE;
+    CFPreferencesSynchronize(kEAPTLSTrustExceptionsApplicationID,
+			     kCFPreferencesCurrentUser,
+			     kCFPreferencesAnyHost);
+    status = notify_post(kEAPTLSTrustExceptionsID);
+    if (status != NOTIFY_STATUS_OK) {
+	EAPLOG_FL(LOG_NOTICE,
+		  "notify_post returned %d",
+		  status);
+    }
+    return;
+}
+
 static void
 exceptions_change_check(void)
 {
@@ -996,24 +1253,121 @@ exceptions_change_check(void)
 	return;
     }
     if (check != 0) {
+	/* writes out pending changes, and picks up the new ones */
 	CFPreferencesSynchronize(kEAPTLSTrustExceptionsApplicationID,
 				 kCFPreferencesCurrentUser,
 				 kCFPreferencesAnyHost);
+	my_CFRelease(&S_exceptions_store);
+	verify_cache_flush();
     }
     return;
 }
 
+/*
+ * Function: exceptions_store_synchronize
+ * Purpose:
+ *   Write out any pending changes now instead of waiting for the
+ *   coalesced flush e.g. before the process exits.
+ */
 static void
-exceptions_change_notify(void)
+exceptions_store_synchronize(void)
 {
-    uint32_t	status;
+    if (S_exceptions_queue == NULL) {
+	return;
+    }
+    dispatch_sync(S_exceptions_queue, ^{
+	    if (S_exceptions_flush_scheduled) {
+		exceptions_store_flush();
+	    }
+	});
+    return;
+}
 
-    status = notify_post(kEAPTLSTrustExceptionsID);
-    if (status != NOTIFY_STATUS_OK) {
-	EAPLOG_FL(LOG_NOTICE,
-		  "notify_post returned %d",
-		  status);
+static void
+exceptions_change_notify(bool immediate)
+{
+    verify_cache_flush();
+    if (S_exceptions_queue == NULL) {
+	S_exceptions_queue
+	    = dispatch_queue_create("com.apple.eapclient.TrustExceptions",
+				    NULL);
+	atexit(exceptions_store_synchronize);
+    }
+    if (immediate) {
+	dispatch_sync(S_exceptions_queue, ^{
+		exceptions_store_flush();
+	    });
+	return;
     }
+    dispatch_async(S_exceptions_queue, ^{
+	    dispatch_time_t	t;
+
+	    if (S_exceptions_flush_scheduled) {
+		return;
+	    }
+	    S_exceptions_flush_scheduled = TRUE;
+	    t = dispatch_time(DISPATCH_TIME_NOW,
+			      kExceptionsFlushDelaySeconds * NSEC_PER_SEC);
+	    dispatch_after(t, S_exceptions_queue, ^{
+		    if (S_exceptions_flush_scheduled) {
+			exceptions_store_flush();
+		    }
+		});
+	});
+    return;
+}
+
+/*
+ * Function: exceptions_store_get_domain_list
+ * Purpose:
+ *   Return the exceptions for the given domain, reading them from
+ *   the preferences the first time.
+ * Returns:
+ *   NULL if there aren't any, non-NULL CFDictionaryRef otherwise;
+ *   the returned value must not be released.
+ */
+static CFDictionaryRef
+exceptions_store_get_domain_list(CFStringRef domain)
+{
+    CFTypeRef		domain_list;
+
+    exceptions_change_check();
+    if (S_exceptions_store == NULL) {
+	S_exceptions_store
+	    = CFDictionaryCreateMutable(NULL, 0,
+					&kCFTypeDictionaryKeyCallBacks,
+					&kCFTypeDictionaryValueCallBacks);
+    }
+    domain_list = CFDictionaryGetValue(S_exceptions_store, domain);
+    if (domain_list == NULL) {
+	domain_list = CFPreferencesCopyValue(domain,
+					     kEAPTLSTrustExceptionsApplicationID,
+					     kCFPreferencesCurrentUser,
+					     kCFPreferencesAnyHost);
+	if (domain_list != NULL && isA_CFDictionary(domain_list) == NULL) {
+	    CFRelease(domain_list);
+	    domain_list = NULL;
+	}
+	/* remember that the domain has no exceptions using kCFNull */
+	CFDictionarySetValue(S_exceptions_store, domain,
+			     (domain_list != NULL) ? domain_list : kCFNull);
+	my_CFRelease(&domain_list);
+	domain_list = CFDictionaryGetValue(S_exceptions_store, domain);
+    }
+    return (isA_CFDictionary(domain_list));
+}
+
+static void
+exceptions_store_set_domain_list(CFStringRef domain,
+				 CFDictionaryRef domain_list,
+				 bool immediate)
+{
+    CFDictionarySetValue(S_exceptions_store, domain, domain_list);
+    CFPreferencesSetValue(domain, domain_list,
+			  kEAPTLSTrustExceptionsApplicationID,
+			  kCFPreferencesCurrentUser,
+			  kCFPreferencesAnyHost);
+    exceptions_change_notify(immediate);
     return;
 }
 
@@ -1021,19 +1375,12 @@ static void
 EAPTLSTrustExceptionsSave(CFStringRef domain, CFStringRef identifier,
 			  CFStringRef hash_str, CFDataRef exceptions)
 {
-    CFDictionaryRef	domain_list;
-    CFDictionaryRef	exceptions_list = NULL;
-    bool		store_exceptions = TRUE;
+    CFDictionaryRef		domain_list;
+    CFDictionaryRef		exceptions_list = NULL;
+    CFMutableDictionaryRef	new_domain_list;
+    CFMutableDictionaryRef	new_exceptions_list;
 
-    exceptions_change_check();
-    domain_list = CFPreferencesCopyValue(domain,
-					 kEAPTLSTrustExceptionsApplicationID,
-					 kCFPreferencesCurrentUser,
-					 kCFPreferencesAnyHost);
-    if (domain_list != NULL && isA_CFDictionary(domain_list) == NULL) {
-	CFRelease(domain_list);
-	domain_list = NULL;
-    }
+    domain_list = exceptions_store_get_domain_list(domain);
     if (domain_list != NULL) {
 	exceptions_list = CFDictionaryGetValue(domain_list, identifier);
 	exceptions_list = isA_CFDictionary(exceptions_list);
@@ -1044,64 +1391,39 @@ EAPTLSTrustExceptionsSave(CFStringRef domain, CFStringRef identifier,
 	    if (isA_CFData(stored_exceptions) != NULL 
 		&& CFEqual(stored_exceptions, exceptions)) {
 		/* stored exceptions are correct, don't store them again */
-		store_exceptions = FALSE;
+		return;
 	    }
 	}
     }
-    if (store_exceptions) {
-	if (exceptions_list == NULL) {
-	    /* no exceptions for this identifier yet, create one */
-	    exceptions_list
-		= CFDictionaryCreate(NULL,
-				     (const void * * )&hash_str,
-				     (const void * *)&exceptions,
-				     1,
-				     &kCFTypeDictionaryKeyCallBacks,
-				     &kCFTypeDictionaryValueCallBacks);
-	}
-	else {
-	    /* update existing exceptions with this one */
-	    CFMutableDictionaryRef	new_exceptions_list;
-
-	    new_exceptions_list
-		= CFDictionaryCreateMutableCopy(NULL, 0,
-						exceptions_list);
-	    CFDictionarySetValue(new_exceptions_list, hash_str, exceptions);
-	    /* don't CFRelease(exceptions_list), it's from domain_list */
-	    exceptions_list = (CFDictionaryRef)new_exceptions_list;
-
-	}
-	if (domain_list == NULL) {
-	    domain_list
-		= CFDictionaryCreate(NULL, 
-				     (const void * *)&identifier,
-				     (const void * *)&exceptions_list,
-				     1,
-				     &kCFTypeDictionaryKeyCallBacks,
-				     &kCFTypeDictionaryValueCallBacks);
-	}
-	else {
-	    CFMutableDictionaryRef	new_domain_list;
 
-	    new_domain_list
-		= CFDictionaryCreateMutableCopy(NULL, 0,
-						domain_list);
-	    CFDictionarySetValue(new_domain_list, identifier, exceptions_list);
-	    CFRelease(domain_list);
-	    domain_list = (CFDictionaryRef)new_domain_list;
+    /* update (or create) the exceptions for this identifier */
+    if (exceptions_list == NULL) {
+	new_exceptions_list
+	    = CFDictionaryCreateMutable(NULL, 0,
+					&kCFTypeDictionaryKeyCallBacks,
+					&kCFTypeDictionaryValueCallBacks);
+    }
+    else {
+	new_exceptions_list
+	    = CFDictionaryCreateMutableCopy(NULL, 0, exceptions_list);
+    }
+    CFDictionarySetValue(new_exceptions_list, hash_str, exceptions);
 
-	}
-	CFRelease(exceptions_list);
-	CFPreferencesSetValue(domain, domain_list,
-			      kEAPTLSTrustExceptionsApplicationID,
-			      kCFPreferencesCurrentUser,
-			      kCFPreferencesAnyHost);
-	CFPreferencesSynchronize(kEAPTLSTrustExceptionsApplicationID,
-				 kCFPreferencesCurrentUser,
-				 kCFPreferencesAnyHost);
-	exceptions_change_notify();
+    /* update (or create) the domain list */
+    if (domain_list == NULL) {
+	new_domain_list
+	    = CFDictionaryCreateMutable(NULL, 0,
+					&kCFTypeDictionaryKeyCallBacks,
+					&kCFTypeDictionaryValueCallBacks);
     }
-    my_CFRelease(&domain_list);
+    else {
+	new_domain_list
+	    = CFDictionaryCreateMutableCopy(NULL, 0, domain_list);
+    }
+    CFDictionarySetValue(new_domain_list, identifier, new_exceptions_list);
+    CFRelease(new_exceptions_list);
+    exceptions_store_set_domain_list(domain, new_domain_list, FALSE);
+    CFRelease(new_domain_list);
     return;
 }
 
@@ -1147,7 +1469,6 @@ void
 EAPTLSRemoveTrustExceptionsBindings(CFStringRef domain, CFStringRef identifier)
 {
     CFDictionaryRef	domain_list;
-    CFDictionaryRef	exceptions_list;
 
     /*
      * Remove the saved EAP-SIM/EAP-AKA information as well.
@@ -1157,37 +1478,20 @@ EAPTLSRemoveTrustExceptionsBindings(CFStringRef domain, CFStringRef identifier)
 	EAPSIMAKAPersistentStateForgetSSID(identifier);
     }
 
-    exceptions_change_check();
-    domain_list = CFPreferencesCopyValue(domain,
-					 kEAPTLSTrustExceptionsApplicationID,
-					 kCFPreferencesCurrentUser,
-					 kCFPreferencesAnyHost);
-    if (domain_list != NULL && isA_CFDictionary(domain_list) == NULL) {
-	CFRelease(domain_list);
-	domain_list = NULL;
-    }
+    domain_list = exceptions_store_get_domain_list(domain);
     if (domain_list == NULL) {
 	return;
     }
-    exceptions_list = CFDictionaryGetValue(domain_list, identifier);
-    if (exceptions_list != NULL) {
+    if (CFDictionaryContainsKey(domain_list, identifier)) {
 	CFMutableDictionaryRef	new_domain_list;
 	
 	new_domain_list
 	    = CFDictionaryCreateMutableCopy(NULL, 0,
 					    domain_list);
 	CFDictionaryRemoveValue(new_domain_list, identifier);
-	CFPreferencesSetValue(domain, new_domain_list,
-			      kEAPTLSTrustExceptionsApplicationID,
-			      kCFPreferencesCurrentUser,
-			      kCFPreferencesAnyHost);
-	CFPreferencesSynchronize(kEAPTLSTrustExceptionsApplicationID,
-				 kCFPreferencesCurrentUser,
-				 kCFPreferencesAnyHost);
-	exceptions_change_notify();
+	exceptions_store_set_domain_list(domain, new_domain_list, TRUE);
 	CFRelease(new_domain_list);
     }
-    CFRelease(domain_list);
     return;
 }
 
@@ -1198,12 +1502,8 @@ EAPTLSTrustExceptionsCopy(CFStringRef domain, CFStringRef identifier,
     CFDataRef		exceptions = NULL;
     CFDictionaryRef	domain_list;
 
-    exceptions_change_check();
-    domain_list = CFPreferencesCopyValue(domain,
-					 kEAPTLSTrustExceptionsApplicationID,
-					 kCFPreferencesCurrentUser,
-					 kCFPreferencesAnyHost);
-    if (isA_CFDictionary(domain_list) != NULL) {
+    domain_list = exceptions_store_get_domain_list(domain);
+    if (domain_list != NULL) {
 	CFDictionaryRef		exceptions_list;
 
 	exceptions_list = CFDictionaryGetValue(domain_list, identifier);
@@ -1215,7 +1515,6 @@ EAPTLSTrustExceptionsCopy(CFStringRef domain, CFStringRef identifier,
 	    }
 	}
     }
-    my_CFRelease(&domain_list);
     return (exceptions);
 }
 
@@ -1384,14 +1683,25 @@ EAPTLSVerifyServerCertificateChain(CFDictionaryRef properties,
 				   CFArrayRef server_certs,
 				   OSStatus * ret_status)
 {
+    bool		cache_key_valid;
+    uint8_t		cache_key[CC_SHA256_DIGEST_LENGTH];
     bool		exceptions_applied = FALSE;
     bool		has_server_certs_or_names = FALSE;
     EAPClientStatus	client_status;
+    CFAbsoluteTime	not_after;
     OSStatus		status;
     CFStringRef		server_hash_str = NULL;
     SecTrustRef		trust = NULL;
     SecTrustResultType 	trust_result;
 
+    exceptions_change_check();
+    cache_key_valid = verify_cache_compute_key(properties, server_certs,
+					       cache_key, &not_after);
+    if (cache_key_valid && verify_cache_lookup(cache_key)) {
+	status = noErr;
+	client_status = kEAPClientStatusOK;
+	goto done;
+    }
     trust = _EAPTLSCreateSecTrust(properties, 
 				  server_certs,
 				  &status,
@@ -1435,6 +1745,9 @@ EAPTLSVerifyServerCertificateChain(CFDictionaryRef properties,
 	status = errSSLXCertChainInvalid;
 	break;
     }
+    if (client_status == kEAPClientStatusOK && cache_key_valid) {
+	verify_cache_add(cache_key, not_after);
+    }
 
     /* if the trust is recoverable, check whether the user already said OK */
     if (client_status == kEAPClientStatusUserInputRequired) {
@@ -1483,9 +1796,12 @@ EAPTLSVerifyServerCertificateChain(CFDictionaryRef properties,
 				   OSStatus * ret_status)
 {
     bool		allow_trust_decisions;
+    uint8_t		cache_key[CC_SHA256_DIGEST_LENGTH];
+    bool		cache_key_valid = FALSE;
     EAPClientStatus	client_status;
     int			count;
     bool		is_recoverable;
+    CFAbsoluteTime	not_after;
     SecPolicyRef	policy = NULL;
     CFStringRef		profileID;
     OSStatus		status = noErr;
@@ -1523,6 +1839,12 @@ EAPTLSVerifyServerCertificateChain(CFDictionaryRef properties,
     if (count == 0) {
 	goto done;
     }
+    cache_key_valid = verify_cache_compute_key(properties, server_certs,
+					       cache_key, &not_after);
+    if (cache_key_valid && verify_cache_lookup(cache_key)) {
+	client_status = kEAPClientStatusOK;
+	goto done;
+    }
     profileID = CFDictionaryGetValue(properties, kEAPClientPropProfileID);
     trusted_certs = copy_cert_list(properties,
 				   kEAPClientPropTLSTrustedCertificates);
@@ -1611,6 +1933,9 @@ EAPTLSVerifyServerCertificateChain(CFDictionaryRef properties,
 	    client_status = kEAPClientStatusUserInputRequired;
 	}
     }
+    else if (client_status == kEAPClientStatusOK && cache_key_valid) {
+	verify_cache_add(cache_key, not_after);
+    }
 
  done:
     if (ret_status != NULL) {
@@ -1624,10 +1949,10 @@ EAPTLSVerifyServerCertificateChain(CFDictionaryRef properties,
 
 #endif /* TARGET_OS_EMBEDDED */
 
-OSStatus
-EAPTLSCopyIdentityTrustChain(SecIdentityRef sec_identity,
-			     CFDictionaryRef properties,
-			     CFArrayRef * ret_array)
+static OSStatus
+identity_trust_chain_create(SecIdentityRef sec_identity,
+			    CFDictionaryRef properties,
+			    CFArrayRef * ret_array)
 {
     if (sec_identity != NULL) {
 #if TARGET_OS_EMBEDDED
@@ -1663,6 +1988,109 @@ EAPTLSCopyIdentityTrustChain(SecIdentityRef sec_identity,
 }
 
 
+/*
+ * Identity trust chain cache
+ *
+ * Resolving the identity and building its trust chain requires going to
+ * the keychain, which is too slow to do while the authenticator waits
+ * for our response.  EAPTLSIdentityTrustChainPrewarm() builds the chain
+ * ahead of time and remembers it along with the identity and identity
+ * handle it was built from; EAPTLSCopyIdentityTrustChain() returns the
+ * remembered chain when called with the same identity and handle.
+ */
+typedef struct {
+    SecIdentityRef	identity;
+    CFTypeRef		id_handle;
+    CFArrayRef		chain;
+    CFAbsoluteTime	copy_duration;
+} IdentityChainCache;
+
+static IdentityChainCache	S_identity_chain;
+
+static CFTypeRef
+identity_chain_get_handle(CFDictionaryRef properties)
+{
+    if (properties == NULL) {
+	return (NULL);
+    }
+    return (CFDictionaryGetValue(properties, kEAPClientPropTLSIdentityHandle));
+}
+
+static OSStatus
+identity_chain_build(SecIdentityRef sec_identity, CFDictionaryRef properties,
+		     CFArrayRef * ret_array)
+{
+    CFArrayRef		chain = NULL;
+    OSStatus		status;
+
+    status = identity_trust_chain_create(sec_identity, properties, &chain);
+    if (status != noErr) {
+	*ret_array = NULL;
+	return (status);
+    }
+    EAPTLSIdentityTrustChainFlush();
+    if (sec_identity != NULL) {
+	S_identity_chain.identity = (SecIdentityRef)CFRetain(sec_identity);
+    }
+    S_identity_chain.id_handle = identity_chain_get_handle(properties);
+    if (S_identity_chain.id_handle != NULL) {
+	CFRetain(S_identity_chain.id_handle);
+    }
+    S_identity_chain.chain = CFRetain(chain);
+    *ret_array = chain;
+    return (noErr);
+}
+
+OSStatus
+EAPTLSIdentityTrustChainPrewarm(SecIdentityRef sec_identity,
+				CFDictionaryRef properties)
+{
+    CFArrayRef		chain = NULL;
+    OSStatus		status;
+
+    status = identity_chain_build(sec_identity, properties, &chain);
+    my_CFRelease(&chain);
+    return (status);
+}
+
+void
+EAPTLSIdentityTrustChainFlush(void)
+{
+    my_CFRelease(&S_identity_chain.identity);
+    my_CFRelease(&S_identity_chain.id_handle);
+    my_CFRelease(&S_identity_chain.chain);
+    return;
+}
+
+CFAbsoluteTime
+EAPTLSIdentityTrustChainGetCopyTime(void)
+{
+    return (S_identity_chain.copy_duration);
+}
+
+OSStatus
+EAPTLSCopyIdentityTrustChain(SecIdentityRef sec_identity,
+			     CFDictionaryRef properties,
+			     CFArrayRef * ret_array)
+{
+    CFAbsoluteTime	start;
+    OSStatus		status;
+
+    start = CFAbsoluteTimeGetCurrent();
+    if (S_identity_chain.chain != NULL
+	&& my_CFEqual(S_identity_chain.identity, sec_identity)
+	&& my_CFEqual(S_identity_chain.id_handle,
+		      identity_chain_get_handle(properties))) {
+	*ret_array = CFRetain(S_identity_chain.chain);
+	status = noErr;
+    }
+    else {
+	status = identity_chain_build(sec_identity, properties, ret_array);
+    }
+    S_identity_chain.copy_duration = CFAbsoluteTimeGetCurrent() - start;
+    return (status);
+}
+
 #if defined(TEST_TRUST_EXCEPTIONS) || defined(TEST_EAPTLSVerifyServerCertificateChain) \
     || defined(TEST_VerifyServerName)
 
@@ -1815,6 +2243,7 @@ removeAllTrustExceptions(char * domain, char * identifier)
 					  kCFStringEncodingUTF8,
 					  kCFAllocatorNull);
     EAPTLSRemoveTrustExceptionsBindings(domain_cf, identifier_cf);
+    exceptions_store_synchronize();
     CFRelease(domain_cf);
     CFRelease(identifier_cf);
     return;
@@ -2078,6 +2507,7 @@ int
 main(int argc, char * argv[])
 {
     CFArrayRef		array;
+    int			i;
     CFDictionaryRef	properties;
     OSStatus		sec_status;
     SecCertificateRef	server_cert;
@@ -2100,11 +2530,18 @@ main(int argc, char * argv[])
     array = CFArrayCreate(NULL, (const void **)&server_cert, 1,
 			  &kCFTypeArrayCallBacks);
     
-    status = EAPTLSVerifyServerCertificateChain(properties, 
-						array,
-						&sec_status);
-    printf("status is %d, sec status is %d\n", 
-	   status, sec_status);
+    for (i = 0; i < 2; i++) {
+	CFAbsoluteTime	start;
+
+	/* the second pass should be satisfied from the cache */
+	start = CFAbsoluteTimeGetCurrent();
+	status = EAPTLSVerifyServerCertificateChain(properties, 
+						    array,
+						    &sec_status);
+	printf("status is %d, sec status is %d (%g usecs)\n", 
+	       status, sec_status,
+	       (CFAbsoluteTimeGetCurrent() - start) * 1000000);
+    }
     exit(0);
 }
 #endif /* TEST_EAPTLSVerifyServerCertificateChain */
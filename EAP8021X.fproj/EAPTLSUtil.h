@@ -41,6 +41,7 @@
 #include <Security/SecPolicy.h>
 #include <CoreFoundation/CFBase.h>
 #include <CoreFoundation/CFData.h>
+#include <CoreFoundation/CFDate.h>
 #include <CoreFoundation/CFArray.h>
 #include <CoreFoundation/CFDictionary.h>
 #include <stdbool.h>
@@ -236,4 +237,32 @@ EAPTLSCopyIdentityTrustChain(SecIdentityRef sec_identity,
 			     CFDictionaryRef properties,
 			     CFArrayRef * ret_array);
 
+/*
+ * Function: EAPTLSIdentityTrustChainPrewarm
+ * Purpose:
+ *   Build the trust chain for the given SecIdentityRef/properties ahead
+ *   of time so that a subsequent EAPTLSCopyIdentityTrustChain() with the
+ *   same identity returns it without accessing the keychain.
+ */
+OSStatus
+EAPTLSIdentityTrustChainPrewarm(SecIdentityRef sec_identity,
+				CFDictionaryRef properties);
+
+/*
+ * Function: EAPTLSIdentityTrustChainFlush
+ * Purpose:
+ *   Forget the trust chain remembered by EAPTLSIdentityTrustChainPrewarm()
+ *   or EAPTLSCopyIdentityTrustChain().
+ */
+void
+EAPTLSIdentityTrustChainFlush(void);
+
+/*
+ * Function: EAPTLSIdentityTrustChainGetCopyTime
+ * Purpose:
+ *   Return how long the most recent EAPTLSCopyIdentityTrustChain() took.
+ */
+CFAbsoluteTime
+EAPTLSIdentityTrustChainGetCopyTime(void);
+
 #endif /* _EAP8021X_EAPTLSUTIL_H */
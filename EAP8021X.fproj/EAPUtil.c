@@ -39,8 +39,8 @@
 #include "EAPUtil.h"
 #include "printdata.h"
 #include "EAPClientModule.h"
-#include "nbo.h"
 #include "myCFUtil.h"
+#include "EAPLog.h"
 #include <SystemConfiguration/SCPrivate.h>
 
 int
@@ -127,53 +127,45 @@ EAPTypeListStrAppend(const uint8_t *type_data, uint32_t length, CFMutableStringR
 }
 
 static void
-EAPPacketHeaderAppendDescription(EAPPacketRef eap_p, uint32_t length,
-				 CFMutableStringRef str)
+EAPPacketHeaderAppendDescription(EAPPacketViewRef view, CFMutableStringRef str)
 {
     STRING_APPEND(str, "EAP %s (%d): Identifier %d Length %d\n",
-		  EAPCodeStr(eap_p->code), eap_p->code,
-		  eap_p->identifier, length);
+		  EAPCodeStr(view->code), view->code,
+		  view->identifier, view->length);
     return;
 }
 
 static bool
-EAPRequestResponseValid(EAPPacketRef eap_p, uint32_t length,
-			CFMutableStringRef str)
+EAPRequestResponseValid(EAPPacketViewRef view, CFMutableStringRef str)
 {
-    EAPNakPacketRef 	nak_p = (EAPNakPacketRef)eap_p;
-    EAPRequestPacketRef	rd_p = (EAPRequestPacketRef)eap_p;
+    EAPRequestPacketRef	rd_p = (EAPRequestPacketRef)view->pkt;
 
 #define REQUEST_RESPONSE_LABEL	"EAPRequestResponsePacket"
-    if (length < sizeof(*rd_p)) {
+    if (view->length < sizeof(*rd_p)) {
 	if (str != NULL) {
 	    STRING_APPEND(str, "%s length %d < %d\n", REQUEST_RESPONSE_LABEL,
-			  length, (int)sizeof(*rd_p));
+			  view->length, (int)sizeof(*rd_p));
 	}
 	return (false);
     }
-    
-    switch (rd_p->type) {
+    view->type = rd_p->type;
+    view->type_data = rd_p->type_data;
+    view->type_data_length = view->length - (int)sizeof(*rd_p);
+    switch (view->type) {
     case kEAPTypeInvalid:
 	if (str != NULL) {
-	    EAPPacketHeaderAppendDescription(eap_p, length, str);
+	    EAPPacketHeaderAppendDescription(view, str);
 	    STRING_APPEND(str, "%s type is 0\n", REQUEST_RESPONSE_LABEL);
 	}
 	return (false);
 
     case kEAPTypeNak:
-	if (length < sizeof(*nak_p)) {
-	    if (str != NULL) {
-		EAPPacketHeaderAppendDescription(eap_p, length, str);
-		STRING_APPEND(str,"EAPNakPacket too short %d < %d\n",
-			      length, (int)sizeof(*nak_p));
-	    }
-	    return (false);
-	}
+	/* EAPNakPacket is the same size as EAPRequestPacket */
 	if (str != NULL) {
-	    EAPPacketHeaderAppendDescription(eap_p, length, str);
-	    STRING_APPEND(str, "%s (%d)\n", EAPTypeStr(rd_p->type),
-			  rd_p->type);
-	    EAPTypeListStrAppend(nak_p->type_data, length - sizeof(*nak_p), str);
+	    EAPPacketHeaderAppendDescription(view, str);
+	    STRING_APPEND(str, "%s (%d)\n", EAPTypeStr(view->type),
+			  view->type);
+	    EAPTypeListStrAppend(view->type_data, view->type_data_length, str);
 	}
 	break;
 
@@ -182,13 +174,13 @@ EAPRequestResponseValid(EAPPacketRef eap_p, uint32_t length,
 	    CFStringRef		packet_description = NULL;
 	    EAPClientModuleRef	module;
 
-	    module = EAPClientModuleLookup(rd_p->type);
+	    module = EAPClientModuleLookup(view->type);
 	    if (module != NULL) {
 		bool			is_valid = FALSE;
-		const EAPPacketRef	pkt = (const EAPPacketRef)rd_p;
 
 		packet_description
-		    = EAPClientModulePluginCopyPacketDescription(module, pkt,
+		    = EAPClientModulePluginCopyPacketDescription(module,
+								 view->pkt,
 								 &is_valid);
 	    }
 	    if (packet_description != NULL) {
@@ -196,11 +188,11 @@ EAPRequestResponseValid(EAPPacketRef eap_p, uint32_t length,
 		CFRelease(packet_description);
 	    }
 	    else {
-		EAPPacketHeaderAppendDescription(eap_p, length, str);
+		EAPPacketHeaderAppendDescription(view, str);
 		STRING_APPEND(str, "%s (%d) Payload Length %d\n",
-			      EAPTypeStr(rd_p->type),rd_p->type,
-			      length - (int)sizeof(*rd_p));
-		print_data_cfstr(str, rd_p->type_data, length - sizeof(*rd_p));
+			      EAPTypeStr(view->type), view->type,
+			      view->type_data_length);
+		print_data_cfstr(str, view->type_data, view->type_data_length);
 	    }
 	}
 	break;
@@ -209,10 +201,9 @@ EAPRequestResponseValid(EAPPacketRef eap_p, uint32_t length,
 }
 
 bool
-EAPPacketIsValid(EAPPacketRef eap_p, uint16_t pkt_length,
-		 CFMutableStringRef str)
+EAPPacketViewInit(EAPPacketViewRef view, EAPPacketRef eap_p,
+		  uint16_t pkt_length, CFMutableStringRef str)
 {
-    int			length;
     bool		ret = true;
 
     if (pkt_length < sizeof(*eap_p)) {
@@ -223,33 +214,65 @@ EAPPacketIsValid(EAPPacketRef eap_p, uint16_t pkt_length,
 	}
 	return (false);
     }
-    length = EAPPacketGetLength(eap_p);
-    if (pkt_length < length) {
+    view->pkt = eap_p;
+    view->code = eap_p->code;
+    view->identifier = eap_p->identifier;
+    view->length = EAPPacketHeaderGetLength(eap_p);
+    view->type = kEAPTypeInvalid;
+    view->type_data = NULL;
+    view->type_data_length = 0;
+    if (pkt_length < view->length) {
 	if (str != NULL) {
-	    EAPPacketHeaderAppendDescription(eap_p, length, str);
+	    EAPPacketHeaderAppendDescription(view, str);
 	    STRING_APPEND(str, "EAPPacket truncated %d < %d\n",
-			  pkt_length, length);
+			  pkt_length, view->length);
 	}
 	return (false);
     }
-    switch (eap_p->code) {
+    switch (view->code) {
     case kEAPCodeRequest:
     case kEAPCodeResponse:
-	ret = EAPRequestResponseValid(eap_p, length, str);
+	ret = EAPRequestResponseValid(view, str);
 	break;
     default:
 	if (str != NULL) {
-	    EAPPacketHeaderAppendDescription(eap_p, length, str);
+	    EAPPacketHeaderAppendDescription(view, str);
 	}
 	break;
     }
-    if (str != NULL && length < pkt_length) {
-	STRING_APPEND(str, "EAP: %d bytes follow data:\n", pkt_length - length);
-	print_data_cfstr(str, eap_p->data + length, pkt_length - length);
+    if (str != NULL && view->length < pkt_length) {
+	STRING_APPEND(str, "EAP: %d bytes follow data:\n",
+		      pkt_length - view->length);
+	print_data_cfstr(str, eap_p->data + view->length,
+			 pkt_length - view->length);
     }
     return (ret);
 }
 
+bool
+EAPPacketIsValid(EAPPacketRef eap_p, uint16_t pkt_length,
+		 CFMutableStringRef str)
+{
+    EAPPacketView	view;
+
+    return (EAPPacketViewInit(&view, eap_p, pkt_length, str));
+}
+
+static void
+EAPPacketDescribe(CFMutableStringRef str, const void * bytes, int length,
+		  const void * info)
+{
+    (void)EAPPacketIsValid((EAPPacketRef)bytes, (uint16_t)length, str);
+    return;
+}
+
+CFTypeRef
+EAPPacketCreateDeferredDescription(EAPPacketRef eap_p, uint16_t pkt_length)
+{
+    return (EAPLogDeferredDescriptionCreate(EAPPacketDescribe,
+					    eap_p, pkt_length, NULL));
+}
+
 bool
 EAPPacketValid(EAPPacketRef eap_p, uint16_t pkt_length, FILE * f)
 {
@@ -310,13 +333,106 @@ EAPPacketCreate(void * buf, int buf_size,
 void
 EAPPacketSetLength(EAPPacketRef pkt, uint16_t length)
 {
-    net_uint16_set(pkt->length, length);
+    EAPPacketHeaderSetLength(pkt, length);
     return;
 }
 
 uint16_t
 EAPPacketGetLength(const EAPPacketRef pkt)
 {
-    return net_uint16_get(pkt->length);
+    return (EAPPacketHeaderGetLength(pkt));
+}
+
+
+#ifdef TEST_DEFERRED_DESCRIPTION
+#include <CoreFoundation/CFDate.h>
+
+#define N_ITERATIONS		10000
+#define TEST_TYPE_DATA_LENGTH	1400
+
+static int	S_describe_count;
+
+static void
+count_describe(CFMutableStringRef str, const void * bytes, int length,
+	       const void * info)
+{
+    S_describe_count++;
+    EAPPacketDescribe(str, bytes, length, info);
+    return;
 }
 
+int
+main(int argc, char * argv[])
+{
+    uint8_t		buf[sizeof(EAPRequestPacket) + TEST_TYPE_DATA_LENGTH];
+    CFStringRef		deferred_str;
+    CFAbsoluteTime	deferred_time;
+    CFTypeRef		descr;
+    CFAbsoluteTime	eager_time;
+    int			i;
+    int			n_iterations;
+    EAPPacketRef	pkt;
+    int			size;
+    CFAbsoluteTime	start;
+    CFMutableStringRef	str;
+    uint8_t		type_data[TEST_TYPE_DATA_LENGTH];
+
+    n_iterations = (argc > 1) ? (int)strtol(argv[1], NULL, 0) : N_ITERATIONS;
+    for (i = 0; i < TEST_TYPE_DATA_LENGTH; i++) {
+	type_data[i] = (uint8_t)i;
+    }
+    pkt = EAPPacketCreate(buf, sizeof(buf), kEAPCodeRequest, 1,
+			  kEAPTypeTLS, type_data, sizeof(type_data), &size);
+
+    /* the deferred description must match, and be formatted once */
+    str = CFStringCreateMutable(NULL, 0);
+    EAPPacketIsValid(pkt, size, str);
+    descr = EAPLogDeferredDescriptionCreate(count_describe, pkt, size, NULL);
+    if (S_describe_count != 0) {
+	fprintf(stderr, "description formatted at creation\n");
+	exit(1);
+    }
+    deferred_str = CFCopyDescription(descr);
+    CFRelease(deferred_str);
+    deferred_str = CFCopyDescription(descr);
+    if (S_describe_count != 1 || !CFEqual(str, deferred_str)) {
+	fprintf(stderr, "deferred description is wrong (%d calls)\n",
+		S_describe_count);
+	exit(1);
+    }
+    CFRelease(deferred_str);
+    CFRelease(descr);
+    CFRelease(str);
+
+    /* basic logging: the per-packet summary at LOG_INFO, details at debug */
+    start = CFAbsoluteTimeGetCurrent();
+    for (i = 0; i < n_iterations; i++) {
+	EAPLOG(LOG_INFO, "Receive Packet Size %d", size);
+	str = CFStringCreateMutable(NULL, 0);
+	EAPPacketIsValid(pkt, size, str);
+	EAPLOG(-LOG_DEBUG, "%@", str);
+	CFRelease(str);
+    }
+    eager_time = CFAbsoluteTimeGetCurrent() - start;
+
+    S_describe_count = 0;
+    start = CFAbsoluteTimeGetCurrent();
+    for (i = 0; i < n_iterations; i++) {
+	EAPLOG(LOG_INFO, "Receive Packet Size %d", size);
+	descr = EAPLogDeferredDescriptionCreate(count_describe, pkt, size,
+						NULL);
+	EAPLOG(-LOG_DEBUG, "%@", descr);
+	my_CFRelease(&descr);
+    }
+    deferred_time = CFAbsoluteTimeGetCurrent() - start;
+    printf("%d packets of %d bytes, debug %s: eager %.2f usecs/packet, "
+	   "deferred %.2f usecs/packet (%d descriptions formatted)\n",
+	   n_iterations, size,
+	   os_log_type_enabled(EAPLogGetLogHandle(), OS_LOG_TYPE_DEBUG)
+	   ? "enabled" : "disabled",
+	   eager_time * 1000000 / n_iterations,
+	   deferred_time * 1000000 / n_iterations,
+	   S_describe_count);
+    return (0);
+}
+#endif /* TEST_DEFERRED_DESCRIPTION */
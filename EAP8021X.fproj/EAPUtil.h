@@ -44,9 +44,80 @@ EAPCodeStr(EAPCode code);
 const char *
 EAPTypeStr(EAPType type);
 
+/*
+ * Inline header accessors
+ * - the multi-byte header fields are byte arrays in network byte order,
+ *   so these are safe for any alignment; the compiler turns each into
+ *   a single load or store plus a byte swap
+ * - EAPPacketGetLength()/EAPPacketSetLength() remain exported and are
+ *   implemented with these
+ */
+static __inline__ uint16_t
+EAPPacketHeaderGetLength(const EAPPacket * pkt)
+{
+    return ((uint16_t)((pkt->length[0] << 8) | pkt->length[1]));
+}
+
+static __inline__ void
+EAPPacketHeaderSetLength(EAPPacket * pkt, uint16_t length)
+{
+    pkt->length[0] = (uint8_t)(length >> 8);
+    pkt->length[1] = (uint8_t)length;
+    return;
+}
+
+/*
+ * Type: EAPPacketView
+ * Purpose:
+ *   The decoded header of an EAP packet that has passed validation.
+ *   The header is read exactly once, by EAPPacketViewInit(); consumers
+ *   use the fields here instead of re-reading and re-checking the packet.
+ *
+ *   'type', 'type_data' and 'type_data_length' are only meaningful for
+ *   Request/Response packets; for other codes 'type' is kEAPTypeInvalid.
+ *
+ *   The view is used by eapolclient's state machines.  The plugin entry
+ *   points in EAPClientPlugin.h still take an EAPPacketRef: that ABI is
+ *   shared with plugins built separately, so it is left unchanged.
+ */
+typedef struct {
+    EAPPacketRef		pkt;
+    uint16_t			length;		/* from the EAP header */
+    uint8_t			code;
+    uint8_t			identifier;
+    EAPType			type;
+    const uint8_t *		type_data;
+    int				type_data_length;
+} EAPPacketView, * EAPPacketViewRef;
+
+/*
+ * Function: EAPPacketViewInit
+ * Purpose:
+ *   Validate the EAP packet 'eap_p' of 'pkt_length' bytes and fill in 'view'.
+ *   If 'str' is not NULL, a description of the packet is appended to it.
+ * Returns:
+ *   true if the packet is valid, false otherwise, in which case
+ *   'view' is not usable.
+ */
+bool
+EAPPacketViewInit(EAPPacketViewRef view, EAPPacketRef eap_p,
+		  uint16_t pkt_length, CFMutableStringRef str);
+
 bool
 EAPPacketValid(EAPPacketRef eap_p, uint16_t pkt_length, FILE * f);
 
+/*
+ * Function: EAPPacketCreateDeferredDescription
+ * Purpose:
+ *   Return an object to log with "%@" in place of the EAPPacketIsValid()
+ *   description of 'eap_p'.  The description, including the plugin's
+ *   copy_packet_description, is only generated if the log record is
+ *   actually emitted.  'eap_p' is referenced, not copied, so release the
+ *   object right after the log call.
+ */
+CFTypeRef
+EAPPacketCreateDeferredDescription(EAPPacketRef eap_p, uint16_t pkt_length);
+
 bool
 EAPPacketIsValid(EAPPacketRef eap_p, uint16_t pkt_length,
 		 CFMutableStringRef str);
@@ -59,7 +59,10 @@ SIMReportDecryptionError(CFDataRef encryptedIdentity);
  * Function: SIMAuthenticateGSM
  * Purpose:
  *   Communicate with SIM to retrieve the (SRES, Kc) pairs for the given
- *   set of RANDs.
+ *   set of RANDs.  All of the RANDs are submitted to the SIM together and
+ *   the responses collected at once.  The RANDs whose requests fail are
+ *   re-submitted together as a new batch; retrying stops once the SIM
+ *   times out.
  * Parameters:
  *   rand_p		input buffer containing RANDs;
  *			size must be at least 'count' * SIM_RAND_SIZE
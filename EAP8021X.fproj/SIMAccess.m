@@ -291,12 +291,30 @@ _SIMReportDecryptionError(CFDataRef encryptedIdentity)
     }
 }
 
-PRIVATE_EXTERN CFDictionaryRef
-_SIMCreateAuthResponse(CFStringRef slotUUID, CFDictionaryRef auth_params)
+#define WAIT_TIME_SECONDS	20
+
+/*
+ * Function: _SIMCreateAuthResponses
+ * Purpose:
+ *   Submit all of the requests to the UICC before waiting for any of
+ *   them, so that the round trips overlap, then wait once for all of the
+ *   responses.  The returned array is parallel to 'requests' and holds
+ *   kCFNull for each request that failed or did not complete in time.
+ *   If 'ret_timed_out' is not NULL, it is set to whether the wait
+ *   timed out.
+ */
+PRIVATE_EXTERN CFArrayRef
+_SIMCreateAuthResponses(CFStringRef slotUUID, CFArrayRef requests,
+			bool * ret_timed_out)
 {
+    if (ret_timed_out != NULL) {
+	*ret_timed_out = false;
+    }
     @autoreleasepool {
+    	CFIndex					count;
+    	dispatch_group_t			group;
     	CTXPCServiceSubscriptionContext 	*preferredSubscriptionCtx = nil;
-    	__block CFDictionaryRef 		retAuthInfo = NULL;
+    	NSMutableArray				*responses;
 
     	CoreTelephonyClient *coreTelephonyclient = [[CoreTelephonyClient alloc] init];
     	if (!coreTelephonyclient) {
@@ -311,38 +329,79 @@ _SIMCreateAuthResponse(CFStringRef slotUUID, CFDictionaryRef auth_params)
 	    /* carrier hotspot case */
 	    preferredSubscriptionCtx = SubscriptionContextUserPreferredGet(coreTelephonyclient);
     	}
-    	if (preferredSubscriptionCtx) {
-	    __block dispatch_semaphore_t	semaphore;
+    	if (!preferredSubscriptionCtx) {
+	    EAPLOG_FL(LOG_ERR, "failed to get the preferred subscription context");
+	    return NULL;
+    	}
+    	count = CFArrayGetCount(requests);
+    	responses = [NSMutableArray arrayWithCapacity:count];
+    	for (CFIndex i = 0; i < count; i++) {
+	    [responses addObject:[NSNull null]];
+    	}
+    	group = dispatch_group_create();
+    	if (group == NULL) {
+	    EAPLOG_FL(LOG_ERR, "dispatch_group_create() failed");
+	    return NULL;
+    	}
+    	for (CFIndex i = 0; i < count; i++) {
+	    NSDictionary *	auth_params;
 
-	    semaphore = dispatch_semaphore_create(0);
-	    if (semaphore == NULL) {
-	    	EAPLOG_FL(LOG_ERR, "dispatch_semaphore_create() failed");
-	    	return NULL;
-	    }
-	    [coreTelephonyclient generateUICCAuthenticationInfo:preferredSubscriptionCtx authParams:(__bridge NSDictionary *)auth_params completion:^(NSDictionary *authInfo, NSError *error) {
+	    auth_params = (__bridge NSDictionary *)CFArrayGetValueAtIndex(requests, i);
+	    dispatch_group_enter(group);
+	    [coreTelephonyclient generateUICCAuthenticationInfo:preferredSubscriptionCtx authParams:auth_params completion:^(NSDictionary *authInfo, NSError *error) {
 	    	if (error) {
 		    EAPLOG_FL(LOG_ERR,
 			      "CoreTelephonyClient.generateUICCAuthenticationInfo failed with "
 			      "error: %@", error);
-	    	} else {
-		    retAuthInfo = (__bridge_retained CFDictionaryRef)authInfo;
+	    	} else if (authInfo != nil) {
+		    /* completions may run concurrently */
+		    @synchronized (responses) {
+			responses[i] = authInfo;
+		    }
 	    	}
-	    	dispatch_semaphore_signal(semaphore);
+	    	dispatch_group_leave(group);
 	    }];
-	    {
-	    	dispatch_time_t	t;
-#define WAIT_TIME_SECONDS	20
-	    	t = dispatch_time(DISPATCH_TIME_NOW, WAIT_TIME_SECONDS * NSEC_PER_SEC);
-	    	if (dispatch_semaphore_wait(semaphore, t) != 0) {
-		    EAPLOG_FL(LOG_NOTICE,
-			      "timed out while waiting for response");
+    	}
+    	{
+	    dispatch_time_t	t;
+
+	    t = dispatch_time(DISPATCH_TIME_NOW, WAIT_TIME_SECONDS * NSEC_PER_SEC);
+	    if (dispatch_group_wait(group, t) != 0) {
+	    	EAPLOG_FL(LOG_NOTICE,
+			  "timed out while waiting for responses");
+	    	if (ret_timed_out != NULL) {
+		    *ret_timed_out = true;
 	    	}
 	    }
     	}
-    	return retAuthInfo;
+    	@synchronized (responses) {
+	    /* snapshot, late completions must not change the result */
+	    return (__bridge_retained CFArrayRef)[responses copy];
+    	}
     }
 }
 
+PRIVATE_EXTERN CFDictionaryRef
+_SIMCreateAuthResponse(CFStringRef slotUUID, CFDictionaryRef auth_params)
+{
+    CFArrayRef		requests;
+    CFDictionaryRef	response = NULL;
+    CFArrayRef		responses;
+
+    requests = CFArrayCreate(NULL, (const void * *)&auth_params, 1,
+			     &kCFTypeArrayCallBacks);
+    responses = _SIMCreateAuthResponses(slotUUID, requests, NULL);
+    CFRelease(requests);
+    if (responses != NULL) {
+	response = isA_CFDictionary(CFArrayGetValueAtIndex(responses, 0));
+	if (response != NULL) {
+	    CFRetain(response);
+	}
+	CFRelease(responses);
+    }
+    return (response);
+}
+
 /**
  ** SIMAuthenticate{SIM,AKA}
  **/
@@ -435,18 +494,81 @@ done:
 
 #define N_ATTEMPTS	3
 
-STATIC CFDictionaryRef
-SIMCreateAuthResponse(CFStringRef slotUUID, CFDictionaryRef request)
+/*
+ * Function: SIMCreateAuthResponses
+ * Purpose:
+ *   Submit the requests as a batch, then re-submit the ones that failed,
+ *   up to N_ATTEMPTS times.  Once a batch times out the UICC isn't
+ *   answering, so give up rather than multiply the wait.
+ *   The returned array is parallel to 'requests' and holds kCFNull for
+ *   each request that didn't get a response.
+ */
+STATIC CFArrayRef
+SIMCreateAuthResponses(CFStringRef slotUUID, CFArrayRef requests)
 {
-    int			i;
-    CFDictionaryRef 	response = NULL;
+    CFIndex		count;
+    CFIndex		i;
+    int			attempt;
+    CFMutableArrayRef	results;
 
-    for (i = 0; i < N_ATTEMPTS; i++) {
-	response = _SIMCreateAuthResponse(slotUUID, request);
-	if (response) {
+    count = CFArrayGetCount(requests);
+    results = CFArrayCreateMutable(NULL, count, &kCFTypeArrayCallBacks);
+    for (i = 0; i < count; i++) {
+	CFArrayAppendValue(results, kCFNull);
+    }
+    for (attempt = 0; attempt < N_ATTEMPTS; attempt++) {
+	CFIndex			j;
+	CFMutableArrayRef	pending;
+	CFArrayRef		responses;
+	bool			timed_out = false;
+
+	pending = CFArrayCreateMutable(NULL, count, &kCFTypeArrayCallBacks);
+	for (i = 0; i < count; i++) {
+	    if (CFArrayGetValueAtIndex(results, i) == kCFNull) {
+		CFArrayAppendValue(pending,
+				   CFArrayGetValueAtIndex(requests, i));
+	    }
+	}
+	if (CFArrayGetCount(pending) == 0) {
+	    CFRelease(pending);
+	    break;
+	}
+	responses = _SIMCreateAuthResponses(slotUUID, pending, &timed_out);
+	CFRelease(pending);
+	if (responses != NULL) {
+	    for (i = 0, j = 0; i < count; i++) {
+		if (CFArrayGetValueAtIndex(results, i) != kCFNull) {
+		    continue;
+		}
+		CFArraySetValueAtIndex(results, i,
+				       CFArrayGetValueAtIndex(responses, j));
+		j++;
+	    }
+	    CFRelease(responses);
+	}
+	if (timed_out) {
 	    break;
 	}
     }
+    return (results);
+}
+
+STATIC CFDictionaryRef
+SIMCreateAuthResponse(CFStringRef slotUUID, CFDictionaryRef request)
+{
+    CFArrayRef		requests;
+    CFDictionaryRef 	response;
+    CFArrayRef		responses;
+
+    requests = CFArrayCreate(NULL, (const void * *)&request, 1,
+			     &kCFTypeArrayCallBacks);
+    responses = SIMCreateAuthResponses(slotUUID, requests);
+    CFRelease(requests);
+    response = isA_CFDictionary(CFArrayGetValueAtIndex(responses, 0));
+    if (response != NULL) {
+	CFRetain(response);
+    }
+    CFRelease(responses);
     return (response);
 }
 
@@ -455,25 +577,37 @@ SIMAuthenticateGSM(CFDictionaryRef properties, const uint8_t * rand_p, int count
 		   uint8_t * kc_p, uint8_t * sres_p)
 {
     int			i;
+    CFMutableArrayRef	requests;
+    CFArrayRef		responses;
     bool		ret = false;
     CFStringRef 	slotUUID = NULL;
 
+    if (count <= 0) {
+	return (false);
+    }
     if (properties != NULL) {
 	slotUUID = isA_CFString(CFDictionaryGetValue(properties,
 						     kCTSimSupportUICCAuthenticationSlotUUIDKey));
     }
+    requests = CFArrayCreateMutable(NULL, count, &kCFTypeArrayCallBacks);
     for (i = 0; i < count; i++) {
 	CFDictionaryRef	request;
-	CFDictionaryRef response = NULL;
 
 	request = make_gsm_request(rand_p + SIM_RAND_SIZE * i);
-	response = SIMCreateAuthResponse(slotUUID, request);
+	CFArrayAppendValue(requests, request);
 	CFRelease(request);
+    }
+
+    /* submit all of the RANDs at once */
+    responses = SIMCreateAuthResponses(slotUUID, requests);
+    for (i = 0; i < count; i++) {
+	CFDictionaryRef response;
+
+	response = isA_CFDictionary(CFArrayGetValueAtIndex(responses, i));
 	if (response != NULL) {
 	    ret = getKcSRESFromResponse(response,
 					kc_p + SIM_KC_SIZE * i,
 					sres_p + SIM_SRES_SIZE * i);
-	    CFRelease(response);
 	}
 	else {
 	    EAPLOG_FL(LOG_NOTICE, "Could not access SIM");
@@ -483,6 +617,8 @@ SIMAuthenticateGSM(CFDictionaryRef properties, const uint8_t * rand_p, int count
 	    break;
 	}
     }
+    CFRelease(responses);
+    CFRelease(requests);
     return (ret);
 }
 
@@ -45,6 +45,10 @@ _SIMReportDecryptionError(CFDataRef encryptedIdentity);
 CFDictionaryRef
 _SIMCreateAuthResponse(CFStringRef slotUUID, CFDictionaryRef auth_params);
 
+CFArrayRef
+_SIMCreateAuthResponses(CFStringRef slotUUID, CFArrayRef requests,
+			bool * ret_timed_out);
+
 typedef void (*SIMAccessConnectionCallback)(CFTypeRef connection, CFStringRef status, void* info);
 
 CFTypeRef
@@ -113,6 +113,7 @@ typedef struct {
     bool				key_info_valid;
     EAPSIMAKAPersistentStateRef		persist;
     bool				reauth_success;
+    bool				proactive_reauth;
     EAPSIMAKAEncryptedIdentityInfoRef	encrypted_identity_info;
     AKAStaticKeys			static_keys;
     uint8_t				pkt[1500];
@@ -448,6 +449,7 @@ STATIC void
 EAPAKAContextFree(EAPAKAContextRef context)
 {
     EAPSIMAKAPersistentStateRelease(context->persist);
+    EAPSIMAKAKeyInfoRelease(&context->key_info);
     EAPAKAContextSetLastIdentity(context, NULL);
     AKAStaticKeysRelease(&context->static_keys);
     EAPSIMAKAClearEncryptedIdentityInfo(context->encrypted_identity_info);
@@ -498,6 +500,55 @@ make_client_error_packet(EAPAKAContextRef context,
     return (pkt);
 }
 
+/*
+ * Function: eapaka_prepare_fast_reauth
+ * Purpose:
+ *   If proactive fast re-authentication is enabled and the persistent
+ *   state holds a reauth ID, make sure K_aut/K_encr are derived from the
+ *   cached master key so that a Reauthentication request can be verified
+ *   and decrypted immediately.
+ *
+ *   Returns TRUE if the reauth ID should be offered, FALSE otherwise.
+ */
+STATIC bool
+eapaka_prepare_fast_reauth(EAPAKAContextRef context)
+{
+    if (context->proactive_reauth == FALSE
+	|| !EAPSIMAKAPersistentStateFastReauthAvailable(context->persist)) {
+	return (FALSE);
+    }
+    if (context->key_info_valid == FALSE) {
+	EAPSIMAKAKeyInfoComputeKeys(&context->key_info,
+				    EAPSIMAKAPersistentStateGetMasterKey(context->persist));
+	context->key_info_valid = TRUE;
+    }
+    return (TRUE);
+}
+
+STATIC void
+save_persistent_state(EAPAKAContextRef context);
+
+/*
+ * Function: eapaka_fast_reauth_failed
+ * Purpose:
+ *   Fast re-authentication didn't work out.  With proactive fast
+ *   re-authentication, forget the reauth ID so that the next attempt
+ *   goes straight to full authentication instead of offering it again.
+ */
+STATIC void
+eapaka_fast_reauth_failed(EAPAKAContextRef context)
+{
+    if (context->proactive_reauth
+	&& EAPSIMAKAPersistentStateFastReauthAvailable(context->persist)) {
+	EAPLOG(LOG_NOTICE,
+	       "eapaka: fast re-authentication failed, forgetting reauth id");
+	EAPSIMAKAPersistentStateSetReauthID(context->persist, NULL);
+	context->key_info_valid = FALSE;
+	save_persistent_state(context);
+    }
+    return;
+}
+
 STATIC void
 save_persistent_state(EAPAKAContextRef context)
 {
@@ -526,6 +577,7 @@ eapaka_identity(EAPAKAContextRef context,
     CFStringRef		identity = NULL;
     CFDataRef		identity_data = NULL;
     EAPSIMAKAAttributeType identity_req_type;
+    bool		offer_reauth_id;
     EAPPacketRef	pkt = NULL;
     Boolean		reauth_id_used = FALSE;
     TLVBufferDeclare(	tb_p);
@@ -589,11 +641,20 @@ eapaka_identity(EAPAKAContextRef context,
     context->last_identity_type = identity_req_type;
     pkt = make_response_packet(context, in_pkt,
 			       kEAPSIMAKAPacketSubtypeAKAIdentity, tb_p);
-    if (isA_CFData(context->plugin->encryptedEAPIdentity) != NULL &&
+#if TARGET_OS_EMBEDDED
+    offer_reauth_id = (identity_req_type == kAT_ANY_ID_REQ
+		       && eapaka_prepare_fast_reauth(context));
+#else /* TARGET_OS_EMBEDDED */
+    /* sim_identity_create() can't return a reauth ID without SIM access */
+    offer_reauth_id = FALSE;
+#endif /* TARGET_OS_EMBEDDED */
+    if (offer_reauth_id == FALSE &&
+	isA_CFData(context->plugin->encryptedEAPIdentity) != NULL &&
 	CFDataGetLength(context->plugin->encryptedEAPIdentity) > 0) {
 	/* encrypted IMSI for Wi-Fi calling */
 	identity_data = CFRetain(context->plugin->encryptedEAPIdentity);
-    } else if (context->encrypted_identity_info != NULL &&
+    } else if (offer_reauth_id == FALSE &&
+	       context->encrypted_identity_info != NULL &&
 	       (EAPSIMAKAPersistentStateTemporaryUsernameAvailable(context->persist) == FALSE ||
 		identity_req_type == kAT_PERMANENT_ID_REQ)) {
 	/* encrypted IMSI for carrier Wi-Fi hotspots */
@@ -645,7 +706,7 @@ eapaka_identity(EAPAKAContextRef context,
 STATIC bool
 eapaka_challenge_process_encr_data(EAPAKAContextRef context, TLVListRef tlvs_p)
 {
-    uint8_t *		decrypted_buffer = NULL;
+    uint8_t		decrypted_buffer[AT_ENCR_DATA_MAX_SIZE];
     TLVListDeclare(	decrypted_tlvs_p);
     AT_ENCR_DATA * 	encr_data_p;
     AT_IV * 		iv_p;
@@ -663,10 +724,10 @@ eapaka_challenge_process_encr_data(EAPAKAContextRef context, TLVListRef tlvs_p)
 	       "eapaka: Challenge missing AT_IV");
 	return (FALSE);
     }
-    decrypted_buffer 
-	= EAPSIMAKAKeyInfoDecryptTLVList(&context->key_info, encr_data_p, iv_p,
-					 decrypted_tlvs_p);
-    if (decrypted_buffer == NULL) {
+    if (!EAPSIMAKAKeyInfoDecryptTLVList(&context->key_info, encr_data_p, iv_p,
+					decrypted_buffer,
+					sizeof(decrypted_buffer),
+					decrypted_tlvs_p)) {
 	EAPLOG(LOG_NOTICE, "eapaka: Challenge decrypt AT_ENCR_DATA failed");
 	return (FALSE);
     }
@@ -694,9 +755,6 @@ eapaka_challenge_process_encr_data(EAPAKAContextRef context, TLVListRef tlvs_p)
 					     next_pseudonym);
 	CFRelease(next_pseudonym);
     }
-    if (decrypted_buffer != NULL) {
-	free(decrypted_buffer);
-    }
     TLVListFree(decrypted_tlvs_p);
     return (TRUE);
 }
@@ -834,8 +892,8 @@ eapaka_challenge(EAPAKAContextRef context,
 		  &sha1_context);
 
     /* now run PRF to generate keying material */
-    fips186_2prf(EAPSIMAKAPersistentStateGetMasterKey(context->persist),
-		 context->key_info.key);
+    EAPSIMAKAKeyInfoComputeKeys(&context->key_info,
+				EAPSIMAKAPersistentStateGetMasterKey(context->persist));
 
     /* validate the MAC */
     if (!EAPSIMAKAKeyInfoVerifyMAC(&context->key_info,
@@ -936,7 +994,7 @@ eapaka_reauthentication(EAPAKAContextRef context,
     bool		force_fullauth = FALSE;
     uint8_t		encr_buffer[ENCR_BUFSIZE_R];
     TLVBufferDeclare(	encr_tb_p);
-    uint8_t *		decrypted_buffer = NULL;
+    uint8_t		decrypted_buffer[AT_ENCR_DATA_MAX_SIZE];
     TLVListDeclare(	decrypted_tlvs_p);
     AT_ENCR_DATA * 	encr_data_p;
     AT_IV * 		iv_p;
@@ -976,6 +1034,7 @@ eapaka_reauthentication(EAPAKAContextRef context,
 				   NULL, 0)) {
 	EAPLOG(LOG_NOTICE,
 	       "eapaka: Reauthentication AT_MAC not valid");
+	eapaka_fast_reauth_failed(context);
 	*client_status = kEAPClientStatusProtocolError;
 	goto done;
     }
@@ -995,12 +1054,13 @@ eapaka_reauthentication(EAPAKAContextRef context,
 	*client_status = kEAPClientStatusProtocolError;
 	goto done;
     }
-    decrypted_buffer 
-	= EAPSIMAKAKeyInfoDecryptTLVList(&context->key_info, encr_data_p, iv_p,
-					 decrypted_tlvs_p);
-    if (decrypted_buffer == NULL) {
+    if (!EAPSIMAKAKeyInfoDecryptTLVList(&context->key_info, encr_data_p, iv_p,
+					decrypted_buffer,
+					sizeof(decrypted_buffer),
+					decrypted_tlvs_p)) {
 	EAPLOG(LOG_NOTICE,
 	       "eapaka: failed to decrypt Reauthentication AT_ENCR_DATA");
+	eapaka_fast_reauth_failed(context);
 	*client_status = kEAPClientStatusProtocolError;
 	goto done;
     }
@@ -1114,9 +1174,6 @@ eapaka_reauthentication(EAPAKAContextRef context,
     }
 
  done:
-    if (decrypted_buffer != NULL) {
-	free(decrypted_buffer);
-    }
     TLVListFree(decrypted_tlvs_p);
     return (pkt);
 }
@@ -1189,7 +1246,7 @@ eapaka_notification(EAPAKAContextRef context,
     do_replay_protection = context->reauth_success && after_auth;
     if (do_replay_protection) {
 	uint16_t	at_counter;
-	uint8_t *	decrypted_buffer;
+	uint8_t		decrypted_buffer[AT_ENCR_DATA_MAX_SIZE];
 	AT_ENCR_DATA *	encr_data_p;
 	TLVListDeclare(	decrypted_tlvs_p);
 	bool		has_counter = FALSE;
@@ -1206,11 +1263,11 @@ eapaka_notification(EAPAKAContextRef context,
 	    goto done;
 	}
 	TLVListInit(decrypted_tlvs_p);
-	decrypted_buffer 
-	    = EAPSIMAKAKeyInfoDecryptTLVList(&context->key_info,
-					     encr_data_p, iv_p,
-					     decrypted_tlvs_p);
-	if (decrypted_buffer != NULL) {
+	if (EAPSIMAKAKeyInfoDecryptTLVList(&context->key_info,
+					   encr_data_p, iv_p,
+					   decrypted_buffer,
+					   sizeof(decrypted_buffer),
+					   decrypted_tlvs_p)) {
 	    AT_COUNTER *	counter_p;
 	    CFStringRef		str;
 
@@ -1224,7 +1281,6 @@ eapaka_notification(EAPAKAContextRef context,
 		at_counter = net_uint16_get(counter_p->co_counter);
 		has_counter = TRUE;
 	    }
-	    free(decrypted_buffer);
 	    TLVListFree(decrypted_tlvs_p);
 	}
 	else {
@@ -1469,10 +1525,17 @@ eapaka_init(EAPClientPluginDataRef plugin, CFArrayRef * require_props,
     CFRelease(imsi);
     if (EAPSIMAKAPersistentStateGetReauthID(context->persist) != NULL) {
 	/* now run PRF to generate keying material */
-	fips186_2prf(EAPSIMAKAPersistentStateGetMasterKey(context->persist),
-		     context->key_info.key);
+	EAPSIMAKAKeyInfoComputeKeys(&context->key_info,
+				    EAPSIMAKAPersistentStateGetMasterKey(context->persist));
 	context->key_info_valid = TRUE;
     }
+    if (plugin->properties != NULL) {
+	CFBooleanRef	b;
+
+	b = isA_CFBoolean(CFDictionaryGetValue(plugin->properties,
+					       kEAPClientPropEAPSIMAKAProactiveFastReauthentication));
+	context->proactive_reauth = (b != NULL && CFBooleanGetValue(b));
+    }
     if (plugin->encryptedEAPIdentity == NULL) {
 	context->encrypted_identity_info
 	= EAPSIMAKAInitEncryptedIdentityInfo(kEAPTypeEAPAKA, plugin->properties, (context->static_keys.ck != NULL));
@@ -1515,12 +1578,19 @@ eapaka_process(EAPClientPluginDataRef plugin,
 	context->previous_identifier = -1;
 	if (context->state == kEAPAKAClientStateSuccess) {
 	    context->plugin_state = kEAPClientStateSuccess;
+	    EAPSIMAKAAuthenticationCountsUpdate(kEAPTypeEAPAKA, context->reauth_success);
 	    save_persistent_state(context);
 	}
 	break;
     case kEAPCodeFailure:
 	context->previous_identifier = -1;
 	context->plugin_state = kEAPClientStateFailure;
+	EAPSIMAKAAuthenticationCountsFailed(kEAPTypeEAPAKA);
+	if (context->state == kEAPAKAClientStateReauthentication
+	    || (context->state == kEAPAKAClientStateSuccess
+		&& context->reauth_success)) {
+	    eapaka_fast_reauth_failed(context);
+	}
 	break;
     default:
 	break;
@@ -1581,7 +1651,7 @@ eapaka_msk_copy_bytes(EAPClientPluginDataRef plugin,
 STATIC CFDictionaryRef
 eapaka_publish_props(EAPClientPluginDataRef plugin)
 {
-    return (NULL);
+    return (EAPSIMAKACreatePublishedProperties(kEAPTypeEAPAKA));
 }
 
 STATIC CFStringRef
@@ -1639,6 +1709,9 @@ eapaka_copy_identity(EAPClientPluginDataRef plugin)
     context->state = kEAPAKAClientStateNone;
     context->previous_identifier = -1;
 
+    /* the link is up, get ready for fast re-authentication */
+    (void)eapaka_prepare_fast_reauth(context);
+
     /* If encrypted identity is enabled and pseudonym/fast reauth-id are not available
      * then send identity with anonymous username.
      */
@@ -2018,12 +2091,14 @@ send_challenge(EAPClientPluginDataRef data, CFStringRef identity)
     CFRelease(identity_data);
 
     /* now run PRF to generate keying material */
-    fips186_2prf(master_key, key_info.key);
+    bzero(&key_info, sizeof(key_info));
+    EAPSIMAKAKeyInfoComputeKeys(&key_info, master_key);
     EAPPacketSetLength(pkt,
 		       offsetof(EAPAKAPacket, attrs) + TLVBufferUsed(tb_p));
 
     /* set the MAC value */
     EAPSIMAKAKeyInfoSetMAC(&key_info, pkt, mac_p->ma_mac, NULL, 0);
+    EAPSIMAKAKeyInfoRelease(&key_info);
 
     test.name = "challenge";
     test.packet_list = (const uint8_t * *)&pkt;
@@ -61,6 +61,8 @@
 #include <EAP8021X/mschap.h>
 #include <CoreFoundation/CFPreferences.h>
 #include <TargetConditionals.h>
+#include <dispatch/dispatch.h>
+#include <notify.h>
 #include "myCFUtil.h"
 #include "printdata.h"
 #include "nbo.h"
@@ -231,6 +233,99 @@ TLVTypeGetType(TLVType tlv_type)
     return (tlv_type & kTLVTypeMask);
 }
 
+INLINE void
+TLVInit(TLVRef tlv, TLVType type, TLVLength length)
+{
+    TLVSetType(tlv, type);
+    TLVSetLength(tlv, length);
+    return;
+}
+
+/*
+ * TLV scanning
+ * - TLVScanNext() returns each TLV in a buffer in turn, after verifying
+ *   that both the header and the value fit in what remains of the buffer
+ */
+typedef struct TLVScan_s {
+    const uint8_t *	ptr;
+    int			left;
+} TLVScan, * TLVScanRef;
+
+typedef enum {
+    kTLVScanStatusTruncated = -1,
+    kTLVScanStatusDone = 0,
+    kTLVScanStatusOK = 1,
+} TLVScanStatus;
+
+INLINE void
+TLVScanInit(TLVScanRef scan, const void * buf, int buf_size)
+{
+    scan->ptr = (const uint8_t *)buf;
+    scan->left = buf_size;
+    return;
+}
+
+INLINE TLVScanStatus
+TLVScanNext(TLVScanRef scan, TLVRef * ret_tlv)
+{
+    int		size;
+    TLVRef	tlv;
+
+    if (scan->left == 0) {
+	return (kTLVScanStatusDone);
+    }
+    if (scan->left < TLV_HEADER_LENGTH) {
+	return (kTLVScanStatusTruncated);
+    }
+    tlv = (TLVRef)scan->ptr;
+    size = TLV_HEADER_LENGTH + TLVGetLength(tlv);
+    if (scan->left < size) {
+	return (kTLVScanStatusTruncated);
+    }
+    scan->ptr += size;
+    scan->left -= size;
+    *ret_tlv = tlv;
+    return (kTLVScanStatusOK);
+}
+
+/*
+ * TLV type counts
+ * - the number of TLVs of each type seen in a message, so that duplicates
+ *   can be detected without re-scanning the message
+ */
+#define TLV_COUNTS_TYPE_COUNT	32	/* covers all defined TLV types */
+
+typedef struct TLVCounts_s {
+    uint16_t		type_count[TLV_COUNTS_TYPE_COUNT];
+} TLVCounts, * TLVCountsRef;
+
+INLINE void
+TLVCountsInit(TLVCountsRef counts)
+{
+    bzero(counts->type_count, sizeof(counts->type_count));
+    return;
+}
+
+INLINE void
+TLVCountsAdd(TLVCountsRef counts, const TLVRef tlv)
+{
+    TLVType	type = TLVTypeGetType(TLVGetType(tlv));
+
+    if (type < TLV_COUNTS_TYPE_COUNT) {
+	counts->type_count[type]++;
+    }
+    return;
+}
+
+INLINE int
+TLVCountsGet(const TLVCountsRef counts, TLVType type)
+{
+    if (type >= TLV_COUNTS_TYPE_COUNT) {
+	return (0);
+    }
+    return (counts->type_count[type]);
+}
+
 typedef struct ResultTLV_s {
     uint8_t		res_type[2];	/* kTLVTypeResult */
     uint8_t		res_length[2];
@@ -482,6 +577,7 @@ typedef struct TLVList_s {
     TLVRef 			mandatory;
     PACTLVRef			pac;
     PACTLVAttributeList		pac_tlvs;
+    TLVCounts			counts;
 } TLVList, * TLVListRef;
 
 #define kTLSKeyExpansionLabel		"key expansion"
@@ -677,6 +773,29 @@ BufferAdvanceWritePtr(BufferRef buf, int size)
     return (TRUE);
 }
 
+/*
+ * Function: BufferAppendTLV
+ * Purpose:
+ *   Reserve space for a TLV with the given type and value length at the
+ *   end of the buffer, and fill in its header.
+ * Returns:
+ *   The TLV, or NULL if there isn't enough space.
+ */
+STATIC TLVRef
+BufferAppendTLV(BufferRef buf, TLVType type, TLVLength length)
+{
+    TLVRef	tlv;
+
+    tlv = (TLVRef)BufferGetWritePtr(buf);
+    if (BufferAdvanceWritePtr(buf, TLV_HEADER_LENGTH + length) == FALSE) {
+	EAPLOG(LOG_NOTICE, "EAP-FAST: %s TLV (type=%d) doesn't fit",
+	       TLVTypeName(TLVTypeGetType(type)), TLVTypeGetType(type));
+	return (NULL);
+    }
+    TLVInit(tlv, type, length);
+    return (tlv);
+}
+
 /**
  ** PAC preferences/keychain routines
  **/
@@ -686,6 +805,7 @@ BufferAdvanceWritePtr(BufferRef buf, int size)
 #define kPACList		CFSTR("PACList")
 #define kPACKey			CFSTR("PACKey")
 #define kPACKeyKeychainItemID	CFSTR("PACKeyKeychainItemID")
+#define kPACKeyHMAC		CFSTR("PACKeyHMAC")	/* in-memory only */
 #define kPACOpaque		CFSTR("PACOpaque")
 #define kPACInfo		CFSTR("PACInfo")
 #define kAuthorityID		CFSTR("AuthorityID")
@@ -709,72 +829,414 @@ pac_list_copy(void)
     return (pac_list);
 }
 
-STATIC int
-pac_list_find_pac(CFArrayRef pac_list, 
-		  const void * auid, uint16_t auid_length,
-		  const uint8_t * initiator, int initiator_length)
+/**
+ ** PAC store
+ **
+ ** The PAC list is read from the preferences once, and indexed by
+ ** (Authority-ID, Initiator-ID) so that finding the PAC to use is a
+ ** single hash lookup.  The PAC-Key for a PAC is retrieved from the
+ ** keychain the first time the PAC is used, and kept in wired memory
+ ** after that.  Changes are applied to the in-memory list immediately;
+ ** writing them to the preferences and notifying other processes is
+ ** batched, except when a new PAC is saved, and flushed at exit.  The
+ ** list is only re-read when another process changes it.
+ **/
+
+#define kPACListChangedNotification	"com.apple.network.eapclient.eapfast.PACList"
+#define kPACStoreFlushDelaySeconds	1
+
+typedef struct {
+    CFMutableArrayRef		list;		/* PACList, as stored */
+    CFMutableDictionaryRef	index;		/* key -> PAC in list */
+    CFMutableDictionaryRef	resolved;	/* key -> PAC with PACKey */
+    int				token;
+    bool			token_valid;
+    dispatch_queue_t		queue;
+    bool			flush_scheduled;/* only accessed on queue */
+} PACStore;
+
+STATIC PACStore			S_pac_store;
+
+/*
+ * Function: pac_store_key_create
+ * Purpose:
+ *   Create the key used to index a PAC, made up of the Authority-ID and,
+ *   if specified, the Initiator-ID.
+ */
+STATIC CFDataRef
+pac_store_key_create(const void * auid, uint16_t auid_length,
+		     const uint8_t * initiator, int initiator_length)
+{
+    uint8_t		header[3];
+    CFMutableDataRef	key;
+
+    key = CFDataCreateMutable(NULL, 0);
+    net_uint16_set(header, auid_length);
+    header[2] = (initiator != NULL) ? 1 : 0;
+    CFDataAppendBytes(key, header, sizeof(header));
+    CFDataAppendBytes(key, auid, auid_length);
+    if (initiator != NULL) {
+	CFDataAppendBytes(key, initiator, initiator_length);
+    }
+    return (key);
+}
+
+STATIC CFDataRef
+pac_store_key_create_with_pac(CFDictionaryRef pac_dict)
+{
+    CFDataRef		auid;
+    char *		initiator = NULL;
+    CFStringRef		initiator_cf;
+    CFDataRef		key = NULL;
+
+    if (isA_CFDictionary(pac_dict) == NULL) {
+	goto done;
+    }
+    auid = CFDictionaryGetValue(pac_dict, kAuthorityID);
+    if (isA_CFData(auid) == NULL || CFDataGetLength(auid) > UINT16_MAX) {
+	goto done;
+    }
+    initiator_cf = CFDictionaryGetValue(pac_dict, kInitiatorID);
+    if (initiator_cf != NULL) {
+	if (isA_CFString(initiator_cf) == NULL) {
+	    /* unexpected type, skip it */
+	    goto done;
+	}
+	initiator = my_CFStringToCString(initiator_cf, kCFStringEncodingUTF8);
+	if (initiator == NULL) {
+	    goto done;
+	}
+    }
+    key = pac_store_key_create(CFDataGetBytePtr(auid),
+			       CFDataGetLength(auid),
+			       (const uint8_t *)initiator,
+			       (initiator != NULL) ? (int)strlen(initiator) : 0);
+ done:
+    if (initiator != NULL) {
+	free(initiator);
+    }
+    return (key);
+}
+
+STATIC void
+pac_store_release(void)
+{
+    my_CFRelease(&S_pac_store.list);
+    my_CFRelease(&S_pac_store.index);
+    my_CFRelease(&S_pac_store.resolved);
+    return;
+}
+
+STATIC void
+pac_store_load(void)
 {
     CFIndex		count;
     int			i;
-    CFStringRef		initiator_cf = NULL;
-    int			ret = -1;
+    CFArrayRef		pac_list;
 
-    if (initiator != NULL) {
-	initiator_cf
-	    = CFStringCreateWithBytes(NULL,
-				      initiator, initiator_length,
-				      kCFStringEncodingUTF8,
-				      TRUE);
+    pac_list = pac_list_copy();
+    if (pac_list != NULL) {
+	S_pac_store.list = CFArrayCreateMutableCopy(NULL, 0, pac_list);
+	CFRelease(pac_list);
     }
-    count = CFArrayGetCount(pac_list);
+    else {
+	S_pac_store.list = CFArrayCreateMutable(NULL, 0,
+						&kCFTypeArrayCallBacks);
+    }
+    S_pac_store.index
+	= CFDictionaryCreateMutable(NULL, 0,
+				    &kCFTypeDictionaryKeyCallBacks,
+				    &kCFTypeDictionaryValueCallBacks);
+    S_pac_store.resolved
+	= CFDictionaryCreateMutable(NULL, 0,
+				    &kCFTypeDictionaryKeyCallBacks,
+				    &kCFTypeDictionaryValueCallBacks);
+    count = CFArrayGetCount(S_pac_store.list);
     for (i = 0; i < count; i++) {
-	CFStringRef		initiator;
+	CFDataRef		key;
 	CFDictionaryRef		item;
-	CFDataRef		this_auid;
 
-	item = CFArrayGetValueAtIndex(pac_list, i);
-	if (isA_CFDictionary(item) == NULL) {
+	item = CFArrayGetValueAtIndex(S_pac_store.list, i);
+	key = pac_store_key_create_with_pac(item);
+	if (key == NULL) {
 	    continue;
 	}
-	this_auid = CFDictionaryGetValue(item, kAuthorityID);
-	if (isA_CFData(this_auid) == NULL) {
-	    continue;
+	/* if there are duplicates, the first one wins */
+	CFDictionaryAddValue(S_pac_store.index, key, item);
+	CFRelease(key);
+    }
+    return;
+}
+
+/*
+ * Function: pac_store_check
+ * Purpose:
+ *   Load the PAC list if it hasn't been loaded yet, or if another process
+ *   changed it since it was loaded.
+ */
+STATIC void
+pac_store_check(void)
+{
+    int			check = 0;
+    uint32_t		status;
+
+    if (!S_pac_store.token_valid) {
+	status = notify_register_check(kPACListChangedNotification,
+				       &S_pac_store.token);
+	if (status != NOTIFY_STATUS_OK) {
+	    EAPLOG(LOG_NOTICE, "EAP-FAST: notify_register_check returned %d",
+		   status);
 	}
-	if (CFDataGetLength(this_auid) != auid_length
-	    || memcmp(auid, CFDataGetBytePtr(this_auid), auid_length) != 0) {
-	    continue;
+	else {
+	    S_pac_store.token_valid = TRUE;
 	}
-	initiator = CFDictionaryGetValue(item, kInitiatorID);
-	if (initiator == NULL) {
-	    ret = i;
-	    if (initiator_cf == NULL) {
-		/* we were looking for a non-specific one, and found it */
-		break;
+    }
+    else {
+	status = notify_check(S_pac_store.token, &check);
+	if (status != NOTIFY_STATUS_OK) {
+	    EAPLOG(LOG_NOTICE, "EAP-FAST: notify_check returned %d",
+		   status);
+	}
+    }
+    if (check != 0) {
+	(void)CFPreferencesSynchronize(kEAPFASTApplicationID,
+				       kCFPreferencesCurrentUser,
+				       kCFPreferencesAnyHost);
+	pac_store_release();
+    }
+    if (S_pac_store.list == NULL) {
+	pac_store_load();
+    }
+    return;
+}
+
+STATIC bool
+pac_store_flush(void)
+{
+    /* only called on S_pac_store.queue */
+    int			check;
+    uint32_t		status;
+    bool		synced;
+
+    S_pac_store.flush_scheduled = FALSE;
+    synced = CFPreferencesSynchronize(kEAPFASTApplicationID,
+				      kCFPreferencesCurrentUser,
+				      kCFPreferencesAnyHost);
+    status = notify_post(kPACListChangedNotification);
+    if (status != NOTIFY_STATUS_OK) {
+	EAPLOG(LOG_NOTICE, "EAP-FAST: notify_post returned %d", status);
+    }
+    else if (S_pac_store.token_valid) {
+	/* don't re-read our own changes */
+	(void)notify_check(S_pac_store.token, &check);
+    }
+    return (synced);
+}
+
+/*
+ * Function: pac_store_synchronize
+ * Purpose:
+ *   Write out any pending changes now instead of waiting for the
+ *   coalesced flush.
+ * Returns:
+ *   FALSE if the changes could not be written, TRUE otherwise.
+ */
+STATIC bool
+pac_store_synchronize(void)
+{
+    __block bool	synced = TRUE;
+
+    if (S_pac_store.queue == NULL) {
+	return (TRUE);
+    }
+    dispatch_sync(S_pac_store.queue, ^{
+	    if (S_pac_store.flush_scheduled) {
+		synced = pac_store_flush();
 	    }
-	    /* remember non-user-specific but keep looking */
-	    continue;
+	});
+    return (synced);
+}
+
+STATIC void
+pac_store_synchronize_at_exit(void)
+{
+    (void)pac_store_synchronize();
+    return;
+}
+
+STATIC void
+pac_store_schedule_flush(void)
+{
+    if (S_pac_store.queue == NULL) {
+	S_pac_store.queue
+	    = dispatch_queue_create("com.apple.eapclient.eapfast.PACStore",
+				    NULL);
+	atexit(pac_store_synchronize_at_exit);
+    }
+    dispatch_async(S_pac_store.queue, ^{
+	    dispatch_time_t	t;
+
+	    if (S_pac_store.flush_scheduled) {
+		return;
+	    }
+	    S_pac_store.flush_scheduled = TRUE;
+	    t = dispatch_time(DISPATCH_TIME_NOW,
+			      kPACStoreFlushDelaySeconds * NSEC_PER_SEC);
+	    dispatch_after(t, S_pac_store.queue, ^{
+		    if (S_pac_store.flush_scheduled) {
+			(void)pac_store_flush();
+		    }
+		});
+	});
+    return;
+}
+
+/*
+ * Function: pac_store_find
+ * Purpose:
+ *   Find the PAC for the given Authority-ID and Initiator-ID.  If there
+ *   isn't one specific to the Initiator-ID, use the one that isn't
+ *   specific to any Initiator-ID.
+ * Returns:
+ *   The key for the PAC, or NULL if there isn't one.
+ */
+CF_RETURNS_RETAINED STATIC CFDataRef
+pac_store_find(const void * auid, uint16_t auid_length,
+	       const uint8_t * initiator, int initiator_length)
+{
+    CFDataRef		key;
+
+    pac_store_check();
+    key = pac_store_key_create(auid, auid_length,
+			       initiator, initiator_length);
+    if (CFDictionaryContainsKey(S_pac_store.index, key)) {
+	return (key);
+    }
+    CFRelease(key);
+    if (initiator == NULL) {
+	return (NULL);
+    }
+    key = pac_store_key_create(auid, auid_length, NULL, 0);
+    if (CFDictionaryContainsKey(S_pac_store.index, key)) {
+	return (key);
+    }
+    CFRelease(key);
+    return (NULL);
+}
+
+/*
+ * Function: pac_store_update
+ * Purpose:
+ *   Replace the PAC stored under old_key with pac_dict stored under new_key.
+ *   If old_key is NULL, pac_dict is added.  If pac_dict is NULL, the PAC
+ *   stored under old_key is removed.
+ */
+STATIC void
+pac_store_update(CFDataRef old_key, CFDataRef new_key,
+		 CFDictionaryRef pac_dict)
+{
+    CFIndex		i = kCFNotFound;
+
+    if (old_key != NULL) {
+	CFDictionaryRef		old_pac_dict;
+
+	old_pac_dict = CFDictionaryGetValue(S_pac_store.index, old_key);
+	if (old_pac_dict != NULL) {
+	    CFRange	range;
+
+	    range = CFRangeMake(0, CFArrayGetCount(S_pac_store.list));
+	    i = CFArrayGetFirstIndexOfValue(S_pac_store.list, range,
+					    old_pac_dict);
 	}
-	if (initiator_cf == NULL) {
-	    /* we're looking for a non-specific one */
-	    continue;
+	CFDictionaryRemoveValue(S_pac_store.index, old_key);
+	CFDictionaryRemoveValue(S_pac_store.resolved, old_key);
+    }
+    if (pac_dict == NULL) {
+	if (i != kCFNotFound) {
+	    CFArrayRemoveValueAtIndex(S_pac_store.list, i);
 	}
-	if (isA_CFString(initiator) == NULL) {
-	    /* unexpected type, skip it */
-	    continue;
+    }
+    else {
+	if (i != kCFNotFound) {
+	    CFArraySetValueAtIndex(S_pac_store.list, i, pac_dict);
 	}
-	if (CFEqual(initiator_cf, initiator)) {
-	    ret = i;
-	    break;
+	else {
+	    CFArrayAppendValue(S_pac_store.list, pac_dict);
 	}
+	CFDictionarySetValue(S_pac_store.index, new_key, pac_dict);
+	CFDictionaryRemoveValue(S_pac_store.resolved, new_key);
     }
-    my_CFRelease(&initiator_cf);
-    return (ret);
+    CFPreferencesSetValue(kPACList, S_pac_store.list, kEAPFASTApplicationID,
+			  kCFPreferencesCurrentUser,
+			  kCFPreferencesAnyHost);
+    pac_store_schedule_flush();
+    return;
+}
+
+/*
+ * PAC-Key storage
+ * - PAC-Keys are kept in memory that is wired, and zeroed before it is
+ *   freed, see my_CFLockedAllocator()
+ */
+STATIC CFDataRef
+locked_data_create(const void * data, CFIndex length)
+{
+    CFAllocatorRef	allocator = my_CFLockedAllocator();
+    void *		bytes;
+
+    bytes = CFAllocatorAllocate(allocator, length, 0);
+    if (bytes == NULL) {
+	return (NULL);
+    }
+    memcpy(bytes, data, length);
+    return (CFDataCreateWithBytesNoCopy(NULL, bytes, length, allocator));
 }
 
+STATIC void
+T_PRF_key_init(CCHmacContext * key_ctx, const void * key, int key_length);
+
+/*
+ * Function: pac_dict_create_resolved
+ * Purpose:
+ *   Return a copy of the PAC with the PAC-Key and its T-PRF key schedule
+ *   added, both kept in wired memory.
+ */
 CF_RETURNS_RETAINED STATIC CFDictionaryRef
-pac_dict_insert_key(CFDictionaryRef orig_pac_dict)
+pac_dict_create_resolved(CFDictionaryRef orig_pac_dict, CFDataRef pac_key)
 {
     CFMutableDictionaryRef	dict;
+    CCHmacContext		key_ctx;
+    CFDataRef			locked_key;
+    CFDataRef			locked_key_hmac = NULL;
+    CFDictionaryRef		pac_dict = NULL;
+
+    locked_key = locked_data_create(CFDataGetBytePtr(pac_key),
+				    CFDataGetLength(pac_key));
+    if (locked_key == NULL) {
+	goto done;
+    }
+    T_PRF_key_init(&key_ctx, CFDataGetBytePtr(pac_key),
+		   (int)CFDataGetLength(pac_key));
+    locked_key_hmac = locked_data_create(&key_ctx, sizeof(key_ctx));
+    cc_clear(sizeof(key_ctx), &key_ctx);
+    if (locked_key_hmac == NULL) {
+	goto done;
+    }
+    dict = CFDictionaryCreateMutableCopy(NULL, 0, orig_pac_dict);
+    CFDictionarySetValue(dict, kPACKey, locked_key);
+    CFDictionarySetValue(dict, kPACKeyHMAC, locked_key_hmac);
+    pac_dict = CFDictionaryCreateCopy(NULL, dict);
+    CFRelease(dict);
+
+ done:
+    my_CFRelease(&locked_key);
+    my_CFRelease(&locked_key_hmac);
+    return (pac_dict);
+}
+
+CF_RETURNS_RETAINED STATIC CFDictionaryRef
+pac_dict_insert_key(CFDictionaryRef orig_pac_dict)
+{
     CFDictionaryRef		pac_dict = NULL;
     CFDataRef			pac_key = NULL;
     OSStatus			status;
@@ -783,10 +1245,13 @@ pac_dict_insert_key(CFDictionaryRef orig_pac_dict)
     if (isA_CFData(CFDictionaryGetValue(orig_pac_dict, kPACOpaque)) == NULL) {
 	goto done;
     }
-    if (isA_CFData(CFDictionaryGetValue(orig_pac_dict, kPACKey)) != NULL) {
-	pac_dict = CFRetain(orig_pac_dict);
+    pac_key = CFDictionaryGetValue(orig_pac_dict, kPACKey);
+    if (isA_CFData(pac_key) != NULL) {
+	pac_dict = pac_dict_create_resolved(orig_pac_dict, pac_key);
+	pac_key = NULL;
 	goto done;
     }
+    pac_key = NULL;
     unique_id_str = CFDictionaryGetValue(orig_pac_dict, kPACKeyKeychainItemID);
     if (isA_CFString(unique_id_str) == NULL) {
 	goto done;
@@ -798,10 +1263,7 @@ pac_dict_insert_key(CFDictionaryRef orig_pac_dict)
 	       EAPSSLErrorString(status), (int)status);
 	goto done;
     }
-    dict = CFDictionaryCreateMutableCopy(NULL, 0, orig_pac_dict);
-    CFDictionarySetValue(dict, kPACKey, pac_key);
-    pac_dict = CFDictionaryCreateCopy(NULL, dict);
-    CFRelease(dict);
+    pac_dict = pac_dict_create_resolved(orig_pac_dict, pac_key);
 
  done:
     my_CFRelease(&pac_key);
@@ -812,24 +1274,26 @@ STATIC CFDictionaryRef
 pac_dict_copy(const void * auid, uint16_t auid_length, 
 	      const uint8_t * initiator, int initiator_length)
 {
-    int			i;
+    CFDataRef		key;
     CFDictionaryRef	pac_dict = NULL;
-    CFArrayRef		pac_list;
 
-    pac_list = pac_list_copy();
-    if (pac_list == NULL) {
+    key = pac_store_find(auid, auid_length, initiator, initiator_length);
+    if (key == NULL) {
 	goto done;
     }
-    i = pac_list_find_pac(pac_list, auid, auid_length,
-			  initiator, initiator_length);
-    if (i == -1) {
+    pac_dict = CFDictionaryGetValue(S_pac_store.resolved, key);
+    if (pac_dict != NULL) {
+	CFRetain(pac_dict);
 	goto done;
     }
-    pac_dict = CFArrayGetValueAtIndex(pac_list, i);
-    pac_dict = pac_dict_insert_key(pac_dict);
+    pac_dict = pac_dict_insert_key(CFDictionaryGetValue(S_pac_store.index,
+							key));
+    if (pac_dict != NULL) {
+	CFDictionarySetValue(S_pac_store.resolved, key, pac_dict);
+    }
 
  done:
-    my_CFRelease(&pac_list);
+    my_CFRelease(&key);
     return (pac_dict);
 }
 
@@ -1061,54 +1525,38 @@ remove_pac(CFDictionaryRef pac_dict,
 	   const uint8_t * initiator, int initiator_length)
 {
     CFDataRef		auid;
-    int			i;
-    CFArrayRef		pac_list;
-    CFMutableArrayRef	new_pac_list;
+    CFDataRef		key;
     OSStatus		status;
     CFStringRef		unique_id_str;
 
     unique_id_str = CFDictionaryGetValue(pac_dict, kPACKeyKeychainItemID);
     auid = CFDictionaryGetValue(pac_dict, kAuthorityID);
-    pac_list = pac_list_copy();
-    if (pac_list == NULL) {
-	goto done;
-    }
-    i = pac_list_find_pac(pac_list, 
-			  CFDataGetBytePtr(auid), CFDataGetLength(auid),
-			  initiator, initiator_length);
-    if (i == -1) {
-	goto done;
+    key = pac_store_find(CFDataGetBytePtr(auid), CFDataGetLength(auid),
+			 initiator, initiator_length);
+    if (key == NULL) {
+	return;
     }
-    new_pac_list = CFArrayCreateMutableCopy(NULL, 0, pac_list);
-    CFArrayRemoveValueAtIndex(new_pac_list, i);
     status = EAPSecKeychainPasswordItemRemove(NULL, unique_id_str);
     if (status != noErr) {
 	EAPLOG(LOG_NOTICE,
 	       "EAP-FAST: EAPSecKeychainPasswordItemRemove failed, %s (%d)",
 	       EAPSecurityErrorString(status), (int)status);
     }
-    CFPreferencesSetValue(kPACList, new_pac_list, kEAPFASTApplicationID,
-			  kCFPreferencesCurrentUser,
-			  kCFPreferencesAnyHost);
-    my_CFRelease(&new_pac_list);
-    (void)CFPreferencesSynchronize(kEAPFASTApplicationID,
-			  kCFPreferencesCurrentUser,
-			  kCFPreferencesAnyHost);
-
- done:
-    my_CFRelease(&pac_list);
+    pac_store_update(key, NULL, NULL);
+    CFRelease(key);
     return;
 }
 
 STATIC bool
 save_pac(bool system_mode, PACTLVAttributeListRef tlvlist_p)
 {
-    int				i = -1;
+    const void *		auid;
+    uint16_t			auid_length;
     const uint8_t *		initiator = NULL;
     int				initiator_length = 0;
     CFStringRef			key_id = NULL;
-    CFMutableArrayRef		new_pac_list = NULL;
-    CFArrayRef			old_pac_list = NULL;
+    CFDataRef			new_key = NULL;
+    CFDataRef			old_key = NULL;
     CFMutableDictionaryRef	pac_dict;
     bool			saved = FALSE;
 
@@ -1140,25 +1588,14 @@ save_pac(bool system_mode, PACTLVAttributeListRef tlvlist_p)
 	initiator = tlvlist_p->i_id->tlv_value;
 	initiator_length = TLVGetLength(tlvlist_p->i_id);
     }
-    old_pac_list = pac_list_copy();
-    if (old_pac_list == NULL) {
-	new_pac_list = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
-    }
-    else {
-	const void *		auid;
-	int			auid_length;
-
-	new_pac_list = CFArrayCreateMutableCopy(NULL, 0, old_pac_list);
-	auid = tlvlist_p->a_id->tlv_value;
-	auid_length = TLVGetLength(tlvlist_p->a_id);
-	i = pac_list_find_pac(new_pac_list, auid, auid_length,
-			      initiator, initiator_length);
-	if (i != -1) {
-	    CFDictionaryRef	old_pac_dict;
-	    
-	    old_pac_dict = CFArrayGetValueAtIndex(new_pac_list, i);
-	    key_id = CFDictionaryGetValue(old_pac_dict, kPACKeyKeychainItemID);
-	}
+    auid = tlvlist_p->a_id->tlv_value;
+    auid_length = TLVGetLength(tlvlist_p->a_id);
+    old_key = pac_store_find(auid, auid_length, initiator, initiator_length);
+    if (old_key != NULL) {
+	CFDictionaryRef	old_pac_dict;
+
+	old_pac_dict = CFDictionaryGetValue(S_pac_store.index, old_key);
+	key_id = CFDictionaryGetValue(old_pac_dict, kPACKeyKeychainItemID);
     }
     if (key_id == NULL) {
 	key_id
@@ -1182,23 +1619,20 @@ save_pac(bool system_mode, PACTLVAttributeListRef tlvlist_p)
 	    goto done;
 	}
     }
-    if (i == -1) {
-	CFArrayAppendValue(new_pac_list, pac_dict);
-    }
-    else {
-	CFArraySetValueAtIndex(new_pac_list, i, pac_dict);
+    new_key = pac_store_key_create(auid, auid_length,
+				   initiator, initiator_length);
+    pac_store_update(old_key, new_key, pac_dict);
+
+    /* the server only sends a PAC once, don't report it saved until it is */
+    saved = pac_store_synchronize();
+    if (!saved) {
+	EAPLOG(LOG_NOTICE, "EAP-FAST: failed to write PAC list");
     }
-    CFPreferencesSetValue(kPACList, new_pac_list, kEAPFASTApplicationID,
-			  kCFPreferencesCurrentUser,
-			  kCFPreferencesAnyHost);
-    saved = CFPreferencesSynchronize(kEAPFASTApplicationID,
-			  kCFPreferencesCurrentUser,
-			  kCFPreferencesAnyHost);
 
  done:
     my_CFRelease(&pac_dict);
-    my_CFRelease(&old_pac_list);
-    my_CFRelease(&new_pac_list);
+    my_CFRelease(&old_key);
+    my_CFRelease(&new_key);
     return (saved);
 }
 
@@ -1207,68 +1641,64 @@ save_pac(bool system_mode, PACTLVAttributeListRef tlvlist_p)
  **/
 
 /*
- * Function: T_PRF
+ * Function: T_PRF_key_init
  * Purpose:
- *   Implements the T-PRF() function as described in the EAP-FAST
- *   internet draft version 03, section 5.5.
+ *   Compute the HMAC-SHA1 key schedule for the given T-PRF key, so that
+ *   several T-PRF computations using the same key (e.g. the PAC-Key) can
+ *   share it.  The result must be cleared with cc_clear() when no longer
+ *   needed.
  */
 STATIC void
-T_PRF(const void * key, int key_length,
-      const void * label, int label_length,
-      const void * seed, int seed_length,
-      void * key_material, int key_material_length)
+T_PRF_key_init(CCHmacContext * key_ctx, const void * key, int key_length)
 {
-    uint8_t *		data;
-    /* ALIGN: data_buf is aligned to at least sizeof(uint16_t) */
-    uint16_t		data_buf[256/sizeof(uint16_t)];
-    int			data_length;
+    CCHmacInit(key_ctx, kCCHmacAlgSHA1, key, key_length);
+    return;
+}
+
+/*
+ * Function: T_PRF_with_key
+ * Purpose:
+ *   Implements the T-PRF() function as described in RFC 4851 section 5.5,
+ *   using a key schedule computed by T_PRF_key_init().
+ *   The input to each HMAC is streamed directly rather than assembled in
+ *   a buffer, so no memory is allocated regardless of the seed length.
+ */
+STATIC void
+T_PRF_with_key(const CCHmacContext * key_ctx,
+	       const void * label, int label_length,
+	       const void * seed, int seed_length,
+	       void * key_material, int key_material_length)
+{
+    CCHmacContext	ctx;
     int			i;
     int			left;
-    void *		output;
+    uint8_t *		output;
     uint8_t		t_buf[CC_SHA1_DIGEST_LENGTH];
+    uint8_t		trailer[sizeof(uint16_t) + 1];
+    static const uint8_t zero = 0x00;
 
     if (key_material_length == 0) {
 	EAPLOG_FL(LOG_NOTICE, "key_material_length is 0");
 	return;
     }
-    data_length	
-	= label_length 		/* label */
-	+ 1			/* 0x00 */
-	+ seed_length 		/* seed */
-	+ sizeof(t_buf)		/* Ti */
-	+ sizeof(uint16_t)	/* outputlength */
-	+ 1;			/* 0xNN */
-    /* allocate a buffer to store the intermediate data */
-    if (data_length > sizeof(data_buf)) {
-	data = (uint8_t *)malloc(data_length);
-    }
-    else {
-	data = (uint8_t *)data_buf;
-    }
     left = key_material_length;
     output = key_material;
+    net_uint16_set(trailer, key_material_length); /* outputlength */
     for (i = 0; ; i++) {
-	uint8_t *	offset = data;
-
+	/* Ti = HMAC-SHA1 (key, [T(i-1) +] S + outputlength + i) */
+	ctx = *key_ctx;
 	if (i != 0) {
-	    memcpy(offset, t_buf, sizeof(t_buf));
-	    offset += sizeof(t_buf);
+	    CCHmacUpdate(&ctx, t_buf, sizeof(t_buf));
 	}
 	/* S = label + 0x00 + seed */
-	memcpy(offset, label, label_length);
-	offset += label_length;
-	*offset++ = 0x00;
+	CCHmacUpdate(&ctx, label, label_length);
+	CCHmacUpdate(&ctx, &zero, sizeof(zero));
 	if (seed != NULL && seed_length != 0) {
-	    memcpy(offset, seed, seed_length);
-	    offset += seed_length;
+	    CCHmacUpdate(&ctx, seed, seed_length);
 	}
-	net_uint16_set((void *)offset, key_material_length); /* outputlength */
-	offset += sizeof(uint16_t);
-	*offset++ = i + 1;
-
-	/* Ti = HMAC-SHA1 (key, [T(i-1) +] S + outputlength + i) */
-	CCHmac(kCCHmacAlgSHA1,
-	       key, key_length, data, (offset - data), t_buf);
+	trailer[sizeof(uint16_t)] = i + 1;
+	CCHmacUpdate(&ctx, trailer, sizeof(trailer));
+	CCHmacFinal(&ctx, t_buf);
 	if (left <= sizeof(t_buf)) {
 	    memcpy(output, t_buf, left);
 	    break;
@@ -1277,9 +1707,28 @@ T_PRF(const void * key, int key_length,
 	output += sizeof(t_buf);
 	left -= sizeof(t_buf);
     }
-    if ((void *)data != (void *)data_buf) {
-	free(data);
-    }
+    cc_clear(sizeof(ctx), &ctx);
+    cc_clear(sizeof(t_buf), t_buf);
+    return;
+}
+
+/*
+ * Function: T_PRF
+ * Purpose:
+ *   Implements the T-PRF() function as described in RFC 4851 section 5.5.
+ */
+STATIC void
+T_PRF(const void * key, int key_length,
+      const void * label, int label_length,
+      const void * seed, int seed_length,
+      void * key_material, int key_material_length)
+{
+    CCHmacContext	key_ctx;
+
+    T_PRF_key_init(&key_ctx, key, key_length);
+    T_PRF_with_key(&key_ctx, label, label_length, seed, seed_length,
+		   key_material, key_material_length);
+    cc_clear(sizeof(key_ctx), &key_ctx);
     return;
 }
 
@@ -1629,15 +2078,21 @@ eapfast_generate_key_material(EAPFASTPluginDataRef context,
 STATIC void
 eapfast_compute_session_key(EAPFASTPluginDataRef context)
 {
-    T_PRF(context->last_s_imck, sizeof(context->last_s_imck),
-	  kSessionKeyLabel, kSessionKeyLabelLength,
-	  NULL, 0, 
-	  context->master_key, sizeof(context->master_key));
-
-    T_PRF(context->last_s_imck, sizeof(context->last_s_imck),
-	  kExtendedSessionKeyLabel, kExtendedSessionKeyLabelLength,
-	  NULL, 0, 
-	  context->extended_master_key, sizeof(context->extended_master_key));
+    CCHmacContext	key_ctx;
+
+    /* MSK and EMSK are both derived from S-IMCK[j] */
+    T_PRF_key_init(&key_ctx, context->last_s_imck,
+		   sizeof(context->last_s_imck));
+    T_PRF_with_key(&key_ctx,
+		   kSessionKeyLabel, kSessionKeyLabelLength,
+		   NULL, 0, 
+		   context->master_key, sizeof(context->master_key));
+    T_PRF_with_key(&key_ctx,
+		   kExtendedSessionKeyLabel, kExtendedSessionKeyLabelLength,
+		   NULL, 0, 
+		   context->extended_master_key,
+		   sizeof(context->extended_master_key));
+    cc_clear(sizeof(key_ctx), &key_ctx);
     context->master_key_valid = TRUE;
     return;
 }
@@ -1730,6 +2185,7 @@ eapfast_compute_master_secret(SSLContextRef ctx, const void * arg,
 {
     EAPFASTPluginDataRef 	context = (EAPFASTPluginDataRef)arg;
     CFDataRef			pac_key;
+    CFDataRef			pac_key_hmac;
     char			random[SSL_CLIENT_SRVR_RAND_SIZE * 2];
     int				random_size;
     OSStatus			status;
@@ -1743,6 +2199,7 @@ eapfast_compute_master_secret(SSLContextRef ctx, const void * arg,
 	EAPLOG_FL(LOG_NOTICE, "pac_key is NULL");
 	goto failed;
     }
+    pac_key_hmac = CFDictionaryGetValue(context->pac_dict, kPACKeyHMAC);
     if (*secret_length < MASTER_SECRET_LENGTH) {
 	EAPLOG_FL(LOG_NOTICE, "%lu < %d",
 		  *secret_length, MASTER_SECRET_LENGTH);
@@ -1754,10 +2211,19 @@ eapfast_compute_master_secret(SSLContextRef ctx, const void * arg,
     if (status != noErr) {
 	goto failed;
     }
-    T_PRF(CFDataGetBytePtr(pac_key), (int)CFDataGetLength(pac_key),
-	  kPACToMasterLabel, kPACToMasterLabelLength,
-	  random, random_size,
-	  secret, MASTER_SECRET_LENGTH);
+    if (pac_key_hmac != NULL) {
+	/* use the key schedule computed when the PAC was loaded */
+	T_PRF_with_key((const CCHmacContext *)CFDataGetBytePtr(pac_key_hmac),
+		       kPACToMasterLabel, kPACToMasterLabelLength,
+		       random, random_size,
+		       secret, MASTER_SECRET_LENGTH);
+    }
+    else {
+	T_PRF(CFDataGetBytePtr(pac_key), (int)CFDataGetLength(pac_key),
+	      kPACToMasterLabel, kPACToMasterLabelLength,
+	      random, random_size,
+	      secret, MASTER_SECRET_LENGTH);
+    }
     *secret_length = MASTER_SECRET_LENGTH;
     context->pac_was_used = TRUE;
     return;
@@ -2110,33 +2576,28 @@ PACTLVAttributeListParse(PACTLVAttributeListRef tlvlist_p,
 			 const void * buf, int buf_size,
 			 CFMutableStringRef str)
 {
-    int			left;
     bool		ret = FALSE;
     TLVRef		scan;
+    TLVScan		tlv_scan;
 
-    scan = (const TLVRef)buf;
-    left = buf_size;
+    TLVScanInit(&tlv_scan, buf, buf_size);
     while (1) {
 	TLVType		tlv_type;
 	TLVLength	tlv_length;
+	TLVScanStatus	scan_status;
 
-	if (left == 0) {
+	scan_status = TLVScanNext(&tlv_scan, &scan);
+	if (scan_status == kTLVScanStatusDone) {
 	    break; /* we're done */
 	}
-	if (left < TLV_HEADER_LENGTH) {
+	if (scan_status == kTLVScanStatusTruncated) {
 	    STRLOG(str, LOG_NOTICE,
-		   "EAP-FAST: TLV attribute is too short (%d < %d)",
-		   left, (int)TLV_HEADER_LENGTH);
+		   "EAP-FAST: TLV attribute is too short (%d bytes left)",
+		   tlv_scan.left);
 	    goto done;
 	}
 	tlv_type = TLVGetType(scan);
 	tlv_length = TLVGetLength(scan);
-	if (left < (TLV_HEADER_LENGTH + tlv_length)) {
-	    STRLOG(str, LOG_NOTICE,
-		   "EAP-FAST: TLV attribute is too short (%d < %d)",
-		   left, (int)TLV_HEADER_LENGTH);
-	    goto done;
-	}
 	if (str != NULL) {
 	    TLVType t = TLVTypeGetType(tlv_type);
 
@@ -2205,8 +2666,6 @@ PACTLVAttributeListParse(PACTLVAttributeListRef tlvlist_p,
 	default:
 	    break;
 	}
-	left -= (TLV_HEADER_LENGTH + tlv_length);
-	scan = (TLVRef)(((void *)scan) + TLV_HEADER_LENGTH + tlv_length);
     }
     ret = TRUE;
 
@@ -2214,42 +2673,50 @@ PACTLVAttributeListParse(PACTLVAttributeListRef tlvlist_p,
     return (ret);
 }
 
+/*
+ * Function: TLVListParse
+ * Purpose:
+ *   Validate the TLVs in the buffer in a single pass.  If tlvlist_p is
+ *   non-NULL, fill it in with the TLVs we act upon, and index all TLVs by
+ *   type.  Logs to str if non-NULL.
+ */
 STATIC bool
 TLVListParse(TLVListRef tlvlist_p,
 	     const void * buf, int buf_size,
 	     CFMutableStringRef str)
 {
-    int			left;
+    TLVCountsRef	counts = NULL;
     PACTLVAttributeListRef pac_tlvs = NULL;
     TLVStatus 		result_status;
     bool		ret = FALSE;
     TLVRef		scan;
+    TLVScan		tlv_scan;
 
     if (tlvlist_p != NULL) {
-	bzero(tlvlist_p, sizeof(*tlvlist_p));
+	bzero(tlvlist_p, offsetof(TLVList, counts));
+	counts = &tlvlist_p->counts;
+	TLVCountsInit(counts);
     }
-    scan = (const TLVRef)buf;
-    left = buf_size;
+    TLVScanInit(&tlv_scan, buf, buf_size);
     while (1) {
 	TLVType		tlv_type;
 	TLVLength	tlv_length;
+	TLVScanStatus	scan_status;
 
-	if (left == 0) {
+	scan_status = TLVScanNext(&tlv_scan, &scan);
+	if (scan_status == kTLVScanStatusDone) {
 	    break; /* we're done */
 	}
-	if (left < TLV_HEADER_LENGTH) {
+	if (scan_status == kTLVScanStatusTruncated) {
 	    STRLOG(str, LOG_NOTICE,
-		   "EAP-FAST: TLV is too short (%d < %d)",
-		   left, (int)TLV_HEADER_LENGTH);
+		   "EAP-FAST: TLV is too short (%d bytes left)",
+		   tlv_scan.left);
 	    goto done;
 	}
 	tlv_type = TLVGetType(scan);
 	tlv_length = TLVGetLength(scan);
-	if (left < (TLV_HEADER_LENGTH + tlv_length)) {
-	    STRLOG(str, LOG_NOTICE,
-		   "EAP-FAST: TLV is too short (%d < %d)",
-		   left, (int)TLV_HEADER_LENGTH);
-	    goto done;
+	if (counts != NULL) {
+	    TLVCountsAdd(counts, scan);
 	}
 	if (str != NULL) {
 	    TLVType t = TLVTypeGetType(tlv_type);
@@ -2286,7 +2753,7 @@ TLVListParse(TLVListRef tlvlist_p,
 		goto done;
 	    }
 	    if (tlvlist_p != NULL) {
-		if (tlvlist_p->result != NULL) {
+		if (TLVCountsGet(counts, kTLVTypeResult) > 1) {
 		    STRLOG(str, LOG_NOTICE,
 			   "EAP-FAST: multiple Result TLV's defined");
 		    goto done;
@@ -2325,7 +2792,7 @@ TLVListParse(TLVListRef tlvlist_p,
 	    break;
 	case kTLVTypeEAPPayload:
 	    if (tlvlist_p != NULL) {
-		if (tlvlist_p->eap != NULL) {
+		if (TLVCountsGet(counts, kTLVTypeEAPPayload) > 1) {
 		    STRLOG(str, LOG_NOTICE,
 			   "EAP-FAST: EAP Payload TLV appears multiple times");
 		    goto done;
@@ -2351,7 +2818,7 @@ TLVListParse(TLVListRef tlvlist_p,
 		goto done;
 	    }
 	    if (tlvlist_p != NULL) {
-		if (tlvlist_p->intermediate != NULL) {
+		if (TLVCountsGet(counts, kTLVTypeIntermediateResult) > 1) {
 		    STRLOG(str, LOG_NOTICE,
 			   "EAP-FAST: multiple Intermediate Result TLV's");
 		    goto done;
@@ -2367,7 +2834,7 @@ TLVListParse(TLVListRef tlvlist_p,
 		goto done;
 	    }
 	    if (tlvlist_p != NULL) {
-		if (tlvlist_p->crypto != NULL) {
+		if (TLVCountsGet(counts, kTLVTypeCryptoBinding) > 1) {
 		    STRLOG(str, LOG_NOTICE,
 			   "EAP-FAST: multiple Crypto Binding TLV's defined");
 		    goto done;
@@ -2407,8 +2874,6 @@ TLVListParse(TLVListRef tlvlist_p,
 	    }
 	    break;
 	}
-	left -= (TLV_HEADER_LENGTH + tlv_length);
-	scan = (TLVRef)(((void *)scan) + TLV_HEADER_LENGTH + tlv_length);
     }
     ret = TRUE;
 
@@ -2421,14 +2886,12 @@ make_result(BufferRef buf, TLVStatus result_status)
 {
     ResultTLVRef	res;
 
-    res = (ResultTLVRef)BufferGetWritePtr(buf);
-    if (BufferAdvanceWritePtr(buf, TLV_HEADER_LENGTH + RESULT_TLV_LENGTH)
-	== FALSE) {
-	EAPLOG(LOG_NOTICE, "EAP-FAST: make_result(): buffer too small");
+    res = (ResultTLVRef)BufferAppendTLV(buf,
+					kTLVTypeMandatoryBit | kTLVTypeResult,
+					RESULT_TLV_LENGTH);
+    if (res == NULL) {
 	return (FALSE);
     }
-    TLVSetLength((TLVRef)res, RESULT_TLV_LENGTH);
-    TLVSetType((TLVRef)res, kTLVTypeMandatoryBit | kTLVTypeResult);
     ResultTLVSetStatus(res, result_status);
     return (TRUE);
 }
@@ -2438,17 +2901,13 @@ make_intermediate_result(BufferRef buf, TLVStatus result_status)
 {
     IntermediateResultTLVRef	ires;
 
-    ires = (IntermediateResultTLVRef)BufferGetWritePtr(buf);
-    if (BufferAdvanceWritePtr(buf, 
-			      (TLV_HEADER_LENGTH
-			       + INTERMEDIATE_RESULT_TLV_MIN_LENGTH))
-	== FALSE) {
-	EAPLOG(LOG_NOTICE,
-	       "EAP-FAST: make_intermediate_result(): buffer too small");
+    ires = (IntermediateResultTLVRef)
+	BufferAppendTLV(buf,
+			kTLVTypeMandatoryBit | kTLVTypeIntermediateResult,
+			INTERMEDIATE_RESULT_TLV_MIN_LENGTH);
+    if (ires == NULL) {
 	return (FALSE);
     }
-    TLVSetLength((TLVRef)ires, INTERMEDIATE_RESULT_TLV_MIN_LENGTH);
-    TLVSetType((TLVRef)ires, kTLVTypeMandatoryBit | kTLVTypeIntermediateResult);
     IntermediateResultTLVSetStatus(ires, result_status);
     return (TRUE);
 }
@@ -2458,14 +2917,12 @@ make_error(BufferRef buf, ErrorTLVErrorCode code)
 {
     ErrorTLVRef		err;
 
-    err = (ErrorTLVRef)BufferGetWritePtr(buf);
-    if (BufferAdvanceWritePtr(buf, TLV_HEADER_LENGTH + ERROR_TLV_LENGTH)
-	== FALSE) {
-	EAPLOG(LOG_NOTICE, "EAP-FAST: make_error(): buffer too small");
+    err = (ErrorTLVRef)BufferAppendTLV(buf,
+				       kTLVTypeMandatoryBit | kTLVTypeError,
+				       ERROR_TLV_LENGTH);
+    if (err == NULL) {
 	return (FALSE);
     }
-    TLVSetLength((TLVRef)err, ERROR_TLV_LENGTH);
-    TLVSetType((TLVRef)err, kTLVTypeMandatoryBit | kTLVTypeError);
     ErrorTLVSetErrorCode(err, code);
     return (TRUE);
 }
@@ -2475,14 +2932,12 @@ make_nak(BufferRef buf, const TLVRef tlv)
 {
     NAKTLVRef		nak;
 
-    nak = (NAKTLVRef)BufferGetWritePtr(buf);
-    if (BufferAdvanceWritePtr(buf, TLV_HEADER_LENGTH + NAK_TLV_MIN_LENGTH)
-	== FALSE) {
-	EAPLOG(LOG_NOTICE, "EAP-FAST: make_nak(): buffer too small");
+    nak = (NAKTLVRef)BufferAppendTLV(buf,
+				     kTLVTypeMandatoryBit | kTLVTypeNAK,
+				     NAK_TLV_MIN_LENGTH);
+    if (nak == NULL) {
 	return (FALSE);
     }
-    TLVSetLength((TLVRef)nak, NAK_TLV_MIN_LENGTH);
-    TLVSetType((TLVRef)nak, kTLVTypeMandatoryBit | kTLVTypeNAK);
     NAKTLVSetNAKType(nak, TLVTypeGetType(TLVGetType(tlv)));
     NAKTLVSetVendorId(nak, 0);
     return (TRUE);
@@ -2493,13 +2948,16 @@ make_eap(BufferRef buf, const EAPPacketRef out_pkt_p, int out_pkt_size)
 {
     EAPPayloadTLVRef	eap;
 
-    eap = (EAPPayloadTLVRef)BufferGetWritePtr(buf);
-    if (BufferAdvanceWritePtr(buf, out_pkt_size + TLV_HEADER_LENGTH) == FALSE) {
-	EAPLOG(LOG_NOTICE, "EAP-FAST: make_eap(): buffer too small");
+    if (out_pkt_size > UINT16_MAX) {
+	EAPLOG(LOG_NOTICE, "EAP-FAST: make_eap(): packet too large");
+	return (FALSE);
+    }
+    eap = (EAPPayloadTLVRef)
+	BufferAppendTLV(buf, kTLVTypeMandatoryBit | kTLVTypeEAPPayload,
+			out_pkt_size);
+    if (eap == NULL) {
 	return (FALSE);
     }
-    TLVSetLength((TLVRef)eap, out_pkt_size);
-    TLVSetType((TLVRef)eap, kTLVTypeMandatoryBit | kTLVTypeEAPPayload);
     memcpy(eap->ep_eap_packet, out_pkt_p, out_pkt_size);
     return (TRUE);
 }
@@ -2510,20 +2968,15 @@ make_pac_request(BufferRef buf)
     PACTLVRef		pac;
     PACTypeTLVRef	pac_type;
 
-    pac = (PACTLVRef)BufferGetWritePtr(buf);
-    if (BufferAdvanceWritePtr(buf, TLV_HEADER_LENGTH * 2 + PAC_TYPE_TLV_LENGTH)
-	== FALSE) {
-	EAPLOG(LOG_NOTICE, "EAP-FAST: make_pac_request(): buffer too small");
+    /* PAC TLV encapsulating a PAC-Type TLV */
+    pac = (PACTLVRef)BufferAppendTLV(buf, kTLVTypePAC,
+				     TLV_HEADER_LENGTH + PAC_TYPE_TLV_LENGTH);
+    if (pac == NULL) {
 	return (FALSE);
     }
-    /* set the PAC TLV header to encapsulate the PAC-Type TLV */
-    TLVSetLength((TLVRef)pac, TLV_HEADER_LENGTH + PAC_TYPE_TLV_LENGTH);
-    TLVSetType((TLVRef)pac, kTLVTypePAC);
-
-    /* PAC-Type TLV */
     pac_type = (PACTypeTLVRef)pac->pa_attributes;
-    TLVSetLength((TLVRef)pac_type, PAC_TYPE_TLV_LENGTH);
-    TLVSetType((TLVRef)pac_type, kPACTLVAttributeTypePAC_Type);
+    TLVInit((TLVRef)pac_type, kPACTLVAttributeTypePAC_Type,
+	    PAC_TYPE_TLV_LENGTH);
     PACTypeTLVSetPACType(pac_type, kPACTypeTunnel);
     return (TRUE);
 }
@@ -2534,20 +2987,15 @@ make_pac_ack(BufferRef buf, TLVStatus result_status)
     PACTLVRef		pac;
     ResultTLVRef	pac_ack;
 
-    pac = (PACTLVRef)BufferGetWritePtr(buf);
-    if (BufferAdvanceWritePtr(buf, TLV_HEADER_LENGTH * 2 + RESULT_TLV_LENGTH)
-	== FALSE) {
-	EAPLOG(LOG_NOTICE, "EAP-FAST: make_pac_ack(): buffer too small");
+    /* PAC TLV encapsulating a PAC-Acknowledgement TLV */
+    pac = (PACTLVRef)BufferAppendTLV(buf, kTLVTypePAC,
+				     TLV_HEADER_LENGTH + RESULT_TLV_LENGTH);
+    if (pac == NULL) {
 	return (FALSE);
     }
-    /* set the PAC TLV header to encapsulate the PAC-Acknowledgement TLV */
-    TLVSetLength((TLVRef)pac, TLV_HEADER_LENGTH + PAC_TYPE_TLV_LENGTH);
-    TLVSetType((TLVRef)pac, kTLVTypePAC);
-
-    /* PAC-Type TLV */
     pac_ack = (ResultTLVRef)pac->pa_attributes;
-    TLVSetLength((TLVRef)pac_ack, RESULT_TLV_LENGTH);
-    TLVSetType((TLVRef)pac_ack, kPACTLVAttributeTypePAC_Acknowledgement);
+    TLVInit((TLVRef)pac_ack, kPACTLVAttributeTypePAC_Acknowledgement,
+	    RESULT_TLV_LENGTH);
     ResultTLVSetStatus(pac_ack, result_status);
     return (TRUE);
 }
@@ -2635,8 +3083,8 @@ process_crypto_binding(EAPFASTPluginDataRef context,
     }
 
     /* turn this into our response */
-    TLVSetLength((TLVRef)cb_p, CRYPTO_BINDING_TLV_LENGTH);
-    TLVSetType((TLVRef)cb_p, kTLVTypeMandatoryBit | kTLVTypeCryptoBinding);
+    TLVInit((TLVRef)cb_p, kTLVTypeMandatoryBit | kTLVTypeCryptoBinding,
+	    CRYPTO_BINDING_TLV_LENGTH);
     cb_p->cb_received_version = context->eapfast_received_version;
     cb_p->cb_nonce[sizeof(cb_p->cb_nonce) - 1] |= 0x01; /* LSBit must be 1 */
     cb_p->cb_sub_type = kCryptoBindingSubTypeBindingResponse;
@@ -2869,15 +3317,14 @@ eapfast_eap(EAPClientPluginDataRef plugin, EAPTLSPacketRef eaptls_in,
 
 	in_pkt_p = (EAPRequestPacketRef)tlvlist_p->eap->ep_eap_packet;
 	if (plugin->log_enabled && do_log) {
-	    CFMutableStringRef	log_msg;
+	    CFTypeRef		log_descr;
 
 	    /* we haven't seen it before, so log it */
-	    log_msg = CFStringCreateMutable(NULL, 0);
-	    EAPPacketIsValid((const EAPPacketRef)in_pkt_p,
-			     EAPPacketGetLength((const EAPPacketRef)in_pkt_p),
-			     log_msg);
-	    EAPLOG(-LOG_DEBUG, "EAP-FAST Receive EAP Payload:\n%@", log_msg);
-	    CFRelease(log_msg);
+	    log_descr
+		= EAPPacketCreateDeferredDescription((EAPPacketRef)in_pkt_p,
+			EAPPacketGetLength((const EAPPacketRef)in_pkt_p));
+	    EAPLOG(-LOG_DEBUG, "EAP-FAST Receive EAP Payload:\n%@", log_descr);
+	    my_CFRelease(&log_descr);
 	}
 	switch (in_pkt_p->code) {
 	case kEAPCodeRequest:
@@ -2920,14 +3367,13 @@ eapfast_eap(EAPClientPluginDataRef plugin, EAPTLSPacketRef eaptls_in,
 	    goto done;
 	}
 	if (plugin->log_enabled) {
-	    CFMutableStringRef		log_msg;
+	    CFTypeRef			log_descr;
 
-	    log_msg = CFStringCreateMutable(NULL, 0);
-	    EAPPacketIsValid((const EAPPacketRef)out_pkt_p,
-			     EAPPacketGetLength((const EAPPacketRef)out_pkt_p),
-			     log_msg);
-	    EAPLOG(-LOG_DEBUG, "EAP-FAST Send EAP Payload:\n%@", log_msg);
-	    CFRelease(log_msg);
+	    log_descr
+		= EAPPacketCreateDeferredDescription((EAPPacketRef)out_pkt_p,
+			EAPPacketGetLength((const EAPPacketRef)out_pkt_p));
+	    EAPLOG(-LOG_DEBUG, "EAP-FAST Send EAP Payload:\n%@", log_descr);
+	    my_CFRelease(&log_descr);
 	}
 	if (make_eap(&out_tlvs_buf, (void *)out_pkt_p, out_pkt_size)
 	    == FALSE) {
@@ -3403,6 +3849,7 @@ eapfast_process(EAPClientPluginDataRef plugin,
     *client_status = kEAPClientStatusOK;
     *error = 0;
     *out_pkt_p = NULL;
+    context->mtu = plugin->mtu;
     switch (in_pkt->code) {
     case kEAPCodeRequest:
 	*out_pkt_p = eapfast_request(plugin, in_pkt, client_status);
@@ -3756,3 +4203,420 @@ eapfast_introspect(EAPClientPluginFuncName name)
     }
     return (NULL);
 }
+
+#ifdef TEST_T_PRF
+/*
+ * From RFC 4851: B.1.  Key Derivation
+ *
+ *   PAC-Key:
+ *
+ *   0B 97 39 0F 37 51 78 09 81 1E FD 9C 6E 65 94 2B
+ *   63 2C E9 53 89 38 08 BA 36 0B 03 7C D1 85 E4 14
+ *
+ *   Server_hello Random
+ *   3F FB 11 C4 6C BF A5 7A 54 40 DA E8 22 D3 11 D3
+ *   F7 6D E4 1D D9 33 E5 93 70 97 EB A9 B3 66 F4 2A
+ *
+ *   Client_hello Random
+ *   00 00 00 02 6A 66 43 2A 8D 14 43 2C EC 58 2D 2F
+ *   C7 9C 33 64 BA 04 AD 3A 52 54 D6 A5 79 AD 1E 00
+ *
+ *   Master_secret = T-PRF(PAC-Key,
+ *                         "PAC to master secret label hash",
+ *                          server_random + Client_random,
+ *                          48)
+ *
+ *   4A 1A 51 2C 01 60 BC 02 3C CF BC 83 3F 03 BC 64
+ *   88 C1 31 2F 0B A9 A2 77 16 A8 D8 E8 BD C9 D2 29
+ *   38 4B 7A 85 BE 16 4D 27 33 D5 24 79 87 B1 C5 A2
+ */
+static const uint8_t	pac_key[32] = {
+    0x0b, 0x97, 0x39, 0x0f, 0x37, 0x51, 0x78, 0x09,
+    0x81, 0x1e, 0xfd, 0x9c, 0x6e, 0x65, 0x94, 0x2b,
+    0x63, 0x2c, 0xe9, 0x53, 0x89, 0x38, 0x08, 0xba,
+    0x36, 0x0b, 0x03, 0x7c, 0xd1, 0x85, 0xe4, 0x14
+};
+
+static const uint8_t	server_client_random[64] = {
+    0x3f, 0xfb, 0x11, 0xc4, 0x6c, 0xbf, 0xa5, 0x7a,
+    0x54, 0x40, 0xda, 0xe8, 0x22, 0xd3, 0x11, 0xd3,
+    0xf7, 0x6d, 0xe4, 0x1d, 0xd9, 0x33, 0xe5, 0x93,
+    0x70, 0x97, 0xeb, 0xa9, 0xb3, 0x66, 0xf4, 0x2a,
+    0x00, 0x00, 0x00, 0x02, 0x6a, 0x66, 0x43, 0x2a,
+    0x8d, 0x14, 0x43, 0x2c, 0xec, 0x58, 0x2d, 0x2f,
+    0xc7, 0x9c, 0x33, 0x64, 0xba, 0x04, 0xad, 0x3a,
+    0x52, 0x54, 0xd6, 0xa5, 0x79, 0xad, 0x1e, 0x00
+};
+
+static const uint8_t	master_secret[MASTER_SECRET_LENGTH] = {
+    0x4a, 0x1a, 0x51, 0x2c, 0x01, 0x60, 0xbc, 0x02,
+    0x3c, 0xcf, 0xbc, 0x83, 0x3f, 0x03, 0xbc, 0x64,
+    0x88, 0xc1, 0x31, 0x2f, 0x0b, 0xa9, 0xa2, 0x77,
+    0x16, 0xa8, 0xd8, 0xe8, 0xbd, 0xc9, 0xd2, 0x29,
+    0x38, 0x4b, 0x7a, 0x85, 0xbe, 0x16, 0x4d, 0x27,
+    0x33, 0xd5, 0x24, 0x79, 0x87, 0xb1, 0xc5, 0xa2
+};
+
+#define N_ITERATIONS	100000
+
+int
+main(int argc, char * argv[])
+{
+    int			i;
+    CCHmacContext	key_ctx;
+    uint8_t		output[MASTER_SECRET_LENGTH];
+    int			ret = 0;
+    CFAbsoluteTime	start;
+
+    T_PRF(pac_key, sizeof(pac_key),
+	  kPACToMasterLabel, kPACToMasterLabelLength,
+	  server_client_random, sizeof(server_client_random),
+	  output, sizeof(output));
+    if (memcmp(output, master_secret, sizeof(master_secret)) != 0) {
+	printf("T_PRF master secret: FAILED\n");
+	print_data(output, sizeof(output));
+	ret = 1;
+    }
+    else {
+	printf("T_PRF master secret: PASSED\n");
+    }
+    T_PRF_key_init(&key_ctx, pac_key, sizeof(pac_key));
+    T_PRF_with_key(&key_ctx,
+		   kPACToMasterLabel, kPACToMasterLabelLength,
+		   server_client_random, sizeof(server_client_random),
+		   output, sizeof(output));
+    if (memcmp(output, master_secret, sizeof(master_secret)) != 0) {
+	printf("T_PRF_with_key master secret: FAILED\n");
+	print_data(output, sizeof(output));
+	ret = 1;
+    }
+    else {
+	printf("T_PRF_with_key master secret: PASSED\n");
+    }
+
+    /* PAC-based reconnect: master secret derivation */
+    start = CFAbsoluteTimeGetCurrent();
+    for (i = 0; i < N_ITERATIONS; i++) {
+	T_PRF(pac_key, sizeof(pac_key),
+	      kPACToMasterLabel, kPACToMasterLabelLength,
+	      server_client_random, sizeof(server_client_random),
+	      output, sizeof(output));
+    }
+    printf("T_PRF: %g usecs per master secret\n",
+	   (CFAbsoluteTimeGetCurrent() - start) * 1000000 / N_ITERATIONS);
+    start = CFAbsoluteTimeGetCurrent();
+    for (i = 0; i < N_ITERATIONS; i++) {
+	T_PRF_with_key(&key_ctx,
+		       kPACToMasterLabel, kPACToMasterLabelLength,
+		       server_client_random, sizeof(server_client_random),
+		       output, sizeof(output));
+    }
+    printf("T_PRF_with_key: %g usecs per master secret\n",
+	   (CFAbsoluteTimeGetCurrent() - start) * 1000000 / N_ITERATIONS);
+    cc_clear(sizeof(key_ctx), &key_ctx);
+    exit(ret);
+    return (ret);
+}
+#endif /* TEST_T_PRF */
+
+#ifdef TEST_TLV_PARSE
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/*
+ * TLV parser throughput benchmark and fuzzer
+ *
+ * tlv_parse			benchmark, then fuzz with the built-in seeds
+ * tlv_parse fuzz <count> [ <seed> ]
+ * tlv_parse corpus <dir>	write the seeds and a set of mutations to <dir>
+ *				for use with an external fuzzer
+ */
+
+#define SAMPLE_MESSAGE_SIZE	512
+#define N_PARSE_ITERATIONS	1000000
+#define N_FUZZ_ITERATIONS	1000000
+#define N_CORPUS_MUTATIONS	256
+
+static const uint8_t	sample_eap_packet[] = {
+    kEAPCodeRequest, 1, 0, 9, kEAPTypeIdentity, 't', 'e', 's', 't'
+};
+
+static void
+append_pac_attribute(uint8_t * * ptr_p, PACTLVAttributeType type,
+		     uint8_t fill, int length)
+{
+    TLVRef	tlv = (TLVRef)*ptr_p;
+
+    TLVInit(tlv, type, length);
+    memset(tlv->tlv_value, fill, length);
+    *ptr_p += TLV_HEADER_LENGTH + length;
+    return;
+}
+
+/*
+ * Function: build_seed
+ * Purpose:
+ *   Build one of the seed messages using the TLV encoder.
+ */
+static int
+build_seed(int which, uint8_t * buf, int buf_size)
+{
+    Buffer		b;
+    CryptoBindingTLVRef	cb;
+    TLVRef		pac;
+    uint8_t *		ptr;
+
+    BufferInit(&b, buf, buf_size);
+    switch (which) {
+    case 0:
+	/* EAP-Payload carrying an inner method request */
+	make_eap(&b, (EAPPacketRef)sample_eap_packet,
+		 sizeof(sample_eap_packet));
+	break;
+    case 1:
+	/* Intermediate-Result + Crypto-Binding request */
+	make_intermediate_result(&b, kTLVStatusSuccess);
+	cb = (CryptoBindingTLVRef)
+	    BufferAppendTLV(&b, kTLVTypeMandatoryBit | kTLVTypeCryptoBinding,
+			    CRYPTO_BINDING_TLV_LENGTH);
+	memset(((uint8_t *)cb) + TLV_HEADER_LENGTH, 0x5a,
+	       CRYPTO_BINDING_TLV_LENGTH);
+	cb->cb_reserved = 0;
+	cb->cb_version = kEAPFASTVersion1;
+	cb->cb_received_version = kEAPFASTVersion1;
+	cb->cb_sub_type = kCryptoBindingSubTypeBindingRequest;
+	break;
+    case 2:
+	/* Result + PAC provisioning */
+	make_result(&b, kTLVStatusSuccess);
+	pac = BufferAppendTLV(&b, kTLVTypePAC,
+			      (TLV_HEADER_LENGTH + 32)
+			      + (TLV_HEADER_LENGTH + 64)
+			      + (TLV_HEADER_LENGTH
+				 + (TLV_HEADER_LENGTH + 16)
+				 + (TLV_HEADER_LENGTH + 8)));
+	ptr = pac->tlv_value;
+	append_pac_attribute(&ptr, kPACTLVAttributeTypePAC_Key, 0x11, 32);
+	append_pac_attribute(&ptr, kPACTLVAttributeTypePAC_Opaque, 0x22, 64);
+	TLVInit((TLVRef)ptr, kPACTLVAttributeTypePAC_Info,
+		(TLV_HEADER_LENGTH + 16) + (TLV_HEADER_LENGTH + 8));
+	ptr += TLV_HEADER_LENGTH;
+	append_pac_attribute(&ptr, kPACTLVAttributeTypeA_ID, 0x33, 16);
+	append_pac_attribute(&ptr, kPACTLVAttributeTypeI_ID, 'u', 8);
+	break;
+    case 3:
+	/* Result + Error + NAK of an unknown mandatory TLV */
+	make_result(&b, kTLVStatusFailure);
+	make_error(&b, kErrorTLVErrorCodeUnexpectedTLVsExchanged);
+	pac = BufferAppendTLV(&b, kTLVTypeMandatoryBit | 0x1f, 4);
+	memset(pac->tlv_value, 0, 4);
+	make_nak(&b, pac);
+	break;
+    default:
+	return (0);
+    }
+    return (BufferGetUsed(&b));
+}
+
+static bool
+tlv_is_contained(const void * tlv, const uint8_t * buf, int size)
+{
+    const uint8_t *	p = (const uint8_t *)tlv;
+
+    if (tlv == NULL) {
+	return (TRUE);
+    }
+    return (p >= buf
+	    && p + TLV_HEADER_LENGTH <= buf + size
+	    && p + TLV_HEADER_LENGTH + TLVGetLength((TLVRef)tlv)
+	    <= buf + size);
+}
+
+static bool
+tlvlist_is_consistent(TLVListRef tlvlist_p, const uint8_t * buf, int size)
+{
+    PACTLVAttributeListRef	pac_tlvs = &tlvlist_p->pac_tlvs;
+
+    return (tlv_is_contained(tlvlist_p->result, buf, size)
+	    && tlv_is_contained(tlvlist_p->nak, buf, size)
+	    && tlv_is_contained(tlvlist_p->error, buf, size)
+	    && tlv_is_contained(tlvlist_p->eap, buf, size)
+	    && tlv_is_contained(tlvlist_p->intermediate, buf, size)
+	    && tlv_is_contained(tlvlist_p->crypto, buf, size)
+	    && tlv_is_contained(tlvlist_p->mandatory, buf, size)
+	    && tlv_is_contained(tlvlist_p->pac, buf, size)
+	    && tlv_is_contained(pac_tlvs->key, buf, size)
+	    && tlv_is_contained(pac_tlvs->opaque, buf, size)
+	    && tlv_is_contained(pac_tlvs->info, buf, size)
+	    && tlv_is_contained(pac_tlvs->a_id, buf, size)
+	    && tlv_is_contained(pac_tlvs->i_id, buf, size)
+	    && tlv_is_contained(pac_tlvs->a_id_info, buf, size)
+	    && tlv_is_contained(pac_tlvs->type, buf, size));
+}
+
+static int
+mutate(uint8_t * buf, int size, int max_size)
+{
+    int		n;
+
+    switch (random() % 4) {
+    case 0:
+	/* flip a few bits */
+	for (n = 1 + random() % 4; n > 0 && size > 0; n--) {
+	    buf[random() % size] ^= (1 << (random() % 8));
+	}
+	break;
+    case 1:
+	/* overwrite a length */
+	if (size >= 2) {
+	    n = random() % (size - 1);
+	    net_uint16_set(buf + n, random() & 0xffff);
+	}
+	break;
+    case 2:
+	/* truncate */
+	if (size > 0) {
+	    size = random() % size;
+	}
+	break;
+    case 3:
+	/* duplicate a tail, creating repeated TLVs */
+	if (size > 0) {
+	    n = random() % size;
+	    if (size + (size - n) <= max_size) {
+		memcpy(buf + size, buf + n, size - n);
+		size += size - n;
+	    }
+	}
+	break;
+    }
+    return (size);
+}
+
+static int
+fuzz(long count, unsigned int seed)
+{
+    int			accepted = 0;
+    uint8_t		buf[SAMPLE_MESSAGE_SIZE * 2];
+    long		i;
+    int			ret = 0;
+    int			size;
+    CFMutableStringRef	str;
+    TLVList		tlvlist;
+
+    srandom(seed);
+    str = CFStringCreateMutable(NULL, 0);
+    for (i = 0; i < count; i++) {
+	size = build_seed(i % 4, buf, sizeof(buf));
+	size = mutate(buf, size, sizeof(buf));
+	if (TLVListParse(&tlvlist, buf, size, NULL)) {
+	    accepted++;
+	    if (tlvlist_is_consistent(&tlvlist, buf, size) == FALSE) {
+		printf("fuzz iteration %ld: TLV outside the message\n", i);
+		print_data(buf, size);
+		ret = 1;
+	    }
+	}
+	if ((i % 64) == 0) {
+	    /* exercise the description path too */
+	    (void)TLVListParse(NULL, buf, size, str);
+	    CFStringDelete(str, CFRangeMake(0, CFStringGetLength(str)));
+	}
+    }
+    CFRelease(str);
+    printf("fuzz: %ld inputs, %d accepted, %ld rejected\n",
+	   count, accepted, count - accepted);
+    return (ret);
+}
+
+static void
+benchmark(void)
+{
+    uint8_t		buf[SAMPLE_MESSAGE_SIZE];
+    int			i;
+    int			size;
+    CFAbsoluteTime	start;
+    CFAbsoluteTime	t;
+    TLVList		tlvlist;
+
+    size = build_seed(2, buf, sizeof(buf));
+    if (TLVListParse(&tlvlist, buf, size, NULL) == FALSE
+	|| tlvlist.result == NULL || tlvlist.pac_tlvs.key == NULL
+	|| tlvlist.pac_tlvs.a_id == NULL || tlvlist.pac_tlvs.i_id == NULL
+	|| TLVCountsGet(&tlvlist.counts, kTLVTypePAC) != 1) {
+	printf("sample message parse: FAILED\n");
+	exit(1);
+    }
+    start = CFAbsoluteTimeGetCurrent();
+    for (i = 0; i < N_PARSE_ITERATIONS; i++) {
+	(void)TLVListParse(&tlvlist, buf, size, NULL);
+    }
+    t = CFAbsoluteTimeGetCurrent() - start;
+    printf("TLVListParse: %d byte message, %g nsecs/message, %g MB/s\n",
+	   size, t * 1e9 / N_PARSE_ITERATIONS,
+	   (double)size * N_PARSE_ITERATIONS / t / (1024 * 1024));
+    return;
+}
+
+static int
+write_file(const char * dir, const char * name, int i,
+	   const uint8_t * buf, int size)
+{
+    int		fd;
+    char	path[MAXPATHLEN];
+
+    snprintf(path, sizeof(path), "%s/%s-%05d", dir, name, i);
+    fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0) {
+	fprintf(stderr, "open(%s) failed, %s\n", path, strerror(errno));
+	return (-1);
+    }
+    (void)write(fd, buf, size);
+    close(fd);
+    return (0);
+}
+
+static int
+write_corpus(const char * dir)
+{
+    uint8_t		buf[SAMPLE_MESSAGE_SIZE * 2];
+    int			i;
+    int			size;
+
+    (void)mkdir(dir, 0755);
+    for (i = 0; i < 4; i++) {
+	size = build_seed(i, buf, sizeof(buf));
+	if (write_file(dir, "seed", i, buf, size) != 0) {
+	    return (1);
+	}
+    }
+    srandom(0);
+    for (i = 0; i < N_CORPUS_MUTATIONS; i++) {
+	size = build_seed(i % 4, buf, sizeof(buf));
+	size = mutate(buf, size, sizeof(buf));
+	if (write_file(dir, "mutant", i, buf, size) != 0) {
+	    return (1);
+	}
+    }
+    return (0);
+}
+
+int
+main(int argc, char * argv[])
+{
+    int		ret;
+
+    if (argc >= 3 && strcmp(argv[1], "corpus") == 0) {
+	exit(write_corpus(argv[2]));
+    }
+    if (argc >= 3 && strcmp(argv[1], "fuzz") == 0) {
+	exit(fuzz(strtol(argv[2], NULL, 0),
+		  (argc >= 4) ? (unsigned int)strtoul(argv[3], NULL, 0) : 0));
+    }
+    benchmark();
+    ret = fuzz(N_FUZZ_ITERATIONS, 0);
+    exit(ret);
+    return (ret);
+}
+#endif /* TEST_TLV_PARSE */
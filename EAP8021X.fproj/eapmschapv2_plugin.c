@@ -244,6 +244,7 @@ typedef struct {
     uint8_t			peer_challenge[MSCHAP2_CHALLENGE_SIZE];
     uint8_t			nt_response[MSCHAP_NT_RESPONSE_SIZE];
     uint8_t			auth_challenge[MSCHAP2_CHALLENGE_SIZE];
+    MSCHAPSecretRef		secret;	/* of password used for nt_response */
     eapmschap2_session_key	session_key;
     bool			session_key_valid;
     uint8_t			pkt_buffer[1024];
@@ -252,6 +253,7 @@ typedef struct {
 static void
 eapmschapv2_free_context(EAPMSCHAPv2PluginData * context)
 {
+    MSCHAPSecretRelease(&context->secret);
     free(context);
     return;
 }
@@ -278,6 +280,7 @@ eapmschapv2_init(EAPClientPluginDataRef plugin, CFArrayRef * require_props,
     *require_props = NULL;
     context = malloc(sizeof(*context));
     plugin->private = context;
+    context->secret = NULL;
     EAPMSCHAPv2PluginDataInit(context);
     context->last_generation = plugin->generation;
     return (result);
@@ -352,9 +355,19 @@ EAPMSCHAPv2ResponsePacketCreate(EAPClientPluginDataRef plugin,
 	MSChapFillWithRandom(context->peer_challenge,
 			     sizeof(context->peer_challenge));
     }
-    MSChap2(context->auth_challenge, context->peer_challenge, 	
-	    plugin->username, plugin->password, plugin->password_length,
-	    context->nt_response);
+    MSCHAPSecretRelease(&context->secret);
+    context->secret = MSCHAPSecretCopy(plugin->password,
+				       plugin->password_length);
+    if (context->secret == NULL) {
+	if (client_status != NULL) {
+	    *client_status = kEAPClientStatusAllocationFailed;
+	}
+	context->plugin_state = kEAPClientStateFailure;
+	return (NULL);
+    }
+    MSChap2WithSecret(context->auth_challenge, context->peer_challenge,
+		      plugin->username, context->secret,
+		      context->nt_response);
 
     /* fill in the data */
     out_pkt_p->op_code = kMSCHAPv2OpCodeResponse;
@@ -443,15 +456,13 @@ eapmschapv2_challenge(EAPClientPluginDataRef plugin,
 }
 
 static void
-eapmschapv2_compute_session_key(EAPMSCHAPv2PluginDataRef context,
-				const char * password,
-				int password_length)
+eapmschapv2_compute_session_key(EAPMSCHAPv2PluginDataRef context)
 {
     uint8_t				master_key[NT_MASTER_KEY_SIZE];
 
-    MSChap2_MPPEGetMasterKey((const uint8_t *)password, password_length,
-			     context->nt_response,
-			     master_key);
+    MSChap2_MPPEGetMasterKeyWithSecret(context->secret,
+				       context->nt_response,
+				       master_key);
     /* MasterSendKey */
     MSChap2_MPPEGetAsymetricStartKey(master_key,
 				     context->session_key.master_send_key,
@@ -474,11 +485,7 @@ eapmschapv2_success_request(EAPClientPluginDataRef plugin,
 			    EAPClientDomainSpecificError * error)
 {
     EAPMSCHAPv2PluginDataRef 		context;
-    char *				new_password = NULL;
-    CFStringRef				new_password_cf;
     EAPMSCHAPv2SuccessResponsePacketRef	out_pkt_p = NULL;
-    const char *			password;
-    int					password_length;
     EAPMSCHAPv2SuccessRequestPacketRef	r_p;
     Boolean				valid;
 		
@@ -489,22 +496,15 @@ eapmschapv2_success_request(EAPClientPluginDataRef plugin,
     context = (EAPMSCHAPv2PluginDataRef)plugin->private;
     switch (context->state) {
     case kMSCHAPv2ClientStateChangePasswordSent:
-	new_password_cf 
-	    = CFDictionaryGetValue(plugin->properties,
-				   kEAPClientPropNewPassword);
-	if (new_password_cf == NULL) {
-	    EAPLOG_FL(LOG_NOTICE, "NewPassword is missing");
-	    goto done;
-	}
-	new_password = my_CFStringToCString(new_password_cf,
-					    kCFStringEncodingUTF8);
-	password = new_password;
-	password_length = (int)strlen(new_password);
-	break;
     case kMSCHAPv2ClientStateResponseSent:
     case kMSCHAPv2ClientStateSuccess:
-	password = (const char *)plugin->password;
-	password_length = plugin->password_length;
+	/*
+	 * context->secret was derived from the password (old or new) that
+	 * was used to compute nt_response
+	 */
+	if (context->secret == NULL) {
+	    goto done;
+	}
 	break;
     case kMSCHAPv2ClientStateFailure:
     default:
@@ -512,13 +512,12 @@ eapmschapv2_success_request(EAPClientPluginDataRef plugin,
     }
     /* process success request */
     r_p = (EAPMSCHAPv2SuccessRequestPacketRef)in_pkt_p;
-    valid = MSChap2AuthResponseValid((const uint8_t *)password,
-				     password_length,
-				     context->nt_response,
-				     context->peer_challenge,
-				     context->auth_challenge,
-				     (const uint8_t *)plugin->username,
-				     r_p->auth_response);
+    valid = MSChap2AuthResponseValidWithSecret(context->secret,
+					       context->nt_response,
+					       context->peer_challenge,
+					       context->auth_challenge,
+					       (const uint8_t *)plugin->username,
+					       r_p->auth_response);
     if (valid == FALSE) {
 	EAPLOG(LOG_NOTICE,
 	       "eapmschapv2_success_request: invalid server auth response");
@@ -537,7 +536,7 @@ eapmschapv2_success_request(EAPClientPluginDataRef plugin,
     default:
 	break;
     }
-    eapmschapv2_compute_session_key(context, password, password_length);
+    eapmschapv2_compute_session_key(context);
     context->state = kMSCHAPv2ClientStateSuccess;
     out_pkt_p = (EAPMSCHAPv2SuccessResponsePacketRef)
 	EAPPacketCreate(context->pkt_buffer, sizeof(context->pkt_buffer),
@@ -547,9 +546,6 @@ eapmschapv2_success_request(EAPClientPluginDataRef plugin,
 			NULL);
     out_pkt_p->op_code = kMSCHAPv2OpCodeSuccess;
  done:
-    if (new_password != NULL) {
-	free(new_password);
-    }
     return ((EAPMSCHAPv2PacketRef)out_pkt_p);
 }
 
@@ -630,10 +626,19 @@ EAPMSCHAPv2ChangePasswordPacketCreate(EAPClientPluginDataRef plugin,
     MSChapFillWithRandom(context->peer_challenge,
 			 sizeof(context->peer_challenge));
     /* compute nt_response using challenge from error packet and new password */
-    MSChap2(context->auth_challenge, context->peer_challenge,
-	    plugin->username,
-	    (const uint8_t *)new_password, new_password_length,
-	    context->nt_response);
+    MSCHAPSecretRelease(&context->secret);
+    /* not the current password until the change succeeds, don't cache */
+    context->secret = MSCHAPSecretCreate((const uint8_t *)new_password,
+					 new_password_length);
+    if (context->secret == NULL) {
+	if (client_status != NULL) {
+	    *client_status = kEAPClientStatusAllocationFailed;
+	}
+	return (NULL);
+    }
+    MSChap2WithSecret(context->auth_challenge, context->peer_challenge,
+		      plugin->username, context->secret,
+		      context->nt_response);
 
     /* fill in the packet */
     out_pkt_p->op_code = kMSCHAPv2OpCodeChangePassword;
@@ -206,6 +206,32 @@ eapol_socket(const char * ifname, bool is_wireless)
     
 }
 
+int
+eapol_socket_get_mtu(const char * ifname)
+{
+    struct ifreq	ifr;
+    int			mtu = -1;
+    int			s;
+
+    s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s < 0) {
+	EAPLOG_FL(LOG_NOTICE, "socket() failed: %s",
+		  strerror(errno));
+	return (-1);
+    }
+    bzero(&ifr, sizeof(ifr));
+    strlcpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name));
+    if (ioctl(s, SIOCGIFMTU, (caddr_t)&ifr) < 0) {
+	EAPLOG_FL(LOG_NOTICE, "SIOCGIFMTU(%s) failed, %s",
+		  ifname, strerror(errno));
+    }
+    else {
+	mtu = ifr.ifr_mtu;
+    }
+    close(s);
+    return (mtu);
+}
+
 #ifdef TEST_EAPOL_SOCKET
 
 static int
@@ -45,5 +45,13 @@
 int
 eapol_socket(const char * ifname, bool is_wireless);
 
+/*
+ * Function: eapol_socket_get_mtu
+ * Purpose:
+ *   Return the MTU of the given interface, or -1 if it can't be retrieved.
+ */
+int
+eapol_socket_get_mtu(const char * ifname);
+
 #endif /* _S_EAPOL_SOCKET_H */
 
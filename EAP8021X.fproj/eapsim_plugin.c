@@ -46,6 +46,10 @@
 #include <stdio.h>
 #include <syslog.h>
 #include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <CommonCrypto/CommonDigest.h>
 #include <CommonCrypto/CommonCryptor.h>
 #include <sys/param.h>
@@ -62,7 +66,7 @@
 #include "EAPSIMAKA.h"
 #include "EAPSIMAKAUtil.h"
 #include "EAPLog.h"
-#include "sim_simulator.h"
+#include "sim_simulator_internal.h"
 
 #define EAP_SIM_NAME		"EAP-SIM"
 
@@ -86,6 +90,22 @@
 #define kEAPClientPropEAPSIMSRESList		CFSTR("EAPSIMSRESList") /* array[data] */
 #define kEAPClientPropEAPSIMRANDList		CFSTR("EAPSIMSRANDList") /* array[data] */
 
+/*
+ * kEAPClientPropEAPSIMTripletsFile
+ * - path to a file holding static triplets, used instead of the parallel
+ *   arrays above; the file is a packed array of SIMStaticTriplet records
+ *   (RAND, SRES, Kc) with no header, and is mapped read-only
+ */
+#define kEAPClientPropEAPSIMTripletsFile	CFSTR("EAPSIMTripletsFile") /* string */
+
+/*
+ * kEAPClientPropEAPSIMSimulatorLatency
+ * - when kEAPClientPropEAPSIMAKAKi and kEAPClientPropEAPSIMAKAOPc select the
+ *   MILENAGE soft-sim, the time in microseconds that each authentication
+ *   request takes, to model the round trip to a real SIM
+ */
+#define kEAPClientPropEAPSIMSimulatorLatency	CFSTR("EAPSIMSimulatorLatency") /* number */
+
 /*
  * Declare these here to ensure that the compiler
  * generates appropriate errors/warnings
@@ -120,12 +140,43 @@ enum {
 };
 typedef int	EAPSIMClientState;
 
+/*
+ * Type: SIMStaticTriplet
+ * Purpose:
+ *   One packed (RAND, SRES, Kc) record, the format of both the in-memory
+ *   table and kEAPClientPropEAPSIMTripletsFile.
+ */
 typedef struct {
-    CFArrayRef			kc;
-    CFArrayRef			sres;
-    CFArrayRef			rand;
+    uint8_t			rand[SIM_RAND_SIZE];
+    uint8_t			sres[SIM_SRES_SIZE];
+    uint8_t			kc[SIM_KC_SIZE];
+} SIMStaticTriplet;
+
+#define SIM_STATIC_TRIPLETS_MAX		(1024 * 1024)
+
+/*
+ * Type: SIMStaticTriplets
+ * Purpose:
+ *   A table of static triplets, either mapped from a file or copied from
+ *   the configuration into a single allocation, with an open-addressed
+ *   hash index on RAND.  The index holds (record index + 1), 0 marks an
+ *   empty slot.  If the configuration supplies no RAND values, there is no
+ *   index and the first record is always used.
+ */
+typedef struct {
+    const SIMStaticTriplet *	list;
+    uint32_t			count;
+    uint32_t *			index;
+    uint32_t			index_mask;
+    void *			map;
+    size_t			map_size;
+} SIMStaticTriplets, * SIMStaticTripletsRef;
+
+typedef struct {
+    SIMStaticTriplets		triplets;
     CFDataRef			ki;
     CFDataRef			opc;
+    uint32_t			latency_usecs;
 } SIMStatic, * SIMStaticRef;
 
 /*
@@ -148,6 +199,7 @@ typedef struct {
     uint8_t				nonce_mt[NONCE_MT_SIZE];
     EAPSIMAKAPersistentStateRef		persist;
     bool				reauth_success;
+    bool				proactive_reauth;
     EAPSIMAKAEncryptedIdentityInfoRef	encrypted_identity_info;
     uint16_t *				version_list;
     int					version_list_count;
@@ -232,7 +284,6 @@ S_get_plist_int(CFDictionaryRef plist, CFStringRef key, int def)
 	return (ret);
 }
 
-#if TARGET_OS_EMBEDDED
 static bool
 S_get_plist_bool(CFDictionaryRef plist, CFStringRef key, bool def)
 {
@@ -245,7 +296,6 @@ S_get_plist_bool(CFDictionaryRef plist, CFStringRef key, bool def)
 	}
 	return (ret);
 }
-#endif /* TARGET_OS_EMBEDDED */
 
 STATIC bool
 blocks_are_duplicated(const uint8_t * blocks, int n_blocks, int block_size)
@@ -537,6 +587,7 @@ SIMStaticSimulatedSIMInitFromProperties(SIMStaticRef sim_static_p,
 					CFDictionaryRef properties)
 {
     CFDataRef 	ki;
+    int		latency;
     CFDataRef 	opc;
     bool	success = FALSE;
 
@@ -550,20 +601,195 @@ SIMStaticSimulatedSIMInitFromProperties(SIMStaticRef sim_static_p,
 	sim_static_p->opc = opc;
 	CFRetain(ki);
 	CFRetain(opc);
+	latency = S_get_plist_int(properties,
+				  kEAPClientPropEAPSIMSimulatorLatency, 0);
+	if (latency > 0) {
+	    sim_static_p->latency_usecs = (uint32_t)latency;
+	}
 	success = TRUE;
     }
     return (success);
 }
 
+static inline uint32_t
+SIMStaticRANDHash(const uint8_t rand[SIM_RAND_SIZE])
+{
+    uint64_t	w0;
+    uint64_t	w1;
+
+    bcopy(rand, &w0, sizeof(w0));
+    bcopy(rand + sizeof(w0), &w1, sizeof(w1));
+    return ((uint32_t)(((w0 * 0x9E3779B97F4A7C15ULL) ^ w1)
+		       * 0xC2B2AE3D27D4EB4FULL >> 32));
+}
+
+STATIC void
+SIMStaticTripletsFree(SIMStaticTripletsRef triplets)
+{
+    if (triplets->map != NULL) {
+	munmap(triplets->map, triplets->map_size);
+	free(triplets->index);
+    }
+    else if (triplets->list != NULL) {
+	/* copied from the configuration, the index is in the same block */
+	free((void *)triplets->list);
+    }
+    bzero(triplets, sizeof(*triplets));
+    return;
+}
+
+/*
+ * Function: SIMStaticTripletsIndexSize
+ * Purpose:
+ *   Return the number of index slots for "count" records: a power of two
+ *   at least twice the count, so probe sequences stay short.
+ */
+STATIC uint32_t
+SIMStaticTripletsIndexSize(uint32_t count)
+{
+    uint32_t	size = 16;
+
+    while (size < count * 2) {
+	size <<= 1;
+    }
+    return (size);
+}
+
+STATIC void
+SIMStaticTripletsBuildIndex(SIMStaticTripletsRef triplets)
+{
+    uint32_t	i;
+
+    for (i = 0; i < triplets->count; i++) {
+	uint32_t		slot;
+	const uint8_t *		rand = triplets->list[i].rand;
+
+	slot = SIMStaticRANDHash(rand) & triplets->index_mask;
+	while (triplets->index[slot] != 0) {
+	    uint32_t	where = triplets->index[slot] - 1;
+
+	    if (bcmp(triplets->list[where].rand, rand, SIM_RAND_SIZE) == 0) {
+		/* duplicate RAND, the first one wins */
+		break;
+	    }
+	    slot = (slot + 1) & triplets->index_mask;
+	}
+	if (triplets->index[slot] == 0) {
+	    triplets->index[slot] = i + 1;
+	}
+    }
+    return;
+}
+
+STATIC const SIMStaticTriplet *
+SIMStaticTripletsLookup(SIMStaticTripletsRef triplets,
+			const uint8_t rand[SIM_RAND_SIZE])
+{
+    uint32_t	slot;
+
+    if (triplets->index == NULL) {
+	/* no RAND values configured, use the first triplet */
+	return (triplets->list);
+    }
+    slot = SIMStaticRANDHash(rand) & triplets->index_mask;
+    while (triplets->index[slot] != 0) {
+	const SIMStaticTriplet *	t;
+
+	t = triplets->list + triplets->index[slot] - 1;
+	if (bcmp(t->rand, rand, SIM_RAND_SIZE) == 0) {
+	    return (t);
+	}
+	slot = (slot + 1) & triplets->index_mask;
+    }
+    return (NULL);
+}
+
+/*
+ * Function: SIMStaticTripletsInitFromFile
+ * Purpose:
+ *   Map the packed triplet records in the file at "path" and index them.
+ *   The only allocation is the index itself.
+ */
 STATIC bool
-SIMStaticTripletsInitFromProperties(SIMStaticRef sim_static_p,
+SIMStaticTripletsInitFromFile(SIMStaticTripletsRef triplets, const char * path)
+{
+    size_t		count;
+    int			fd;
+    void *		map = MAP_FAILED;
+    uint32_t		n_slots;
+    struct stat		sb;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+	EAPLOG_FL(LOG_NOTICE, "open(%s) failed, %s", path, strerror(errno));
+	return (FALSE);
+    }
+    if (fstat(fd, &sb) < 0) {
+	EAPLOG_FL(LOG_NOTICE, "fstat(%s) failed, %s", path, strerror(errno));
+	goto failed;
+    }
+    count = (size_t)sb.st_size / sizeof(SIMStaticTriplet);
+    if (sb.st_size <= 0
+	|| ((size_t)sb.st_size % sizeof(SIMStaticTriplet)) != 0
+	|| count > SIM_STATIC_TRIPLETS_MAX) {
+	EAPLOG_FL(LOG_NOTICE, "%s: invalid size %lld", path,
+		  (long long)sb.st_size);
+	goto failed;
+    }
+    map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+	EAPLOG_FL(LOG_NOTICE, "mmap(%s) failed, %s", path, strerror(errno));
+	goto failed;
+    }
+    n_slots = SIMStaticTripletsIndexSize((uint32_t)count);
+    triplets->index = (uint32_t *)calloc(n_slots, sizeof(uint32_t));
+    if (triplets->index == NULL) {
+	munmap(map, (size_t)sb.st_size);
+	goto failed;
+    }
+    close(fd);
+    triplets->map = map;
+    triplets->map_size = (size_t)sb.st_size;
+    triplets->list = (const SIMStaticTriplet *)map;
+    triplets->count = (uint32_t)count;
+    triplets->index_mask = n_slots - 1;
+    SIMStaticTripletsBuildIndex(triplets);
+    return (TRUE);
+
+ failed:
+    close(fd);
+    return (FALSE);
+}
+
+STATIC bool
+SIMStaticTripletsInitFromProperties(SIMStaticTripletsRef triplets,
 				    CFDictionaryRef properties)
 {
+    void *		buf;
     CFIndex		count;
-    CFArrayRef		kc;
-    CFArrayRef		rand;
-    CFArrayRef		sres;
-
+    int			i;
+    CFArrayRef		kc = NULL;
+    SIMStaticTriplet *	list;
+    uint32_t		n_slots = 0;
+    CFStringRef		path;
+    CFArrayRef		rand = NULL;
+    CFArrayRef		sres = NULL;
+    bool		success = FALSE;
+
+    path = (properties != NULL)
+	? isA_CFString(CFDictionaryGetValue(properties,
+					    kEAPClientPropEAPSIMTripletsFile))
+	: NULL;
+    if (path != NULL) {
+	char *	c_path;
+
+	c_path = my_CFStringToCString(path, kCFStringEncodingUTF8);
+	if (c_path != NULL) {
+	    success = SIMStaticTripletsInitFromFile(triplets, c_path);
+	    free(c_path);
+	}
+	return (success);
+    }
     kc = copy_data_array(properties,
 			 kEAPClientPropEAPSIMKcList,
 			 SIM_KC_SIZE);
@@ -582,24 +808,56 @@ SIMStaticTripletsInitFromProperties(SIMStaticRef sim_static_p,
      * and the corresponding Kc and SRES value is retrieved.
      */
     if (kc == NULL || sres == NULL) {
-	goto failed;
+	goto done;
     }
     count = CFArrayGetCount(kc);
     if (count != CFArrayGetCount(sres)
 	|| (rand != NULL && count != CFArrayGetCount(rand))) {
 	/* they need to be parallel arrays */
-	goto failed;
+	goto done;
     }
-    sim_static_p->kc = kc;
-    sim_static_p->sres = sres;
-    sim_static_p->rand = rand;
-    return (TRUE);
+    if (count > SIM_STATIC_TRIPLETS_MAX) {
+	EAPLOG_FL(LOG_NOTICE, "too many static triplets (%ld)", (long)count);
+	goto done;
+    }
+    if (rand == NULL) {
+	/* only the first triplet is ever used */
+	count = 1;
+    }
+    else {
+	n_slots = SIMStaticTripletsIndexSize((uint32_t)count);
+    }
+
+    /* one allocation: the records followed by the index */
+    buf = calloc(1, count * sizeof(*list) + n_slots * sizeof(uint32_t));
+    if (buf == NULL) {
+	goto done;
+    }
+    list = (SIMStaticTriplet *)buf;
+    for (i = 0; i < count; i++) {
+	bcopy(CFDataGetBytePtr(CFArrayGetValueAtIndex(kc, i)),
+	      list[i].kc, SIM_KC_SIZE);
+	bcopy(CFDataGetBytePtr(CFArrayGetValueAtIndex(sres, i)),
+	      list[i].sres, SIM_SRES_SIZE);
+	if (rand != NULL) {
+	    bcopy(CFDataGetBytePtr(CFArrayGetValueAtIndex(rand, i)),
+		  list[i].rand, SIM_RAND_SIZE);
+	}
+    }
+    triplets->list = list;
+    triplets->count = (uint32_t)count;
+    if (n_slots != 0) {
+	triplets->index = (uint32_t *)(list + count);
+	triplets->index_mask = n_slots - 1;
+	SIMStaticTripletsBuildIndex(triplets);
+    }
+    success = TRUE;
 
-failed:
+ done:
     my_CFRelease(&kc);
     my_CFRelease(&sres);
     my_CFRelease(&rand);
-    return (FALSE);
+    return (success);
 }
 
 STATIC bool
@@ -608,14 +866,13 @@ SIMStaticInitFromProperties(SIMStaticRef sim_static_p,
 {
     bool	success = FALSE;
 
-    my_CFRelease(&sim_static_p->kc);
-    my_CFRelease(&sim_static_p->sres);
-    my_CFRelease(&sim_static_p->rand);
+    SIMStaticTripletsFree(&sim_static_p->triplets);
     my_CFRelease(&sim_static_p->ki);
     my_CFRelease(&sim_static_p->opc);
 
     if (properties != NULL) {
-	success = SIMStaticTripletsInitFromProperties(sim_static_p, properties);
+	success = SIMStaticTripletsInitFromProperties(&sim_static_p->triplets,
+						      properties);
 	if (success == FALSE) {
 	    success = SIMStaticSimulatedSIMInitFromProperties(sim_static_p,
 							      properties);
@@ -631,33 +888,13 @@ EAPSIMContextFree(EAPSIMContextRef context)
     EAPSIMContextSetVersionList(context, NULL, 0);
     SIMStaticInitFromProperties(&context->sim_static, NULL);
     EAPSIMAKAPersistentStateRelease(context->persist);
+    EAPSIMAKAKeyInfoRelease(&context->key_info);
     EAPSIMContextSetLastIdentity(context, NULL);
     EAPSIMContextClear(context);
     free(context);
     return;
 }
 
-STATIC int
-EAPSIMContextLookupStaticRAND(EAPSIMContextRef context, 
-			      const uint8_t rand[SIM_RAND_SIZE])
-{
-    if (context->sim_static.rand != NULL) {
-	CFIndex	count;
-	int		i;
-
-	count = CFArrayGetCount(context->sim_static.rand);
-	for (i = 0; i < count; i++) {
-	    CFDataRef	data;
-
-	    data = CFArrayGetValueAtIndex(context->sim_static.rand, i);
-	    if (bcmp(rand, CFDataGetBytePtr(data), SIM_RAND_SIZE) == 0) {
-		return (i);
-	    }
-	}
-    }
-    return (-1);
-}
-
 STATIC bool
 EAPSIMContextSIMProcessRAND(EAPSIMContextRef context, 
 			    const uint8_t * rand_p, int count,
@@ -669,32 +906,22 @@ EAPSIMContextSIMProcessRAND(EAPSIMContextRef context,
     uint8_t *		sres_scan;
     SIMStatic *		sim_static_p = &context->sim_static;
 
-    if (sim_static_p->kc != NULL) {
+    if (sim_static_p->triplets.count != 0) {
         /* use the static SIM information */
         rand_scan = rand_p;
         kc_scan = kc_p;
         sres_scan = sres_p;
         for (i = 0; i < count; i++) {
-            CFDataRef	kc_data;
-            CFDataRef	sres_data;
-            int		where;
-            
-            if (sim_static_p->rand != NULL) {
-                where = EAPSIMContextLookupStaticRAND(context, rand_scan);
-                if (where == -1) {
-                    EAPLOG(LOG_NOTICE, "eapsim: can't find static RAND value");
-                    return (FALSE);
-                }
-            }
-	    else {
-                /* If RAND is NULL, choose first KC and SRES */
-                where = 0;
+            const SIMStaticTriplet *	triplet;
+
+            triplet = SIMStaticTripletsLookup(&sim_static_p->triplets,
+					      rand_scan);
+            if (triplet == NULL) {
+                EAPLOG(LOG_NOTICE, "eapsim: can't find static RAND value");
+                return (FALSE);
             }
-    
-            kc_data = CFArrayGetValueAtIndex(sim_static_p->kc, where);
-            bcopy(CFDataGetBytePtr(kc_data), kc_scan, SIM_KC_SIZE);
-            sres_data = CFArrayGetValueAtIndex(sim_static_p->sres, where);
-            bcopy(CFDataGetBytePtr(sres_data), sres_scan, SIM_SRES_SIZE);
+            bcopy(triplet->kc, kc_scan, SIM_KC_SIZE);
+            bcopy(triplet->sres, sres_scan, SIM_SRES_SIZE);
             
             /* move to the next element */
             rand_scan += SIM_RAND_SIZE;
@@ -703,16 +930,15 @@ EAPSIMContextSIMProcessRAND(EAPSIMContextRef context,
         }
     }
     else if (sim_static_p->ki != NULL && sim_static_p->opc != NULL) {
-	rand_scan = rand_p;
-	kc_scan = kc_p;
-	sres_scan = sres_p;
-	for (i = 0; i < count; i++) {
-	    sim_simulator_gsm_milenage_algo(CFDataGetBytePtr(sim_static_p->opc),
-					    CFDataGetBytePtr(sim_static_p->ki),
-					    rand_scan, sres_scan, kc_scan);
-	    kc_scan += SIM_KC_SIZE;
-	    sres_scan += SIM_SRES_SIZE;
-	    rand_scan += SIM_RAND_SIZE;
+	sim_simulator_gsm	sim;
+
+	sim.opc = CFDataGetBytePtr(sim_static_p->opc);
+	sim.ki = CFDataGetBytePtr(sim_static_p->ki);
+	sim.latency_usecs = sim_static_p->latency_usecs;
+	if (!sim_simulator_gsm_authenticate_batch(&sim, rand_p, count,
+						  kc_p, sres_p)) {
+	    EAPLOG(LOG_NOTICE, "eapsim: soft-sim authentication failed");
+	    return (FALSE);
 	}
     }
     else {
@@ -789,10 +1015,14 @@ eapsim_init(EAPClientPluginDataRef plugin, CFArrayRef * require_props,
     }
     if (EAPSIMAKAPersistentStateGetReauthID(context->persist) != NULL) {
 	/* now run PRF to generate keying material */
-	fips186_2prf(EAPSIMAKAPersistentStateGetMasterKey(context->persist),
-		     context->key_info.key);
+	EAPSIMAKAKeyInfoComputeKeys(&context->key_info,
+				    EAPSIMAKAPersistentStateGetMasterKey(context->persist));
 	context->key_info_valid = TRUE;
     }
+    context->proactive_reauth
+	= S_get_plist_bool(plugin->properties,
+			   kEAPClientPropEAPSIMAKAProactiveFastReauthentication,
+			   false);
     if (plugin->encryptedEAPIdentity == NULL) {
 	context->encrypted_identity_info
 	= EAPSIMAKAInitEncryptedIdentityInfo(kEAPTypeEAPSIM, plugin->properties, static_config);
@@ -858,6 +1088,55 @@ eapsim_make_client_error(EAPSIMContextRef context,
     return (pkt);
 }
 
+/*
+ * Function: eapsim_prepare_fast_reauth
+ * Purpose:
+ *   If proactive fast re-authentication is enabled and the persistent
+ *   state holds a reauth ID, make sure K_aut/K_encr are derived from the
+ *   cached master key so that a Reauthentication request can be verified
+ *   and decrypted without running the PRF first.
+ *
+ *   Returns TRUE if the reauth ID should be offered, FALSE otherwise.
+ */
+STATIC bool
+eapsim_prepare_fast_reauth(EAPSIMContextRef context)
+{
+    if (context->proactive_reauth == FALSE
+	|| !EAPSIMAKAPersistentStateFastReauthAvailable(context->persist)) {
+	return (FALSE);
+    }
+    if (context->key_info_valid == FALSE) {
+	EAPSIMAKAKeyInfoComputeKeys(&context->key_info,
+				    EAPSIMAKAPersistentStateGetMasterKey(context->persist));
+	context->key_info_valid = TRUE;
+    }
+    return (TRUE);
+}
+
+STATIC void
+save_persistent_state(EAPSIMContextRef context);
+
+/*
+ * Function: eapsim_fast_reauth_failed
+ * Purpose:
+ *   With proactive fast re-authentication, a reauth ID that the server
+ *   didn't accept is dropped so that the next attempt uses full
+ *   authentication right away.
+ */
+STATIC void
+eapsim_fast_reauth_failed(EAPSIMContextRef context)
+{
+    if (context->proactive_reauth
+	&& EAPSIMAKAPersistentStateFastReauthAvailable(context->persist)) {
+	EAPLOG(LOG_NOTICE,
+	       "eapsim: fast re-authentication failed, forgetting reauth id");
+	EAPSIMAKAPersistentStateSetReauthID(context->persist, NULL);
+	context->key_info_valid = FALSE;
+	save_persistent_state(context);
+    }
+    return;
+}
+
 STATIC void
 save_persistent_state(EAPSIMContextRef context)
 {
@@ -999,13 +1278,23 @@ eapsim_start(EAPSIMContextRef context,
 
     if (!skip_identity) {
 	CFDataRef	identity_data = NULL;
+	bool		offer_reauth_id;
 	Boolean		reauth_id_used = FALSE;
 
-	if (isA_CFData(context->plugin->encryptedEAPIdentity) != NULL &&
+#if TARGET_OS_EMBEDDED
+	offer_reauth_id = (identity_req_type == kAT_ANY_ID_REQ
+			   && eapsim_prepare_fast_reauth(context));
+#else /* TARGET_OS_EMBEDDED */
+	/* sim_identity_create() can't return a reauth ID without SIM access */
+	offer_reauth_id = FALSE;
+#endif /* TARGET_OS_EMBEDDED */
+	if (offer_reauth_id == FALSE &&
+	    isA_CFData(context->plugin->encryptedEAPIdentity) != NULL &&
 	    CFDataGetLength(context->plugin->encryptedEAPIdentity) > 0) {
 	    /* Wi-Fi calling case */
 	    identity_data = CFRetain(context->plugin->encryptedEAPIdentity);
-	} else if (context->encrypted_identity_info != NULL &&
+	} else if (offer_reauth_id == FALSE &&
+		   context->encrypted_identity_info != NULL &&
 		   (EAPSIMAKAPersistentStateTemporaryUsernameAvailable(context->persist) == FALSE ||
 		    identity_req_type == kAT_PERMANENT_ID_REQ)) {
 	    /* Carrier Wi-Fi hotspot case */
@@ -1089,7 +1378,7 @@ eapsim_start(EAPSIMContextRef context,
 STATIC bool
 eapsim_challenge_process_encr_data(EAPSIMContextRef context, TLVListRef tlvs_p)
 {
-    uint8_t *		decrypted_buffer = NULL;
+    uint8_t		decrypted_buffer[AT_ENCR_DATA_MAX_SIZE];
     TLVListDeclare(	decrypted_tlvs_p);
     AT_ENCR_DATA * 	encr_data_p;
     AT_IV * 		iv_p;
@@ -1107,10 +1396,10 @@ eapsim_challenge_process_encr_data(EAPSIMContextRef context, TLVListRef tlvs_p)
 	       "eapsim: Challenge missing AT_IV");
 	return (FALSE);
     }
-    decrypted_buffer 
-	= EAPSIMAKAKeyInfoDecryptTLVList(&context->key_info, encr_data_p, iv_p,
-					 decrypted_tlvs_p);
-    if (decrypted_buffer == NULL) {
+    if (!EAPSIMAKAKeyInfoDecryptTLVList(&context->key_info, encr_data_p, iv_p,
+					decrypted_buffer,
+					sizeof(decrypted_buffer),
+					decrypted_tlvs_p)) {
 	EAPLOG(LOG_NOTICE, "eapsim: Challenge decrypt AT_ENCR_DATA failed");
 	return (FALSE);
     }
@@ -1138,9 +1427,6 @@ eapsim_challenge_process_encr_data(EAPSIMContextRef context, TLVListRef tlvs_p)
 					     next_pseudonym);
 	CFRelease(next_pseudonym);
     }
-    if (decrypted_buffer != NULL) {
-	free(decrypted_buffer);
-    }
     TLVListFree(decrypted_tlvs_p);
     return (TRUE);
 }
@@ -1238,8 +1524,8 @@ eapsim_challenge(EAPSIMContextRef context,
 		  &sha1_context);
 
     /* now run PRF to generate keying material */
-    fips186_2prf(EAPSIMAKAPersistentStateGetMasterKey(context->persist),
-		 context->key_info.key);
+    EAPSIMAKAKeyInfoComputeKeys(&context->key_info,
+				EAPSIMAKAPersistentStateGetMasterKey(context->persist));
 
     /* validate the MAC */
     mac_p = (AT_MAC *)TLVListLookupAttribute(tlvs_p, kAT_MAC);
@@ -1330,7 +1616,7 @@ eapsim_reauthentication(EAPSIMContextRef context,
     bool		force_fullauth = FALSE;
     uint8_t		encr_buffer[ENCR_BUFSIZE_R];
     TLVBufferDeclare(	encr_tb_p);
-    uint8_t *		decrypted_buffer = NULL;
+    uint8_t		decrypted_buffer[AT_ENCR_DATA_MAX_SIZE];
     TLVListDeclare(	decrypted_tlvs_p);
     AT_ENCR_DATA * 	encr_data_p;
     AT_IV * 		iv_p;
@@ -1370,6 +1656,7 @@ eapsim_reauthentication(EAPSIMContextRef context,
 				   NULL, 0)) {
 	EAPLOG(LOG_NOTICE,
 	       "eapsim: Reauthentication AT_MAC not valid");
+	eapsim_fast_reauth_failed(context);
 	*client_status = kEAPClientStatusProtocolError;
 	goto done;
     }
@@ -1389,12 +1676,13 @@ eapsim_reauthentication(EAPSIMContextRef context,
 	*client_status = kEAPClientStatusProtocolError;
 	goto done;
     }
-    decrypted_buffer 
-	= EAPSIMAKAKeyInfoDecryptTLVList(&context->key_info, encr_data_p, iv_p,
-					 decrypted_tlvs_p);
-    if (decrypted_buffer == NULL) {
+    if (!EAPSIMAKAKeyInfoDecryptTLVList(&context->key_info, encr_data_p, iv_p,
+					decrypted_buffer,
+					sizeof(decrypted_buffer),
+					decrypted_tlvs_p)) {
 	EAPLOG(LOG_NOTICE,
 	       "eapsim: failed to decrypt Reauthentication AT_ENCR_DATA");
+	eapsim_fast_reauth_failed(context);
 	*client_status = kEAPClientStatusProtocolError;
 	goto done;
     }
@@ -1508,9 +1796,6 @@ eapsim_reauthentication(EAPSIMContextRef context,
     }
 
  done:
-    if (decrypted_buffer != NULL) {
-	free(decrypted_buffer);
-    }
     TLVListFree(decrypted_tlvs_p);
     return (pkt);
 }
@@ -1584,7 +1869,7 @@ eapsim_notification(EAPSIMContextRef context,
     do_replay_protection = context->reauth_success && after_auth;
     if (do_replay_protection) {
 	uint16_t	at_counter;
-	uint8_t *	decrypted_buffer;
+	uint8_t		decrypted_buffer[AT_ENCR_DATA_MAX_SIZE];
 	AT_ENCR_DATA *	encr_data_p;
 	TLVListDeclare(	decrypted_tlvs_p);
 	bool		has_counter = FALSE;
@@ -1602,11 +1887,11 @@ eapsim_notification(EAPSIMContextRef context,
 	}
 
 	TLVListInit(decrypted_tlvs_p);
-	decrypted_buffer 
-	    = EAPSIMAKAKeyInfoDecryptTLVList(&context->key_info,
-					     encr_data_p, iv_p,
-					     decrypted_tlvs_p);
-	if (decrypted_buffer != NULL) {
+	if (EAPSIMAKAKeyInfoDecryptTLVList(&context->key_info,
+					   encr_data_p, iv_p,
+					   decrypted_buffer,
+					   sizeof(decrypted_buffer),
+					   decrypted_tlvs_p)) {
 	    AT_COUNTER *	counter_p;
 	    CFStringRef		str;
 
@@ -1620,7 +1905,6 @@ eapsim_notification(EAPSIMContextRef context,
 		at_counter = net_uint16_get(counter_p->co_counter);
 		has_counter = TRUE;
 	    }
-	    free(decrypted_buffer);
 	    TLVListFree(decrypted_tlvs_p);
 	}
 	else {
@@ -1814,12 +2098,19 @@ eapsim_process(EAPClientPluginDataRef plugin,
 	context->previous_identifier = -1;
 	if (context->state == kEAPSIMClientStateSuccess) {
 	    context->plugin_state = kEAPClientStateSuccess;
+	    EAPSIMAKAAuthenticationCountsUpdate(kEAPTypeEAPSIM, context->reauth_success);
 	    save_persistent_state(context);
 	}
 	break;
     case kEAPCodeFailure:
 	context->previous_identifier = -1;
 	context->plugin_state = kEAPClientStateFailure;
+	EAPSIMAKAAuthenticationCountsFailed(kEAPTypeEAPSIM);
+	if (context->state == kEAPSIMClientStateReauthentication
+	    || (context->state == kEAPSIMClientStateSuccess
+		&& context->reauth_success)) {
+	    eapsim_fast_reauth_failed(context);
+	}
 	break;
     default:
 	break;
@@ -1880,7 +2171,7 @@ eapsim_msk_copy_bytes(EAPClientPluginDataRef plugin,
 STATIC CFDictionaryRef
 eapsim_publish_props(EAPClientPluginDataRef plugin)
 {
-    return (NULL);
+    return (EAPSIMAKACreatePublishedProperties(kEAPTypeEAPSIM));
 }
 
 STATIC CFStringRef
@@ -1939,6 +2230,9 @@ eapsim_copy_identity(EAPClientPluginDataRef plugin)
     context->state = kEAPSIMClientStateNone;
     context->previous_identifier = -1;
 
+    /* the link is up, get ready for fast re-authentication */
+    (void)eapsim_prepare_fast_reauth(context);
+
     /* If encrypted identity is enabled and pseudonym/fast reauth-id are not available
      * then send identity with anonymous username.
      */
@@ -2113,6 +2407,149 @@ main(int argc, char * argv[])
 
 #endif /* TEST_SET_VERSION_LIST */
 
+#ifdef TEST_SIM_STATIC_TRIPLETS
+#include <CoreFoundation/CFDate.h>
+
+#define N_TRIPLETS		5000
+#define N_LOOKUPS		1000000
+
+static bool
+check_triplets(SIMStaticTripletsRef triplets, const SIMStaticTriplet * list,
+	       int count)
+{
+    int		i;
+    uint8_t	rand[SIM_RAND_SIZE];
+
+    for (i = 0; i < count; i++) {
+	const SIMStaticTriplet *	t;
+
+	t = SIMStaticTripletsLookup(triplets, list[i].rand);
+	if (t == NULL
+	    || bcmp(t->sres, list[i].sres, SIM_SRES_SIZE) != 0
+	    || bcmp(t->kc, list[i].kc, SIM_KC_SIZE) != 0) {
+	    printf("lookup of triplet %d failed\n", i);
+	    return (FALSE);
+	}
+    }
+    arc4random_buf(rand, sizeof(rand));
+    if (SIMStaticTripletsLookup(triplets, rand) != NULL) {
+	printf("lookup of unknown RAND succeeded\n");
+	return (FALSE);
+    }
+    return (TRUE);
+}
+
+static CFDictionaryRef
+properties_create(const SIMStaticTriplet * list, int count, bool include_rand)
+{
+    CFMutableArrayRef		kc;
+    int				i;
+    CFMutableDictionaryRef	properties;
+    CFMutableArrayRef		rand;
+    CFMutableArrayRef		sres;
+
+    kc = CFArrayCreateMutable(NULL, count, &kCFTypeArrayCallBacks);
+    rand = CFArrayCreateMutable(NULL, count, &kCFTypeArrayCallBacks);
+    sres = CFArrayCreateMutable(NULL, count, &kCFTypeArrayCallBacks);
+    for (i = 0; i < count; i++) {
+	CFDataRef	data;
+
+	data = CFDataCreate(NULL, list[i].kc, SIM_KC_SIZE);
+	CFArrayAppendValue(kc, data);
+	CFRelease(data);
+	data = CFDataCreate(NULL, list[i].sres, SIM_SRES_SIZE);
+	CFArrayAppendValue(sres, data);
+	CFRelease(data);
+	data = CFDataCreate(NULL, list[i].rand, SIM_RAND_SIZE);
+	CFArrayAppendValue(rand, data);
+	CFRelease(data);
+    }
+    properties = CFDictionaryCreateMutable(NULL, 0,
+					   &kCFTypeDictionaryKeyCallBacks,
+					   &kCFTypeDictionaryValueCallBacks);
+    CFDictionarySetValue(properties, kEAPClientPropEAPSIMKcList, kc);
+    CFDictionarySetValue(properties, kEAPClientPropEAPSIMSRESList, sres);
+    if (include_rand) {
+	CFDictionarySetValue(properties, kEAPClientPropEAPSIMRANDList, rand);
+    }
+    CFRelease(kc);
+    CFRelease(rand);
+    CFRelease(sres);
+    return (properties);
+}
+
+int
+main(int argc, char * argv[])
+{
+    int			fd;
+    int			i;
+    SIMStaticTriplet *	list;
+    char		path[] = "/tmp/sim_triplets.XXXXXX";
+    CFDictionaryRef	properties;
+    CFAbsoluteTime	start;
+    SIMStaticTriplets	triplets;
+
+    list = (SIMStaticTriplet *)malloc(N_TRIPLETS * sizeof(*list));
+    arc4random_buf(list, N_TRIPLETS * sizeof(*list));
+
+    /* from properties */
+    bzero(&triplets, sizeof(triplets));
+    properties = properties_create(list, N_TRIPLETS, TRUE);
+    if (SIMStaticTripletsInitFromProperties(&triplets, properties) == FALSE
+	|| check_triplets(&triplets, list, N_TRIPLETS) == FALSE) {
+	printf("properties test failed\n");
+	exit(1);
+    }
+    CFRelease(properties);
+    SIMStaticTripletsFree(&triplets);
+    printf("properties test passed\n");
+
+    /* no RAND list: always the first triplet */
+    properties = properties_create(list, N_TRIPLETS, FALSE);
+    if (SIMStaticTripletsInitFromProperties(&triplets, properties) == FALSE
+	|| SIMStaticTripletsLookup(&triplets, list[1].rand) == NULL
+	|| bcmp(SIMStaticTripletsLookup(&triplets, list[1].rand)->kc,
+		list[0].kc, SIM_KC_SIZE) != 0) {
+	printf("no RAND test failed\n");
+	exit(1);
+    }
+    CFRelease(properties);
+    SIMStaticTripletsFree(&triplets);
+    printf("no RAND test passed\n");
+
+    /* from a file */
+    fd = mkstemp(path);
+    if (fd < 0
+	|| write(fd, list, N_TRIPLETS * sizeof(*list))
+	   != (ssize_t)(N_TRIPLETS * sizeof(*list))) {
+	perror("write");
+	exit(1);
+    }
+    close(fd);
+    if (SIMStaticTripletsInitFromFile(&triplets, path) == FALSE
+	|| check_triplets(&triplets, list, N_TRIPLETS) == FALSE) {
+	printf("file test failed\n");
+	unlink(path);
+	exit(1);
+    }
+    printf("file test passed\n");
+
+    start = CFAbsoluteTimeGetCurrent();
+    for (i = 0; i < N_LOOKUPS; i++) {
+	(void)SIMStaticTripletsLookup(&triplets,
+				      list[i % N_TRIPLETS].rand);
+    }
+    printf("%d triplets: %g nsecs/lookup\n", N_TRIPLETS,
+	   (CFAbsoluteTimeGetCurrent() - start) * 1e9 / N_LOOKUPS);
+    SIMStaticTripletsFree(&triplets);
+    unlink(path);
+    free(list);
+    exit(0);
+    return (0);
+}
+
+#endif /* TEST_SIM_STATIC_TRIPLETS */
+
 #ifdef TEST_SIM_INFO
 #if TARGET_OS_EMBEDDED
 int
@@ -179,6 +179,9 @@ eaptls_start(EAPClientPluginDataRef plugin)
 		      EAPSSLErrorString(status), (long)status);
 	    goto failed;
 	}
+	/* also resume using RFC 5077 tickets, avoiding the full handshake
+	 * with servers that don't keep a session cache */
+	(void)SSLSetSessionTicketsEnabled(ssl_context, TRUE);
     }
     if (context->cert_is_required) {
 	if (context->certs == NULL) {
@@ -621,6 +624,8 @@ eaptls_process(EAPClientPluginDataRef plugin,
     *client_status = kEAPClientStatusOK;
     *error = 0;
     *out_pkt_p = NULL;
+    /* the MTU may change between packets, see EAPClientPlugin.h */
+    context->mtu = plugin->mtu;
     switch (in_pkt->code) {
     case kEAPCodeRequest:
 	*out_pkt_p = eaptls_request(plugin, in_pkt, client_status);
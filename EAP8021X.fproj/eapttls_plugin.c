@@ -151,6 +151,13 @@ struct eap_client {
 
 #define TTLS_MSCHAP2_RESPONSE_LENGTH	(MSCHAP2_RESPONSE_LENGTH	\
 					 + MSCHAP_IDENT_SIZE)
+
+/*
+ * Sizes of the stack buffers used to build the inner authentication
+ * AVPs; longer user names/passwords use an allocated buffer.
+ */
+#define TTLS_USER_NAME_SIZE		256
+#define TTLS_PASSWORD_SIZE		128
 typedef struct {
     SSLContextRef		ssl_context;
     memoryBuffer		read_buffer;
@@ -181,13 +188,14 @@ typedef struct {
     EAPInnerAuthState		inner_auth_state;
     struct eap_client		eap;
     EAPPacketRef		last_packet;
-    char			last_packet_buf[1024];
+    char			in_buf[2048];	/* decrypted inner EAP packet */
     int				last_eap_type_index;
 
     /* MSCHAPv2 state: */
     uint8_t			peer_challenge[MSCHAP2_CHALLENGE_SIZE];
     uint8_t			nt_response[MSCHAP_NT_RESPONSE_SIZE];
     uint8_t			auth_challenge_id[MSCHAP2_CHALLENGE_SIZE + 1];
+    MSCHAPSecretRef		mschap_secret;
 } EAPTTLSPluginData, * EAPTTLSPluginDataRef;
 
 enum {
@@ -199,11 +207,18 @@ enum {
 static void
 eap_client_free(EAPTTLSPluginDataRef context);
 
+static bool
+packet_is_in_buf(EAPTTLSPluginDataRef context, EAPPacketRef packet)
+{
+    return ((char *)packet >= context->in_buf
+	    && (char *)packet < context->in_buf + sizeof(context->in_buf));
+}
+
 static void
 free_last_packet(EAPTTLSPluginDataRef context)
 {
     if (context->last_packet != NULL
-	&& (void *)context->last_packet != context->last_packet_buf) {
+	&& packet_is_in_buf(context, context->last_packet) == FALSE) {
 	free(context->last_packet);
     }
     context->last_packet = NULL;
@@ -221,16 +236,17 @@ save_last_packet(EAPTTLSPluginDataRef context, EAPPacketRef packet)
 	/* don't bother re-saving the same buffer */
 	return;
     }
-    len = EAPPacketGetLength(packet);
-    if (len > sizeof(context->last_packet_buf)) {
-	context->last_packet = (EAPPacketRef)malloc(len);
+    if (packet_is_in_buf(context, packet)) {
+	/* the packet was decrypted into the context, just remember it */
+	context->last_packet = packet;
     }
     else {
-	context->last_packet = (EAPPacketRef)context->last_packet_buf;
+	len = EAPPacketGetLength(packet);
+	context->last_packet = (EAPPacketRef)malloc(len);
+	memcpy(context->last_packet, packet, len);
     }
-    memcpy(context->last_packet, packet, len);
     if (last_packet != NULL
-	&& (void *)last_packet != context->last_packet_buf) {
+	&& packet_is_in_buf(context, last_packet) == FALSE) {
 	free(last_packet);
     }
     return;
@@ -282,6 +298,7 @@ eapttls_free_context(EAPTTLSPluginDataRef context)
     my_CFRelease(&context->certs);
     my_CFRelease(&context->server_certs);
     memoryIOClearBuffers(&context->mem_io);
+    MSCHAPSecretRelease(&context->mschap_secret);
     free(context);
     return;
 }
@@ -315,6 +332,7 @@ eapttls_start(EAPClientPluginDataRef plugin)
 		      EAPSSLErrorString(status), (long)status);
 	    goto failed;
 	}
+	(void)SSLSetSessionTicketsEnabled(ssl_context, TRUE);
     }
     if (context->cert_is_required) {
 	if (context->certs == NULL) {
@@ -442,70 +460,76 @@ EAPTTLSPacketCreateAck(int identifier)
 			       identifier, 0, NULL, NULL));
 }
 
+/*
+ * Function: eapttls_write_avps
+ * Purpose:
+ *   Send the AVPs laid out by the encoder in a single SSLWrite.
+ */
+static bool
+eapttls_write_avps(EAPTTLSPluginDataRef context, DiameterAVPEncoder * enc)
+{
+    size_t		length;
+    OSStatus		status;
+
+    status = SSLWrite(context->ssl_context, DiameterAVPEncoderGetBytes(enc),
+		      DiameterAVPEncoderGetLength(enc), &length);
+    if (status != noErr) {
+	EAPLOG_FL(LOG_NOTICE, "SSLWrite failed, %s (%ld)",
+		  EAPSSLErrorString(status), (long)status);
+	return (FALSE);
+    }
+    return (TRUE);
+}
+
 static bool
 eapttls_pap(EAPClientPluginDataRef plugin)
 {
-    DiameterAVP *	avp;
+    uint8_t		buf[DIAMETER_AVP_SIZE(TTLS_USER_NAME_SIZE)
+			    + DIAMETER_AVP_SIZE(TTLS_PASSWORD_SIZE)];
     EAPTTLSPluginDataRef context = (EAPTTLSPluginDataRef)plugin->private;
-    void *		data;
-    int			data_length;
-    void *		offset;
-    size_t		length;
+    uint8_t *		data;
+    DiameterAVPEncoder	enc;
     int			password_length_r;
-    bool		ret = TRUE;
-    OSStatus		status;
-    int			user_length_r;
+    bool		ret = FALSE;
 
-    /* allocate buffer to hold message */
+    /* size the message, use the stack buffer if it fits */
     password_length_r = roundup(plugin->password_length, 16);
-    user_length_r = roundup(plugin->username_length, 4);
-    data_length = sizeof(*avp) * 2 + user_length_r + password_length_r;
-    data = malloc(data_length);
-    if (data == NULL) {
+    if (DiameterAVPEncoderInit(&enc, buf, sizeof(buf),
+			       DIAMETER_AVP_SIZE(plugin->username_length)
+			       + DIAMETER_AVP_SIZE(password_length_r))
+	== FALSE) {
 	EAPLOG_FL(LOG_NOTICE, "malloc failed");
 	return (FALSE);
     }
-    offset = data;
 
     /* User-Name AVP */
-    avp = (DiameterAVP *)offset;
-    avp->AVP_code = htonl(kRADIUSAttributeTypeUserName);
-    avp->AVP_flags_length 
-	= htonl(DiameterAVPMakeFlagsLength(0, sizeof(*avp) 
-					   + plugin->username_length));
-    offset = (void *)(avp + 1);
-    bcopy(plugin->username, offset, plugin->username_length);
-    if (user_length_r > plugin->username_length) {
-	bzero(offset + plugin->username_length,
-	      user_length_r - plugin->username_length);
-    }
-    offset += user_length_r;
+    if (DiameterAVPEncoderAppendData(&enc, kRADIUSAttributeTypeUserName, 0,
+				     plugin->username,
+				     plugin->username_length) == FALSE) {
+	goto done;
+    }
 
     /* Password-Name AVP */
-    avp = (DiameterAVP *)offset;
-    avp->AVP_code = htonl(kRADIUSAttributeTypeUserPassword);
-    avp->AVP_flags_length 
-	= htonl(DiameterAVPMakeFlagsLength(0, 
-					   sizeof(*avp) + password_length_r));
-    offset = (void *)(avp + 1);
-    bcopy(plugin->password, offset, plugin->password_length);
+    data = DiameterAVPEncoderAppend(&enc, kRADIUSAttributeTypeUserPassword,
+				    0, password_length_r);
+    if (data == NULL) {
+	goto done;
+    }
+    bcopy(plugin->password, data, plugin->password_length);
     if (password_length_r > plugin->password_length) {
-	bzero(offset + plugin->password_length, 
+	bzero(data + plugin->password_length, 
 	      password_length_r - plugin->password_length);
     }
-    offset += password_length_r;
 #if 0
     printf("\n----------PAP Raw AVP Data START\n");
-    print_data(data, offset - data);
+    print_data(DiameterAVPEncoderGetBytes(&enc),
+	       DiameterAVPEncoderGetLength(&enc));
     printf("----------PAP Raw AVP Data END\n");
 #endif
-    status = SSLWrite(context->ssl_context, data, offset - data, &length);
-    if (status != noErr) {
-	EAPLOG_FL(LOG_NOTICE, "SSLWrite failed, %s (%ld)",
-		  EAPSSLErrorString(status), (long)status);
-	ret = FALSE;
-    }
-    free(data);
+    ret = eapttls_write_avps(context, &enc);
+
+ done:
+    DiameterAVPEncoderFree(&enc);
     return (ret);
 }
 
@@ -513,62 +537,55 @@ static bool
 eapttls_eap_read_avp(EAPClientPluginDataRef plugin, int avp_code,
 		     uint8_t * data, uint32_t * data_length)
 {
-    DiameterAVP 		avp;
+    bool			capture = FALSE;
     EAPTTLSPluginDataRef 	context = (EAPTTLSPluginDataRef)plugin->private;
-    uint32_t			flags_length;
+    DiameterAVPDecoder		decoder;
     size_t			len;
+    uint32_t			max_data_length = *data_length;
     bool			ret = FALSE;
     OSStatus			status = noErr;
-    uint32_t			max_data_length = *data_length;
 
+    DiameterAVPDecoderInit(&decoder);
     while (status != errSSLWouldBlock) {
+	void *		buf;
+	uint32_t	want;
+
+	/* read straight into the decoder, which handles short reads */
+	buf = DiameterAVPDecoderGetBuffer(&decoder, &want);
 	len = 0;
-	status = SSLRead(context->ssl_context, &avp, sizeof(avp), &len);
-	if (status != noErr) {
-	    if (status != errSSLWouldBlock) {
-		EAPLOG_FL(LOG_NOTICE, "SSLRead failed, %s (%d)",
-			  EAPSSLErrorString(status), (int)status);
-	    }
-	    goto done;
-	}
-	if (len != sizeof(avp)) {
-	    EAPLOG_FL(LOG_NOTICE, "EAP AVP is invalid");
-	    goto done;
-	}
-	flags_length
-	    = DiameterAVPLengthFromFlagsLength(ntohl(avp.AVP_flags_length));
-	if (flags_length <= sizeof(avp)) {
-	    EAPLOG_FL(LOG_NOTICE, "EAP AVP is too short %d <= %d",
-		      flags_length, (int)sizeof(avp));
-	    goto done;
-	}
-	flags_length -= sizeof(avp);
-	flags_length = roundup(flags_length, 4);
-	if (flags_length > max_data_length) {
-	    EAPLOG_FL(LOG_NOTICE, "EAP AVP is too large %d > %d",
-		      flags_length, max_data_length);
-	    goto done;
-	}
-	if (ret == FALSE && ntohl(avp.AVP_code) == avp_code) {
-	    status = SSLRead(context->ssl_context, data, flags_length, &len);
-	    if (status != noErr) {
+	if (want != 0) {
+	    status = SSLRead(context->ssl_context, buf, want, &len);
+	    if (status != noErr && status != errSSLWouldBlock) {
 		EAPLOG_FL(LOG_NOTICE, "SSLRead failed, %s (%d)",
 			  EAPSSLErrorString(status), (int)status);
 		goto done;
 	    }
-	    *data_length = (uint32_t)len;
-	    ret = TRUE;
 	}
-	else {
-	    uint8_t	temp_buf[flags_length];
-
-	    status = SSLRead(context->ssl_context, temp_buf, flags_length,
-			     &len);
-	    if (status != noErr) {
-		EAPLOG_FL(LOG_NOTICE, "SSLRead failed, %s (%d)",
-			  EAPSSLErrorString(status), (int)status);
-		goto done;
+	switch (DiameterAVPDecoderAdvance(&decoder, (uint32_t)len)) {
+	case kDiameterAVPDecoderStatusNeedMore:
+	    break;
+	case kDiameterAVPDecoderStatusHeader:
+	    if (ret == FALSE && decoder.code == avp_code
+		&& decoder.vendor == 0) {
+		if (decoder.data_length > max_data_length) {
+		    EAPLOG_FL(LOG_NOTICE, "EAP AVP is too large %d > %d",
+			      decoder.data_length, max_data_length);
+		    goto done;
+		}
+		DiameterAVPDecoderSetData(&decoder, data, max_data_length);
+		capture = TRUE;
+	    }
+	    break;
+	case kDiameterAVPDecoderStatusComplete:
+	    if (capture) {
+		*data_length = decoder.data_length;
+		capture = FALSE;
+		ret = TRUE;
 	    }
+	    break;
+	case kDiameterAVPDecoderStatusInvalid:
+	    EAPLOG_FL(LOG_NOTICE, "EAP AVP is invalid");
+	    goto done;
 	}
     }
 
@@ -734,65 +751,47 @@ next_eap_type(EAPTTLSPluginDataRef context)
 bool
 eapttls_eap_start(EAPClientPluginDataRef plugin, int identifier)
 {
-    DiameterAVP *	avp;
+    uint8_t		buf[DIAMETER_AVP_SIZE(sizeof(EAPResponsePacket)
+					      + TTLS_USER_NAME_SIZE)];
     EAPTTLSPluginDataRef context = (EAPTTLSPluginDataRef)plugin->private;
-    void *		data;
-    int			data_length;
-    int			data_length_r;
-    void *		offset;
-    size_t		length;
+    DiameterAVPEncoder	enc;
+    int			resp_length;
     EAPResponsePacket *	resp_p = NULL;
-    bool		ret = TRUE;
-    OSStatus		status;
+    bool		ret = FALSE;
 
-    /* allocate buffer to hold message */
-    data_length = sizeof(*avp) + plugin->username_length + sizeof(*resp_p);
-    data_length_r = roundup(data_length, 4);
-    data = malloc(data_length_r);
-    if (data == NULL) {
+    /* size the message, use the stack buffer if it fits */
+    resp_length = sizeof(*resp_p) + plugin->username_length;
+    if (DiameterAVPEncoderInit(&enc, buf, sizeof(buf),
+			       DIAMETER_AVP_SIZE(resp_length)) == FALSE) {
 	EAPLOG_FL(LOG_NOTICE, "malloc failed");
 	return (FALSE);
     }
-    offset = data;
 
     /* EAP AVP */
-    avp = (DiameterAVP *)offset;
-    avp->AVP_code = htonl(kRADIUSAttributeTypeEAPMessage);
-    avp->AVP_flags_length = htonl(DiameterAVPMakeFlagsLength(0, data_length));
-    offset = (void *)(avp + 1);
-    resp_p = (EAPResponsePacket *)offset;
+    resp_p = (EAPResponsePacket *)
+	DiameterAVPEncoderAppend(&enc, kRADIUSAttributeTypeEAPMessage, 0,
+				 resp_length);
+    if (resp_p == NULL) {
+	goto done;
+    }
     resp_p->code = kEAPCodeResponse;
     resp_p->identifier = 0; /* identifier */
-    EAPPacketSetLength((EAPPacketRef)resp_p, 
-		       sizeof(*resp_p) + plugin->username_length);
-
+    EAPPacketSetLength((EAPPacketRef)resp_p, resp_length);
     resp_p->type = kEAPTypeIdentity;
     bcopy(plugin->username, resp_p->type_data, plugin->username_length);
-    offset += sizeof(*resp_p) + plugin->username_length;
-    if (data_length_r > data_length) {
-	bzero(offset, data_length_r - data_length);
-    }
     if (plugin->log_enabled) {
-	CFMutableStringRef		log_msg;
+	CFTypeRef		log_descr;
 
-	log_msg = CFStringCreateMutable(NULL, 0);
-	EAPPacketIsValid((const EAPPacketRef)resp_p,
-			 EAPPacketGetLength((const EAPPacketRef)resp_p),
-			 log_msg);
-	EAPLOG(-LOG_DEBUG, "TTLS Send EAP Payload:\n%@", log_msg);
-	CFRelease(log_msg);
+	log_descr
+	    = EAPPacketCreateDeferredDescription((EAPPacketRef)resp_p,
+			EAPPacketGetLength((const EAPPacketRef)resp_p));
+	EAPLOG(-LOG_DEBUG, "TTLS Send EAP Payload:\n%@", log_descr);
+	my_CFRelease(&log_descr);
     }
+    ret = eapttls_write_avps(context, &enc);
 
-#if 0
-    printf("offset - data %d length %d\n", offset - data, data_length);
-#endif /* 0 */
-    status = SSLWrite(context->ssl_context, data, data_length_r, &length);
-    if (status != noErr) {
-	EAPLOG_FL(LOG_NOTICE, "SSLWrite failed, %s (%ld)",
-		  EAPSSLErrorString(status), (long)status);
-	ret = FALSE;
-    }
-    free(data);
+ done:
+    DiameterAVPEncoderFree(&enc);
     return (ret);
 }
 
@@ -911,10 +910,11 @@ eapttls_eap(EAPClientPluginDataRef plugin, EAPTLSPacketRef eaptls_in,
     DiameterAVP *	avp_p;
     bool 		call_module_free_packet = FALSE;
     EAPTTLSPluginDataRef context = (EAPTTLSPluginDataRef)plugin->private;
-    uint8_t		in_buf[2048];
     uint32_t		in_data_size = 0;
     EAPRequestPacketRef	in_pkt_p;
-    char 		out_buf[2048];
+    char		out_avp_buf[sizeof(DiameterAVP) + 2048
+				    + sizeof(uint32_t)];
+    char *		out_buf = out_avp_buf + sizeof(DiameterAVP);
     void *		out_data;
     int			out_data_size;
     int			out_data_size_r = 0;
@@ -935,24 +935,28 @@ eapttls_eap(EAPClientPluginDataRef plugin, EAPTLSPacketRef eaptls_in,
 	in_pkt_p = (EAPRequestPacketRef)context->last_packet;
     }
     else {
-	CFMutableStringRef	log_msg = NULL;
-	bool			is_valid;
 	bool			found_avp = FALSE;
+	bool			is_valid;
+	CFTypeRef		log_descr;
 
-	in_data_size = sizeof(in_buf);
+	/* decrypt in place into the context, the remembered packet is stale */
+	free_last_packet(context);
+	in_data_size = sizeof(context->in_buf);
 	found_avp = eapttls_eap_read_avp(plugin,
 					 kRADIUSAttributeTypeEAPMessage,
-					 in_buf, &in_data_size);
+					 (uint8_t *)context->in_buf,
+					 &in_data_size);
 	if (found_avp == TRUE) {
-	    in_pkt_p = (EAPRequestPacketRef)(in_buf);
-	    log_msg = plugin->log_enabled
-		? CFStringCreateMutable(NULL, 0) : NULL;
+	    in_pkt_p = (EAPRequestPacketRef)context->in_buf;
 	    is_valid = EAPPacketIsValid((EAPPacketRef)in_pkt_p, in_data_size,
-					log_msg);
-	    if (log_msg != NULL) {
+					NULL);
+	    if (plugin->log_enabled) {
+		log_descr
+		    = EAPPacketCreateDeferredDescription((EAPPacketRef)in_pkt_p,
+							 in_data_size);
 		EAPLOG(-LOG_DEBUG, "TTLS Receive EAP Payload%s:\n%@",
-		       is_valid ? "" : " Invalid", log_msg);
-		CFRelease(log_msg);
+		       is_valid ? "" : " Invalid", log_descr);
+		my_CFRelease(&log_descr);
 	    }
 	    if (is_valid == FALSE) {
 		if (plugin->log_enabled == FALSE) {
@@ -967,7 +971,9 @@ eapttls_eap(EAPClientPluginDataRef plugin, EAPTLSPacketRef eaptls_in,
 	    goto done;
 	}
     }
-    out_pkt_size = sizeof(out_buf);
+    /* leave room after the packet to pad the AVP */
+    out_pkt_size = sizeof(out_avp_buf) - sizeof(DiameterAVP)
+	- sizeof(uint32_t);
     switch (in_pkt_p->code) {
     case kEAPCodeRequest:
 	switch (in_pkt_p->type) {
@@ -1019,14 +1025,13 @@ eapttls_eap(EAPClientPluginDataRef plugin, EAPTLSPacketRef eaptls_in,
 	goto done;
     }
     if (plugin->log_enabled) {
-	CFMutableStringRef		log_msg;
+	CFTypeRef		log_descr;
 
-	log_msg = CFStringCreateMutable(NULL, 0);
-	EAPPacketIsValid((const EAPPacketRef)out_pkt_p,
-			 EAPPacketGetLength((const EAPPacketRef)out_pkt_p),
-			 log_msg);
-	EAPLOG(-LOG_DEBUG, "TTLS Send EAP Payload:\n%@", log_msg);
-	CFRelease(log_msg);
+	log_descr
+	    = EAPPacketCreateDeferredDescription((EAPPacketRef)out_pkt_p,
+			EAPPacketGetLength((const EAPPacketRef)out_pkt_p));
+	EAPLOG(-LOG_DEBUG, "TTLS Send EAP Payload:\n%@", log_descr);
+	my_CFRelease(&log_descr);
     }
 
     free_last_packet(context);
@@ -1034,17 +1039,29 @@ eapttls_eap(EAPClientPluginDataRef plugin, EAPTLSPacketRef eaptls_in,
     /* need to form complete packet */
     out_data_size = out_pkt_size + sizeof(*avp_p);
     out_data_size_r = roundup(out_data_size, 4);
-    out_data = malloc(out_data_size_r);
-    bzero(out_data, out_data_size_r);
+    if ((char *)out_pkt_p == out_buf) {
+	/* the packet was built in place after the AVP header */
+	out_data = out_avp_buf;
+    }
+    else if (out_data_size_r <= sizeof(out_avp_buf)) {
+	out_data = out_avp_buf;
+	bcopy(out_pkt_p, out_buf, out_pkt_size);
+    }
+    else {
+	out_data = malloc(out_data_size_r);
+	bcopy(out_pkt_p, out_data + sizeof(*avp_p), out_pkt_size);
+    }
+    bzero(out_data + out_data_size, out_data_size_r - out_data_size);
     avp_p = (DiameterAVP *)out_data;
     avp_p->AVP_code = htonl(kRADIUSAttributeTypeEAPMessage);
     avp_p->AVP_flags_length
 	= htonl(DiameterAVPMakeFlagsLength(0, out_data_size));
-    bcopy(out_pkt_p, out_data + sizeof(*avp_p), out_pkt_size);
 
     status = SSLWrite(context->ssl_context, out_data,
 		      out_data_size_r, &out_data_size_ret);
-    free(out_data);
+    if (out_data != out_avp_buf) {
+	free(out_data);
+    }
     if ((char *)out_pkt_p != out_buf) {
 	if (call_module_free_packet) {
 	    eap_client_free_packet(context, (EAPPacketRef)out_pkt_p);
@@ -1077,19 +1094,16 @@ eapttls_eap(EAPClientPluginDataRef plugin, EAPTLSPacketRef eaptls_in,
 static bool
 eapttls_chap(EAPClientPluginDataRef plugin)
 {
-    DiameterAVP *	avp;
+    uint8_t		buf[DIAMETER_AVP_SIZE(TTLS_USER_NAME_SIZE)
+			    + DIAMETER_AVP_SIZE(16)
+			    + DIAMETER_AVP_SIZE(1 + 16)];
     EAPTTLSPluginDataRef context = (EAPTTLSPluginDataRef)plugin->private;
-    void *		data;
-    int			data_length;
-    int			data_length_r;
+    uint8_t *		data;
+    DiameterAVPEncoder	enc;
     uint8_t		key_data[17];
-    size_t		length;
-    void *		offset;
-    bool		ret = TRUE;
+    bool		ret = FALSE;
     OSStatus		status;
-    int			user_length_r;
 
-    user_length_r = roundup(plugin->username_length, 4);
     status = EAPTLSComputeKeyData(context->ssl_context, 
 				  kEAPTTLSChallengeLabel,
 				  kEAPTTLSChallengeLabelLength,
@@ -1100,72 +1114,48 @@ eapttls_chap(EAPClientPluginDataRef plugin)
 	return (FALSE);
     }
 
-    /* allocate buffer to hold message */
-    data_length = sizeof(*avp) * 3 
-	+ user_length_r
-	+ 16  /* challenge */ 
-	+ 1 + 16; /* identifier + response */
-    data_length_r = roundup(data_length, 4);
-    data = malloc(data_length_r);
-    if (data == NULL) {
+    /* size the message, use the stack buffer if it fits */
+    if (DiameterAVPEncoderInit(&enc, buf, sizeof(buf),
+			       DIAMETER_AVP_SIZE(plugin->username_length)
+			       + DIAMETER_AVP_SIZE(16)  /* challenge */
+			       + DIAMETER_AVP_SIZE(1 + 16))/* ident + resp */
+	== FALSE) {
 	EAPLOG_FL(LOG_NOTICE, "malloc failed");
 	return (FALSE);
     }
-    offset = data;
 
     /* User-Name AVP */
-    avp = (DiameterAVP *)offset;
-    avp->AVP_code = htonl(kRADIUSAttributeTypeUserName);
-    avp->AVP_flags_length 
-	= htonl(DiameterAVPMakeFlagsLength(0, sizeof(*avp) 
-					   + plugin->username_length));
-    offset = (void *)(avp + 1);
-    bcopy(plugin->username, offset, plugin->username_length);
-    if (user_length_r > plugin->username_length) {
-	bzero(offset + plugin->username_length,
-	      user_length_r - plugin->username_length);
-    }
-    offset += user_length_r;
+    if (DiameterAVPEncoderAppendData(&enc, kRADIUSAttributeTypeUserName, 0,
+				     plugin->username,
+				     plugin->username_length) == FALSE) {
+	goto done;
+    }
 
     /* CHAP-Challenge AVP */
-    avp = (DiameterAVP *)offset;
-    avp->AVP_code = htonl(kRADIUSAttributeTypeCHAPChallenge);
-    avp->AVP_flags_length 
-	= htonl(DiameterAVPMakeFlagsLength(0, sizeof(*avp) + 16));
-    offset = (void *)(avp + 1);
-    bcopy(key_data, offset, 16);
-    offset += 16;
+    if (DiameterAVPEncoderAppendData(&enc, kRADIUSAttributeTypeCHAPChallenge,
+				     0, key_data, 16) == FALSE) {
+	goto done;
+    }
 
     /* CHAP-Password AVP */
-    avp = (DiameterAVP *)offset;
-    avp->AVP_code = htonl(kRADIUSAttributeTypeCHAPPassword);
-    avp->AVP_flags_length 
-	= htonl(DiameterAVPMakeFlagsLength(0, sizeof(*avp) + 17));
-    offset = (void *)(avp + 1);
-    *((u_char *)offset) = key_data[16]; /* identifier */
-    offset++;
-    chap_md5(key_data[16], plugin->password, plugin->password_length, 
-	     key_data, 16, offset);
-    offset += 16;
-    { /* pad out with zeroes */
-	int 	pad_length = data_length_r - data_length;
-	if (pad_length != 0) {
-	    bzero(offset, pad_length);
-	    offset += pad_length;
-	}
+    data = DiameterAVPEncoderAppend(&enc, kRADIUSAttributeTypeCHAPPassword,
+				    0, 1 + 16);
+    if (data == NULL) {
+	goto done;
     }
+    data[0] = key_data[16]; /* identifier */
+    chap_md5(key_data[16], plugin->password, plugin->password_length, 
+	     key_data, 16, data + 1);
 #if 0
     printf("\n----------CHAP Raw AVP Data START\n");
-    print_data(data, offset - data);
+    print_data(DiameterAVPEncoderGetBytes(&enc),
+	       DiameterAVPEncoderGetLength(&enc));
     printf("----------CHAP Raw AVP Data END\n");
 #endif /* 0 */
-    status = SSLWrite(context->ssl_context, data, offset - data, &length);
-    if (status != noErr) {
-	EAPLOG_FL(LOG_NOTICE, "SSLWrite failed, %s (%ld)",
-		  EAPSSLErrorString(status), (long)status);
-	ret = FALSE;
-    }
-    free(data);
+    ret = eapttls_write_avps(context, &enc);
+
+ done:
+    DiameterAVPEncoderFree(&enc);
     return (ret);
 }
 
@@ -1179,21 +1169,16 @@ eapttls_chap(EAPClientPluginDataRef plugin)
 static bool
 eapttls_mschap(EAPClientPluginDataRef plugin)
 {
-    DiameterAVP *	avp;
-    DiameterVendorAVP *	avpv;
+    uint8_t		buf[DIAMETER_AVP_SIZE(TTLS_USER_NAME_SIZE)
+			    + DIAMETER_VENDOR_AVP_SIZE(MSCHAP_NT_CHALLENGE_SIZE)
+			    + DIAMETER_VENDOR_AVP_SIZE(TTLS_MSCHAP_RESPONSE_LENGTH)];
     EAPTTLSPluginDataRef context = (EAPTTLSPluginDataRef)plugin->private;
-    void *		data;
-    int			data_length;
-    int			data_length_r;
+    uint8_t *		data;
+    DiameterAVPEncoder	enc;
     uint8_t		key_data[MSCHAP_NT_CHALLENGE_SIZE + MSCHAP_IDENT_SIZE];
-    size_t		length;
-    void *		offset;
-    bool		ret = TRUE;
-    uint8_t		response[MSCHAP_NT_RESPONSE_SIZE];
+    bool		ret = FALSE;
     OSStatus		status;
-    int			user_length_r;
 
-    user_length_r = roundup(plugin->username_length, 4);
     status = EAPTLSComputeKeyData(context->ssl_context, 
 				  kEAPTTLSChallengeLabel,
 				  kEAPTTLSChallengeLabelLength,
@@ -1204,84 +1189,62 @@ eapttls_mschap(EAPClientPluginDataRef plugin)
 	return (FALSE);
     }
 
-    /* allocate buffer to hold message */
-    data_length = sizeof(*avp) + sizeof(*avpv) * 2 
-	+ user_length_r
-	+ MSCHAP_NT_CHALLENGE_SIZE  /* challenge */ 
-	+ TTLS_MSCHAP_RESPONSE_LENGTH;/* flags + identifer + {NT,LM}Response */
-    data_length_r = roundup(data_length, 4);
-    data = malloc(data_length_r);
-    if (data == NULL) {
+    /* size the message, use the stack buffer if it fits */
+    if (DiameterAVPEncoderInit(&enc, buf, sizeof(buf),
+			       DIAMETER_AVP_SIZE(plugin->username_length)
+			       + DIAMETER_VENDOR_AVP_SIZE(MSCHAP_NT_CHALLENGE_SIZE)
+			       + DIAMETER_VENDOR_AVP_SIZE(TTLS_MSCHAP_RESPONSE_LENGTH))
+	== FALSE) {
 	EAPLOG_FL(LOG_NOTICE, "malloc failed");
 	return (FALSE);
     }
-    offset = data;
 
     /* User-Name AVP */
-    avp = (DiameterAVP *)offset;
-    avp->AVP_code = htonl(kRADIUSAttributeTypeUserName);
-    avp->AVP_flags_length 
-	= htonl(DiameterAVPMakeFlagsLength(0, sizeof(*avp) 
-					   + plugin->username_length));
-    offset = (void *)(avp + 1);
-    bcopy(plugin->username, offset, plugin->username_length);
-    if (user_length_r > plugin->username_length) {
-	bzero(offset + plugin->username_length, 
-	      user_length_r - plugin->username_length);
-    }
-    offset += user_length_r;
+    if (DiameterAVPEncoderAppendData(&enc, kRADIUSAttributeTypeUserName, 0,
+				     plugin->username,
+				     plugin->username_length) == FALSE) {
+	goto done;
+    }
 
     /* MS-CHAP-Challenge AVP */
-    avpv = (DiameterVendorAVP *)offset;
-    avpv->AVPV_code = htonl(kMSRADIUSAttributeTypeMSCHAPChallenge);
-    avpv->AVPV_flags_length 
-	= htonl(DiameterAVPMakeFlagsLength(kDiameterFlagsVendorSpecific,
-					   sizeof(*avpv) 
-					   + MSCHAP_NT_CHALLENGE_SIZE));
-    avpv->AVPV_vendor = htonl(kRADIUSVendorIdentifierMicrosoft);
-    offset = (void *)(avpv + 1);
-    bcopy(key_data, offset, MSCHAP_NT_CHALLENGE_SIZE);
-    offset += MSCHAP_NT_CHALLENGE_SIZE;
+    if (DiameterAVPEncoderAppendData(&enc,
+				     kMSRADIUSAttributeTypeMSCHAPChallenge,
+				     kRADIUSVendorIdentifierMicrosoft,
+				     key_data, MSCHAP_NT_CHALLENGE_SIZE)
+	== FALSE) {
+	goto done;
+    }
 
     /* MS-CHAP-Response AVP */
-    avpv = (DiameterVendorAVP *)offset;
-    avpv->AVPV_code = htonl(kMSRADIUSAttributeTypeMSCHAPResponse);
-    avpv->AVPV_flags_length 
-	= htonl(DiameterAVPMakeFlagsLength(kDiameterFlagsVendorSpecific,
-					   sizeof(*avpv) 
-					   + TTLS_MSCHAP_RESPONSE_LENGTH));
-    avpv->AVPV_vendor = htonl(kRADIUSVendorIdentifierMicrosoft);
-    offset = (void *)(avpv + 1);
-    *((u_char *)offset) = key_data[MSCHAP_NT_CHALLENGE_SIZE];	/* ident */
-    offset++;
-    *((u_char *)offset) = 1;		   /* flags: 1 = use NT-Response */
-    offset++;
-    bzero(offset, MSCHAP_LM_RESPONSE_SIZE);/* LM-Response: not used */
-    offset += MSCHAP_LM_RESPONSE_SIZE;
-    MSChap(key_data, plugin->password,
-	   plugin->password_length, response);		/* NT-Response */
-    bcopy(response, offset, MSCHAP_NT_RESPONSE_SIZE);
-    offset += MSCHAP_NT_RESPONSE_SIZE;
-    { /* pad out with zeroes */
-	int 	pad_length = data_length_r - data_length;
-	if (pad_length != 0) {
-	    bzero(offset, pad_length);
-	    offset += pad_length;
-	}
+    MSCHAPSecretRelease(&context->mschap_secret);
+    context->mschap_secret = MSCHAPSecretCopy(plugin->password,
+					      plugin->password_length);
+    if (context->mschap_secret == NULL) {
+	goto done;
+    }
+    data = DiameterAVPEncoderAppend(&enc,
+				    kMSRADIUSAttributeTypeMSCHAPResponse,
+				    kRADIUSVendorIdentifierMicrosoft,
+				    TTLS_MSCHAP_RESPONSE_LENGTH);
+    if (data == NULL) {
+	goto done;
     }
+    *data++ = key_data[MSCHAP_NT_CHALLENGE_SIZE];	/* ident */
+    *data++ = 1;			/* flags: 1 = use NT-Response */
+    bzero(data, MSCHAP_LM_RESPONSE_SIZE);/* LM-Response: not used */
+    data += MSCHAP_LM_RESPONSE_SIZE;
+    MSChapWithSecret(key_data, context->mschap_secret,
+		     data);				/* NT-Response */
 #if 0
-    printf("offset - data %d length %d\n", offset - data, data_length);
     printf("\n----------MSCHAP Raw AVP Data START\n");
-    print_data(data, offset - data);
+    print_data(DiameterAVPEncoderGetBytes(&enc),
+	       DiameterAVPEncoderGetLength(&enc));
     printf("----------MSCHAP Raw AVP Data END\n");
 #endif /* 0 */
-    status = SSLWrite(context->ssl_context, data, offset - data, &length);
-    if (status != noErr) {
-	EAPLOG_FL(LOG_NOTICE, "SSLWrite failed, %s (%ld)",
-		  EAPSSLErrorString(status), (long)status);
-	ret = FALSE;
-    }
-    free(data);
+    ret = eapttls_write_avps(context, &enc);
+
+ done:
+    DiameterAVPEncoderFree(&enc);
     return (ret);
 }
 
@@ -1295,19 +1258,15 @@ eapttls_mschap(EAPClientPluginDataRef plugin)
 static bool
 eapttls_mschap2(EAPClientPluginDataRef plugin)
 {
-    DiameterAVP *	avp;
-    DiameterVendorAVP *	avpv;
+    uint8_t		buf[DIAMETER_AVP_SIZE(TTLS_USER_NAME_SIZE)
+			    + DIAMETER_VENDOR_AVP_SIZE(MSCHAP2_CHALLENGE_SIZE)
+			    + DIAMETER_VENDOR_AVP_SIZE(TTLS_MSCHAP2_RESPONSE_LENGTH)];
     EAPTTLSPluginDataRef context = (EAPTTLSPluginDataRef)plugin->private;
-    void *		data;
-    int			data_length;
-    int			data_length_r;
-    size_t		length;
-    void *		offset;
-    bool		ret = TRUE;
+    uint8_t *		data;
+    DiameterAVPEncoder	enc;
+    bool		ret = FALSE;
     OSStatus		status;
-    int			user_length_r;
 
-    user_length_r = roundup(plugin->username_length, 4);
     status = EAPTLSComputeKeyData(context->ssl_context, 
 				  kEAPTTLSChallengeLabel,
 				  kEAPTTLSChallengeLabelLength,
@@ -1319,160 +1278,139 @@ eapttls_mschap2(EAPClientPluginDataRef plugin)
 	return (FALSE);
     }
 
-    /* allocate buffer to hold message */
-    data_length = sizeof(*avp) + sizeof(*avpv) * 2 
-	+ user_length_r
-	+ MSCHAP2_CHALLENGE_SIZE
-	+ TTLS_MSCHAP2_RESPONSE_LENGTH;
-    data_length_r = roundup(data_length, 4);
-    data = malloc(data_length_r);
-    if (data == NULL) {
+    /* size the message, use the stack buffer if it fits */
+    if (DiameterAVPEncoderInit(&enc, buf, sizeof(buf),
+			       DIAMETER_AVP_SIZE(plugin->username_length)
+			       + DIAMETER_VENDOR_AVP_SIZE(MSCHAP2_CHALLENGE_SIZE)
+			       + DIAMETER_VENDOR_AVP_SIZE(TTLS_MSCHAP2_RESPONSE_LENGTH))
+	== FALSE) {
 	EAPLOG_FL(LOG_NOTICE, "malloc failed");
 	return (FALSE);
     }
-    offset = data;
 
     /* User-Name AVP */
-    avp = (DiameterAVP *)offset;
-    avp->AVP_code = htonl(kRADIUSAttributeTypeUserName);
-    avp->AVP_flags_length 
-	= htonl(DiameterAVPMakeFlagsLength(0, sizeof(*avp)
-					   + plugin->username_length));
-    offset = (void *)(avp + 1);
-    bcopy(plugin->username, offset, plugin->username_length);
-    if (user_length_r > plugin->username_length) {
-	bzero(offset + plugin->username_length, 
-	      user_length_r - plugin->username_length);
-    }
-    offset += user_length_r;
+    if (DiameterAVPEncoderAppendData(&enc, kRADIUSAttributeTypeUserName, 0,
+				     plugin->username,
+				     plugin->username_length) == FALSE) {
+	goto done;
+    }
 
     /* MS-CHAP-Challenge AVP */
-    avpv = (DiameterVendorAVP *)offset;
-    avpv->AVPV_code = htonl(kMSRADIUSAttributeTypeMSCHAPChallenge);
-    avpv->AVPV_flags_length 
-	= htonl(DiameterAVPMakeFlagsLength(kDiameterFlagsVendorSpecific,
-					   sizeof(*avpv) 
-					   + MSCHAP2_CHALLENGE_SIZE));
-    avpv->AVPV_vendor = htonl(kRADIUSVendorIdentifierMicrosoft);
-    offset = (void *)(avpv + 1);
-    bcopy(context->auth_challenge_id, offset, MSCHAP2_CHALLENGE_SIZE);
-    offset += MSCHAP2_CHALLENGE_SIZE;
+    if (DiameterAVPEncoderAppendData(&enc,
+				     kMSRADIUSAttributeTypeMSCHAPChallenge,
+				     kRADIUSVendorIdentifierMicrosoft,
+				     context->auth_challenge_id,
+				     MSCHAP2_CHALLENGE_SIZE) == FALSE) {
+	goto done;
+    }
 
     /* MS-CHAP2-Response AVP */
-    avpv = (DiameterVendorAVP *)offset;
-    avpv->AVPV_code = htonl(kMSRADIUSAttributeTypeMSCHAP2Response);
-    avpv->AVPV_flags_length 
-	= htonl(DiameterAVPMakeFlagsLength(kDiameterFlagsVendorSpecific,
-					   sizeof(*avpv) 
-					   + TTLS_MSCHAP2_RESPONSE_LENGTH));
-    avpv->AVPV_vendor = htonl(kRADIUSVendorIdentifierMicrosoft);
-    offset = (void *)(avpv + 1);
-    *((u_char *)offset) 		/* identifier */
+    MSCHAPSecretRelease(&context->mschap_secret);
+    context->mschap_secret = MSCHAPSecretCopy(plugin->password,
+					      plugin->password_length);
+    if (context->mschap_secret == NULL) {
+	goto done;
+    }
+    data = DiameterAVPEncoderAppend(&enc,
+				    kMSRADIUSAttributeTypeMSCHAP2Response,
+				    kRADIUSVendorIdentifierMicrosoft,
+				    TTLS_MSCHAP2_RESPONSE_LENGTH);
+    if (data == NULL) {
+	goto done;
+    }
+    *data++ 				/* identifier */
 	= context->auth_challenge_id[MSCHAP2_CHALLENGE_SIZE];
-    offset++;
-    *((u_char *)offset) = 0;		/* flags: must be 0 */
-    offset++;
+    *data++ = 0;			/* flags: must be 0 */
     MSChapFillWithRandom(context->peer_challenge, 
 			 sizeof(context->peer_challenge));
-    bcopy(context->peer_challenge, offset,
+    bcopy(context->peer_challenge, data,
 	  MSCHAP2_CHALLENGE_SIZE);	/* peer challenge */
-    offset += sizeof(context->peer_challenge);
-    bzero(offset, MSCHAP2_RESERVED_SIZE);
-    offset += MSCHAP2_RESERVED_SIZE;
-    MSChap2(context->auth_challenge_id, context->peer_challenge, 	
-	    plugin->username, plugin->password, plugin->password_length,
-	    context->nt_response);
-    bcopy(context->nt_response, offset, 	/* response */
+    data += sizeof(context->peer_challenge);
+    bzero(data, MSCHAP2_RESERVED_SIZE);
+    data += MSCHAP2_RESERVED_SIZE;
+    MSChap2WithSecret(context->auth_challenge_id, context->peer_challenge,
+		      plugin->username, context->mschap_secret,
+		      context->nt_response);
+    bcopy(context->nt_response, data, 	/* response */
 	  MSCHAP_NT_RESPONSE_SIZE);
-    offset += MSCHAP_NT_RESPONSE_SIZE;
-    { /* pad out with zeroes */
-	int 	pad_length = data_length_r - data_length;
-	if (pad_length != 0) {
-	    bzero(offset, pad_length);
-	    offset += pad_length;
-	}
-    }
 #if 0
-    printf("offset - data %d length %d\n", offset - data, data_length);
     printf("\n----------MSCHAP2 Raw AVP Data START\n");
-    print_data(data, offset - data);
+    print_data(DiameterAVPEncoderGetBytes(&enc),
+	       DiameterAVPEncoderGetLength(&enc));
     printf("----------MSCHAP2 Raw AVP Data END\n");
 #endif /* 0 */
+    ret = eapttls_write_avps(context, &enc);
 
-    status = SSLWrite(context->ssl_context, data, offset - data, &length);
-    if (status != noErr) {
-	EAPLOG_FL(LOG_NOTICE, "SSLWrite failed, %s (%ld)",
-		  EAPSSLErrorString(status), (long)status);
-	ret = FALSE;
-    }
-    free(data);
+ done:
+    DiameterAVPEncoderFree(&enc);
     return (ret);
 }
 
 static EAPPacketRef
 eapttls_mschap2_verify(EAPClientPluginDataRef plugin, int identifier)
 {
-    DiameterVendorAVP	avpv;
     EAPTTLSPluginDataRef context = (EAPTTLSPluginDataRef)plugin->private;
-    void *		data = NULL;
-    size_t		data_size = 0;
-    u_int32_t		flags_length;
+    uint8_t		data[MSCHAP2_AUTH_RESPONSE_SIZE + 1];
+    DiameterAVPDecoder	decoder;
+    DiameterAVPDecoderStatus decoder_status;
     size_t		length;
     EAPPacketRef	pkt = NULL;
     OSStatus		status;
 
-    status = SSLRead(context->ssl_context, &avpv, sizeof(avpv), 
-		     &data_size);
-    if (status != noErr) {
-	EAPLOG_FL(LOG_NOTICE, "SSLRead failed, %s (%ld)",
-		  EAPSSLErrorString(status), (long)status);
-	context->plugin_state = kEAPClientStateFailure;
-	context->last_ssl_error = status;
-	goto done;
-    }
-    if (data_size != sizeof(avpv)) {
-	context->plugin_state = kEAPClientStateFailure;
-	goto done;
-    }
-    flags_length = ntohl(avpv.AVPV_flags_length);
-    if ((DiameterAVPFlagsFromFlagsLength(flags_length) 
-	 & kDiameterFlagsVendorSpecific) == 0
-	|| ntohl(avpv.AVPV_code) != kMSRADIUSAttributeTypeMSCHAP2Success
-	|| ntohl(avpv.AVPV_vendor) != kRADIUSVendorIdentifierMicrosoft) {
-	context->plugin_state = kEAPClientStateFailure;
-	goto done;
-    }
-    length = DiameterAVPLengthFromFlagsLength(flags_length);
-    if (length > kEAPTLSAvoidDenialOfServiceSize) {
-	context->plugin_state = kEAPClientStateFailure;
-	goto done;
-    }
-    length -= sizeof(avpv);
-    data = malloc(length);
-    status = SSLRead(context->ssl_context, data, length, &length);
-    if (status != noErr) {
-	context->plugin_state = kEAPClientStateFailure;
-	goto done;
-    }
-    if (length < (MSCHAP2_AUTH_RESPONSE_SIZE + 1)
-	|| (*((uint8_t *)data)
-	    != context->auth_challenge_id[MSCHAP2_CHALLENGE_SIZE])) {
+    /* read the MS-CHAP2-Success AVP, keeping only what's needed */
+    DiameterAVPDecoderInit(&decoder);
+    do {
+	void *		buf;
+	uint32_t	want;
+
+	buf = DiameterAVPDecoderGetBuffer(&decoder, &want);
+	length = 0;
+	if (want != 0) {
+	    status = SSLRead(context->ssl_context, buf, want, &length);
+	    if (status != noErr) {
+		EAPLOG_FL(LOG_NOTICE, "SSLRead failed, %s (%ld)",
+			  EAPSSLErrorString(status), (long)status);
+		context->plugin_state = kEAPClientStateFailure;
+		context->last_ssl_error = status;
+		goto done;
+	    }
+	}
+	decoder_status = DiameterAVPDecoderAdvance(&decoder,
+						   (uint32_t)length);
+	switch (decoder_status) {
+	case kDiameterAVPDecoderStatusHeader:
+	    if (decoder.code != kMSRADIUSAttributeTypeMSCHAP2Success
+		|| decoder.vendor != kRADIUSVendorIdentifierMicrosoft
+		|| decoder.data_length > kEAPTLSAvoidDenialOfServiceSize) {
+		context->plugin_state = kEAPClientStateFailure;
+		goto done;
+	    }
+	    DiameterAVPDecoderSetData(&decoder, data, sizeof(data));
+	    break;
+	case kDiameterAVPDecoderStatusInvalid:
+	    context->plugin_state = kEAPClientStateFailure;
+	    goto done;
+	default:
+	    break;
+	}
+    } while (decoder_status != kDiameterAVPDecoderStatusComplete);
+    if (decoder.data_length < sizeof(data)
+	|| data[0] != context->auth_challenge_id[MSCHAP2_CHALLENGE_SIZE]) {
 	context->plugin_state = kEAPClientStateFailure;
 	goto done;
     }
-    if (MSChap2AuthResponseValid(plugin->password, plugin->password_length,
-				 context->nt_response,
-				 context->peer_challenge,
-				 context->auth_challenge_id,
-				 plugin->username, data + 1) == FALSE) {
+    if (context->mschap_secret == NULL
+	|| MSChap2AuthResponseValidWithSecret(context->mschap_secret,
+					      context->nt_response,
+					      context->peer_challenge,
+					      context->auth_challenge_id,
+					      plugin->username,
+					      data + 1) == FALSE) {
 	context->plugin_state = kEAPClientStateFailure;
 	goto done;
     }
     pkt = EAPTTLSPacketCreateAck(identifier);
  done:
-    if (data != NULL) {
-	free(data);
-    }
     return (pkt);
 }
 
@@ -1963,6 +1901,7 @@ eapttls_process(EAPClientPluginDataRef plugin,
     *error = 0;
 
     *out_pkt_p = NULL;
+    context->mtu = plugin->mtu;
     switch (in_pkt->code) {
     case kEAPCodeRequest:
 	*out_pkt_p = eapttls_request(plugin, in_pkt, client_status);
@@ -2242,3 +2181,277 @@ eapttls_introspect(EAPClientPluginFuncName name)
     }
     return (NULL);
 }
+
+#ifdef TEST_DIAMETER_AVP
+
+/*
+ * Diameter AVP codec round-trip test and benchmark
+ *
+ * diameter_avp			round-trip tests, then the benchmark
+ * diameter_avp <count> [ <seed> ]	run <count> random round trips
+ */
+
+#define N_ROUND_TRIPS		100000
+#define N_BENCH_ITERATIONS	1000000
+#define MAX_TEST_AVPS		8
+#define MAX_TEST_DATA		300
+
+typedef struct {
+    uint32_t	code;
+    uint32_t	vendor;
+    uint32_t	length;
+    uint8_t	data[MAX_TEST_DATA];
+} TestAVP;
+
+static int
+encode_avps(const TestAVP * avps, int count, uint8_t * buf, int buf_size)
+{
+    DiameterAVPEncoder	enc;
+    int			i;
+
+    (void)DiameterAVPEncoderInit(&enc, buf, buf_size, buf_size);
+    for (i = 0; i < count; i++) {
+	if (DiameterAVPEncoderAppendData(&enc, avps[i].code, avps[i].vendor,
+					 avps[i].data, avps[i].length)
+	    == FALSE) {
+	    return (-1);
+	}
+    }
+    return (DiameterAVPEncoderGetLength(&enc));
+}
+
+/*
+ * Function: decode_avps
+ * Purpose:
+ *   Decode the message, delivering it to the decoder in chunks of
+ *   random size to simulate AVPs split across TLS records.
+ */
+static int
+decode_avps(const uint8_t * msg, int msg_length, TestAVP * avps,
+	    int max_count, bool random_chunks)
+{
+    int				count = 0;
+    DiameterAVPDecoder		dec;
+    int				offset = 0;
+
+    DiameterAVPDecoderInit(&dec);
+    for (;;) {
+	void *		buf;
+	uint32_t	n;
+	uint32_t	want;
+
+	buf = DiameterAVPDecoderGetBuffer(&dec, &want);
+	if (random_chunks && want > 1) {
+	    want = 1 + random() % want;
+	}
+	n = (want < (uint32_t)(msg_length - offset))
+	    ? want : (uint32_t)(msg_length - offset);
+	bcopy(msg + offset, buf, n);
+	offset += n;
+	switch (DiameterAVPDecoderAdvance(&dec, n)) {
+	case kDiameterAVPDecoderStatusNeedMore:
+	    if (offset == msg_length) {
+		return ((dec.state == kDiameterAVPDecoderStateHeader
+			 && dec.offset == 0) ? count : -1);
+	    }
+	    break;
+	case kDiameterAVPDecoderStatusHeader:
+	    if (count == max_count) {
+		return (-1);
+	    }
+	    avps[count].code = dec.code;
+	    avps[count].vendor = dec.vendor;
+	    avps[count].length = dec.data_length;
+	    DiameterAVPDecoderSetData(&dec, avps[count].data,
+				      sizeof(avps[count].data));
+	    break;
+	case kDiameterAVPDecoderStatusComplete:
+	    count++;
+	    if (offset == msg_length) {
+		return (count);
+	    }
+	    break;
+	case kDiameterAVPDecoderStatusInvalid:
+	    return (-1);
+	}
+    }
+}
+
+static void
+random_avps(TestAVP * avps, int count)
+{
+    int		i;
+    uint32_t	j;
+
+    for (i = 0; i < count; i++) {
+	avps[i].code = random() & 0xffff;
+	avps[i].vendor = (random() % 2) ? kRADIUSVendorIdentifierMicrosoft : 0;
+	avps[i].length = random() % MAX_TEST_DATA;
+	for (j = 0; j < avps[i].length; j++) {
+	    avps[i].data[j] = random();
+	}
+    }
+    return;
+}
+
+static bool
+avps_equal(const TestAVP * a, const TestAVP * b, int count)
+{
+    int		i;
+
+    for (i = 0; i < count; i++) {
+	if (a[i].code != b[i].code || a[i].vendor != b[i].vendor
+	    || a[i].length != b[i].length
+	    || bcmp(a[i].data, b[i].data, a[i].length) != 0) {
+	    return (FALSE);
+	}
+    }
+    return (TRUE);
+}
+
+static int
+round_trips(long iterations, unsigned int seed)
+{
+    TestAVP		avps[MAX_TEST_AVPS];
+    uint8_t		buf[MAX_TEST_AVPS * DIAMETER_VENDOR_AVP_SIZE(MAX_TEST_DATA)];
+    int			count;
+    TestAVP		decoded[MAX_TEST_AVPS];
+    long		i;
+    int			length;
+
+    srandom(seed);
+    for (i = 0; i < iterations; i++) {
+	count = 1 + random() % MAX_TEST_AVPS;
+	random_avps(avps, count);
+	length = encode_avps(avps, count, buf, sizeof(buf));
+	if (length < 0 || (length % 4) != 0) {
+	    printf("round trip %ld: encode failed\n", i);
+	    return (1);
+	}
+	if (decode_avps(buf, length, decoded, MAX_TEST_AVPS, TRUE) != count
+	    || avps_equal(avps, decoded, count) == FALSE) {
+	    printf("round trip %ld: decode mismatch\n", i);
+	    print_data(buf, length);
+	    return (1);
+	}
+	/* a truncated message must not decode completely */
+	if (decode_avps(buf, length - 1 - random() % 4, decoded,
+			MAX_TEST_AVPS, TRUE) == count) {
+	    printf("round trip %ld: truncated message accepted\n", i);
+	    return (1);
+	}
+    }
+    printf("round trips: %ld passed\n", iterations);
+    return (0);
+}
+
+/*
+ * Function: check_chap_layout
+ * Purpose:
+ *   Verify that the encoder produces exactly the byte layout of the
+ *   CHAP message that used to be built by hand.
+ */
+static int
+check_chap_layout(void)
+{
+    uint8_t		buf[128];
+    uint8_t *		data;
+    DiameterAVPEncoder	enc;
+    static const uint8_t expected[] = {
+	0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0d,	/* User-Name */
+	'u', 's', 'e', 'r', 'x', 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x3c, 0x00, 0x00, 0x00, 0x0c,	/* CHAP-Challenge */
+	0xcc, 0xcc, 0xcc, 0xcc,
+	0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x0e,	/* CHAP-Password */
+	0x07, 0xdd, 0xdd, 0xdd, 0xdd, 0xdd, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x19, 0x80, 0x00, 0x00, 0x0e,	/* MS vendor AVP */
+	0x00, 0x00, 0x01, 0x37, 0xee, 0xee, 0x00, 0x00,
+    };
+
+    (void)DiameterAVPEncoderInit(&enc, buf, sizeof(buf), sizeof(buf));
+    (void)DiameterAVPEncoderAppendData(&enc, kRADIUSAttributeTypeUserName,
+				       0, "userx", 5);
+    data = DiameterAVPEncoderAppend(&enc, kRADIUSAttributeTypeCHAPChallenge,
+				    0, 4);
+    memset(data, 0xcc, 4);
+    data = DiameterAVPEncoderAppend(&enc, kRADIUSAttributeTypeCHAPPassword,
+				    0, 6);
+    data[0] = 7;
+    memset(data + 1, 0xdd, 5);
+    data = DiameterAVPEncoderAppend(&enc,
+				    kMSRADIUSAttributeTypeMSCHAP2Response,
+				    kRADIUSVendorIdentifierMicrosoft, 2);
+    memset(data, 0xee, 2);
+    if (DiameterAVPEncoderGetLength(&enc) != sizeof(expected)
+	|| bcmp(buf, expected, sizeof(expected)) != 0) {
+	printf("AVP layout: FAILED\n");
+	print_data(buf, DiameterAVPEncoderGetLength(&enc));
+	return (1);
+    }
+    if (DiameterAVPEncoderAppend(&enc, 1, 0, sizeof(buf)) != NULL) {
+	printf("AVP overflow: FAILED\n");
+	return (1);
+    }
+    printf("AVP layout: passed\n");
+    return (0);
+}
+
+static void
+benchmark(void)
+{
+    TestAVP		avps[3];
+    uint8_t		buf[3 * DIAMETER_VENDOR_AVP_SIZE(MAX_TEST_DATA)];
+    TestAVP		decoded[3];
+    int			i;
+    int			length = 0;
+    CFAbsoluteTime	start;
+    CFAbsoluteTime	t;
+
+    /* a typical MS-CHAPv2 inner authentication message */
+    bzero(avps, sizeof(avps));
+    avps[0].code = kRADIUSAttributeTypeUserName;
+    avps[0].length = 16;
+    avps[1].code = kMSRADIUSAttributeTypeMSCHAPChallenge;
+    avps[1].vendor = kRADIUSVendorIdentifierMicrosoft;
+    avps[1].length = MSCHAP2_CHALLENGE_SIZE;
+    avps[2].code = kMSRADIUSAttributeTypeMSCHAP2Response;
+    avps[2].vendor = kRADIUSVendorIdentifierMicrosoft;
+    avps[2].length = TTLS_MSCHAP2_RESPONSE_LENGTH;
+    start = CFAbsoluteTimeGetCurrent();
+    for (i = 0; i < N_BENCH_ITERATIONS; i++) {
+	length = encode_avps(avps, 3, buf, sizeof(buf));
+    }
+    t = CFAbsoluteTimeGetCurrent() - start;
+    printf("encode: %d byte message, %g nsecs/message\n",
+	   length, t * 1e9 / N_BENCH_ITERATIONS);
+    start = CFAbsoluteTimeGetCurrent();
+    for (i = 0; i < N_BENCH_ITERATIONS; i++) {
+	(void)decode_avps(buf, length, decoded, 3, FALSE);
+    }
+    t = CFAbsoluteTimeGetCurrent() - start;
+    printf("decode: %d byte message, %g nsecs/message\n",
+	   length, t * 1e9 / N_BENCH_ITERATIONS);
+    return;
+}
+
+int
+main(int argc, char * argv[])
+{
+    int		ret;
+
+    if (argc >= 2) {
+	exit(round_trips(strtol(argv[1], NULL, 0),
+			 (argc >= 3)
+			 ? (unsigned int)strtoul(argv[2], NULL, 0) : 0));
+    }
+    ret = check_chap_layout();
+    if (ret == 0) {
+	ret = round_trips(N_ROUND_TRIPS, 0);
+    }
+    if (ret == 0) {
+	benchmark();
+    }
+    exit(ret);
+    return (ret);
+}
+#endif /* TEST_DIAMETER_AVP */
@@ -54,8 +54,7 @@
 #include "fips186prf.h"
 
 /*
- * we do it in 8-bit chunks, because we have to keep the numbers
- * in network byte order (i.e. MSB)
+ * the numbers are kept in network byte order (i.e. MSB)
  *
  * make it a structure so that we can do structure assignments.
  */
@@ -63,20 +62,83 @@ typedef struct onesixty {
 	uint8_t p[20];
 } onesixty;
 
-static void onesixty_add_mod(onesixty *sum, onesixty *a, onesixty *b)
+static inline uint64_t load_be64(const uint8_t *p)
 {
-	uint32_t s;
-	int i, carry;
+	return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48)
+		| ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32)
+		| ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16)
+		| ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+}
 
-	carry = 0;
-	for(i=19; i>=0; i--) {
-/*	for(i=0; i<20; i++) {  */
-		s = a->p[i] + b->p[i] + carry;
-		sum->p[i] = s & 0xff;
-		carry = s >> 8;
+static inline void store_be64(uint8_t *p, uint64_t v)
+{
+	int i;
+
+	for (i = 7; i >= 0; i--) {
+		p[i] = (uint8_t)v;
+		v >>= 8;
 	}
 }
 
+static inline uint32_t load_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+		| ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void store_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)v;
+}
+
+/*
+ * sum = (1 + a + b) mod 2^160
+ *
+ * The 160-bit numbers are added as a 32-bit high limb and two 64-bit
+ * limbs, with the 1 going in as the initial carry.
+ */
+static void onesixty_add_one_mod(onesixty *sum, const onesixty *a,
+				 const onesixty *b)
+{
+	uint64_t a_lo, a_mid, s_lo, s_mid, t;
+	uint32_t s_hi;
+	unsigned int carry;
+
+	a_lo = load_be64(a->p + 12);
+	t = a_lo + 1;
+	carry = (t < a_lo);
+	s_lo = t + load_be64(b->p + 12);
+	carry += (s_lo < t);
+
+	a_mid = load_be64(a->p + 4);
+	t = a_mid + carry;
+	carry = (t < a_mid);
+	s_mid = t + load_be64(b->p + 4);
+	carry += (s_mid < t);
+
+	s_hi = load_be32(a->p) + load_be32(b->p) + carry;
+
+	store_be32(sum->p, s_hi);
+	store_be64(sum->p + 4, s_mid);
+	store_be64(sum->p + 12, s_lo);
+}
+
+/*
+ * w = SHA1(XVAL), the raw transform of XVAL followed by zeroes
+ */
+static void sha1_xval(const onesixty *xval, uint8_t block[64], onesixty *w)
+{
+	fr_SHA1_CTX context;
+
+	fr_SHA1Init(&context);
+	memcpy(block, xval->p, sizeof(xval->p));
+	fr_SHA1Transform(&context, block);
+	fr_SHA1FinalNoLen(w->p, &context);
+}
+
 /*
  * run the FIPS-186-2 PRF on the given Master Key (160 bits)
  * in order to derive 1280 bits (160 bytes) of keying data from
@@ -85,16 +147,19 @@ static void onesixty_add_mod(onesixty *sum, onesixty *a, onesixty *b)
  * Given that in EAP-SIM, this is coming from a 64-bit Kc it seems
  * like an awful lot of "randomness" to pull out.. (MCR)
  *
+ * Each step depends on the XKEY produced by the one before it, so the
+ * eight SHA1 blocks can only be computed one after another; the
+ * speedup comes from fr_SHA1Transform() selecting a hardware SHA1
+ * implementation when available.
  */
 
 __private_extern__
 void fips186_2prf(uint8_t mk[20], uint8_t finalkey[160])
 {
-	fr_SHA1_CTX context;
 	int j;
-	onesixty xval, xkey, w_0, w_1, sum, one;
+	onesixty xkey, w_0, w_1;
 	uint8_t *f;
-	uint8_t zeros[64];
+	uint8_t block[64];
 
 	/*
 	 * let XKEY := MK,
@@ -111,42 +176,23 @@ void fips186_2prf(uint8_t mk[20], uint8_t finalkey[160])
 	 */
 	memcpy(&xkey, mk, sizeof(xkey));
 
-	/* make the value 1 */
-	memset(&one,  0, sizeof(one));
-	one.p[19]=1;
+	/* the bytes after XVAL stay zero */
+	memset(block, 0, sizeof(block));
 
 	f=finalkey;
 
 	for(j=0; j<4; j++) {
-		/*   a. XVAL = XKEY  */
-		xval = xkey;
-
-		/*   b. w_0 = SHA1(XVAL)  */
-		fr_SHA1Init(&context);
-
-		memset(zeros, 0, sizeof(zeros));
-		memcpy(zeros, xval.p, 20);
-		fr_SHA1Transform(&context, zeros);
-		fr_SHA1FinalNoLen(w_0.p, &context);
+		/*   a. XVAL = XKEY, b. w_0 = SHA1(XVAL)  */
+		sha1_xval(&xkey, block, &w_0);
 
 		/*   c. XKEY = (1 + XKEY + w_0) mod 2^160 */
-		onesixty_add_mod(&sum,  &xkey, &w_0);
-		onesixty_add_mod(&xkey, &sum,  &one);
-
-		/*   d. XVAL = XKEY  */
-		xval = xkey;
-
-		/*   e. w_1 = SHA1(XVAL)  */
-		fr_SHA1Init(&context);
+		onesixty_add_one_mod(&xkey, &xkey, &w_0);
 
-		memset(zeros, 0, sizeof(zeros));
-		memcpy(zeros, xval.p, 20);
-		fr_SHA1Transform(&context, zeros);
-		fr_SHA1FinalNoLen(w_1.p, &context);
+		/*   d. XVAL = XKEY, e. w_1 = SHA1(XVAL)  */
+		sha1_xval(&xkey, block, &w_1);
 
 		/*   f. XKEY = (1 + XKEY + w_1) mod 2^160 */
-		onesixty_add_mod(&sum,  &xkey, &w_1);
-		onesixty_add_mod(&xkey, &sum,  &one);
+		onesixty_add_one_mod(&xkey, &xkey, &w_1);
 
 		/* now store it away */
 		memcpy(f, &w_0, 20);
@@ -155,6 +201,8 @@ void fips186_2prf(uint8_t mk[20], uint8_t finalkey[160])
 		memcpy(f, &w_1, 20);
 		f += 20;
 	}
+	memset(block, 0, sizeof(block));
+	memset(&xkey, 0, sizeof(xkey));
 }
 
 #ifdef TEST_FIPS186PRF
@@ -197,6 +245,160 @@ uint8_t final_output[160] = {
     0x7c, 0x9d, 0xfd, 0xab, 0x92, 0xff, 0xbd, 0xf2, 0x40, 0xfc, 0xec, 0xf6,  0x5a, 0x2c, 0x93, 0xb9,
 };
 
+#include <time.h>
+
+#define N_RANDOM_TESTS		10000
+#define N_BENCH_ITERATIONS	200000
+
+/*
+ * FIPS 180-2, Appendix A.1: SHA1("abc"), padded by hand into one block
+ */
+static const uint8_t abc_digest[20] = {
+    0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a, 0xba, 0x3e,
+    0x25, 0x71, 0x78, 0x50, 0xc2, 0x6c, 0x9c, 0xd0, 0xd8, 0x9d
+};
+
+/*
+ * The original byte-at-a-time addition and PRF, kept as the reference
+ * that the optimized versions are checked against.
+ */
+static void onesixty_add_mod(onesixty *sum, onesixty *a, onesixty *b)
+{
+	uint32_t s;
+	int i, carry;
+
+	carry = 0;
+	for(i=19; i>=0; i--) {
+		s = a->p[i] + b->p[i] + carry;
+		sum->p[i] = s & 0xff;
+		carry = s >> 8;
+	}
+}
+
+static void reference_fips186_2prf(uint8_t mk[20], uint8_t finalkey[160])
+{
+	fr_SHA1_CTX context;
+	int i, j;
+	onesixty xkey, w[2], sum, one;
+	uint8_t *f;
+	uint8_t zeros[64];
+
+	memcpy(&xkey, mk, sizeof(xkey));
+	memset(&one,  0, sizeof(one));
+	one.p[19]=1;
+	f=finalkey;
+	for(j=0; j<4; j++) {
+		for (i = 0; i < 2; i++) {
+			fr_SHA1Init(&context);
+			memset(zeros, 0, sizeof(zeros));
+			memcpy(zeros, xkey.p, 20);
+			fr_SHA1TransformScalar(&context, zeros);
+			fr_SHA1FinalNoLen(w[i].p, &context);
+			onesixty_add_mod(&sum,  &xkey, &w[i]);
+			onesixty_add_mod(&xkey, &sum,  &one);
+		}
+		memcpy(f, w, 40);
+		f += 40;
+	}
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static int
+sha1_tests(void)
+{
+	uint8_t block[64];
+	fr_SHA1_CTX context;
+	uint8_t digest[20];
+	uint8_t ref_digest[20];
+	int i;
+
+	memset(block, 0, sizeof(block));
+	memcpy(block, "abc", 3);
+	block[3] = 0x80;
+	block[63] = 24;		/* length in bits */
+	fr_SHA1Init(&context);
+	fr_SHA1Transform(&context, block);
+	fr_SHA1FinalNoLen(digest, &context);
+	if (bcmp(digest, abc_digest, sizeof(digest)) != 0) {
+		fprintf(stderr, "SHA1 (%s) known answer FAILED\n",
+			fr_SHA1TransformName());
+		return (1);
+	}
+	for (i = 0; i < N_RANDOM_TESTS; i++) {
+		arc4random_buf(block, sizeof(block));
+		fr_SHA1Init(&context);
+		fr_SHA1Transform(&context, block);
+		fr_SHA1FinalNoLen(digest, &context);
+		fr_SHA1Init(&context);
+		fr_SHA1TransformScalar(&context, block);
+		fr_SHA1FinalNoLen(ref_digest, &context);
+		if (bcmp(digest, ref_digest, sizeof(digest)) != 0) {
+			fprintf(stderr, "SHA1 (%s) vs scalar FAILED\n",
+				fr_SHA1TransformName());
+			return (1);
+		}
+	}
+	printf("SHA1 (%s) is correct!\n", fr_SHA1TransformName());
+	return (0);
+}
+
+static int
+prf_random_tests(void)
+{
+	uint8_t finalkey[160];
+	int i;
+	uint8_t key[20];
+	uint8_t ref_finalkey[160];
+
+	for (i = 0; i < N_RANDOM_TESTS; i++) {
+		arc4random_buf(key, sizeof(key));
+		if (i == 0) {
+			/* carry all the way through the 160 bits */
+			memset(key, 0xff, sizeof(key));
+		}
+		fips186_2prf(key, finalkey);
+		reference_fips186_2prf(key, ref_finalkey);
+		if (bcmp(finalkey, ref_finalkey, sizeof(finalkey)) != 0) {
+			fprintf(stderr, "PRF vs reference FAILED\n");
+			return (1);
+		}
+	}
+	printf("PRF matches the reference\n");
+	return (0);
+}
+
+static void
+benchmark(void)
+{
+	uint8_t finalkey[160];
+	int i;
+	double start;
+	double t;
+
+	start = now();
+	for (i = 0; i < N_BENCH_ITERATIONS; i++) {
+		reference_fips186_2prf(mk, finalkey);
+	}
+	t = now() - start;
+	printf("reference PRF: %g nsecs/call\n",
+	       t * 1e9 / N_BENCH_ITERATIONS);
+	start = now();
+	for (i = 0; i < N_BENCH_ITERATIONS; i++) {
+		fips186_2prf(mk, finalkey);
+	}
+	t = now() - start;
+	printf("PRF (%s): %g nsecs/call\n", fr_SHA1TransformName(),
+	       t * 1e9 / N_BENCH_ITERATIONS);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -238,10 +440,13 @@ main(int argc, char *argv[])
 
 	if (bcmp(finalkey, final_output, sizeof(finalkey)) != 0) {
 	    fprintf(stderr, "Calculation FAILED\n");
+	    exit(1);
 	}
-	else {
-	    printf("Calculation is correct!\n");
+	printf("Calculation is correct!\n");
+	if (sha1_tests() != 0 || prf_random_tests() != 0) {
+	    exit(1);
 	}
+	benchmark();
 	exit(0);
 	return (0);
 }
@@ -11,6 +11,12 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define FR_SHA1_HAVE_SHANI	1
+#endif
 
 #define EXTERN	__private_extern__
 
@@ -36,7 +42,7 @@
 
 /* Hash a single 512-bit block. This is the core of the algorithm. */
 EXTERN
-void fr_SHA1Transform(fr_SHA1_CTX * context, const uint8_t buffer[64])
+void fr_SHA1TransformScalar(fr_SHA1_CTX * context, const uint8_t buffer[64])
 {
   uint32_t a, b, c, d, e;
   typedef union {
@@ -87,6 +93,162 @@ void fr_SHA1Transform(fr_SHA1_CTX * context, const uint8_t buffer[64])
 }
 
 
+#ifdef FR_SHA1_HAVE_SHANI
+/*
+ * The same transform using the SHA extensions (SHA-NI): each
+ * _mm_sha1rnds4_epu32() performs four rounds, and the message schedule
+ * for the next four rounds is computed alongside it with
+ * _mm_sha1msg1_epu32()/_mm_sha1msg2_epu32().
+ */
+#define SHANI_QROUND(e_cur, e_next, m0, m1, m2, m3, f)	\
+    e_cur = _mm_sha1nexte_epu32(e_cur, m0);		\
+    e_next = abcd;					\
+    m1 = _mm_sha1msg2_epu32(m1, m0);			\
+    abcd = _mm_sha1rnds4_epu32(abcd, e_cur, f);		\
+    m3 = _mm_sha1msg1_epu32(m3, m0);			\
+    m2 = _mm_xor_si128(m2, m0);
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void fr_SHA1TransformSHANI(fr_SHA1_CTX * context, const uint8_t buffer[64])
+{
+    __m128i abcd, abcd_save, e0, e0_save, e1;
+    __m128i msg0, msg1, msg2, msg3;
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+					 0x08090a0b0c0d0e0fULL);
+    uint32_t * state = context->state;
+
+    abcd = _mm_loadu_si128((const __m128i *)state);
+    abcd = _mm_shuffle_epi32(abcd, 0x1B);
+    e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+    abcd_save = abcd;
+    e0_save = e0;
+
+    /* rounds 0-3 */
+    msg0 = _mm_loadu_si128((const __m128i *)buffer);
+    msg0 = _mm_shuffle_epi8(msg0, mask);
+    e0 = _mm_add_epi32(e0, msg0);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+    /* rounds 4-7 */
+    msg1 = _mm_loadu_si128((const __m128i *)(buffer + 16));
+    msg1 = _mm_shuffle_epi8(msg1, mask);
+    e1 = _mm_sha1nexte_epu32(e1, msg1);
+    e0 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+    msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+    /* rounds 8-11 */
+    msg2 = _mm_loadu_si128((const __m128i *)(buffer + 32));
+    msg2 = _mm_shuffle_epi8(msg2, mask);
+    e0 = _mm_sha1nexte_epu32(e0, msg2);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+    msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+    msg0 = _mm_xor_si128(msg0, msg2);
+
+    /* rounds 12-15 */
+    msg3 = _mm_loadu_si128((const __m128i *)(buffer + 48));
+    msg3 = _mm_shuffle_epi8(msg3, mask);
+    e1 = _mm_sha1nexte_epu32(e1, msg3);
+    e0 = abcd;
+    msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+    msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+    msg1 = _mm_xor_si128(msg1, msg3);
+
+    /* rounds 16-67 */
+    SHANI_QROUND(e0, e1, msg0, msg1, msg2, msg3, 0);
+    SHANI_QROUND(e1, e0, msg1, msg2, msg3, msg0, 1);
+    SHANI_QROUND(e0, e1, msg2, msg3, msg0, msg1, 1);
+    SHANI_QROUND(e1, e0, msg3, msg0, msg1, msg2, 1);
+    SHANI_QROUND(e0, e1, msg0, msg1, msg2, msg3, 1);
+    SHANI_QROUND(e1, e0, msg1, msg2, msg3, msg0, 1);
+    SHANI_QROUND(e0, e1, msg2, msg3, msg0, msg1, 2);
+    SHANI_QROUND(e1, e0, msg3, msg0, msg1, msg2, 2);
+    SHANI_QROUND(e0, e1, msg0, msg1, msg2, msg3, 2);
+    SHANI_QROUND(e1, e0, msg1, msg2, msg3, msg0, 2);
+    SHANI_QROUND(e0, e1, msg2, msg3, msg0, msg1, 2);
+    SHANI_QROUND(e1, e0, msg3, msg0, msg1, msg2, 3);
+    SHANI_QROUND(e0, e1, msg0, msg1, msg2, msg3, 3);
+
+    /* rounds 68-71 */
+    e1 = _mm_sha1nexte_epu32(e1, msg1);
+    e0 = abcd;
+    msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+    msg3 = _mm_xor_si128(msg3, msg1);
+
+    /* rounds 72-75 */
+    e0 = _mm_sha1nexte_epu32(e0, msg2);
+    e1 = abcd;
+    msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+    /* rounds 76-79 */
+    e1 = _mm_sha1nexte_epu32(e1, msg3);
+    e0 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+    /* Add the working vars back into context.state[] */
+    e0 = _mm_sha1nexte_epu32(e0, e0_save);
+    abcd = _mm_add_epi32(abcd, abcd_save);
+    abcd = _mm_shuffle_epi32(abcd, 0x1B);
+    _mm_storeu_si128((__m128i *)state, abcd);
+    state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+static int cpu_has_shani(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0
+	|| (ecx & bit_SSSE3) == 0 || (ecx & bit_SSE4_1) == 0) {
+	return (0);
+    }
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0) {
+	return (0);
+    }
+    return ((ebx & (1 << 29)) != 0);	/* CPUID.(EAX=7,ECX=0):EBX.SHA */
+}
+#endif /* FR_SHA1_HAVE_SHANI */
+
+typedef void (*fr_SHA1TransformFunc)(fr_SHA1_CTX * context,
+				     const uint8_t buffer[64]);
+
+static fr_SHA1TransformFunc	S_transform = fr_SHA1TransformScalar;
+static const char *		S_transform_name = "scalar";
+static pthread_once_t		S_transform_once = PTHREAD_ONCE_INIT;
+
+static void fr_SHA1SelectTransform(void)
+{
+#ifdef FR_SHA1_HAVE_SHANI
+    if (cpu_has_shani()) {
+	S_transform = fr_SHA1TransformSHANI;
+	S_transform_name = "SHA-NI";
+    }
+#endif /* FR_SHA1_HAVE_SHANI */
+}
+
+/*
+ * fr_SHA1Transform - hash a block using the fastest transform that
+ * the CPU supports; fr_SHA1TransformScalar() is the reference.
+ */
+EXTERN
+void fr_SHA1Transform(fr_SHA1_CTX * context, const uint8_t buffer[64])
+{
+    pthread_once(&S_transform_once, fr_SHA1SelectTransform);
+    (*S_transform)(context, buffer);
+}
+
+EXTERN
+const char * fr_SHA1TransformName(void)
+{
+    pthread_once(&S_transform_once, fr_SHA1SelectTransform);
+    return (S_transform_name);
+}
+
+
 /* fr_SHA1Init - Initialize new context */
 EXTERN
 void fr_SHA1Init(fr_SHA1_CTX* context)
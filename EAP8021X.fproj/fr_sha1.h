@@ -9,6 +9,8 @@ typedef struct {
 } fr_SHA1_CTX;
 
 void fr_SHA1Transform(fr_SHA1_CTX * context, const uint8_t buffer[64]);
+void fr_SHA1TransformScalar(fr_SHA1_CTX * context, const uint8_t buffer[64]);
+const char * fr_SHA1TransformName(void);
 void fr_SHA1Init(fr_SHA1_CTX* context);
 #if 0
 void fr_SHA1Update(fr_SHA1_CTX* context, const uint8_t* data, unsigned int len);
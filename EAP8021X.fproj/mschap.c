@@ -31,7 +31,9 @@
 #include <CoreFoundation/CFString.h>
 #include <libkern/OSByteOrder.h>
 #include <stdbool.h>
+#include <corecrypto/cc.h>
 #include "mschap.h"
+#include "myCFUtil.h"
 
 #include "DESSupport.h"
 
@@ -103,20 +105,67 @@ NTMPPEChallengeResponse(const uint8_t challenge[MSCHAP_NT_CHALLENGE_SIZE],
     return;
 }
 
+#define CHALLENGE_RESPONSE_KEY_COUNT	3
+#define CHALLENGE_RESPONSE_BATCH_SIZE	16
+
+/*
+ * Function: ChallengeResponseBatch
+ * Purpose:
+ *   Compute the RFC 2759 ChallengeResponse() for "count" challenges
+ *   that share the same password hash.  The three DES sub-keys are
+ *   expanded once from the (implicitly zero-padded) 16-byte hash, and
+ *   each sub-key encrypts the challenges in runs of up to
+ *   CHALLENGE_RESPONSE_BATCH_SIZE blocks.
+ */
+static void
+ChallengeResponseBatch(const uint8_t challenges[][MSCHAP_NT_CHALLENGE_SIZE],
+		       int count,
+		       const uint8_t password_hash[NT_PASSWORD_HASH_SIZE], 
+		       uint8_t responses[][MSCHAP_NT_RESPONSE_SIZE])
+{
+    uint8_t	cipher[CHALLENGE_RESPONSE_BATCH_SIZE][DES_BLOCK_SIZE];
+    uint8_t	des_keys[CHALLENGE_RESPONSE_KEY_COUNT][DES_KEY_SIZE];
+    int		i;
+
+    DesMakeKeys(password_hash, NT_PASSWORD_HASH_SIZE,
+		des_keys, CHALLENGE_RESPONSE_KEY_COUNT);
+    for (i = 0; i < count; i += CHALLENGE_RESPONSE_BATCH_SIZE) {
+	int	j;
+	int	k;
+	int	n;
+
+	n = count - i;
+	if (n > CHALLENGE_RESPONSE_BATCH_SIZE) {
+	    n = CHALLENGE_RESPONSE_BATCH_SIZE;
+	}
+	for (k = 0; k < CHALLENGE_RESPONSE_KEY_COUNT; k++) {
+	    DesEncryptBlocks(des_keys[k], challenges[i], n, cipher[0]);
+	    for (j = 0; j < n; j++) {
+		bcopy(cipher[j], responses[i + j] + k * DES_BLOCK_SIZE,
+		      DES_BLOCK_SIZE);
+	    }
+	}
+    }
+    cc_clear(sizeof(des_keys), des_keys);
+    cc_clear(sizeof(cipher), cipher);
+    return;
+}
+
 static void
 ChallengeResponse(const uint8_t challenge[MSCHAP_NT_CHALLENGE_SIZE], 
 		  const uint8_t password_hash[NT_PASSWORD_HASH_SIZE], 
 		  uint8_t response[MSCHAP_NT_RESPONSE_SIZE])
 {
-    uint8_t	zhash[21];
-
-    /* zero pad the password hash to 21 bytes */
-    bzero(zhash, 21);
-    bcopy(password_hash, zhash, NT_PASSWORD_HASH_SIZE);
-
-    DesEncrypt(challenge, zhash, response);
-    DesEncrypt(challenge, zhash + 7, response + 8);
-    DesEncrypt(challenge, zhash + 14, response + 16);
+    uint8_t	des_keys[CHALLENGE_RESPONSE_KEY_COUNT][DES_KEY_SIZE];
+    int		k;
+
+    DesMakeKeys(password_hash, NT_PASSWORD_HASH_SIZE,
+		des_keys, CHALLENGE_RESPONSE_KEY_COUNT);
+    for (k = 0; k < CHALLENGE_RESPONSE_KEY_COUNT; k++) {
+	DesEncryptBlocks(des_keys[k], challenge, 1,
+			 response + k * DES_BLOCK_SIZE);
+    }
+    cc_clear(sizeof(des_keys), des_keys);
     return;
 }
 
@@ -163,7 +212,7 @@ static const uint8_t	magic2[41] = {
     0x6E};
 
 static void
-GenerateAuthResponse(uint8_t * password, uint32_t password_len,
+GenerateAuthResponse(const uint8_t password_hash[NT_PASSWORD_HASH_SIZE],
 		     const uint8_t nt_response[MSCHAP_NT_RESPONSE_SIZE],
 		     const uint8_t peer_challenge[MSCHAP2_CHALLENGE_SIZE],
 		     const uint8_t auth_challenge[MSCHAP2_CHALLENGE_SIZE],
@@ -174,11 +223,8 @@ GenerateAuthResponse(uint8_t * password, uint32_t password_len,
     CC_SHA1_CTX		context;
     int			i;
     uint8_t		hash[CC_SHA1_DIGEST_LENGTH];
-    uint8_t		password_hash[NT_PASSWORD_HASH_SIZE];
     uint8_t *		scan;
 
-    NTPasswordHashHash(password, password_len, password_hash);
-
     CC_SHA1_Init(&context);
     CC_SHA1_Update(&context, password_hash, NT_PASSWORD_HASH_SIZE);
     CC_SHA1_Update(&context, nt_response, MSCHAP_NT_RESPONSE_SIZE);
@@ -309,11 +355,186 @@ MSChap2AuthResponseValid(const uint8_t * password, uint32_t password_len,
 			 const uint8_t response[MSCHAP2_AUTH_RESPONSE_SIZE])
 {
     uint8_t	my_response[MSCHAP2_AUTH_RESPONSE_SIZE];
+    uint8_t	password_hash[NT_PASSWORD_HASH_SIZE];
     uint8_t	unicode_password[NT_MAXPWLEN * 2];
 
     password_len = password_to_unicode(password, password_len, unicode_password);
+    NTPasswordHashHash(unicode_password, password_len, password_hash);
+
+    GenerateAuthResponse(password_hash,
+			 nt_response,
+			 peer_challenge,
+			 auth_challenge, 
+			 username,
+			 my_response);
+    if (bcmp(my_response, response, MSCHAP2_AUTH_RESPONSE_SIZE)) {
+	return (false);
+    }
+    return (true);
+}
+
+/**
+ ** MSCHAPSecret
+ ** - the NT password hash and the hash of the hash, derived once per
+ **   password and shared by every MSCHAPv2 exchange (including those
+ **   inside new PEAP/TTLS tunnels) until the password changes
+ ** - the secret remembers the password it was derived from, so that a
+ **   caller with a different password never gets a stale hash; the owner
+ **   of the credentials also calls MSCHAPSecretFlush() when it changes
+ **   or clears the password, so the old one isn't kept around
+ **/
+
+struct MSCHAPSecret_s {
+    int			retain_count;
+    uint32_t		password_len;
+    uint8_t		password[NT_MAXPWLEN];
+    uint8_t		password_hash[NT_PASSWORD_HASH_SIZE];
+    uint8_t		password_hash_hash[NT_PASSWORD_HASH_SIZE];
+};
+
+/* the secret for the current password */
+static MSCHAPSecretRef	S_secret;
+
+/*
+ * Function: MSCHAPSecretCreate
+ * Purpose:
+ *   Derive a new secret for the given password, bypassing the cache
+ *   e.g. for a password that isn't the current one yet.
+ *   The caller must release it using MSCHAPSecretRelease().
+ */
+MSCHAPSecretRef
+MSCHAPSecretCreate(const uint8_t * password, uint32_t password_len)
+{
+    MSCHAPSecretRef	secret;
+    uint8_t		unicode_password[NT_MAXPWLEN * 2];
+    uint32_t		unicode_password_len;
+
+    /* keep the hashes out of swap */
+    secret = (MSCHAPSecretRef)my_LockedAllocate(sizeof(*secret));
+    if (secret == NULL) {
+	return (NULL);
+    }
+    secret->retain_count = 1;
+    if (password_len > NT_MAXPWLEN) {
+	/* password_to_unicode() only uses this much */
+	password_len = NT_MAXPWLEN;
+    }
+    secret->password_len = password_len;
+    bcopy(password, secret->password, password_len);
+    unicode_password_len = password_to_unicode(password, password_len,
+					       unicode_password);
+    NTPasswordHash(unicode_password, unicode_password_len,
+		   secret->password_hash);
+    NTPasswordHash(secret->password_hash, NT_PASSWORD_HASH_SIZE,
+		   secret->password_hash_hash);
+    cc_clear(sizeof(unicode_password), unicode_password);
+    return (secret);
+}
+
+/*
+ * Function: MSCHAPSecretCopy
+ * Purpose:
+ *   Return a reference to the secret for the given password, deriving
+ *   it only if the cached one is for a different password.
+ *   The caller must release it using MSCHAPSecretRelease().
+ */
+MSCHAPSecretRef
+MSCHAPSecretCopy(const uint8_t * password, uint32_t password_len)
+{
+    if (password_len > NT_MAXPWLEN) {
+	password_len = NT_MAXPWLEN;
+    }
+    if (S_secret != NULL
+	&& (S_secret->password_len != password_len
+	    || (password_len != 0
+		&& cc_cmp_safe(password_len, password,
+			       S_secret->password) != 0))) {
+	MSCHAPSecretFlush();
+    }
+    if (S_secret == NULL) {
+	S_secret = MSCHAPSecretCreate(password, password_len);
+	if (S_secret == NULL) {
+	    return (NULL);
+	}
+    }
+    S_secret->retain_count++;
+    return (S_secret);
+}
+
+void
+MSCHAPSecretRelease(MSCHAPSecretRef * secret_p)
+{
+    MSCHAPSecretRef	secret = *secret_p;
+
+    if (secret == NULL) {
+	return;
+    }
+    *secret_p = NULL;
+    if (--secret->retain_count > 0) {
+	return;
+    }
+    my_LockedFree(secret);
+    return;
+}
+
+/*
+ * Function: MSCHAPSecretFlush
+ * Purpose:
+ *   Forget the cached secret when the password changes or is cleared.
+ */
+void
+MSCHAPSecretFlush(void)
+{
+    MSCHAPSecretRelease(&S_secret);
+    return;
+}
+
+void
+MSChapWithSecret(const uint8_t challenge[MSCHAP_NT_CHALLENGE_SIZE],
+		 MSCHAPSecretRef secret,
+		 uint8_t response[MSCHAP_NT_RESPONSE_SIZE])
+{
+    ChallengeResponse(challenge, secret->password_hash, response);
+    return;
+}
+
+void
+MSChapBatchWithSecret(const uint8_t challenges[][MSCHAP_NT_CHALLENGE_SIZE],
+		      int count,
+		      MSCHAPSecretRef secret,
+		      uint8_t responses[][MSCHAP_NT_RESPONSE_SIZE])
+{
+    ChallengeResponseBatch(challenges, count, secret->password_hash,
+			   responses);
+    return;
+}
+
+void
+MSChap2WithSecret(const uint8_t auth_challenge[MSCHAP2_CHALLENGE_SIZE], 
+		  const uint8_t peer_challenge[MSCHAP2_CHALLENGE_SIZE],
+		  const uint8_t * username,
+		  MSCHAPSecretRef secret,
+		  uint8_t response[MSCHAP_NT_RESPONSE_SIZE])
+{
+    uint8_t	challenge[MSCHAP_NT_CHALLENGE_SIZE];
 
-    GenerateAuthResponse(unicode_password, password_len, 
+    ChallengeHash(peer_challenge, auth_challenge, username,
+		  challenge);
+    ChallengeResponse(challenge, secret->password_hash, response);
+    return;
+}
+
+bool
+MSChap2AuthResponseValidWithSecret(MSCHAPSecretRef secret,
+				   const uint8_t nt_response[MSCHAP_NT_RESPONSE_SIZE],
+				   const uint8_t peer_challenge[MSCHAP2_CHALLENGE_SIZE],
+				   const uint8_t auth_challenge[MSCHAP2_CHALLENGE_SIZE],
+				   const uint8_t * username,
+				   const uint8_t response[MSCHAP2_AUTH_RESPONSE_SIZE])
+{
+    uint8_t	my_response[MSCHAP2_AUTH_RESPONSE_SIZE];
+
+    GenerateAuthResponse(secret->password_hash_hash,
 			 nt_response,
 			 peer_challenge,
 			 auth_challenge, 
@@ -402,8 +623,13 @@ NTPasswordHashEncryptedWithBlock(const uint8_t pw_hash[NT_PASSWORD_HASH_SIZE],
 				 const uint8_t block[NT_PASSWORD_HASH_SIZE],
 				 uint8_t cypher[NT_PASSWORD_HASH_SIZE])
 {
-    DesEncrypt(pw_hash, block, cypher);
-    DesEncrypt(pw_hash + 8, block + 7, cypher + 8);
+    uint8_t	des_keys[2][DES_KEY_SIZE];
+
+    /* the two keys are block[0..6] and block[7..13] */
+    DesMakeKeys(block, 2 * DES_KEY_MATERIAL_SIZE, des_keys, 2);
+    DesEncryptBlocks(des_keys[0], pw_hash, 1, cypher);
+    DesEncryptBlocks(des_keys[1], pw_hash + 8, 1, cypher + 8);
+    cc_clear(sizeof(des_keys), des_keys);
     return;
 }
 
@@ -538,6 +764,15 @@ MSChap2_MPPEGetMasterKey(const uint8_t * password, uint32_t password_len,
     GetMasterKey(password_hash, NTResponse, MasterKey);
 }
 
+void
+MSChap2_MPPEGetMasterKeyWithSecret(MSCHAPSecretRef secret,
+				   const uint8_t NTResponse[MSCHAP_NT_RESPONSE_SIZE],
+				   uint8_t MasterKey[NT_MASTER_KEY_SIZE])
+{
+    GetMasterKey(secret->password_hash_hash, NTResponse, MasterKey);
+    return;
+}
+
 void
 MSChap2_MPPEGetAsymetricStartKey(const uint8_t MasterKey[NT_MASTER_KEY_SIZE],
 				 uint8_t SessionKey[NT_SESSION_KEY_SIZE],
@@ -660,6 +895,144 @@ const uint8_t mschapv2_test2_expected_NT_response[MSCHAP_NT_RESPONSE_SIZE] = {
 const char * test2_username = "MSCHAPv2_User";
 const uint32_t test2_password_len = 10;
 
+/* RFC 2759, Section 9.2 */
+const uint8_t mschapv2_test1_auth_response[MSCHAP2_AUTH_RESPONSE_SIZE + 1] =
+    "S=407A5589115FD0D6209F510FE9C04566932CDA56";
+
+/* RFC 2759, Section 9.2: ChallengeResponse() */
+const uint8_t mschapv2_test1_password_hash[NT_PASSWORD_HASH_SIZE] = {
+    0x44, 0xEB, 0xBA, 0x8D, 0x53, 0x12, 0xB8, 0xD6,
+    0x11, 0x47, 0x44, 0x11, 0xF5, 0x69, 0x89, 0xAE
+};
+
+const uint8_t mschapv2_test1_challenge[MSCHAP_NT_CHALLENGE_SIZE] = {
+    0xD0, 0x2E, 0x43, 0x86, 0xBC, 0xE9, 0x12, 0x26
+};
+
+/* RFC 2433, Appendix B: MS-CHAPv1 (also the LEAP peer response) */
+const char * mschap_test_password = "MyPw";
+
+const uint8_t mschap_test_challenge[MSCHAP_NT_CHALLENGE_SIZE] = {
+    0x10, 0x2D, 0xB5, 0xDF, 0x08, 0x5D, 0x30, 0x41
+};
+
+const uint8_t mschap_test_expected_NT_response[MSCHAP_NT_RESPONSE_SIZE] = {
+    0x4E, 0x9D, 0x3C, 0x8F, 0x9C, 0xFD, 0x38, 0x5D,
+    0x5B, 0xF4, 0xD3, 0x24, 0x67, 0x91, 0x95, 0x6C,
+    0xA4, 0xC3, 0x51, 0xAB, 0x40, 0x9A, 0x3D, 0x61
+};
+
+#include <CoreFoundation/CFDate.h>
+
+#define N_DES_KEY_TESTS		100000
+#define N_BATCH_CHALLENGES	100
+#define N_BENCH_ITERATIONS	200000
+
+/*
+ * The bit-at-a-time key expansion that DesMakeKeys() replaced, kept
+ * here to check the table-driven version against.
+ */
+static void
+reference_make_key(const uint8_t key[DES_KEY_MATERIAL_SIZE],
+		   uint8_t des_key[DES_KEY_SIZE])
+{
+    int		i;
+
+    for (i = 0; i < DES_KEY_SIZE; i++) {
+	int	bit;
+	int	j;
+	uint8_t	val = 0;
+
+	for (j = 0, bit = i * 7; j < 7; j++, bit++) {
+	    val = (val << 1) | ((key[bit / 8] >> (7 - (bit % 8))) & 1);
+	}
+	val <<= 1;
+	/* set the low bit to make the parity odd */
+	des_key[i] = val | (__builtin_popcount(val) % 2 == 0);
+    }
+    return;
+}
+
+static int
+des_key_tests(void)
+{
+    uint8_t	des_key[1][DES_KEY_SIZE];
+    int		i;
+    uint8_t	key[DES_KEY_MATERIAL_SIZE];
+    uint8_t	ref_key[DES_KEY_SIZE];
+
+    for (i = 0; i < N_DES_KEY_TESTS; i++) {
+	arc4random_buf(key, sizeof(key));
+	DesMakeKeys(key, sizeof(key), des_key, 1);
+	reference_make_key(key, ref_key);
+	if (bcmp(des_key[0], ref_key, DES_KEY_SIZE) != 0) {
+	    printf("DES key expansion TEST failed\n");
+	    return (1);
+	}
+    }
+    printf("DES key expansion TEST Passed\n");
+    return (0);
+}
+
+/*
+ * The original ChallengeResponse(): zero-pad the hash, then expand
+ * and encrypt each 7-byte sub-key separately.
+ */
+static void
+legacy_challenge_response(const uint8_t challenge[MSCHAP_NT_CHALLENGE_SIZE], 
+			  const uint8_t password_hash[NT_PASSWORD_HASH_SIZE], 
+			  uint8_t response[MSCHAP_NT_RESPONSE_SIZE])
+{
+    uint8_t	zhash[21];
+
+    bzero(zhash, 21);
+    bcopy(password_hash, zhash, NT_PASSWORD_HASH_SIZE);
+    DesEncrypt(challenge, zhash, response);
+    DesEncrypt(challenge, zhash + 7, response + 8);
+    DesEncrypt(challenge, zhash + 14, response + 16);
+    return;
+}
+
+static void
+challenge_response_benchmark(void)
+{
+    uint8_t		challenges[N_BATCH_CHALLENGES][MSCHAP_NT_CHALLENGE_SIZE];
+    int			i;
+    uint8_t		responses[N_BATCH_CHALLENGES][MSCHAP_NT_RESPONSE_SIZE];
+    CFAbsoluteTime	start;
+    CFAbsoluteTime	t;
+
+    arc4random_buf(challenges, sizeof(challenges));
+    start = CFAbsoluteTimeGetCurrent();
+    for (i = 0; i < N_BENCH_ITERATIONS; i++) {
+	legacy_challenge_response(challenges[i % N_BATCH_CHALLENGES],
+				  mschapv2_test1_password_hash,
+				  responses[i % N_BATCH_CHALLENGES]);
+    }
+    t = CFAbsoluteTimeGetCurrent() - start;
+    printf("legacy ChallengeResponse: %g nsecs/response\n",
+	   t * 1e9 / N_BENCH_ITERATIONS);
+    start = CFAbsoluteTimeGetCurrent();
+    for (i = 0; i < N_BENCH_ITERATIONS; i++) {
+	ChallengeResponse(challenges[i % N_BATCH_CHALLENGES],
+			  mschapv2_test1_password_hash,
+			  responses[i % N_BATCH_CHALLENGES]);
+    }
+    t = CFAbsoluteTimeGetCurrent() - start;
+    printf("ChallengeResponse: %g nsecs/response\n",
+	   t * 1e9 / N_BENCH_ITERATIONS);
+    start = CFAbsoluteTimeGetCurrent();
+    for (i = 0; i < N_BENCH_ITERATIONS; i += N_BATCH_CHALLENGES) {
+	ChallengeResponseBatch(challenges, N_BATCH_CHALLENGES,
+			       mschapv2_test1_password_hash,
+			       responses);
+    }
+    t = CFAbsoluteTimeGetCurrent() - start;
+    printf("ChallengeResponseBatch: %g nsecs/response\n",
+	   t * 1e9 / N_BENCH_ITERATIONS);
+    return;
+}
+
 int
 main()
 {
@@ -685,6 +1058,45 @@ main()
     printf("SendStartKey128 generation successful\n");
     }
 
+    { /* DES/ChallengeResponse Test START */
+    uint8_t	challenges[N_BATCH_CHALLENGES][MSCHAP_NT_CHALLENGE_SIZE];
+    int		i;
+    uint8_t	response[MSCHAP_NT_RESPONSE_SIZE];
+    uint8_t	responses[N_BATCH_CHALLENGES][MSCHAP_NT_RESPONSE_SIZE];
+
+    if (des_key_tests() != 0) {
+	exit(1);
+    }
+    ChallengeResponse(mschapv2_test1_challenge, mschapv2_test1_password_hash,
+		      response);
+    if (bcmp(response, mschapv2_test1_expected_NT_response,
+	     MSCHAP_NT_RESPONSE_SIZE) != 0) {
+	printf("ChallengeResponse TEST failed\n");
+	exit(1);
+    }
+    printf("ChallengeResponse TEST Passed\n");
+    MSChap(mschap_test_challenge, (const uint8_t *)mschap_test_password,
+	   strlen(mschap_test_password), response);
+    if (bcmp(response, mschap_test_expected_NT_response,
+	     MSCHAP_NT_RESPONSE_SIZE) != 0) {
+	printf("MSCHAP NT Response TEST failed\n");
+	exit(1);
+    }
+    printf("MSCHAP NT Response TEST Passed\n");
+    arc4random_buf(challenges, sizeof(challenges));
+    ChallengeResponseBatch(challenges, N_BATCH_CHALLENGES,
+			   mschapv2_test1_password_hash, responses);
+    for (i = 0; i < N_BATCH_CHALLENGES; i++) {
+	legacy_challenge_response(challenges[i], mschapv2_test1_password_hash,
+				  response);
+	if (bcmp(response, responses[i], MSCHAP_NT_RESPONSE_SIZE) != 0) {
+	    printf("ChallengeResponseBatch TEST failed\n");
+	    exit(1);
+	}
+    }
+    printf("ChallengeResponseBatch TEST Passed\n");
+    } /* DES/ChallengeResponse Test END */
+
     { /* MSCHAPv2 Test START */
     uint8_t response[MSCHAP_NT_RESPONSE_SIZE] = {0};
 
@@ -705,8 +1117,98 @@ main()
         exit(1);
     }
     printf("MSCHAPv2 NT Response generation TEST 2 Passed\n");
+    if (MSChap2AuthResponseValid((const uint8_t *)password, strlen(password),
+				 mschapv2_test1_expected_NT_response,
+				 mschapv2_test1_peer_challenge,
+				 mschapv2_test1_auth_challenge,
+				 (const uint8_t *)username,
+				 mschapv2_test1_auth_response) == false) {
+	printf("MSCHAPv2 Authenticator Response TEST failed\n");
+	exit(1);
+    }
+    printf("MSCHAPv2 Authenticator Response TEST Passed\n");
     } /* MSCHAPv2 Test END */
 
+    { /* MSCHAPSecret Test START */
+    uint8_t		master[NT_MASTER_KEY_SIZE];
+    uint8_t		response[MSCHAP_NT_RESPONSE_SIZE];
+    MSCHAPSecretRef	secret;
+    MSCHAPSecretRef	secret2;
+
+    secret = MSCHAPSecretCopy((const uint8_t *)password, strlen(password));
+    MSChap2WithSecret(mschapv2_test1_auth_challenge,
+		      mschapv2_test1_peer_challenge,
+		      (const uint8_t *)username, secret, response);
+    if (bcmp(response, mschapv2_test1_expected_NT_response,
+	     MSCHAP_NT_RESPONSE_SIZE) != 0) {
+	printf("MSCHAPSecret NT Response TEST failed\n");
+	exit(1);
+    }
+    if (MSChap2AuthResponseValidWithSecret(secret,
+					   mschapv2_test1_expected_NT_response,
+					   mschapv2_test1_peer_challenge,
+					   mschapv2_test1_auth_challenge,
+					   (const uint8_t *)username,
+					   mschapv2_test1_auth_response)
+	== false) {
+	printf("MSCHAPSecret Authenticator Response TEST failed\n");
+	exit(1);
+    }
+    MSChap2_MPPEGetMasterKeyWithSecret(secret, nt_response, master);
+    if (bcmp(master, MasterKey, NT_MASTER_KEY_SIZE) != 0) {
+	printf("MSCHAPSecret Master Key TEST failed\n");
+	exit(1);
+    }
+
+    /* the cached secret is returned until it's flushed */
+    secret2 = MSCHAPSecretCopy((const uint8_t *)password, strlen(password));
+    if (secret2 != secret) {
+	printf("MSCHAPSecret cache TEST failed\n");
+	exit(1);
+    }
+    MSCHAPSecretRelease(&secret2);
+
+    /* new password: a new secret is derived, even without a flush */
+    secret2 = MSCHAPSecretCopy(mschapv2_test2_password, test2_password_len);
+    MSChap2WithSecret(mschapv2_test2_auth_challenge,
+		      mschapv2_test2_peer_challenge,
+		      (const uint8_t *)test2_username, secret2, response);
+    if (secret2 == secret
+	|| bcmp(response, mschapv2_test2_expected_NT_response,
+		MSCHAP_NT_RESPONSE_SIZE) != 0) {
+	printf("MSCHAPSecret invalidation TEST failed\n");
+	exit(1);
+    }
+    MSCHAPSecretRelease(&secret2);
+
+    /* MS-CHAPv1 with the cached secret, one and several at a time */
+    {
+	uint8_t	challenges[2][MSCHAP_NT_CHALLENGE_SIZE];
+	uint8_t	responses[2][MSCHAP_NT_RESPONSE_SIZE];
+
+	secret2 = MSCHAPSecretCreate((const uint8_t *)mschap_test_password,
+				     strlen(mschap_test_password));
+	MSChapWithSecret(mschap_test_challenge, secret2, response);
+	bcopy(mschap_test_challenge, challenges[0], MSCHAP_NT_CHALLENGE_SIZE);
+	bcopy(mschap_test_challenge, challenges[1], MSCHAP_NT_CHALLENGE_SIZE);
+	MSChapBatchWithSecret(challenges, 2, secret2, responses);
+	MSCHAPSecretRelease(&secret2);
+	if (bcmp(response, mschap_test_expected_NT_response,
+		 MSCHAP_NT_RESPONSE_SIZE) != 0
+	    || bcmp(responses[0], mschap_test_expected_NT_response,
+		    MSCHAP_NT_RESPONSE_SIZE) != 0
+	    || bcmp(responses[1], mschap_test_expected_NT_response,
+		    MSCHAP_NT_RESPONSE_SIZE) != 0) {
+	    printf("MSCHAPSecret MS-CHAP TEST failed\n");
+	    exit(1);
+	}
+    }
+    MSCHAPSecretRelease(&secret);
+    MSCHAPSecretFlush();
+    printf("MSCHAPSecret TESTs Passed\n");
+    } /* MSCHAPSecret Test END */
+
+    challenge_response_benchmark();
     exit(0);
     return (0);
 }
@@ -126,4 +126,63 @@ MSChap2_MPPEGetAsymetricStartKey(const uint8_t MasterKey[NT_MASTER_KEY_SIZE],
 				 int SessionKeyLength,
 				 bool IsSend,
 				 bool IsServer);
+
+/*
+ * MSCHAPSecret
+ * - the NT password hash and hash of the hash derived from a password,
+ *   held in wired memory that is zeroed when released
+ * - MSCHAPSecretCopy() returns the cached secret if it was derived from
+ *   the same password; call MSCHAPSecretFlush() when the password changes
+ *   or is cleared so that the old one isn't kept
+ */
+typedef struct MSCHAPSecret_s * MSCHAPSecretRef;
+
+MSCHAPSecretRef
+MSCHAPSecretCreate(const uint8_t * password, uint32_t password_len);
+
+MSCHAPSecretRef
+MSCHAPSecretCopy(const uint8_t * password, uint32_t password_len);
+
+void
+MSCHAPSecretRelease(MSCHAPSecretRef * secret_p);
+
+void
+MSCHAPSecretFlush(void);
+
+void
+MSChapWithSecret(const uint8_t challenge[MSCHAP_NT_CHALLENGE_SIZE],
+		 MSCHAPSecretRef secret,
+		 uint8_t response[MSCHAP_NT_RESPONSE_SIZE]);
+
+/*
+ * MSChapBatchWithSecret
+ * - compute the MS-CHAP NT-Response to each of "count" challenges,
+ *   expanding the DES keys from the secret only once
+ */
+void
+MSChapBatchWithSecret(const uint8_t challenges[][MSCHAP_NT_CHALLENGE_SIZE],
+		      int count,
+		      MSCHAPSecretRef secret,
+		      uint8_t responses[][MSCHAP_NT_RESPONSE_SIZE]);
+
+void
+MSChap2WithSecret(const uint8_t auth_challenge[MSCHAP2_CHALLENGE_SIZE], 
+		  const uint8_t peer_challenge[MSCHAP2_CHALLENGE_SIZE],
+		  const uint8_t * username,
+		  MSCHAPSecretRef secret,
+		  uint8_t response[MSCHAP_NT_RESPONSE_SIZE]);
+
+bool
+MSChap2AuthResponseValidWithSecret(MSCHAPSecretRef secret,
+				   const uint8_t nt_response[MSCHAP_NT_RESPONSE_SIZE],
+				   const uint8_t peer_challenge[MSCHAP2_CHALLENGE_SIZE],
+				   const uint8_t auth_challenge[MSCHAP2_CHALLENGE_SIZE],
+				   const uint8_t * username,
+				   const uint8_t response[MSCHAP2_AUTH_RESPONSE_SIZE]);
+
+void
+MSChap2_MPPEGetMasterKeyWithSecret(MSCHAPSecretRef secret,
+				   const uint8_t NTResponse[MSCHAP_NT_RESPONSE_SIZE],
+				   uint8_t MasterKey[NT_MASTER_KEY_SIZE]);
+
 #endif /* _EAP8021X_MSCHAP_H */
@@ -39,6 +39,9 @@
 #include <mach/notify.h>
 #include <mach/mach_error.h>
 #include <pthread.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <corecrypto/cc.h>
 
 #include <CoreFoundation/CFPropertyList.h>
 #include <CoreFoundation/CFData.h>
@@ -426,3 +429,84 @@ my_CFStringCopyComponent(CFStringRef path, CFStringRef separator,
 
 }
 
+/*
+ * Locked memory
+ * - memory that is wired so that it never reaches swap, and zeroed before
+ *   it is freed; used for keys and password hashes
+ * - each allocation occupies whole pages of its own, so that munlock()
+ *   on one allocation can't unwire a page shared with another
+ */
+typedef struct {
+    size_t		size;
+    uint8_t		bytes[1];
+} LockedBuffer, * LockedBufferRef;
+
+#define LOCKED_BUFFER_HEADER_SIZE	offsetof(LockedBuffer, bytes)
+
+void *
+my_LockedAllocate(size_t size)
+{
+    LockedBufferRef	buf;
+    size_t		page_size;
+    size_t		total_size;
+
+    page_size = (size_t)getpagesize();
+    total_size = roundup(LOCKED_BUFFER_HEADER_SIZE + size, page_size);
+    if (posix_memalign((void * *)&buf, page_size, total_size) != 0) {
+	return (NULL);
+    }
+    buf->size = total_size;
+    (void)mlock(buf, total_size);
+    return (buf->bytes);
+}
+
+void
+my_LockedFree(void * ptr)
+{
+    LockedBufferRef	buf;
+    size_t		total_size;
+
+    if (ptr == NULL) {
+	return;
+    }
+    buf = (LockedBufferRef)((uint8_t *)ptr - LOCKED_BUFFER_HEADER_SIZE);
+    total_size = buf->size;
+    cc_clear(total_size, buf);
+    (void)munlock(buf, total_size);
+    free(buf);
+    return;
+}
+
+static void *
+locked_allocate(CFIndex size, CFOptionFlags hint, void * info)
+{
+    return (my_LockedAllocate(size));
+}
+
+static void
+locked_deallocate(void * ptr, void * info)
+{
+    my_LockedFree(ptr);
+    return;
+}
+
+/*
+ * Function: my_CFLockedAllocator
+ * Purpose:
+ *   Return a CFAllocator whose memory comes from my_LockedAllocate().
+ */
+CFAllocatorRef
+my_CFLockedAllocator(void)
+{
+    static CFAllocatorRef	S_allocator;
+
+    if (S_allocator == NULL) {
+	CFAllocatorContext	context;
+
+	bzero(&context, sizeof(context));
+	context.allocate = locked_allocate;
+	context.deallocate = locked_deallocate;
+	S_allocator = CFAllocatorCreate(NULL, &context);
+    }
+    return (S_allocator);
+}
@@ -86,4 +86,13 @@ my_CFPropertyListCreateVMData(CFPropertyListRef plist,
 CFStringRef
 my_CFStringCopyComponent(CFStringRef path, CFStringRef separator, 
 			 CFIndex component_index);
+
+void *
+my_LockedAllocate(size_t size);
+
+void
+my_LockedFree(void * ptr);
+
+CFAllocatorRef
+my_CFLockedAllocator(void);
 #endif /* _S_MYCFUTIL_H */
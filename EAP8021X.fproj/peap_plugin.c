@@ -238,7 +238,7 @@ typedef struct {
     PEAPInnerAuthState		inner_auth_state;
     struct eap_client		eap;
     EAPPacketRef		last_packet;
-    char			last_packet_buf[1024];
+    char			in_buf[2048];	/* decrypted inner EAP packet */
     int				last_eap_type_index;
     OSStatus			trust_ssl_error;
     EAPClientStatus		trust_status;
@@ -258,11 +258,18 @@ enum {
 #define BAD_IDENTIFIER			(-1)
 #define BAD_VERSION			(-1)
 
+static bool
+packet_is_in_buf(PEAPPluginDataRef context, EAPPacketRef packet)
+{
+    return ((char *)packet >= context->in_buf
+	    && (char *)packet < context->in_buf + sizeof(context->in_buf));
+}
+
 static void
 free_last_packet(PEAPPluginDataRef context)
 {
     if (context->last_packet != NULL
-	&& (void *)context->last_packet != context->last_packet_buf) {
+	&& packet_is_in_buf(context, context->last_packet) == FALSE) {
 	free(context->last_packet);
     }
     context->last_packet = NULL;
@@ -280,16 +287,17 @@ save_last_packet(PEAPPluginDataRef context, EAPPacketRef packet)
 	/* don't bother re-saving the same buffer */
 	return;
     }
-    len = EAPPacketGetLength(packet);
-    if (len > sizeof(context->last_packet_buf)) {
-	context->last_packet = (EAPPacketRef)malloc(len);
+    if (packet_is_in_buf(context, packet)) {
+	/* the packet was decrypted into the context, just remember it */
+	context->last_packet = packet;
     }
     else {
-	context->last_packet = (EAPPacketRef)context->last_packet_buf;
+	len = EAPPacketGetLength(packet);
+	context->last_packet = (EAPPacketRef)malloc(len);
+	memcpy(context->last_packet, packet, len);
     }
-    memcpy(context->last_packet, packet, len);
     if (last_packet != NULL
-	&& (void *)last_packet != context->last_packet_buf) {
+	&& packet_is_in_buf(context, last_packet) == FALSE) {
 	free(last_packet);
     }
     return;
@@ -501,6 +509,7 @@ peap_start(EAPClientPluginDataRef plugin)
 		      EAPSSLErrorString(status), (long)status);
 	    goto failed;
 	}
+	(void)SSLSetSessionTicketsEnabled(ssl_context, TRUE);
     }
     if (context->cert_is_required) {
 	if (context->certs == NULL) {
@@ -786,7 +795,7 @@ peap_eap(EAPClientPluginDataRef plugin, EAPTLSPacketRef eaptls_in,
 {
     bool 		call_module_free_packet = FALSE;
     PEAPPluginDataRef 	context = (PEAPPluginDataRef)plugin->private;
-    char 		in_buf[2048];
+    char *		in_buf = context->in_buf;
     size_t		in_data_size = 0;
     EAPRequestPacketRef	in_pkt_p;
     int			offset;
@@ -818,11 +827,13 @@ peap_eap(EAPClientPluginDataRef plugin, EAPTLSPacketRef eaptls_in,
     }
     else {
 	bool			is_valid;
-	CFMutableStringRef	log_msg = NULL;
+	CFTypeRef		log_descr;
 
+	/* decrypt in place into the context, the remembered packet is stale */
+	free_last_packet(context);
 	read_buf->offset = 0;
 	status = SSLRead(context->ssl_context, in_buf + offset, 
-			 sizeof(in_buf) - offset, &in_data_size);
+			 sizeof(context->in_buf) - offset, &in_data_size);
 	if (status != noErr) {
 	    EAPLOG_FL(LOG_NOTICE, "SSLRead failed, %s (%d)",
 		      EAPSSLErrorString(status), (int)status);
@@ -852,13 +863,15 @@ peap_eap(EAPClientPluginDataRef plugin, EAPTLSPacketRef eaptls_in,
 	default:
 	    break;
 	}
-	log_msg = plugin->log_enabled ? CFStringCreateMutable(NULL, 0) : NULL;
 	is_valid = EAPPacketIsValid((EAPPacketRef)in_pkt_p, in_data_size,
-				    log_msg);
-	if (log_msg != NULL) {
+				    NULL);
+	if (plugin->log_enabled) {
+	    log_descr
+		= EAPPacketCreateDeferredDescription((EAPPacketRef)in_pkt_p,
+						     in_data_size);
 	    EAPLOG(-LOG_DEBUG, "PEAP Receive EAP Payload%s:\n%@",
-		   is_valid ? "" : " Invalid", log_msg);
-	    CFRelease(log_msg);
+		   is_valid ? "" : " Invalid", log_descr);
+	    my_CFRelease(&log_descr);
 	}
 	if (is_valid == FALSE) {
 	    if (plugin->log_enabled == FALSE) {
@@ -933,14 +946,13 @@ peap_eap(EAPClientPluginDataRef plugin, EAPTLSPacketRef eaptls_in,
 	goto done;
     }
     if (plugin->log_enabled) {
-	CFMutableStringRef		log_msg;
+	CFTypeRef		log_descr;
 
-	log_msg = CFStringCreateMutable(NULL, 0);
-	EAPPacketIsValid((const EAPPacketRef)out_pkt_p,
-			 EAPPacketGetLength((const EAPPacketRef)out_pkt_p),
-			 log_msg);
-	EAPLOG(-LOG_DEBUG, "PEAP Send EAP Payload:\n%@", log_msg);
-	CFRelease(log_msg);
+	log_descr
+	    = EAPPacketCreateDeferredDescription((EAPPacketRef)out_pkt_p,
+			EAPPacketGetLength((const EAPPacketRef)out_pkt_p));
+	EAPLOG(-LOG_DEBUG, "PEAP Send EAP Payload:\n%@", log_descr);
+	my_CFRelease(&log_descr);
     }
     switch (context->peap_version) {
     case kPEAPVersion0:
@@ -1379,6 +1391,7 @@ peap_process(EAPClientPluginDataRef plugin,
     *error = 0;
     context->bogus_l_bit = FALSE;
     *out_pkt_p = NULL;
+    context->mtu = plugin->mtu;
     switch (in_pkt->code) {
     case kEAPCodeRequest:
 	*out_pkt_p = peap_request(plugin, in_pkt, client_status);
@@ -32,14 +32,234 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdarg.h>
-#include <ctype.h>
 #include "printdata.h"
 #include "myCFUtil.h"
 #include <SystemConfiguration/SCPrivate.h>
 
+/*
+ * The dump engine formats a whole line into a stack buffer using table
+ * lookups, and hands it to CF or stdio once, instead of making a
+ * formatted call per byte.
+ */
+#define CHARS_PER_LINE 		16
+
+/* "%08x" offset, 16 x " xx", extra " ", "  ", 16 ASCII chars, "\n" */
+#define DATA_LINE_SIZE		(8 + 1 + CHARS_PER_LINE * 3 + 1 + 2 \
+				 + CHARS_PER_LINE + 1 + 1)
+
+/*
+ * 16 x "xx", a separator before each (all but the first line start with
+ * one), an extra space before the 1st and 9th of a line, nul
+ */
+#define BYTES_LINE_SIZE		(CHARS_PER_LINE * 3 + 2 + 1)
+
+static const char	S_hex_digits[] = "0123456789abcdef";
+
+static inline char *
+hex_byte(char * buf, uint8_t b)
+{
+    buf[0] = S_hex_digits[b >> 4];
+    buf[1] = S_hex_digits[b & 0xf];
+    return (buf + 2);
+}
+
+static inline char
+printable_char(uint8_t b)
+{
+    /* same as isprint() in the C locale */
+    return ((b >= 0x20 && b < 0x7f) ? (char)b : '.');
+}
+
+/*
+ * Function: format_data_line
+ * Purpose:
+ *   Format up to CHARS_PER_LINE bytes as one hexdump line:
+ *   "0010  xx xx xx xx xx xx xx xx  xx xx xx xx xx xx xx xx  ascii\n"
+ * Returns:
+ *   The length of the line, which is nul-terminated.
+ */
+static int
+format_data_line(char line[DATA_LINE_SIZE], int offset,
+		 const uint8_t * data_p, int n_bytes)
+{
+    char *	ascii;
+    int		i;
+    char *	scan = line;
+    int		shift;
+
+    /* offset: at least 4 hex digits, like "%04x" */
+    for (shift = 28; shift > 12 && (offset >> shift) == 0; shift -= 4) {
+	;
+    }
+    for (; shift >= 0; shift -= 4) {
+	*scan++ = S_hex_digits[(offset >> shift) & 0xf];
+    }
+    *scan++ = ' ';
+    for (i = 0; i < CHARS_PER_LINE; i++) {
+	*scan++ = ' ';
+	if (i < n_bytes) {
+	    scan = hex_byte(scan, data_p[i]);
+	}
+	else {
+	    *scan++ = ' ';
+	    *scan++ = ' ';
+	}
+	if (i == (CHARS_PER_LINE / 2 - 1)) {
+	    *scan++ = ' ';
+	}
+    }
+    *scan++ = ' ';
+    *scan++ = ' ';
+    ascii = scan;
+    for (i = 0; i < n_bytes; i++) {
+	ascii[i] = printable_char(data_p[i]);
+    }
+    for (; i < CHARS_PER_LINE; i++) {
+	ascii[i] = ' ';
+    }
+    scan = ascii + CHARS_PER_LINE;
+    *scan++ = '\n';
+    *scan = '\0';
+    return ((int)(scan - line));
+}
+
+/*
+ * Function: format_bytes_line
+ * Purpose:
+ *   Format up to CHARS_PER_LINE bytes as "xx xx ... xx  xx xx", starting
+ *   at byte index 'start' of the whole run (for the separators).
+ */
+static int
+format_bytes_line(char line[BYTES_LINE_SIZE], int start,
+		  const uint8_t * data_p, int n_bytes)
+{
+    int		i;
+    char *	scan = line;
+
+    for (i = 0; i < n_bytes; i++) {
+	int	index = start + i;
+
+	if (index != 0) {
+	    if ((index % 8) == 0) {
+		*scan++ = ' ';
+	    }
+	    *scan++ = ' ';
+	}
+	scan = hex_byte(scan, data_p[i]);
+    }
+    *scan = '\0';
+    return ((int)(scan - line));
+}
+
 void
 print_bytes_cfstr(CFMutableStringRef str, const uint8_t * data_p,
 		  int n_bytes)
+{
+    char	line[BYTES_LINE_SIZE];
+    int		offset;
+
+    for (offset = 0; offset < n_bytes; offset += CHARS_PER_LINE) {
+	int	count = n_bytes - offset;
+
+	if (count > CHARS_PER_LINE) {
+	    count = CHARS_PER_LINE;
+	}
+	format_bytes_line(line, offset, data_p + offset, count);
+	CFStringAppendCString(str, line, kCFStringEncodingASCII);
+    }
+    return;
+}
+
+void
+print_data_cfstr(CFMutableStringRef str, const uint8_t * data_p,
+		 int n_bytes)
+{
+    char	line[DATA_LINE_SIZE];
+    int		offset;
+
+    for (offset = 0; offset < n_bytes; offset += CHARS_PER_LINE) {
+	int	count = n_bytes - offset;
+
+	if (count > CHARS_PER_LINE) {
+	    count = CHARS_PER_LINE;
+	}
+	format_data_line(line, offset, data_p + offset, count);
+	CFStringAppendCString(str, line, kCFStringEncodingASCII);
+    }
+    return;
+}
+
+void
+fprint_bytes(FILE * out_f, const uint8_t * data_p, int n_bytes)
+{
+    char	line[BYTES_LINE_SIZE];
+    int		offset;
+
+    if (out_f == NULL) {
+	out_f = stdout;
+    }
+    for (offset = 0; offset < n_bytes; offset += CHARS_PER_LINE) {
+	int	count = n_bytes - offset;
+
+	if (count > CHARS_PER_LINE) {
+	    count = CHARS_PER_LINE;
+	}
+	fwrite(line, format_bytes_line(line, offset, data_p + offset, count),
+	       1, out_f);
+    }
+    fflush(out_f);
+    return;
+}
+
+void
+fprint_data(FILE * out_f, const uint8_t * data_p, int n_bytes)
+{
+    char	line[DATA_LINE_SIZE];
+    int		offset;
+
+    if (out_f == NULL) {
+	out_f = stdout;
+    }
+    for (offset = 0; offset < n_bytes; offset += CHARS_PER_LINE) {
+	int	count = n_bytes - offset;
+
+	if (count > CHARS_PER_LINE) {
+	    count = CHARS_PER_LINE;
+	}
+	fwrite(line, format_data_line(line, offset, data_p + offset, count),
+	       1, out_f);
+    }
+    fflush(out_f);
+    return;
+}
+
+void
+print_bytes(const uint8_t * data, int len)
+{
+    fprint_bytes(NULL, data, len);
+}
+
+void
+print_data(const uint8_t * data, int len)
+{
+    fprint_data(NULL, data, len);
+}
+
+#ifdef TEST_PRINTDATA
+#include <ctype.h>
+#include <CoreFoundation/CFDate.h>
+
+#define N_ITERATIONS	10000
+#define TEST_DATA_SIZE	1400	/* a full TLS fragment */
+
+/*
+ * Function: print_bytes_cfstr_per_byte
+ * Purpose:
+ *   Reference implementation that makes one formatted call per byte.
+ */
+static void
+print_bytes_cfstr_per_byte(CFMutableStringRef str, const uint8_t * data_p,
+			   int n_bytes)
 {
     int 		i;
 
@@ -60,11 +280,15 @@ print_bytes_cfstr(CFMutableStringRef str, const uint8_t * data_p,
     return;
 }
 
-void
-print_data_cfstr(CFMutableStringRef str, const uint8_t * data_p,
-		 int n_bytes)
+/*
+ * Function: print_data_cfstr_per_byte
+ * Purpose:
+ *   Reference implementation that makes one formatted call per byte.
+ */
+static void
+print_data_cfstr_per_byte(CFMutableStringRef str, const uint8_t * data_p,
+			  int n_bytes)
 {
-#define CHARS_PER_LINE 	16
     char		line_buf[CHARS_PER_LINE + 1];
     int			line_pos;
     int			offset;
@@ -99,46 +323,70 @@ print_data_cfstr(CFMutableStringRef str, const uint8_t * data_p,
     return;
 }
 
-void
-fprint_bytes(FILE * out_f, const uint8_t * data_p, int n_bytes)
+int
+main(int argc, char * argv[])
 {
+    uint8_t		data[TEST_DATA_SIZE];
+    int			i;
+    int			n_iterations;
+    CFAbsoluteTime	per_byte_time;
+    CFAbsoluteTime	start;
     CFMutableStringRef	str;
+    CFAbsoluteTime	table_time;
 
-    str = CFStringCreateMutable(NULL, 0);
-    if (out_f == NULL) {
-	out_f = stdout;
+    n_iterations = (argc > 1) ? (int)strtol(argv[1], NULL, 0) : N_ITERATIONS;
+    for (i = 0; i < TEST_DATA_SIZE; i++) {
+	data[i] = (uint8_t)arc4random();
     }
-    print_bytes_cfstr(str, data_p, n_bytes);
-    SCPrint(TRUE, out_f, CFSTR("%@"), str);
-    CFRelease(str);
-    fflush(out_f);
-    return;
-}
 
-void
-fprint_data(FILE * out_f, const uint8_t * data_p, int n_bytes)
-{
-    CFMutableStringRef	str;
+    /* every partial line length must produce the same text */
+    for (i = 0; i <= TEST_DATA_SIZE; i++) {
+	CFMutableStringRef	ref;
 
-    str = CFStringCreateMutable(NULL, 0);
-    print_data_cfstr(str, data_p, n_bytes);
-    if (out_f == NULL) {
-	out_f = stdout;
-    }
-    SCPrint(TRUE, out_f, CFSTR("%@"), str);
-    CFRelease(str);
-    fflush(out_f);
-    return;
-}
+	ref = CFStringCreateMutable(NULL, 0);
+	str = CFStringCreateMutable(NULL, 0);
+	print_data_cfstr_per_byte(ref, data, i);
+	print_data_cfstr(str, data, i);
+	if (!CFEqual(ref, str)) {
+	    SCPrint(TRUE, stderr, CFSTR("%d bytes: mismatch\n%@\n%@"),
+		    i, ref, str);
+	    exit(1);
+	}
+	CFRelease(ref);
+	CFRelease(str);
 
-void
-print_bytes(const uint8_t * data, int len)
-{
-    fprint_bytes(NULL, data, len);
-}
+	ref = CFStringCreateMutable(NULL, 0);
+	str = CFStringCreateMutable(NULL, 0);
+	print_bytes_cfstr_per_byte(ref, data, i);
+	print_bytes_cfstr(str, data, i);
+	if (!CFEqual(ref, str)) {
+	    SCPrint(TRUE, stderr, CFSTR("%d bytes: bytes mismatch\n%@\n%@"),
+		    i, ref, str);
+	    exit(1);
+	}
+	CFRelease(ref);
+	CFRelease(str);
+    }
 
-void
-print_data(const uint8_t * data, int len)
-{
-    fprint_data(NULL, data, len);
+    start = CFAbsoluteTimeGetCurrent();
+    for (i = 0; i < n_iterations; i++) {
+	str = CFStringCreateMutable(NULL, 0);
+	print_data_cfstr_per_byte(str, data, TEST_DATA_SIZE);
+	CFRelease(str);
+    }
+    per_byte_time = CFAbsoluteTimeGetCurrent() - start;
+    start = CFAbsoluteTimeGetCurrent();
+    for (i = 0; i < n_iterations; i++) {
+	str = CFStringCreateMutable(NULL, 0);
+	print_data_cfstr(str, data, TEST_DATA_SIZE);
+	CFRelease(str);
+    }
+    table_time = CFAbsoluteTimeGetCurrent() - start;
+    printf("%d bytes x %d: per-byte %.2f usecs/dump, table %.2f usecs/dump\n",
+	   TEST_DATA_SIZE, n_iterations,
+	   per_byte_time * 1000000 / n_iterations,
+	   table_time * 1000000 / n_iterations);
+    fprint_data(stdout, data, 40);
+    return (0);
 }
+#endif /* TEST_PRINTDATA */
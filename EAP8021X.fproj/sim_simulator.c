@@ -29,11 +29,13 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <CommonCrypto/CommonCryptor.h>
 #include "EAPLog.h"
 #include "EAPClientPlugin.h"
 #include "EAPSIMAKAUtil.h"
-#include "sim_simulator.h"
+#include "sim_simulator_internal.h"
 #include "symbol_scope.h"
 
 #define SIM_CK_SIZE 16
@@ -270,6 +272,321 @@ sim_simulator_gsm_milenage_algo(const uint8_t *opc, const uint8_t *Ki, const uin
 #endif /* GSM_MILENAGE_DEBUG */
 }
 
+typedef struct {
+	const sim_simulator_gsm *	sim;
+	const uint8_t *			rand;
+	uint8_t *			kc;
+	uint8_t *			sres;
+} sim_simulator_gsm_request;
+
+STATIC void *
+sim_simulator_gsm_request_process(void *arg)
+{
+	sim_simulator_gsm_request *	req = (sim_simulator_gsm_request *)arg;
+
+	if (req->sim->latency_usecs != 0) {
+		usleep(req->sim->latency_usecs);
+	}
+	sim_simulator_gsm_milenage_algo(req->sim->opc, req->sim->ki, req->rand,
+					req->sres, req->kc);
+	return (NULL);
+}
+
+PRIVATE_EXTERN bool
+sim_simulator_gsm_authenticate(const sim_simulator_gsm *sim, const uint8_t *rand_p, int count,
+			       uint8_t *kc_p, uint8_t *sres_p)
+{
+	int				i;
+	sim_simulator_gsm_request	req;
+
+	if (count <= 0 || count > EAPSIM_MAX_RANDS) {
+		return (false);
+	}
+	req.sim = sim;
+	for (i = 0; i < count; i++) {
+		req.rand = rand_p + SIM_RAND_SIZE * i;
+		req.kc = kc_p + SIM_KC_SIZE * i;
+		req.sres = sres_p + SIM_SRES_SIZE * i;
+		sim_simulator_gsm_request_process(&req);
+	}
+	return (true);
+}
+
+PRIVATE_EXTERN bool
+sim_simulator_gsm_authenticate_batch(const sim_simulator_gsm *sim, const uint8_t *rand_p, int count,
+				     uint8_t *kc_p, uint8_t *sres_p)
+{
+	int				error;
+	int				i;
+	sim_simulator_gsm_request	reqs[EAPSIM_MAX_RANDS];
+	bool				started[EAPSIM_MAX_RANDS];
+	pthread_t			threads[EAPSIM_MAX_RANDS];
+
+	if (count <= 0 || count > EAPSIM_MAX_RANDS) {
+		return (false);
+	}
+	if (sim->latency_usecs == 0) {
+		/* nothing to overlap */
+		return (sim_simulator_gsm_authenticate(sim, rand_p, count,
+						       kc_p, sres_p));
+	}
+	for (i = 0; i < count; i++) {
+		reqs[i].sim = sim;
+		reqs[i].rand = rand_p + SIM_RAND_SIZE * i;
+		reqs[i].kc = kc_p + SIM_KC_SIZE * i;
+		reqs[i].sres = sres_p + SIM_SRES_SIZE * i;
+		error = pthread_create(&threads[i], NULL,
+				       sim_simulator_gsm_request_process,
+				       &reqs[i]);
+		started[i] = (error == 0);
+		if (!started[i]) {
+			/* fall back to processing the request inline */
+			EAPLOG_FL(LOG_NOTICE, "pthread_create failed, %s",
+				  strerror(error));
+			sim_simulator_gsm_request_process(&reqs[i]);
+		}
+	}
+	for (i = 0; i < count; i++) {
+		if (started[i]) {
+			pthread_join(threads[i], NULL);
+		}
+	}
+	return (true);
+}
+
+/*
+ * Bulk MILENAGE
+ * - the AES-128 key schedule for Ki is expanded once, in a single ECB
+ *   cryptor that is used for every block
+ * - RANDs are processed SIM_MILENAGE_CHUNK at a time: one call encrypts
+ *   TEMP for the whole chunk, a second call encrypts every OUTn block for
+ *   the chunk, so that CommonCrypto can keep the AES unit busy
+ * - there is no AES-NI path here, unlike the SHA-NI one in fr_sha1.c:
+ *   that SHA-1 is our own code, whereas CommonCrypto already selects
+ *   AES-NI or the ARMv8 AES instructions at runtime
+ */
+#define SIM_MILENAGE_BLOCK_SIZE		kCCBlockSizeAES128
+#define SIM_MILENAGE_CHUNK		64
+#define SIM_MILENAGE_OUT_MAX		4	/* OUT1 .. OUT4 */
+
+typedef uint8_t sim_simulator_milenage_block[SIM_MILENAGE_BLOCK_SIZE];
+
+struct sim_simulator_milenage {
+	CCCryptorRef	cryptor;
+	uint8_t		opc[SIM_OPC_SIZE];
+};
+
+sim_simulator_milenage_ref
+sim_simulator_milenage_create(const uint8_t *opc, const uint8_t *ki)
+{
+	sim_simulator_milenage_ref	milenage;
+	CCCryptorStatus			status;
+
+	milenage = (sim_simulator_milenage_ref)malloc(sizeof(*milenage));
+	if (milenage == NULL) {
+		return (NULL);
+	}
+	status = CCCryptorCreate(kCCEncrypt,
+				 kCCAlgorithmAES128,
+				 kCCOptionECBMode,
+				 ki,
+				 kCCKeySizeAES128,
+				 NULL,
+				 &milenage->cryptor);
+	if (status != kCCSuccess) {
+		EAPLOG_FL(LOG_NOTICE, "CCCryptorCreate failed with %d", status);
+		free(milenage);
+		return (NULL);
+	}
+	memcpy(milenage->opc, opc, SIM_OPC_SIZE);
+	return (milenage);
+}
+
+void
+sim_simulator_milenage_release(sim_simulator_milenage_ref *milenage_p)
+{
+	sim_simulator_milenage_ref	milenage = *milenage_p;
+
+	if (milenage != NULL) {
+		CCCryptorRelease(milenage->cryptor);
+		memset(milenage, 0, sizeof(*milenage));
+		free(milenage);
+		*milenage_p = NULL;
+	}
+}
+
+STATIC bool
+sim_simulator_milenage_encrypt(sim_simulator_milenage_ref milenage,
+			       const sim_simulator_milenage_block *in,
+			       sim_simulator_milenage_block *out, int count)
+{
+	size_t		buf_used;
+	size_t		len = (size_t)count * SIM_MILENAGE_BLOCK_SIZE;
+	CCCryptorStatus	status;
+
+	status = CCCryptorUpdate(milenage->cryptor, in, len, out, len, &buf_used);
+	if (status != kCCSuccess || buf_used != len) {
+		EAPLOG_FL(LOG_NOTICE, "CCCryptorUpdate failed with %d", status);
+		return (false);
+	}
+	return (true);
+}
+
+/*
+ * Function: sim_simulator_milenage_compute
+ * Purpose:
+ *   Compute the MILENAGE output blocks for up to SIM_MILENAGE_CHUNK RANDs.
+ *   For each RAND, 'out' receives OUT1 (only if 'in1' is not NULL), then
+ *   OUT2, OUT3 and OUT4.  'in1' holds one SQN || AMF || SQN || AMF block
+ *   per RAND.
+ */
+STATIC bool
+sim_simulator_milenage_compute(sim_simulator_milenage_ref milenage,
+			       const uint8_t *rand_p, int count,
+			       const sim_simulator_milenage_block *in1,
+			       sim_simulator_milenage_block *out)
+{
+	sim_simulator_milenage_block	blocks[SIM_MILENAGE_CHUNK * SIM_MILENAGE_OUT_MAX];
+	int				i;
+	int				j;
+	int				n_out = (in1 != NULL) ? 4 : 3;
+	const uint8_t *			opc = milenage->opc;
+	sim_simulator_milenage_block	temp[SIM_MILENAGE_CHUNK];
+
+	/* TEMP = E[RAND XOR OPc] */
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < SIM_MILENAGE_BLOCK_SIZE; j++) {
+			blocks[i][j] = rand_p[SIM_RAND_SIZE * i + j] ^ opc[j];
+		}
+	}
+	if (!sim_simulator_milenage_encrypt(milenage, blocks, temp, count)) {
+		return (false);
+	}
+
+	/* OUTn = E[rot(TEMP XOR OPc, rn) XOR cn] XOR OPc */
+	for (i = 0; i < count; i++) {
+		sim_simulator_milenage_block *	b = blocks + n_out * i;
+
+		if (in1 != NULL) {
+			/* r1 = 64, c1 = 0; IN1 is XORed into TEMP instead */
+			for (j = 0; j < SIM_MILENAGE_BLOCK_SIZE; j++) {
+				int	k = (j + 8) % SIM_MILENAGE_BLOCK_SIZE;
+
+				(*b)[j] = temp[i][j] ^ in1[i][k] ^ opc[k];
+			}
+			b++;
+		}
+		for (j = 0; j < SIM_MILENAGE_BLOCK_SIZE; j++) {
+			uint8_t		t = temp[i][j] ^ opc[j];
+
+			/* r2 = 0, r3 = 32, r4 = 64 */
+			b[0][j] = t;
+			b[1][(j + 12) % SIM_MILENAGE_BLOCK_SIZE] = t;
+			b[2][(j + 8) % SIM_MILENAGE_BLOCK_SIZE] = t;
+		}
+		b[0][15] ^= 1;	/* c2 */
+		b[1][15] ^= 2;	/* c3 */
+		b[2][15] ^= 4;	/* c4 */
+	}
+	if (!sim_simulator_milenage_encrypt(milenage, blocks, out, n_out * count)) {
+		return (false);
+	}
+	for (i = 0; i < n_out * count; i++) {
+		for (j = 0; j < SIM_MILENAGE_BLOCK_SIZE; j++) {
+			out[i][j] ^= opc[j];
+		}
+	}
+	return (true);
+}
+
+bool
+sim_simulator_milenage_gsm_triplets(sim_simulator_milenage_ref milenage,
+				    const uint8_t *rand_p, int count,
+				    sim_simulator_triplet *triplets)
+{
+	int				i;
+	int				n;
+	sim_simulator_milenage_block	out[SIM_MILENAGE_CHUNK * 3];
+
+	if (count < 0) {
+		return (false);
+	}
+	for (; count > 0; count -= n) {
+		n = (count < SIM_MILENAGE_CHUNK) ? count : SIM_MILENAGE_CHUNK;
+		if (!sim_simulator_milenage_compute(milenage, rand_p, n, NULL, out)) {
+			return (false);
+		}
+		for (i = 0; i < n; i++, triplets++) {
+			const uint8_t *	res = out[3 * i] + 8;
+			const uint8_t *	ck = out[3 * i + 1];
+			const uint8_t *	ik = out[3 * i + 2];
+			int		j;
+
+			memcpy(triplets->rand, rand_p + SIM_RAND_SIZE * i, SIM_RAND_SIZE);
+			sim_simulator_gsm_derive_sres_f1(res, triplets->sres);
+			for (j = 0; j < SIM_KC_SIZE; j++) {
+				triplets->kc[j] = ck[j] ^ ck[j + 8] ^ ik[j] ^ ik[j + 8];
+			}
+		}
+		rand_p += SIM_RAND_SIZE * n;
+	}
+	return (true);
+}
+
+bool
+sim_simulator_milenage_aka_quintets(sim_simulator_milenage_ref milenage,
+				    const uint8_t *rand_p, int count,
+				    const uint8_t *sqn, const uint8_t *amf,
+				    sim_simulator_quintet *quintets)
+{
+	int				i;
+	sim_simulator_milenage_block	in1[SIM_MILENAGE_CHUNK];
+	int				n;
+	uint64_t			next_sqn = 0;
+	sim_simulator_milenage_block	out[SIM_MILENAGE_CHUNK * 4];
+
+	if (count < 0) {
+		return (false);
+	}
+	for (i = 0; i < SIM_SQN_SIZE; i++) {
+		next_sqn = (next_sqn << 8) | sqn[i];
+	}
+	for (; count > 0; count -= n) {
+		n = (count < SIM_MILENAGE_CHUNK) ? count : SIM_MILENAGE_CHUNK;
+		for (i = 0; i < n; i++, next_sqn++) {
+			int	j;
+
+			/* IN1 = SQN || AMF || SQN || AMF */
+			for (j = 0; j < SIM_SQN_SIZE; j++) {
+				in1[i][j] = (uint8_t)(next_sqn >> (8 * (SIM_SQN_SIZE - 1 - j)));
+			}
+			memcpy(in1[i] + SIM_SQN_SIZE, amf, SIM_AMF_SIZE);
+			memcpy(in1[i] + 8, in1[i], 8);
+		}
+		if (!sim_simulator_milenage_compute(milenage, rand_p, n, in1, out)) {
+			return (false);
+		}
+		for (i = 0; i < n; i++, quintets++) {
+			const uint8_t *	out1 = out[4 * i];
+			const uint8_t *	out2 = out[4 * i + 1];
+			int		j;
+
+			memcpy(quintets->rand, rand_p + SIM_RAND_SIZE * i, SIM_RAND_SIZE);
+			memcpy(quintets->xres, out2 + 8, sizeof(quintets->xres));
+			memcpy(quintets->ck, out[4 * i + 2], sizeof(quintets->ck));
+			memcpy(quintets->ik, out[4 * i + 3], sizeof(quintets->ik));
+
+			/* AUTN = SQN XOR AK || AMF || MAC-A, AK = OUT2[0..47] */
+			for (j = 0; j < SIM_SQN_SIZE; j++) {
+				quintets->autn[j] = in1[i][j] ^ out2[j];
+			}
+			memcpy(quintets->autn + SIM_SQN_SIZE, amf, SIM_AMF_SIZE);
+			memcpy(quintets->autn + 8, out1, 8);
+		}
+		rand_p += SIM_RAND_SIZE * n;
+	}
+	return (true);
+}
 
 #ifdef TEST_GSM_MILENAGE_TEST_VECTOR
 
@@ -656,3 +973,210 @@ int main()
 	return 0;
 }
 #endif /* TEST_GSM_MILENAGE_TEST_VECTOR */
+
+#ifdef TEST_SIM_SIMULATOR_BATCH
+#include <CoreFoundation/CFDate.h>
+
+#define N_ITERATIONS	20
+
+int main(int argc, char * argv[])
+{
+	static const uint8_t ki[SIM_KI_SIZE] = {
+		0x46, 0x5b, 0x5c, 0xe8, 0xb1, 0x99, 0xb4, 0x9f,
+		0xaa, 0x5f, 0x0a, 0x2e, 0xe2, 0x38, 0xa6, 0xbc
+	};
+	static const uint8_t opc[SIM_OPC_SIZE] = {
+		0xcd, 0x63, 0xcb, 0x71, 0x95, 0x4a, 0x9f, 0x4e,
+		0x48, 0xa5, 0x99, 0x4e, 0x37, 0xa0, 0x2b, 0xaf
+	};
+	CFAbsoluteTime		batch_time;
+	int			i;
+	uint8_t			kc[SIM_KC_SIZE * EAPSIM_MAX_RANDS];
+	uint8_t			kc_batch[SIM_KC_SIZE * EAPSIM_MAX_RANDS];
+	uint8_t			rand[SIM_RAND_SIZE * EAPSIM_MAX_RANDS];
+	CFAbsoluteTime		serial_time;
+	uint8_t			sres[SIM_SRES_SIZE * EAPSIM_MAX_RANDS];
+	uint8_t			sres_batch[SIM_SRES_SIZE * EAPSIM_MAX_RANDS];
+	sim_simulator_gsm	sim;
+	CFAbsoluteTime		start;
+
+	for (i = 0; i < (int)sizeof(rand); i++) {
+		rand[i] = (uint8_t)(0x10 + i);
+	}
+	sim.opc = opc;
+	sim.ki = ki;
+	sim.latency_usecs = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 5000;
+
+	/* the batch must produce the same values as the per-RAND algorithm */
+	for (i = 0; i < EAPSIM_MAX_RANDS; i++) {
+		sim_simulator_gsm_milenage_algo(opc, ki, rand + SIM_RAND_SIZE * i,
+						sres + SIM_SRES_SIZE * i,
+						kc + SIM_KC_SIZE * i);
+	}
+	if (!sim_simulator_gsm_authenticate_batch(&sim, rand, EAPSIM_MAX_RANDS,
+						  kc_batch, sres_batch)
+	    || memcmp(kc, kc_batch, sizeof(kc)) != 0
+	    || memcmp(sres, sres_batch, sizeof(sres)) != 0) {
+		fprintf(stderr, "batch results don't match\n");
+		exit(1);
+	}
+	if (sim_simulator_gsm_authenticate_batch(&sim, rand, 0, kc_batch, sres_batch)
+	    || sim_simulator_gsm_authenticate_batch(&sim, rand, EAPSIM_MAX_RANDS + 1,
+						    kc_batch, sres_batch)) {
+		fprintf(stderr, "bad count accepted\n");
+		exit(1);
+	}
+
+	start = CFAbsoluteTimeGetCurrent();
+	for (i = 0; i < N_ITERATIONS; i++) {
+		sim_simulator_gsm_authenticate(&sim, rand, EAPSIM_MAX_RANDS, kc, sres);
+	}
+	serial_time = (CFAbsoluteTimeGetCurrent() - start) / N_ITERATIONS;
+	start = CFAbsoluteTimeGetCurrent();
+	for (i = 0; i < N_ITERATIONS; i++) {
+		sim_simulator_gsm_authenticate_batch(&sim, rand, EAPSIM_MAX_RANDS,
+						     kc_batch, sres_batch);
+	}
+	batch_time = (CFAbsoluteTimeGetCurrent() - start) / N_ITERATIONS;
+	printf("%d RANDs, %u usecs per request: serial %.0f usecs, batch %.0f usecs\n",
+	       EAPSIM_MAX_RANDS, sim.latency_usecs,
+	       serial_time * 1000000, batch_time * 1000000);
+	return (0);
+}
+#endif /* TEST_SIM_SIMULATOR_BATCH */
+
+#ifdef TEST_SIM_SIMULATOR_VECTORS
+#include <CoreFoundation/CFDate.h>
+
+#define N_VECTORS	(256 * 1024)
+
+/* 3GPP TS 35.208, Test Set 1 */
+static const uint8_t	ts1_ki[SIM_KI_SIZE] = {
+	0x46, 0x5b, 0x5c, 0xe8, 0xb1, 0x99, 0xb4, 0x9f,
+	0xaa, 0x5f, 0x0a, 0x2e, 0xe2, 0x38, 0xa6, 0xbc
+};
+static const uint8_t	ts1_opc[SIM_OPC_SIZE] = {
+	0xcd, 0x63, 0xcb, 0x71, 0x95, 0x4a, 0x9f, 0x4e,
+	0x48, 0xa5, 0x99, 0x4e, 0x37, 0xa0, 0x2b, 0xaf
+};
+static const uint8_t	ts1_rand[SIM_RAND_SIZE] = {
+	0x23, 0x55, 0x3c, 0xbe, 0x96, 0x37, 0xa8, 0x9d,
+	0x21, 0x8a, 0xe6, 0x4d, 0xae, 0x47, 0xbf, 0x35
+};
+static const uint8_t	ts1_sqn[SIM_SQN_SIZE] = {
+	0xff, 0x9b, 0xb4, 0xd0, 0xb6, 0x07
+};
+static const uint8_t	ts1_amf[SIM_AMF_SIZE] = {
+	0xb9, 0xb9
+};
+static const sim_simulator_quintet ts1_quintet = {
+	.rand = {
+		0x23, 0x55, 0x3c, 0xbe, 0x96, 0x37, 0xa8, 0x9d,
+		0x21, 0x8a, 0xe6, 0x4d, 0xae, 0x47, 0xbf, 0x35
+	},
+	.xres = {
+		0xa5, 0x42, 0x11, 0xd5, 0xe3, 0xba, 0x50, 0xbf
+	},
+	.ck = {
+		0xb4, 0x0b, 0xa9, 0xa3, 0xc5, 0x8b, 0x2a, 0x05,
+		0xbb, 0xf0, 0xd9, 0x87, 0xb2, 0x1b, 0xf8, 0xcb
+	},
+	.ik = {
+		0xf7, 0x69, 0xbc, 0xd7, 0x51, 0x04, 0x46, 0x04,
+		0x12, 0x76, 0x72, 0x71, 0x1c, 0x6d, 0x34, 0x41
+	},
+	.autn = {
+		/* SQN XOR AK, AK = aa689c648370 */
+		0x55, 0xf3, 0x28, 0xb4, 0x35, 0x77,
+		/* AMF */
+		0xb9, 0xb9,
+		/* MAC-A */
+		0x4a, 0x9f, 0xfa, 0xc3, 0x54, 0xdf, 0xaf, 0xb3
+	},
+};
+
+int main(int argc, char * argv[])
+{
+	int			count = N_VECTORS;
+	int			i;
+	sim_simulator_milenage_ref milenage;
+	sim_simulator_quintet *	quintets;
+	uint8_t *		rand;
+	CFAbsoluteTime		single_time;
+	CFAbsoluteTime		start;
+	sim_simulator_triplet *	triplets;
+	CFAbsoluteTime		triplet_time;
+	CFAbsoluteTime		quintet_time;
+
+	if (argc > 1) {
+		count = (int)strtoul(argv[1], NULL, 0);
+		if (count < EAPSIM_MAX_RANDS) {
+			count = EAPSIM_MAX_RANDS;
+		}
+	}
+	milenage = sim_simulator_milenage_create(ts1_opc, ts1_ki);
+	if (milenage == NULL) {
+		fprintf(stderr, "sim_simulator_milenage_create failed\n");
+		exit(1);
+	}
+	rand = malloc(SIM_RAND_SIZE * count);
+	triplets = malloc(sizeof(*triplets) * count);
+	quintets = malloc(sizeof(*quintets) * count);
+	for (i = 0; i < SIM_RAND_SIZE * count; i++) {
+		rand[i] = (uint8_t)(i * 7 + (i >> 8));
+	}
+
+	/* known answers */
+	if (!sim_simulator_milenage_aka_quintets(milenage, ts1_rand, 1,
+						 ts1_sqn, ts1_amf, quintets)
+	    || memcmp(quintets, &ts1_quintet, sizeof(ts1_quintet)) != 0) {
+		fprintf(stderr, "quintet doesn't match TS 35.208 test set 1\n");
+		exit(1);
+	}
+
+	/* the batch must produce the same values as the per-RAND algorithm */
+	if (!sim_simulator_milenage_gsm_triplets(milenage, rand, count, triplets)) {
+		fprintf(stderr, "sim_simulator_milenage_gsm_triplets failed\n");
+		exit(1);
+	}
+	for (i = 0; i < SIM_MILENAGE_CHUNK * 2 + 3 && i < count; i++) {
+		uint8_t		kc[SIM_KC_SIZE];
+		uint8_t		sres[SIM_SRES_SIZE];
+
+		sim_simulator_gsm_milenage_algo(ts1_opc, ts1_ki,
+						rand + SIM_RAND_SIZE * i,
+						sres, kc);
+		if (memcmp(triplets[i].rand, rand + SIM_RAND_SIZE * i, SIM_RAND_SIZE) != 0
+		    || memcmp(triplets[i].sres, sres, sizeof(sres)) != 0
+		    || memcmp(triplets[i].kc, kc, sizeof(kc)) != 0) {
+			fprintf(stderr, "triplet %d doesn't match\n", i);
+			exit(1);
+		}
+	}
+
+	/* throughput */
+	start = CFAbsoluteTimeGetCurrent();
+	for (i = 0; i < count; i++) {
+		sim_simulator_gsm_milenage_algo(ts1_opc, ts1_ki,
+						rand + SIM_RAND_SIZE * i,
+						triplets[i].sres, triplets[i].kc);
+	}
+	single_time = CFAbsoluteTimeGetCurrent() - start;
+	start = CFAbsoluteTimeGetCurrent();
+	sim_simulator_milenage_gsm_triplets(milenage, rand, count, triplets);
+	triplet_time = CFAbsoluteTimeGetCurrent() - start;
+	start = CFAbsoluteTimeGetCurrent();
+	sim_simulator_milenage_aka_quintets(milenage, rand, count,
+					    ts1_sqn, ts1_amf, quintets);
+	quintet_time = CFAbsoluteTimeGetCurrent() - start;
+	printf("%d vectors\n", count);
+	printf("triplets, one at a time: %10.0f per second\n", count / single_time);
+	printf("triplets, bulk:          %10.0f per second\n", count / triplet_time);
+	printf("quintets, bulk:          %10.0f per second\n", count / quintet_time);
+	sim_simulator_milenage_release(&milenage);
+	free(rand);
+	free(triplets);
+	free(quintets);
+	return (0);
+}
+#endif /* TEST_SIM_SIMULATOR_VECTORS */
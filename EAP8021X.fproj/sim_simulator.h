@@ -25,10 +25,75 @@
 #ifndef _EAP8021X_SIM_SIMULATOR_H
 #define _EAP8021X_SIM_SIMULATOR_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #define SIM_KI_SIZE		16
 #define SIM_OPC_SIZE	16
+#define SIM_SQN_SIZE	6
+#define SIM_AMF_SIZE	2
+
+/*
+ * Type: sim_simulator_triplet
+ * Purpose:
+ *   A packed GSM authentication vector.  A file holding an array of these
+ *   is what the EAPSIMTripletsFile property expects.
+ */
+typedef struct {
+	uint8_t		rand[16];
+	uint8_t		sres[4];
+	uint8_t		kc[8];
+} sim_simulator_triplet;
+
+/*
+ * Type: sim_simulator_quintet
+ * Purpose:
+ *   A packed UMTS authentication vector.  The xres, ck and ik values are
+ *   what the EAPAKARES, EAPAKACk and EAPAKAIk properties expect.
+ */
+typedef struct {
+	uint8_t		rand[16];
+	uint8_t		xres[8];
+	uint8_t		ck[16];
+	uint8_t		ik[16];
+	uint8_t		autn[16];
+} sim_simulator_quintet;
+
+/*
+ * Type: sim_simulator_milenage_ref
+ * Purpose:
+ *   MILENAGE for one subscriber, with the Ki key schedule expanded once,
+ *   for generating authentication vectors in bulk.
+ */
+typedef struct sim_simulator_milenage * sim_simulator_milenage_ref;
+
+sim_simulator_milenage_ref
+sim_simulator_milenage_create(const uint8_t *opc, const uint8_t *ki);
 
 void
-sim_simulator_gsm_milenage_algo(const uint8_t *opc, const uint8_t *Ki, const uint8_t *rand, uint8_t *sres, uint8_t *Kc);
+sim_simulator_milenage_release(sim_simulator_milenage_ref *milenage_p);
+
+/*
+ * Function: sim_simulator_milenage_gsm_triplets
+ * Purpose:
+ *   Compute the triplet for each of the 'count' RANDs at 'rand_p', using
+ *   the same conversion as the per-RAND GSM MILENAGE algorithm.
+ */
+bool
+sim_simulator_milenage_gsm_triplets(sim_simulator_milenage_ref milenage,
+				    const uint8_t *rand_p, int count,
+				    sim_simulator_triplet *triplets);
+
+/*
+ * Function: sim_simulator_milenage_aka_quintets
+ * Purpose:
+ *   Compute the quintet for each of the 'count' RANDs at 'rand_p'.  The
+ *   first quintet uses 'sqn', each one after that uses the next SQN.
+ */
+bool
+sim_simulator_milenage_aka_quintets(sim_simulator_milenage_ref milenage,
+				    const uint8_t *rand_p, int count,
+				    const uint8_t *sqn, const uint8_t *amf,
+				    sim_simulator_quintet *quintets);
 
 #endif /* _EAP8021X_SIM_SIMULATOR_H */
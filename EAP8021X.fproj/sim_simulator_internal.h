@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2015 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+
+#ifndef _EAP8021X_SIM_SIMULATOR_INTERNAL_H
+#define _EAP8021X_SIM_SIMULATOR_INTERNAL_H
+
+/*
+ * sim_simulator_internal.h
+ * - the simulated UICC used by the EAP-SIM plugin, which is internal to
+ *   the framework and not part of the published sim_simulator.h
+ */
+
+#include "sim_simulator.h"
+
+void
+sim_simulator_gsm_milenage_algo(const uint8_t *opc, const uint8_t *Ki, const uint8_t *rand, uint8_t *sres, uint8_t *Kc);
+
+/*
+ * Type: sim_simulator_gsm
+ * Purpose:
+ *   A simulated UICC running the GSM MILENAGE algorithm.  Each request
+ *   takes at least 'latency_usecs' to complete, to model the round trip
+ *   to a real SIM.
+ */
+typedef struct {
+	const uint8_t *	opc;
+	const uint8_t *	ki;
+	uint32_t	latency_usecs;
+} sim_simulator_gsm;
+
+/*
+ * Function: sim_simulator_gsm_authenticate
+ * Purpose:
+ *   Compute the (SRES, Kc) pairs for 'count' RANDs, submitting one
+ *   request at a time and waiting for each to complete.
+ */
+bool
+sim_simulator_gsm_authenticate(const sim_simulator_gsm *sim, const uint8_t *rand_p, int count,
+			       uint8_t *kc_p, uint8_t *sres_p);
+
+/*
+ * Function: sim_simulator_gsm_authenticate_batch
+ * Purpose:
+ *   Same as sim_simulator_gsm_authenticate(), but submit all of the
+ *   requests before waiting, so that their latencies overlap.
+ */
+bool
+sim_simulator_gsm_authenticate_batch(const sim_simulator_gsm *sim, const uint8_t *rand_p, int count,
+				     uint8_t *kc_p, uint8_t *sres_p);
+
+#endif /* _EAP8021X_SIM_SIMULATOR_INTERNAL_H */
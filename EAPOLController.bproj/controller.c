@@ -324,56 +324,129 @@ make_number(int val)
     return (CFNumberCreate(NULL, kCFNumberIntType, &val));
 }
 
-eapolClientRef
-eapolClientLookupInterfaceCF(CFStringRef if_name_cf)
+/**
+ ** eapolClient indices
+ ** - the list is still used to iterate over every client, the indices
+ **   answer the per-interface/pid/session lookups made on every MIG call,
+ **   link change and child exit without walking the list
+ ** - the keys are stored in the dictionaries directly: the interface name
+ **   is the client's own if_name buffer, the pid and session port are
+ **   integer values cast to pointers
+ **/
+static CFMutableDictionaryRef	S_if_name_index;
+static CFMutableDictionaryRef	S_pid_index;
+static CFMutableDictionaryRef	S_session_index;
+
+#define INDEX_KEY(val)		((const void *)(uintptr_t)(val))
+
+static Boolean
+if_name_key_equal(const void * value1, const void * value2)
 {
-    eapolClientRef	scan;
+    return (strcmp((const char *)value1, (const char *)value2) == 0);
+}
 
-    LIST_FOREACH(scan, S_clientHead_p, link) {
-	if (CFEqual(if_name_cf, scan->if_name_cf)) {
-	    return (scan);
-	}
+static CFHashCode
+if_name_key_hash(const void * value)
+{
+    CFHashCode			hash = 5381;
+    const unsigned char *	scan;
+
+    for (scan = (const unsigned char *)value; *scan != '\0'; scan++) {
+	hash = (hash * 33) + *scan;
     }
-    return (NULL);
+    return (hash);
+}
+
+static const CFDictionaryKeyCallBacks	S_if_name_key_callbacks = {
+    0,					/* version */
+    NULL,				/* retain */
+    NULL,				/* release */
+    NULL,				/* copyDescription */
+    if_name_key_equal,			/* equal */
+    if_name_key_hash			/* hash */
+};
+
+static void
+eapolClientIndicesInit(void)
+{
+    S_if_name_index = CFDictionaryCreateMutable(NULL, 0,
+						&S_if_name_key_callbacks,
+						NULL);
+    S_pid_index = CFDictionaryCreateMutable(NULL, 0, NULL, NULL);
+    S_session_index = CFDictionaryCreateMutable(NULL, 0, NULL, NULL);
+    return;
+}
+
+static void
+eapolClientSetPID(eapolClientRef client, pid_t pid)
+{
+    if (client->pid != -1
+	&& CFDictionaryGetValue(S_pid_index,
+				INDEX_KEY(client->pid)) == client) {
+	CFDictionaryRemoveValue(S_pid_index, INDEX_KEY(client->pid));
+    }
+    client->pid = pid;
+    if (pid != -1) {
+	CFDictionarySetValue(S_pid_index, INDEX_KEY(pid), client);
+    }
+    return;
 }
+
+static void
+eapolClientSetSessionPort(eapolClientRef client, CFMachPortRef session_cfport)
+{
+    if (client->session_cfport != NULL) {
+	mach_port_t	port = CFMachPortGetPort(client->session_cfport);
+
+	CFDictionaryRemoveValue(S_session_index, INDEX_KEY(port));
+	CFMachPortInvalidate(client->session_cfport);
+	my_CFRelease(&client->session_cfport);
+    }
+    if (session_cfport != NULL) {
+	client->session_cfport = session_cfport;
+	CFDictionarySetValue(S_session_index,
+			     INDEX_KEY(CFMachPortGetPort(session_cfport)),
+			     client);
+    }
+    return;
+}
+
 eapolClientRef
 eapolClientLookupInterface(const char * if_name)
 {
-    eapolClientRef	scan;
+    return ((eapolClientRef)CFDictionaryGetValue(S_if_name_index, if_name));
+}
 
-    LIST_FOREACH(scan, S_clientHead_p, link) {
-	if (strcmp(if_name, scan->if_name) == 0) {
-	    return (scan);
-	}
+eapolClientRef
+eapolClientLookupInterfaceCF(CFStringRef if_name_cf)
+{
+    if_name_t		if_name;
+
+    if (CFStringGetCString(if_name_cf, if_name, sizeof(if_name),
+			   kCFStringEncodingASCII) == FALSE) {
+	return (NULL);
     }
-    return (NULL);
+    return (eapolClientLookupInterface(if_name));
 }
 
 eapolClientRef
 eapolClientLookupProcess(pid_t pid)
 {
-    eapolClientRef	scan;
-
-    LIST_FOREACH(scan, S_clientHead_p, link) {
-	if (pid == scan->pid) {
-	    return (scan);
-	}
+    if (pid == -1) {
+	return (NULL);
     }
-    return (NULL);
+    return ((eapolClientRef)CFDictionaryGetValue(S_pid_index,
+						 INDEX_KEY(pid)));
 }
 
 eapolClientRef
 eapolClientLookupSession(mach_port_t session_port)
 {
-    eapolClientRef	scan;
-
-    LIST_FOREACH(scan, S_clientHead_p, link) {
-	if (scan->session_cfport != NULL
-	    && session_port == CFMachPortGetPort(scan->session_cfport)) {
-	    return (scan);
-	}
+    if (session_port == MACH_PORT_NULL) {
+	return (NULL);
     }
-    return (NULL);
+    return ((eapolClientRef)CFDictionaryGetValue(S_session_index,
+						 INDEX_KEY(session_port)));
 }
 
 eapolClientRef
@@ -397,6 +470,7 @@ eapolClientAdd(const char * if_name, boolean_t is_wifi)
     client->autodetect_can_start_system_mode = !is_wifi;
 #endif /* ! TARGET_OS_EMBEDDED */
     LIST_INSERT_HEAD(S_clientHead_p, client, link);
+    CFDictionarySetValue(S_if_name_index, client->if_name, client);
     return (client);
 }
 
@@ -406,6 +480,9 @@ eapolClientRemove(eapolClientRef client)
 #if ! TARGET_OS_EMBEDDED
     clear_loginwindow_config(client);
 #endif /* ! TARGET_OS_EMBEDDED */
+    eapolClientSetPID(client, -1);
+    eapolClientSetSessionPort(client, NULL);
+    CFDictionaryRemoveValue(S_if_name_index, client->if_name);
     my_CFRelease(&client->if_name_cf);
     LIST_REMOVE(client, link);
     free(client);
@@ -416,7 +493,7 @@ static void
 eapolClientInvalidate(eapolClientRef client)
 {
     eapolClientSetState(client, kEAPOLControlStateIdle);
-    client->pid = -1;
+    eapolClientSetPID(client, -1);
     client->owner.uid = 0;
     client->owner.gid = 0;
     client->mode = kEAPOLControlModeNone;
@@ -443,10 +520,7 @@ eapolClientInvalidate(eapolClientRef client)
 	(void)mach_port_deallocate(mach_task_self(), client->au_session);
 	client->au_session = MACH_PORT_NULL;
     }
-    if (client->session_cfport != NULL) {
-	CFMachPortInvalidate(client->session_cfport);
-	my_CFRelease(&client->session_cfport);
-    }
+    eapolClientSetSessionPort(client, NULL);
     my_CFRelease(&client->config_dict);
     my_CFRelease(&client->user_input_dict);
     my_CFRelease(&client->status_dict);
@@ -896,9 +970,10 @@ eapolClientStart(eapolClientRef client, uid_t uid, gid_t gid,
 	argv[5] = "-g";
 	argv[6] = gid_str;
     }
-    client->pid = _SCDPluginExecCommand2(exec_callback, NULL, 0, 0,
-					 S_eapolclient_path, argv,
-					 exec_setup, &ec);
+    eapolClientSetPID(client,
+		      _SCDPluginExecCommand2(exec_callback, NULL, 0, 0,
+					     S_eapolclient_path, argv,
+					     exec_setup, &ec));
     if (client->pid == -1) {
 	/* failure, clean-up too */
 	exec_setup(-1, &ec);
@@ -1539,8 +1614,9 @@ ControllerClientAttach(pid_t pid, if_name_t if_name,
 	goto failed;
     }
     client->notify_port = notify_port;
-    client->session_cfport 
-	= CFMachPortCreate(NULL, server_handle_request, NULL, NULL);
+    eapolClientSetSessionPort(client,
+			      CFMachPortCreate(NULL, server_handle_request,
+					       NULL, NULL));
     *session_port = CFMachPortGetPort(client->session_cfport);
     rls = CFMachPortCreateRunLoopSource(NULL, client->session_cfport, 0);
     CFRunLoopAddSource(CFRunLoopGetCurrent(), rls, kCFRunLoopDefaultMode);
@@ -2806,6 +2882,7 @@ start(const char *bundleName, const char *bundleDir)
 	return;
     }
     LIST_INIT(S_clientHead_p);
+    eapolClientIndicesInit();
     S_store = dynamic_store_create();
 #if TARGET_OS_EMBEDDED
     register_sim_removal();
@@ -2827,3 +2904,120 @@ prime()
 #endif
     return;
 }
+
+#ifdef TEST_EAPOLCLIENT_INDEX
+#include <CoreFoundation/CFDate.h>
+
+#define N_INTERFACES	1000
+#define N_ITERATIONS	100
+
+/* server.c isn't linked into the test */
+void
+server_register(void)
+{
+}
+
+void
+server_start(void)
+{
+}
+
+void
+server_handle_request(CFMachPortRef port, void *msg, CFIndex size, void *info)
+{
+}
+
+static eapolClientRef
+list_lookup_interface(const char * if_name)
+{
+    eapolClientRef	scan;
+
+    LIST_FOREACH(scan, S_clientHead_p, link) {
+	if (strcmp(if_name, scan->if_name) == 0) {
+	    return (scan);
+	}
+    }
+    return (NULL);
+}
+
+int
+main(int argc, char * argv[])
+{
+    eapolClientRef	clients[N_INTERFACES];
+    int			i;
+    CFAbsoluteTime	index_time;
+    int			iteration;
+    CFAbsoluteTime	list_time;
+    mach_port_t		ports[N_INTERFACES];
+    CFAbsoluteTime	start;
+
+    LIST_INIT(S_clientHead_p);
+    eapolClientIndicesInit();
+    for (i = 0; i < N_INTERFACES; i++) {
+	if_name_t	if_name;
+
+	snprintf(if_name, sizeof(if_name), "vlan%d", i);
+	clients[i] = eapolClientAdd(if_name, FALSE);
+	eapolClientSetPID(clients[i], 10000 + i);
+	eapolClientSetSessionPort(clients[i],
+				  CFMachPortCreate(NULL, server_handle_request,
+						   NULL, NULL));
+	ports[i] = CFMachPortGetPort(clients[i]->session_cfport);
+    }
+
+    /* every index must find the right client */
+    for (i = 0; i < N_INTERFACES; i++) {
+	eapolClientRef	client = clients[i];
+
+	if (eapolClientLookupInterface(client->if_name) != client
+	    || eapolClientLookupInterfaceCF(client->if_name_cf) != client
+	    || eapolClientLookupProcess(client->pid) != client
+	    || eapolClientLookupSession(ports[i]) != client) {
+	    fprintf(stderr, "lookup %s failed\n", client->if_name);
+	    exit(1);
+	}
+    }
+    eapolClientInvalidate(clients[0]);
+    if (eapolClientLookupProcess(10000) != NULL
+	|| eapolClientLookupSession(ports[0]) != NULL
+	|| eapolClientLookupInterface("vlan0") != clients[0]) {
+	fprintf(stderr, "invalidate didn't update the indices\n");
+	exit(1);
+    }
+
+    start = CFAbsoluteTimeGetCurrent();
+    for (iteration = 0; iteration < N_ITERATIONS; iteration++) {
+	for (i = 0; i < N_INTERFACES; i++) {
+	    if (list_lookup_interface(clients[i]->if_name) != clients[i]) {
+		exit(1);
+	    }
+	}
+    }
+    list_time = CFAbsoluteTimeGetCurrent() - start;
+    start = CFAbsoluteTimeGetCurrent();
+    for (iteration = 0; iteration < N_ITERATIONS; iteration++) {
+	for (i = 0; i < N_INTERFACES; i++) {
+	    if (eapolClientLookupInterface(clients[i]->if_name)
+		!= clients[i]) {
+		exit(1);
+	    }
+	}
+    }
+    index_time = CFAbsoluteTimeGetCurrent() - start;
+    printf("%d interfaces: list %.3f usecs/lookup, index %.3f usecs/lookup\n",
+	   N_INTERFACES,
+	   list_time * 1000000 / (N_ITERATIONS * N_INTERFACES),
+	   index_time * 1000000 / (N_ITERATIONS * N_INTERFACES));
+
+    for (i = 0; i < N_INTERFACES; i++) {
+	eapolClientRemove(clients[i]);
+    }
+    if (CFDictionaryGetCount(S_if_name_index) != 0
+	|| CFDictionaryGetCount(S_pid_index) != 0
+	|| CFDictionaryGetCount(S_session_index) != 0) {
+	fprintf(stderr, "indices not empty after removing every client\n");
+	exit(1);
+    }
+    return (0);
+}
+#endif /* TEST_EAPOLCLIENT_INDEX */
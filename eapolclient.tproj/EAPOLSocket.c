@@ -86,7 +86,7 @@
 #endif /* NO_WIRELESS */
 
 #define EAPOLSOCKET_RECV_BUFSIZE	1600
-#define EAPOLSOCKET_SEND_BUFSIZE	1600
+#define EAPOLSOCKET_SEND_BUFSIZE	9024	/* > header + EAPOL_MTU_MAX */
 
 static const struct ether_addr eapol_multicast = {
     EAPOL_802_1_X_GROUP_ADDRESS
@@ -96,8 +96,18 @@ static const struct ether_addr eapol_multicast = {
 #define kMTU				CFSTR("MTU")
 #define EAPOL_MTU_DEFAULT		1280
 #define EAPOL_MTU_MIN			576
+#define EAPOL_MTU_MAX			9000
 static int				S_mtu;
 
+/*
+ * Static: S_mtu_discovery
+ * Purpose:
+ *   Controls whether the Supplicant probes for a larger MTU than the
+ *   default.  Disabled when the MTU is explicitly configured.
+ */
+#define kMTUDiscovery			CFSTR("MTUDiscovery")
+static bool				S_mtu_discovery = TRUE;
+
 /* pre-auth tunables */
 #define kPreauthentication		CFSTR("Preauthentication")
 #define kScanDelayAuthenticatedSeconds	CFSTR("ScanDelayAuthenticatedSeconds")
@@ -188,6 +198,7 @@ struct EAPOLSocketSource_s {
     bool				authenticated;
     bool				need_force_renew;
     InterestNotificationRef		interest;
+    int					if_mtu;
     struct ether_addr			authenticator_mac;
     bool				authenticator_mac_valid;
 #ifndef NO_WIRELESS
@@ -411,6 +422,50 @@ log_packet_simple(const char * dest_mac,
     return;
 }
 
+typedef struct {
+    char		dest_mac[32];
+    int			size;
+    boolean_t		is_receive;
+} log_packet_info;
+
+static void
+log_packet_describe(CFMutableStringRef str, const void * bytes, int length,
+		    const void * info)
+{
+    const log_packet_info *	p = (const log_packet_info *)info;
+
+    log_packet_simple(p->dest_mac, (EAPOLPacketRef)bytes, p->size,
+		      p->is_receive, str);
+    STRING_APPEND(str, "\n");
+    EAPOLPacketIsValid((EAPOLPacketRef)bytes, length, str);
+    return;
+}
+
+/*
+ * Function: log_packet_details
+ * Purpose:
+ *   Log the full description of the packet.  The description, which
+ *   calls into the EAP plugins, is only formatted if the logging system
+ *   actually emits the record.
+ */
+static void
+log_packet_details(const char * dest_mac,
+		   EAPOLPacketRef eapol_p, int size, unsigned int length,
+		   boolean_t is_receive)
+{
+    log_packet_info	info;
+    CFTypeRef		log_descr;
+
+    strlcpy(info.dest_mac, dest_mac, sizeof(info.dest_mac));
+    info.size = size;
+    info.is_receive = is_receive;
+    log_descr = EAPLogDeferredDescriptionCreate(log_packet_describe,
+						eapol_p, length, &info);
+    EAPLOG(-LOG_DEBUG, "%@", log_descr);
+    my_CFRelease(&log_descr);
+    return;
+}
+
 
 
 PRIVATE_EXTERN void
@@ -436,8 +491,20 @@ EAPOLSocketSetGlobals(SCPreferencesRef prefs)
 		      mtu_val, EAPOL_MTU_MIN, EAPOL_MTU_DEFAULT);
 	}
 	else {
+	    if (mtu_val > EAPOL_MTU_MAX) {
+		mtu_val = EAPOL_MTU_MAX;
+	    }
 	    EAPLOG(LOG_NOTICE, "Using MTU %d", mtu_val);
 	    S_mtu = mtu_val;
+	    S_mtu_discovery = FALSE;
+	}
+    }
+    if (S_mtu == 0) {
+	CFBooleanRef	discovery;
+
+	discovery = SCPreferencesGetValue(prefs, kMTUDiscovery);
+	if (isA_CFBoolean(discovery) != NULL) {
+	    S_mtu_discovery = CFBooleanGetValue(discovery);
 	}
     }
 
@@ -508,6 +575,20 @@ EAPOLSocketSetEAPTxPacket(EAPOLSocketRef sock, EAPPacketRef pkt, int length)
     return;
 }
 
+/*
+ * Function: EAPOLSocketClearRetransmitPacket
+ * Purpose:
+ *   Forget the last EAP transmit packet so that a retransmitted Request
+ *   is passed up to the caller instead of being answered here with the
+ *   saved packet.
+ */
+PRIVATE_EXTERN void
+EAPOLSocketClearRetransmitPacket(EAPOLSocketRef sock)
+{
+    EAPOLSocketSetEAPTxPacket(sock, NULL, 0);
+    return;
+}
+
 static void
 EAPOLSocketMarkForRemoval(EAPOLSocketRef sock)
 {
@@ -618,6 +699,25 @@ EAPOLSocketMTU(EAPOLSocketRef sock)
     return (EAPOL_MTU_DEFAULT);
 }
 
+PRIVATE_EXTERN int
+EAPOLSocketMaxMTU(EAPOLSocketRef sock)
+{
+    int		max_mtu;
+    int		mtu = EAPOLSocketMTU(sock);
+
+    if (S_mtu_discovery == FALSE) {
+	return (mtu);
+    }
+    max_mtu = sock->source->if_mtu;
+    if (max_mtu > EAPOL_MTU_MAX) {
+	max_mtu = EAPOL_MTU_MAX;
+    }
+    if (max_mtu < mtu) {
+	return (mtu);
+    }
+    return (max_mtu);
+}
+
 PRIVATE_EXTERN const struct ether_addr *
 EAPOLSocketGetAuthenticatorMACAddress(EAPOLSocketRef sock)
 {
@@ -1158,7 +1258,8 @@ EAPOLSocketSourceReceive(void * arg1, void * arg2)
     }
     eapol_p = (void *)(eh_p + 1);
     length = (int)(n - sizeof(*eh_p));
-    if (EAPOLPacketIsValid(eapol_p, length, NULL) == FALSE) {
+    rx = &source->rx;
+    if (EAPOLPacketViewInit(&rx->view, eapol_p, length, NULL) == FALSE) {
 	if (eapolclient_should_log(kLogFlagBasic)) {
 	    CFMutableStringRef	log_msg;
 	    
@@ -1185,19 +1286,11 @@ EAPOLSocketSourceReceive(void * arg1, void * arg2)
 	    }
 	}
     }
-    rx = &source->rx;
     rx->length = length;
     rx->eapol_p = eapol_p;
     if (eapolclient_should_log(kLogFlagPacketDetails)) {
-	CFMutableStringRef	log_msg;
-
-	log_msg = CFStringCreateMutable(NULL, 0);
-	log_packet_simple(ether_ntoa((void *)eh_p->ether_shost),
-			  eapol_p, (int)n, TRUE, log_msg);
-	STRING_APPEND(log_msg, "\n");
-	EAPOLPacketIsValid(eapol_p, length, log_msg);
-	EAPLOG(-LOG_DEBUG, "%@", log_msg);
-	CFRelease(log_msg);
+	log_packet_details(ether_ntoa((void *)eh_p->ether_shost),
+			   eapol_p, (int)n, length, TRUE);
     }
     else if (eapolclient_should_log(kLogFlagBasic)) {
 	log_packet_simple(ether_ntoa((void *)eh_p->ether_shost),
@@ -1273,6 +1366,11 @@ EAPOLSocketSourceTransmit(EAPOLSocketSourceRef source,
     else {
 	body_length = 0;
     }
+    if (size > sizeof(buf)) {
+	EAPLOG_FL(LOG_NOTICE, "packet too large %d > %d",
+		  size, (int)sizeof(buf));
+	return (-1);
+    }
 
     bzero(buf, size);
     eh_p = (struct ether_header *)buf;
@@ -1325,16 +1423,9 @@ EAPOLSocketSourceTransmit(EAPOLSocketSourceRef source,
     ndrv.snd_family = AF_NDRV;
 
     if (eapolclient_should_log(kLogFlagPacketDetails)) {
-	CFMutableStringRef	log_msg;
-
-	log_msg = CFStringCreateMutable(NULL, 0);
-	log_packet_simple(ether_ntoa((void *)eh_p->ether_dhost),
-			  eapol_p, body_length + sizeof(*eapol_p),
-			  FALSE, log_msg);
-	STRING_APPEND(log_msg, "\n");
-	EAPOLPacketIsValid(eapol_p, body_length + sizeof(*eapol_p), log_msg);
-	EAPLOG(-LOG_DEBUG, "%@", log_msg);
-	CFRelease(log_msg);
+	log_packet_details(ether_ntoa((void *)eh_p->ether_dhost),
+			   eapol_p, body_length + sizeof(*eapol_p),
+			   body_length + sizeof(*eapol_p), FALSE);
     }
     else if (eapolclient_should_log(kLogFlagBasic)) {
 	log_packet_simple(ether_ntoa((void *)eh_p->ether_dhost),
@@ -1486,6 +1577,7 @@ EAPOLSocketSourceCreate(const char * if_name,
     strlcpy(source->if_name, if_name, sizeof(source->if_name));
     source->if_name_length = (int)strlen(source->if_name);
     source->ether = *ether;
+    source->if_mtu = eapol_socket_get_mtu(if_name);
     source->handler = handler;
     source->store = store;
     source->is_wireless = is_wireless;
@@ -33,6 +33,7 @@
 
 
 #include "EAPOL.h"
+#include "EAPOLUtil.h"
 #include "EAPOLControlTypes.h"
 #include "wireless.h"
 #include "ClientControlInterface.h"
@@ -42,6 +43,7 @@ typedef struct EAPOLSocket_s EAPOLSocket, * EAPOLSocketRef;
 typedef struct {
     EAPOLPacket *		eapol_p;
     unsigned int		length;
+    EAPOLPacketView		view;	/* filled in when eapol_p was validated */
 } EAPOLSocketReceiveData, *EAPOLSocketReceiveDataRef;
 
 typedef void (EAPOLSocketReceiveCallback)(void * arg1, void * arg2, 
@@ -57,6 +59,9 @@ EAPOLSocketIsLinkActive(EAPOLSocketRef sock);
 int
 EAPOLSocketMTU(EAPOLSocketRef sock);
 
+int
+EAPOLSocketMaxMTU(EAPOLSocketRef sock);
+
 const struct ether_addr *
 EAPOLSocketGetAuthenticatorMACAddress(EAPOLSocketRef sock);
 
@@ -93,6 +98,9 @@ EAPOLSocketTransmit(EAPOLSocketRef sock,
 		    EAPOLPacketType packet_type,
 		    void * body, unsigned int body_length);
 
+void
+EAPOLSocketClearRetransmitPacket(EAPOLSocketRef sock);
+
 const char *
 EAPOLSocketIfName(EAPOLSocketRef sock, uint32_t * length);
 
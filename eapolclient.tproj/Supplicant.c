@@ -44,11 +44,14 @@
 #include <EAP8021X/EAPUtil.h>
 #include <EAP8021X/EAPClientModule.h>
 #include <EAP8021X/EAPClientProperties.h>
+#include <EAP8021X/EAPTLS.h>
+#include <EAP8021X/EAPTLSUtil.h>
 #include <EAP8021X/EAPOLControlTypes.h>
 #include <EAP8021X/EAPOLControlTypesPrivate.h>
 #include <EAP8021X/EAPOLControl.h>
 #include <EAP8021X/SupplicantTypes.h>
 #include <EAP8021X/EAPKeychainUtil.h>
+#include <EAP8021X/mschap.h>
 #include <TargetConditionals.h>
 #if ! TARGET_OS_EMBEDDED
 #include <EAP8021X/EAPOLClientConfiguration.h>
@@ -122,6 +125,26 @@ typedef struct {
     bool		use_outer_identity;
 } EAPAcceptTypes, * EAPAcceptTypesRef;
 
+/*
+ * Type: MTUDiscovery
+ * Purpose:
+ *   Tracks the EAPOL MTU used with the current authenticator.  We start
+ *   with the largest MTU the interface supports (or the value remembered
+ *   for the authenticator), and fall back to the default MTU if the
+ *   authenticator retransmits its request or times out after we've sent
+ *   a frame larger than the default.
+ */
+typedef struct {
+    int			base;		/* default, known to work */
+    int			max;		/* largest we're willing to try */
+    int			current;	/* MTU in use */
+    bool		verified;	/* current is known to work */
+    bool		probing;	/* waiting for reply to a large frame */
+    int			probe_identifier;
+    int			fragment_count;
+    int			round_trip_count;
+} MTUDiscovery, * MTUDiscoveryRef;
+
 struct Supplicant_s {
     SupplicantState		state;
     CFDateRef			start_timestamp;
@@ -150,6 +173,7 @@ struct Supplicant_s {
     bool			remember_information;
 
     SecIdentityRef		sec_identity;
+    CFAbsoluteTime		sec_identity_prewarm_time;
 
     EAPAcceptTypes		eap_accept;
 
@@ -176,6 +200,7 @@ struct Supplicant_s {
     bool			no_authenticator;
 
     struct eap_client		eap;
+    MTUDiscovery		mtu;
 
     EAPOLSocketReceiveData	last_rx_packet;
     EAPClientStatus		last_status;
@@ -439,6 +464,178 @@ EAPClientStatusGetString(EAPClientStatus status)
     return (str);
 }
 
+/**
+ ** MTU discovery
+ **/
+
+/*
+ * Static: S_authenticator_mtu
+ * Purpose:
+ *   Remembers the EAPOL MTU learned for each authenticator, keyed by
+ *   the authenticator's MAC address.
+ */
+static CFMutableDictionaryRef	S_authenticator_mtu;
+
+static CFDataRef
+S_authenticator_key_create(SupplicantRef supp)
+{
+    const struct ether_addr *	authenticator_mac;
+
+    authenticator_mac = EAPOLSocketGetAuthenticatorMACAddress(supp->sock);
+    if (authenticator_mac == NULL) {
+	return (NULL);
+    }
+    return (CFDataCreate(NULL, (const UInt8 *)authenticator_mac,
+			 sizeof(*authenticator_mac)));
+}
+
+static int
+S_authenticator_mtu_lookup(SupplicantRef supp)
+{
+    CFDataRef		key;
+    int			mtu = 0;
+    CFNumberRef		mtu_cf;
+
+    if (S_authenticator_mtu == NULL) {
+	return (0);
+    }
+    key = S_authenticator_key_create(supp);
+    if (key == NULL) {
+	return (0);
+    }
+    mtu_cf = CFDictionaryGetValue(S_authenticator_mtu, key);
+    if (mtu_cf != NULL) {
+	(void)CFNumberGetValue(mtu_cf, kCFNumberIntType, &mtu);
+    }
+    CFRelease(key);
+    return (mtu);
+}
+
+static void
+S_authenticator_mtu_save(SupplicantRef supp, int mtu)
+{
+    CFDataRef		key;
+    CFNumberRef		mtu_cf;
+
+    key = S_authenticator_key_create(supp);
+    if (key == NULL) {
+	return;
+    }
+    if (S_authenticator_mtu == NULL) {
+	S_authenticator_mtu
+	    = CFDictionaryCreateMutable(NULL, 0,
+					&kCFTypeDictionaryKeyCallBacks,
+					&kCFTypeDictionaryValueCallBacks);
+    }
+    mtu_cf = CFNumberCreate(NULL, kCFNumberIntType, &mtu);
+    CFDictionarySetValue(S_authenticator_mtu, key, mtu_cf);
+    CFRelease(mtu_cf);
+    CFRelease(key);
+    return;
+}
+
+static void
+mtu_discovery_init(SupplicantRef supp)
+{
+    MTUDiscoveryRef	mtu = &supp->mtu;
+    int			saved_mtu;
+
+    bzero(mtu, sizeof(*mtu));
+    mtu->base = EAPOLSocketMTU(supp->sock);
+    mtu->max = EAPOLSocketMaxMTU(supp->sock);
+    saved_mtu = S_authenticator_mtu_lookup(supp);
+    if (saved_mtu >= mtu->base && saved_mtu <= mtu->max) {
+	mtu->current = saved_mtu;
+	mtu->verified = TRUE;
+    }
+    else {
+	mtu->current = mtu->max;
+	mtu->verified = (mtu->current == mtu->base);
+    }
+    return;
+}
+
+static void
+mtu_discovery_fall_back(SupplicantRef supp, const char * reason)
+{
+    MTUDiscoveryRef	mtu = &supp->mtu;
+
+    if (mtu->probing == FALSE) {
+	return;
+    }
+    EAPLOG(LOG_NOTICE, "%s: MTU %d failed (%s), using %d",
+	   EAPOLSocketIfName(supp->sock, NULL), mtu->current, reason,
+	   mtu->base);
+    mtu->current = mtu->base;
+    mtu->verified = TRUE;
+    mtu->probing = FALSE;
+    S_authenticator_mtu_save(supp, mtu->base);
+    return;
+}
+
+static void
+mtu_discovery_receive(SupplicantRef supp, EAPPacketRef in_pkt_p)
+{
+    MTUDiscoveryRef	mtu = &supp->mtu;
+
+    if (mtu->probing == FALSE) {
+	return;
+    }
+    switch (in_pkt_p->code) {
+    case kEAPCodeRequest:
+	if (in_pkt_p->identifier == mtu->probe_identifier) {
+	    mtu_discovery_fall_back(supp, "retransmit");
+	    return;
+	}
+	break;
+    case kEAPCodeFailure:
+	mtu_discovery_fall_back(supp, "failure");
+	return;
+    default:
+	break;
+    }
+    /* the authenticator received the large frame */
+    eapolclient_log(kLogFlagBasic, "MTU %d verified", mtu->current);
+    mtu->verified = TRUE;
+    mtu->probing = FALSE;
+    S_authenticator_mtu_save(supp, mtu->current);
+    return;
+}
+
+static void
+mtu_discovery_transmit(SupplicantRef supp, EAPPacketRef out_pkt_p)
+{
+    int			length = EAPPacketGetLength(out_pkt_p);
+    MTUDiscoveryRef	mtu = &supp->mtu;
+
+    mtu->round_trip_count++;
+    switch (supp->eap.last_type) {
+    case kEAPTypeTLS:
+    case kEAPTypeTTLS:
+    case kEAPTypePEAP:
+    case kEAPTypeEAPFAST:
+	if (length > sizeof(EAPTLSPacket)) {
+	    mtu->fragment_count++;
+	}
+	break;
+    default:
+	break;
+    }
+    if (mtu->verified == FALSE
+	&& (length + sizeof(EAPOLPacket)) > mtu->base) {
+	mtu->probing = TRUE;
+	mtu->probe_identifier = out_pkt_p->identifier;
+	/*
+	 * If the authenticator didn't get the large frame, it retransmits
+	 * its Request.  Make sure that reaches mtu_discovery_receive() and
+	 * the plugin, which re-sends at the base MTU, rather than having
+	 * the socket re-send the same oversized frame.
+	 */
+	EAPOLSocketClearRetransmitPacket(supp->sock);
+    }
+    return;
+}
+
 /**
  ** EAP client module access convenience routines
  **/
@@ -571,8 +768,9 @@ eap_client_init(SupplicantRef supp, EAPType type)
     supp->eap.plugin_data.unique_id 
 	= EAPOLSocketIfName(supp->sock, (uint32_t *)
 			    &supp->eap.plugin_data.unique_id_length);
+    mtu_discovery_init(supp);
     S_set_uint32(&supp->eap.plugin_data.mtu,
-		 EAPOLSocketMTU(supp->sock) - sizeof(EAPOLPacket));
+		 supp->mtu.current - sizeof(EAPOLPacket));
 
     supp->eap.plugin_data.username = (uint8_t *)supp->username;
     S_set_uint32(&supp->eap.plugin_data.username_length, 
@@ -628,6 +826,8 @@ eap_client_process(SupplicantRef supp, EAPPacketRef in_pkt_p,
 		 supp->password_length);
     S_set_uint32(&supp->eap.plugin_data.generation, 
 		 supp->generation);
+    S_set_uint32(&supp->eap.plugin_data.mtu,
+		 supp->mtu.current - sizeof(EAPOLPacket));
     eap_client_set_properties(supp);
     *((bool *)&supp->eap.plugin_data.log_enabled)
 	= ((eapolclient_log_flags() & kLogFlagDisableInnerDetails) == 0);
@@ -908,6 +1108,7 @@ clear_password(SupplicantRef supp)
 	supp->password = NULL;
     }
     supp->password_length = 0;
+    MSCHAPSecretFlush();
     return;
 }
 
@@ -930,6 +1131,8 @@ clear_sec_identity(SupplicantRef supp)
 {
     supp->ignore_sec_identity = TRUE;
     my_CFRelease(&supp->sec_identity);
+    supp->sec_identity_prewarm_time = 0;
+    EAPTLSIdentityTrustChainFlush();
     return;
 }
 
@@ -957,6 +1160,10 @@ save_last_packet(SupplicantRef supp, EAPOLSocketReceiveDataRef rx_p)
     supp->last_rx_packet.eapol_p = (EAPOLPacketRef)malloc(rx_p->length);
     supp->last_rx_packet.length = rx_p->length;
     bcopy(rx_p->eapol_p, supp->last_rx_packet.eapol_p, rx_p->length);
+    /* the view points into the packet, so re-create it for the copy */
+    (void)EAPOLPacketViewInit(&supp->last_rx_packet.view,
+			      supp->last_rx_packet.eapol_p,
+			      supp->last_rx_packet.length, NULL);
     if (last_eapol_p != NULL) {
 	free(last_eapol_p);
     }
@@ -1206,6 +1413,7 @@ Supplicant_authenticated(SupplicantRef supp, SupplicantEvent event,
 		if (supp->password != NULL) {
 		    supp->password_length = (int)strlen(supp->password);
 		}
+		MSCHAPSecretFlush();
 	    }
 	}
 #if ! TARGET_OS_EMBEDDED
@@ -1281,12 +1489,12 @@ Supplicant_authenticated(SupplicantRef supp, SupplicantEvent event,
 	break;
     case kSupplicantEventData:
 	Timer_cancel(supp->timer);
-	switch (rx->eapol_p->packet_type) {
+	switch (rx->view.packet_type) {
 	case kEAPOLPacketTypeEAPPacket:
 	    req_p = (EAPRequestPacket *)rx->eapol_p->body;
-	    switch (req_p->code) {
+	    switch (rx->view.body.eap.code) {
 	    case kEAPCodeRequest:
-		switch (req_p->type) {
+		switch (rx->view.body.eap.type) {
 		case kEAPTypeIdentity:
 		    Supplicant_acquired(supp, kSupplicantEventStart, evdata);
 		    break;
@@ -1305,10 +1513,7 @@ Supplicant_authenticated(SupplicantRef supp, SupplicantEvent event,
 	    break;
 	case kEAPOLPacketTypeKey:
 	    if (EAPOLSocketIsWireless(supp->sock)) {
-		EAPOLKeyDescriptorRef	descr_p;
-
-		descr_p = (EAPOLKeyDescriptorRef)(rx->eapol_p->body);
-		switch (descr_p->descriptor_type) {
+		switch (rx->view.body.key.descriptor_type) {
 		case kEAPOLKeyDescriptorTypeRC4:
 		    process_key(supp, rx->eapol_p);
 		    break;
@@ -1369,6 +1574,7 @@ Supplicant_disconnected(SupplicantRef supp, SupplicantEvent event,
 	    req->code = kEAPCodeRequest;
 	    req->type = kEAPTypeIdentity;
 	    EAPPacketSetLength((EAPPacketRef)req, sizeof(EAPRequestPacket));
+	    (void)EAPOLPacketViewInit(&rx.view, rx.eapol_p, rx.length, NULL);
 	    EAPLOG(LOG_INFO, "Re-created EAP Request Identity");
 	    Supplicant_connecting(supp, kSupplicantEventStart, &rx);
 	}
@@ -1424,14 +1630,10 @@ Supplicant_connecting(SupplicantRef supp, SupplicantEvent event,
 	/* FALL THROUGH */
     case kSupplicantEventData:
 	if (rx != NULL) {
-	    EAPOLIEEE80211KeyDescriptorRef	ieee80211_descr_p;
-	    EAPRequestPacketRef			req_p;
-
-	    switch (rx->eapol_p->packet_type) {
+	    switch (rx->view.packet_type) {
 	    case kEAPOLPacketTypeEAPPacket:
-		req_p = (void *)rx->eapol_p->body;
-		if (req_p->code == kEAPCodeRequest) {
-		    if (req_p->type == kEAPTypeIdentity) {
+		if (rx->view.body.eap.code == kEAPCodeRequest) {
+		    if (rx->view.body.eap.type == kEAPTypeIdentity) {
 			Supplicant_acquired(supp,
 					    kSupplicantEventStart,
 					    evdata);
@@ -1444,8 +1646,7 @@ Supplicant_connecting(SupplicantRef supp, SupplicantEvent event,
 		}
 		return;
  	    case kEAPOLPacketTypeKey:
-		ieee80211_descr_p = (void *)rx->eapol_p->body;
-		if (ieee80211_descr_p->descriptor_type
+		if (rx->view.body.key.descriptor_type
 		    == kEAPOLKeyDescriptorTypeIEEE80211) {
 		    break;
 		}
@@ -1577,18 +1778,19 @@ Supplicant_acquired(SupplicantRef supp, SupplicantEvent event,
     case kSupplicantEventData:
 	supp->no_authenticator = FALSE;
 	rx = evdata;
-	if (rx->eapol_p->packet_type != kEAPOLPacketTypeEAPPacket) {
+	if (rx->view.packet_type != kEAPOLPacketTypeEAPPacket) {
 	    break;
 	}
 	req_p = (EAPRequestPacket *)rx->eapol_p->body;
-	if (req_p->code == kEAPCodeRequest
-	    && req_p->type == kEAPTypeIdentity) {
-	    int				len;
-
-	    len = EAPPacketGetLength((EAPPacketRef)req_p) - sizeof(*req_p);
-	    S_update_identity_attributes(supp, req_p->type_data, len);
+	if (rx->view.body.eap.code == kEAPCodeRequest
+	    && rx->view.body.eap.type == kEAPTypeIdentity) {
+	    S_update_identity_attributes(supp,
+					 (void *)rx->view.body.eap.type_data,
+					 rx->view.body.eap.type_data_length);
 	    eapolclient_log(kLogFlagBasic,
 			    "EAP Request Identity");
+	    /* authenticator restarted while we waited for a large frame */
+	    mtu_discovery_fall_back(supp, "restart");
 	    supp->previous_identifier = req_p->identifier;
 #if ! TARGET_OS_EMBEDDED
 	    if (EAPOLSocketGetMode(supp->sock) == kEAPOLControlModeSystem) {
@@ -1739,7 +1941,7 @@ process_packet(SupplicantRef supp, EAPOLSocketReceiveDataRef rx)
 {
     EAPPacketRef	in_pkt_p = (EAPPacketRef)(rx->eapol_p->body);
     EAPPacketRef	out_pkt_p = NULL;
-    EAPRequestPacket *	req_p = (EAPRequestPacket *)in_pkt_p;
+    EAPType		in_type = rx->view.body.eap.type;
     EAPClientState	state;
     struct timeval 	t = {S_auth_period_secs, 0};
 
@@ -1747,22 +1949,22 @@ process_packet(SupplicantRef supp, EAPOLSocketReceiveDataRef rx)
 	return;
     }
 
-    switch (in_pkt_p->code) {
+    switch (rx->view.body.eap.code) {
     case kEAPCodeRequest:
-	if (req_p->type == kEAPTypeInvalid) {
+	if (in_type == kEAPTypeInvalid) {
 	    return;
 	}
-	if (req_p->type != eap_client_type(supp)) {
+	if (in_type != eap_client_type(supp)) {
 	    if (EAPAcceptTypesIsSupportedType(&supp->eap_accept, 
-					      req_p->type) == FALSE) {
+					      in_type) == FALSE) {
 		EAPType eap_type = EAPAcceptTypesNextType(&supp->eap_accept);
 		if (eap_type == kEAPTypeInvalid) {
 		    eapolclient_log(kLogFlagBasic,
 				    "EAP Request: %s (%d) not enabled",
-				    EAPTypeStr(req_p->type), req_p->type);
+				    EAPTypeStr(in_type), in_type);
 		}
 		else {
-		    LogNakEapTypesList(req_p->type, &supp->eap_accept);
+		    LogNakEapTypesList(in_type, &supp->eap_accept);
 		}
 		respond_with_nak(supp, in_pkt_p->identifier, eap_type);
 		if (eap_type == kEAPTypeInvalid) {
@@ -1781,12 +1983,12 @@ process_packet(SupplicantRef supp, EAPOLSocketReceiveDataRef rx)
 	    }
 	    Timer_cancel(supp->timer);
 	    eap_client_free(supp);
-	    if (eap_client_init(supp, req_p->type) == FALSE) {
+	    if (eap_client_init(supp, in_type) == FALSE) {
 		if (supp->last_status 
 		    != kEAPClientStatusUserInputRequired) {
 		    EAPLOG(LOG_NOTICE,
 			   "EAP Request: %s (%d) init failed, %d",
-			   EAPTypeStr(req_p->type), req_p->type,
+			   EAPTypeStr(in_type), in_type,
 			   supp->last_status);
 		    Supplicant_held(supp, kSupplicantEventStart, NULL);
 		    return;
@@ -1797,12 +1999,12 @@ process_packet(SupplicantRef supp, EAPOLSocketReceiveDataRef rx)
 	    }
 	    eapolclient_log(kLogFlagBasic,
 			    "EAP Request: %s (%d) accepted",
-			    EAPTypeStr(req_p->type), req_p->type);
+			    EAPTypeStr(in_type), in_type);
 	    Supplicant_report_status(supp);
 	}
 	break;
     case kEAPCodeResponse:
-	if (req_p->type != eap_client_type(supp)) {
+	if (in_type != eap_client_type(supp)) {
 	    /* this should not happen, but if it does, ignore the packet */
 	    return;
 	}
@@ -1829,6 +2031,7 @@ process_packet(SupplicantRef supp, EAPOLSocketReceiveDataRef rx)
     /* invoke the authentication method "process" function */
     my_CFRelease(&supp->eap.required_props);
     my_CFRelease(&supp->eap.published_props);
+    mtu_discovery_receive(supp, in_pkt_p);
     state = eap_client_process(supp, in_pkt_p, &out_pkt_p,
 			       &supp->last_status, &supp->last_error);
     if (out_pkt_p != NULL) {
@@ -1840,6 +2043,7 @@ process_packet(SupplicantRef supp, EAPOLSocketReceiveDataRef rx)
 	    EAPLOG_FL(LOG_NOTICE, "EAPOLSocketTransmit %d failed",
 		      out_pkt_p->code);
 	}
+	mtu_discovery_transmit(supp, out_pkt_p);
 	/* and free the packet */
 	eap_client_free_packet(supp, out_pkt_p);
     }
@@ -1917,11 +2121,11 @@ Supplicant_authenticating(SupplicantRef supp, SupplicantEvent event,
     case kSupplicantEventData:
 	Timer_cancel(supp->timer);
 	supp->no_authenticator = FALSE;
-	if (rx->eapol_p->packet_type != kEAPOLPacketTypeEAPPacket) {
+	if (rx->view.packet_type != kEAPOLPacketTypeEAPPacket) {
 	    break;
 	}
 	req_p = (EAPRequestPacket *)rx->eapol_p->body;
-	switch (req_p->code) {
+	switch (rx->view.body.eap.code) {
 	case kEAPCodeSuccess:
 	    process_packet(supp, rx);
 	    break;
@@ -1932,9 +2136,9 @@ Supplicant_authenticating(SupplicantRef supp, SupplicantEvent event,
 
 	case kEAPCodeRequest:
 	case kEAPCodeResponse:
-	    switch (req_p->type) {
+	    switch (rx->view.body.eap.type) {
 	    case kEAPTypeIdentity:
-		if (req_p->code == kEAPCodeResponse) {
+		if (rx->view.body.eap.code == kEAPCodeResponse) {
 		    /* don't care about responses */
 		    break;
 		}
@@ -1949,7 +2153,7 @@ Supplicant_authenticating(SupplicantRef supp, SupplicantEvent event,
 		break;
 		
 	    case kEAPTypeNotification:	
-		if (req_p->code == kEAPCodeResponse) {
+		if (rx->view.body.eap.code == kEAPCodeResponse) {
 		    /* don't care about responses */
 		    break;
 		}
@@ -1960,13 +2164,14 @@ Supplicant_authenticating(SupplicantRef supp, SupplicantEvent event,
 	    default:
 		process_packet(supp, rx);
 		break;
-	    } /* switch (req_p->type) */
+	    } /* switch (rx->view.body.eap.type) */
 	    break;
 	default:
 	    break;
-	} /* switch (req_p->code) */
+	} /* switch (rx->view.body.eap.code) */
 	break;
     case kSupplicantEventTimeout:
+	mtu_discovery_fall_back(supp, "timeout");
 	Supplicant_connecting(supp, kSupplicantEventStart, NULL);
 	break;
     default:
@@ -2063,6 +2268,33 @@ dictInsertPublishedProperties(CFMutableDictionaryRef dict,
 			 published_props);
 }
 
+static void
+dictInsertMTUDiscovery(CFMutableDictionaryRef dict, MTUDiscoveryRef mtu)
+{
+    if (mtu->current == 0) {
+	return;
+    }
+    dictInsertNumber(dict, kEAPOLControlMTU, mtu->current);
+    dictInsertNumber(dict, kEAPOLControlFragmentCount, mtu->fragment_count);
+    dictInsertNumber(dict, kEAPOLControlRoundTripCount,
+		     mtu->round_trip_count);
+    return;
+}
+
+static void
+dictInsertIdentityPrewarm(CFMutableDictionaryRef dict, SupplicantRef supp)
+{
+    if (supp->sec_identity_prewarm_time == 0) {
+	return;
+    }
+    dictInsertNumber(dict, kEAPOLControlIdentityPrewarmTime,
+		     (uint32_t)(supp->sec_identity_prewarm_time * 1000000));
+    dictInsertNumber(dict, kEAPOLControlIdentityChainCopyTime,
+		     (uint32_t)(EAPTLSIdentityTrustChainGetCopyTime()
+				* 1000000));
+    return;
+}
+
 static void
 dictInsertIdentityAttributes(CFMutableDictionaryRef dict,
 			     CFArrayRef identity_attributes)
@@ -2538,6 +2770,8 @@ Supplicant_report_status(SupplicantRef supp)
 	}
 	dictInsertPublishedProperties(dict, supp->eap.published_props);
 	dictInsertIdentityAttributes(dict, supp->identity_attributes);
+	dictInsertMTUDiscovery(dict, &supp->mtu);
+	dictInsertIdentityPrewarm(dict, supp);
     }
     dictInsertGeneration(dict, supp->generation);
     timestamp = CFDateCreate(NULL, CFAbsoluteTimeGetCurrent());
@@ -2790,13 +3024,13 @@ Supplicant_held(SupplicantRef supp, SupplicantEvent event,
 	Supplicant_connecting(supp, kSupplicantEventStart, NULL);
 	break;
     case kSupplicantEventData:
-	if (rx->eapol_p->packet_type != kEAPOLPacketTypeEAPPacket) {
+	if (rx->view.packet_type != kEAPOLPacketTypeEAPPacket) {
 	    break;
 	}
 	req_p = (EAPRequestPacket *)rx->eapol_p->body;
-	switch (req_p->code) {
+	switch (rx->view.body.eap.code) {
 	case kEAPCodeRequest:
-	    switch (req_p->type) {
+	    switch (rx->view.body.eap.type) {
 	    case kEAPTypeIdentity:
 		Supplicant_acquired(supp, kSupplicantEventStart, evdata);
 		break;
@@ -3242,6 +3476,9 @@ S_set_credentials(SupplicantRef supp)
 					    tls_specified);
     }
     if (cert_required) {
+	CFAbsoluteTime	start;
+
+	start = CFAbsoluteTimeGetCurrent();
 	id_handle = CFDictionaryGetValue(supp->config_dict,
 					 kEAPClientPropTLSIdentityHandle);
 	if (id_handle != NULL) {
@@ -3265,6 +3502,24 @@ S_set_credentials(SupplicantRef supp)
 #endif /* ! TARGET_OS_EMBEDDED */
 	my_CFRelease(&supp->sec_identity);
 	supp->sec_identity = sec_identity;
+	supp->sec_identity_prewarm_time = 0;
+	if (sec_identity != NULL) {
+	    /*
+	     * Build the trust chain now rather than when the authenticator
+	     * is waiting for the TLS handshake.
+	     */
+	    status = EAPTLSIdentityTrustChainPrewarm(sec_identity,
+						     supp->config_dict);
+	    if (status != noErr) {
+		EAPLOG_FL(LOG_NOTICE,
+			  "EAPTLSIdentityTrustChainPrewarm failed, %ld",
+			  (long)status);
+	    }
+	    else {
+		supp->sec_identity_prewarm_time
+		    = CFAbsoluteTimeGetCurrent() - start;
+	    }
+	}
 
 	if (name == NULL && sec_identity != NULL) {
 	    name = S_identity_copy_name(sec_identity);
@@ -3308,6 +3563,7 @@ S_set_credentials(SupplicantRef supp)
     /* password */
     if (my_strcmp(supp->password, password) != 0) {
 	change = TRUE;
+	MSCHAPSecretFlush();
     }
     if (supp->password != NULL) {
 	free(supp->password);
@@ -3889,6 +4145,7 @@ Supplicant_simulate_success(SupplicantRef supp)
     EAPPacketSetLength(success_pkt, sizeof(EAPSuccessPacket));
     rx.eapol_p = eapol_p;
     rx.length = SUCCESS_SIZE;
+    (void)EAPOLPacketViewInit(&rx.view, eapol_p, rx.length, NULL);
     Supplicant_authenticating(supp, kSupplicantEventData, &rx);
     return;
 }
@@ -38,6 +38,7 @@
 #include <SystemConfiguration/SystemConfiguration.h>
 #include <SystemConfiguration/SCDynamicStorePrivate.h>
 #include "EAP8021X/EAPTLSUtil.h"
+#include "EAP8021X/sim_simulator.h"
 #include "EAPOLControl.h"
 #include "EAPOLControlPrivate.h"
 #include "EAPOLControlPrefs.h"
@@ -699,6 +700,156 @@ S_verify_server(int argc, char * argv[])
     return (status == kEAPClientStatusOK ? 0 : -1);
 }
 
+static bool
+hex_to_bytes(const char * hex, uint8_t * bytes, int size)
+{
+    int		i;
+
+    if (strlen(hex) != (size_t)size * 2) {
+	return (false);
+    }
+    for (i = 0; i < size; i++) {
+	unsigned int	val;
+
+	if (sscanf(hex + 2 * i, "%2x", &val) != 1) {
+	    return (false);
+	}
+	bytes[i] = (uint8_t)val;
+    }
+    return (true);
+}
+
+static void
+sqn_add(uint8_t * sqn, int n)
+{
+    unsigned int	carry = (unsigned int)n;
+    int			i;
+
+    for (i = SIM_SQN_SIZE - 1; i >= 0 && carry != 0; i--) {
+	carry += sqn[i];
+	sqn[i] = (uint8_t)carry;
+	carry >>= 8;
+    }
+    return;
+}
+
+#define SIM_VECTORS_CHUNK	4096
+
+/*
+ * S_sim_vectors
+ * - generate authentication vectors for random RANDs using the software
+ *   SIM, and write them to a file as packed sim_simulator_triplet or
+ *   sim_simulator_quintet records; a triplet file can be used as-is
+ *   as the EAPSIMTripletsFile property
+ */
+static int
+S_sim_vectors(int argc, char * argv[])
+{
+    uint8_t			amf[SIM_AMF_SIZE] = { 0x80, 0x00 };
+    long			count;
+    double			elapsed;
+    FILE *			f;
+    bool			gsm = false;
+    uint8_t			ki[SIM_KI_SIZE];
+    sim_simulator_milenage_ref	milenage;
+    uint8_t			opc[SIM_OPC_SIZE];
+    void *			records = NULL;
+    size_t			record_size = 0;
+    long			remaining;
+    int				result = 0;
+    uint8_t			rand[SIM_VECTORS_CHUNK * 16];
+    uint8_t			sqn[SIM_SQN_SIZE] = { 0, 0, 0, 0, 0, 0x20 };
+    struct timeval		start;
+    struct timeval		end;
+
+    if (strcmp(argv[0], "gsm") == 0) {
+	gsm = true;
+	record_size = sizeof(sim_simulator_triplet);
+    }
+    else if (strcmp(argv[0], "aka") == 0) {
+	gsm = false;
+	record_size = sizeof(sim_simulator_quintet);
+    }
+    else {
+	command_usage();
+    }
+    if (!hex_to_bytes(argv[1], ki, sizeof(ki))
+	|| !hex_to_bytes(argv[2], opc, sizeof(opc))) {
+	fprintf(stderr, "Ki and OPc must be %d hex digits\n", SIM_KI_SIZE * 2);
+	return (EINVAL);
+    }
+    count = strtol(argv[3], NULL, 0);
+    if (count <= 0) {
+	fprintf(stderr, "invalid count '%s'\n", argv[3]);
+	return (EINVAL);
+    }
+    if (argc > 5 && !hex_to_bytes(argv[5], sqn, sizeof(sqn))) {
+	fprintf(stderr, "SQN must be %d hex digits\n", SIM_SQN_SIZE * 2);
+	return (EINVAL);
+    }
+    if (argc > 6 && !hex_to_bytes(argv[6], amf, sizeof(amf))) {
+	fprintf(stderr, "AMF must be %d hex digits\n", SIM_AMF_SIZE * 2);
+	return (EINVAL);
+    }
+    f = fopen(argv[4], "w");
+    if (f == NULL) {
+	fprintf(stderr, "%s: %s\n", argv[4], strerror(errno));
+	return (errno);
+    }
+    milenage = sim_simulator_milenage_create(opc, ki);
+    records = malloc(record_size * SIM_VECTORS_CHUNK);
+    if (milenage == NULL || records == NULL) {
+	fprintf(stderr, "failed to initialize\n");
+	result = ENOMEM;
+	goto done;
+    }
+    gettimeofday(&start, NULL);
+    for (remaining = count; remaining > 0; ) {
+	int	n;
+
+	n = (remaining < SIM_VECTORS_CHUNK) ? (int)remaining : SIM_VECTORS_CHUNK;
+	arc4random_buf(rand, (size_t)n * 16);
+	if (gsm) {
+	    if (!sim_simulator_milenage_gsm_triplets(milenage, rand, n,
+						     records)) {
+		result = EINVAL;
+		goto done;
+	    }
+	}
+	else {
+	    if (!sim_simulator_milenage_aka_quintets(milenage, rand, n,
+						     sqn, amf, records)) {
+		result = EINVAL;
+		goto done;
+	    }
+	    /* continue the SQN sequence with the next chunk */
+	    sqn_add(sqn, n);
+	}
+	if (fwrite(records, record_size, n, f) != (size_t)n) {
+	    result = errno;
+	    fprintf(stderr, "%s: %s\n", argv[4], strerror(result));
+	    goto done;
+	}
+	remaining -= n;
+    }
+    gettimeofday(&end, NULL);
+    elapsed = (end.tv_sec - start.tv_sec)
+	+ (end.tv_usec - start.tv_usec) / 1000000.0;
+    fprintf(stderr, "%ld %s written to %s in %.3f secs (%.0f per second)\n",
+	    count, gsm ? "triplets" : "quintets", argv[4], elapsed,
+	    (elapsed > 0) ? count / elapsed : 0.0);
+
+ done:
+    sim_simulator_milenage_release(&milenage);
+    if (records != NULL) {
+	free(records);
+    }
+    if (fclose(f) != 0 && result == 0) {
+	result = errno;
+    }
+    return (result);
+}
+
 typedef struct {
     char *	command;
     funcptr_t	func;
@@ -718,6 +869,8 @@ static commandInfo commands[] = {
     { "stress_start", S_stress_start, 2, "<interface_name> <config_file>"  },
     { "show_identities", S_show_identities, 0 },
     { "verify_server", S_verify_server, 2, "<cert-file> <properties>" },
+    { "sim_vectors", S_sim_vectors, 5,
+      "( gsm | aka ) <Ki> <OPc> <count> <output_file> [ <SQN> [ <AMF> ] ]" },
 #if ! TARGET_OS_EMBEDDED
     { "start_system", S_start_system, 1, "<interface_name> [ <config_file> ]"},
     { "loginwindow_config", S_loginwindow_config, 1, "<interface_name>" },